@@ -1,40 +1,64 @@
 from __future__ import print_function
 import argparse
 
-def main(args):
-    import pysam
+class SyntheticStats(object):
+    def __init__(self, totalNumReads, readsSeen, truePos, falsePos, nhData):
+        self.totalNumReads = totalNumReads
+        self.readsSeen = readsSeen
+        self.truePos = truePos
+        self.falsePos = falsePos
+        self.falseNeg = totalNumReads - readsSeen
+        self.nhData = nhData
+
+    def precision(self):
+        return self.truePos / float(max(1, self.truePos + self.falsePos))
+
+    def recall(self):
+        return self.truePos / float(max(1, self.truePos + self.falseNeg))
+
+    def tph(self):
+        return self.truePos / float(max(1, self.readsSeen))
+
+    def fdr(self):
+        return self.falsePos / float(max(1, self.falsePos + self.truePos))
+
+    def f1(self):
+        return (2*self.truePos) / float(max(1, 2*self.truePos + self.falsePos + self.falseNeg))
+
+
+def computeStats(records, totalNumReads, useNHTag=False, printFP=False):
+    """
+    Tally the alignments of synthetic reads, whose names carry the true
+    transcript as their third ':'-separated field.  records yields
+    (qname, refName, isUnmapped, nh, rec) tuples, with the alignments of
+    each read adjacent; nh is only used when useNHTag is set, and rec
+    is what gets printed for a false positive.
+    """
     import sys
 
-    printFP = args.printFalsePositives
-    alnFile = pysam.AlignmentFile(args.input, 'r')
-    totalNumReads = args.totalNumReads
     currQueryName = ''
     skipToNextAlignment = False
 
-    readsWithTrueAln = 0
     readsSeen = 0
 
     truePos = 0
     falsePos = 0
-    falseNeg = 0
     foundTrueAlignment = False
     ## True Neg are somewhat ill-defined in our context
     prevRec = None
-    useNHTag = args.useNHTag
-    NHTagSum = 0
     nhData = []
-    for rec in alnFile:
-        if rec.is_unmapped:
+    for qname, refName, isUnmapped, nh, rec in records:
+        if isUnmapped:
             continue
-        qname = rec.qname[:-2]
+        # drop the mate suffix, if the aligner left it on
+        if qname[-2:] in ('/1', '/2'):
+            qname = qname[:-2]
         # If this is a new read, remember the name
         # and increment the counter
         if qname != currQueryName:
             readsSeen += 1
             if useNHTag:
-                tagVal = rec.get_tag('NH')
-                NHTagSum += tagVal
-                nhData.append(tagVal)
+                nhData.append(nh)
             if readsSeen % 1000000 == 0:
                 print("\r\rSaw {} reads --- thp = {:.2%}".format(readsSeen, \
                        float(truePos) / readsSeen), file=sys.stderr, end='')
@@ -57,13 +81,24 @@ def main(args):
             # hit
             currQueryName = qname
             trueTxpName = qname.split(':')[2]
-            alignedTxpName = alnFile.getrname(rec.rname)
-            if (trueTxpName == alignedTxpName):
+            if (trueTxpName == refName):
                 truePos += 1
                 skipToNextAlignment = True
                 foundTrueAlignment = True
 
-    falseNeg = totalNumReads - readsSeen
+    return SyntheticStats(totalNumReads, readsSeen, truePos, falsePos, nhData)
+
+def main(args):
+    import pysam
+    import sys
+
+    alnFile = pysam.AlignmentFile(args.input, 'r')
+    useNHTag = args.useNHTag
+    records = ((rec.qname, None if rec.is_unmapped else alnFile.getrname(rec.rname),
+                rec.is_unmapped, rec.get_tag('NH') if (useNHTag and not rec.is_unmapped) else None,
+                rec) for rec in alnFile)
+    stats = computeStats(records, args.totalNumReads, useNHTag, args.printFalsePositives)
+
     print('\n'.join(["Total Reads = {}" ,
           "Reads Aligned  = {}" ,
           "True Pos = {}" ,
@@ -73,21 +108,21 @@ def main(args):
           "Recall = {:.2%}" ,
           "TPH = {:.2%}",
           "FDR = {:.2%}",
-          "F1 Score = {:.2%}"]).format(totalNumReads, readsSeen,
-                                  truePos, falsePos,
-                                  falseNeg, truePos / float(truePos + falsePos),
-                                  truePos / float(truePos + falseNeg),
-                                  truePos / float(readsSeen),
-                                  falsePos / float(falsePos + truePos),
-                                  (2*truePos) / float(2*truePos + falsePos + falseNeg)),
+          "F1 Score = {:.2%}"]).format(stats.totalNumReads, stats.readsSeen,
+                                  stats.truePos, stats.falsePos,
+                                  stats.falseNeg, stats.precision(),
+                                  stats.recall(),
+                                  stats.tph(),
+                                  stats.fdr(),
+                                  stats.f1()),
           file=sys.stderr)
 
     if useNHTag:
         print("Average hits-per-read = {:.2}".format(
-              NHTagSum / float(totalNumReads)), file=sys.stderr)
+              sum(stats.nhData) / float(stats.totalNumReads)), file=sys.stderr)
         if args.nhFreqFile:
             import pickle
-            pickle.dump(nhData, args.nhFreqFile)
+            pickle.dump(stats.nhData, args.nhFreqFile)
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(description='Compute statistics from synthetic SAM file.')
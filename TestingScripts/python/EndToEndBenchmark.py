@@ -0,0 +1,309 @@
+"""
+End-to-end throughput benchmark for quasimap.
+
+Builds a quasiindex (of --transcripts, or of a generated transcriptome
+with repeat families, so that some reads multi-map), simulates single-
+and paired-end reads from it at each of the given error rates, and runs
+quasimap on them at each thread count, both with --noOutput and writing
+SAM.  For every run we report reads per second (over the mapping, after
+the index is loaded), the index load time and the peak RSS; the SAM runs
+are also scored with the logic of ComputeSyntheticStats.py.
+
+The results go to --results as JSON.  The benchmark fails (exit status 1)
+if a run is slower than a threshold -- either an absolute minimum from
+--thresholds ({"se.err0.01.t4.noOutput": 500000, ...}, in reads per
+second) or --maxSlowdown relative to the same run in a --baseline
+results file -- or if the precision or recall drop below --minPrecision
+or --minRecall.
+
+Simulated reads are named <n>:<pos>:<transcript>/<mate>, as
+ComputeSyntheticStats.py expects.
+"""
+from __future__ import print_function
+import argparse
+import json
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from ComputeSyntheticStats import computeStats
+
+_complement = {'A': 'T', 'C': 'G', 'G': 'C', 'T': 'A', 'N': 'N'}
+
+
+def revComp(s):
+    return ''.join(_complement[c] for c in reversed(s))
+
+
+def randomSeq(rng, n):
+    return ''.join(rng.choice('ACGT') for _ in range(n))
+
+
+def generateTranscriptome(fname, numTranscripts, rng):
+    """
+    Random transcripts of 200--3000 bases; a quarter of them carry a copy
+    (with 1% substitutions) of one of 64 repeat families, picked with
+    probability ~ 1 / (family + 1).
+    """
+    families = [randomSeq(rng, 300) for _ in range(64)]
+    weights = [1.0 / (f + 1) for f in range(len(families))]
+    txps = []
+    with open(fname, 'w') as out:
+        for t in range(numTranscripts):
+            seq = randomSeq(rng, rng.randint(200, 3000))
+            if rng.random() < 0.25:
+                copy = list(rng.choices(families, weights)[0])
+                for i in range(len(copy)):
+                    if rng.random() < 0.01:
+                        copy[i] = rng.choice('ACGT')
+                at = rng.randint(0, len(seq))
+                seq = seq[:at] + ''.join(copy) + seq[at:]
+            name = 'txp{}'.format(t)
+            txps.append((name, seq))
+            out.write('>{}\n'.format(name))
+            for i in range(0, len(seq), 70):
+                out.write(seq[i:i+70] + '\n')
+    return txps
+
+
+def readTranscriptome(fname):
+    txps = []
+    name, seq = None, []
+    with open(fname) as f:
+        for line in f:
+            line = line.strip()
+            if line.startswith('>'):
+                if name is not None:
+                    txps.append((name, ''.join(seq).upper()))
+                name, seq = line[1:].split()[0], []
+            else:
+                seq.append(line)
+    if name is not None:
+        txps.append((name, ''.join(seq).upper()))
+    return txps
+
+
+def addErrors(seq, rate, rng):
+    if rate <= 0.0:
+        return seq
+    seq = list(seq)
+    # jump from error to error rather than drawing for every base
+    i = int(rng.expovariate(rate))
+    while i < len(seq):
+        seq[i] = rng.choice([b for b in 'ACGT' if b != seq[i]])
+        i += 1 + int(rng.expovariate(rate))
+    return ''.join(seq)
+
+
+def simulateReads(txps, prefix, paired, numReads, readLength, fragMean, fragSD,
+                  errorRate, rng):
+    """
+    Write numReads reads (or pairs) to <prefix>.fq (or <prefix>_1.fq and
+    <prefix>_2.fq), each from a uniformly chosen position and strand.
+    """
+    usable = [t for t in txps if len(t[1]) >= (fragMean if paired else readLength)]
+    if not usable:
+        raise RuntimeError('No transcript is long enough to simulate reads from')
+    qual = 'I' * readLength
+    fnames = ['{}_1.fq'.format(prefix), '{}_2.fq'.format(prefix)] if paired else ['{}.fq'.format(prefix)]
+    outs = [open(f, 'w') for f in fnames]
+    for n in range(numReads):
+        name, seq = rng.choice(usable)
+        if paired:
+            fragLen = int(rng.gauss(fragMean, fragSD))
+            fragLen = min(max(fragLen, readLength), len(seq))
+        else:
+            fragLen = readLength
+        pos = rng.randint(0, len(seq) - fragLen)
+        frag = seq[pos:pos+fragLen]
+        if rng.random() < 0.5:
+            frag = revComp(frag)
+        mates = [frag[:readLength], revComp(frag[-readLength:])] if paired else [frag]
+        for m, (out, mate) in enumerate(zip(outs, mates)):
+            out.write('@{}:{}:{}/{}\n{}\n+\n{}\n'.format(
+                n, pos, name, m + 1, addErrors(mate, errorRate, rng), qual))
+    for out in outs:
+        out.close()
+    return fnames
+
+
+def samRecords(fname):
+    """(qname, refName, isUnmapped, nh, line) for each alignment of a SAM file"""
+    with open(fname) as f:
+        for line in f:
+            if line.startswith('@'):
+                continue
+            fields = line.rstrip('\n').split('\t')
+            isUnmapped = (int(fields[1]) & 0x4) != 0
+            nh = None
+            for tag in fields[11:]:
+                if tag.startswith('NH:i:'):
+                    nh = int(tag[5:])
+            yield fields[0], fields[2], isUnmapped, nh, line
+
+
+def peakRSSBytes(rusage):
+    # ru_maxrss is in bytes on OS X, and in kilobytes elsewhere
+    return rusage.ru_maxrss if sys.platform == 'darwin' else rusage.ru_maxrss * 1024
+
+
+def runMapper(cmd, logName):
+    """
+    Run quasimap, timing it from the stderr log: the index is loaded when
+    "Done loading index" is logged, and mapping lasts from there until
+    the process exits.
+    """
+    start = time.time()
+    loaded = None
+    numReads = None
+    with open(logName, 'w') as log:
+        proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE,
+                                universal_newlines=True)
+        for line in proc.stderr:
+            log.write(line)
+            if loaded is None and 'Done loading index' in line:
+                loaded = time.time()
+            if 'In total saw' in line:
+                numReads = int(line.split('In total saw')[1].split()[0])
+        _, status, rusage = os.wait4(proc.pid, 0)
+    end = time.time()
+    # let the Popen object know the process is gone
+    proc.returncode = os.waitstatus_to_exitcode(status) if hasattr(os, 'waitstatus_to_exitcode') else status
+    if proc.returncode != 0:
+        raise RuntimeError('{} failed (exit status {}); see {}'.format(
+            ' '.join(cmd), proc.returncode, logName))
+    if loaded is None:
+        loaded = start
+    return {'index_load_seconds': loaded - start,
+            'mapping_seconds': end - loaded,
+            'wall_seconds': end - start,
+            'peak_rss_bytes': peakRSSBytes(rusage),
+            'num_reads': numReads}
+
+
+def minimumRates(args):
+    """The minimum reads per second for each run, from --thresholds and --baseline"""
+    mins = {}
+    if args.thresholds:
+        with open(args.thresholds) as f:
+            mins.update(json.load(f))
+    if args.baseline:
+        with open(args.baseline) as f:
+            for run in json.load(f)['runs']:
+                limit = run['reads_per_second'] * (1.0 - args.maxSlowdown)
+                mins[run['name']] = max(limit, mins.get(run['name'], 0.0))
+    return mins
+
+
+def main(args):
+    rng = random.Random(args.seed)
+    workDir = args.workDir or tempfile.mkdtemp(prefix='rapmap_bench_')
+    if not os.path.isdir(workDir):
+        os.makedirs(workDir)
+
+    if args.transcripts:
+        txpFile = args.transcripts
+        txps = readTranscriptome(txpFile)
+    else:
+        txpFile = os.path.join(workDir, 'transcripts.fa')
+        txps = generateTranscriptome(txpFile, args.numTranscripts, rng)
+
+    indexDir = os.path.join(workDir, 'index')
+    start = time.time()
+    with open(os.path.join(workDir, 'index.log'), 'w') as log:
+        subprocess.check_call([args.rapmap, 'quasiindex', '-t', txpFile, '-i', indexDir] +
+                              args.indexArgs.split(), stdout=log, stderr=log)
+    indexSeconds = time.time() - start
+    print('built the index of {} transcripts in {:.1f}s'.format(len(txps), indexSeconds),
+          file=sys.stderr)
+
+    errorRates = [float(e) for e in args.errorRates.split(',')]
+    threads = [int(t) for t in args.threads.split(',')]
+    runs = []
+    failures = []
+    for mode in args.modes.split(','):
+        paired = (mode == 'pe')
+        for errorRate in errorRates:
+            prefix = os.path.join(workDir, '{}_err{}'.format(mode, errorRate))
+            readFiles = simulateReads(txps, prefix, paired, args.numReads, args.readLength,
+                                      args.fragmentMean, args.fragmentSD, errorRate, rng)
+            readArgs = ['-1', readFiles[0], '-2', readFiles[1]] if paired else ['-r', readFiles[0]]
+            scored = False
+            for nt in threads:
+                for output in [False, True]:
+                    name = '{}.err{}.t{}.{}'.format(mode, errorRate, nt, 'sam' if output else 'noOutput')
+                    samName = os.path.join(workDir, 'out.sam')
+                    cmd = [args.rapmap, 'quasimap', '-i', indexDir, '-t', str(nt)] + readArgs
+                    cmd += ['-o', samName] if output else ['-n']
+                    cmd += args.mapArgs.split()
+                    run = runMapper(cmd, os.path.join(workDir, name + '.log'))
+                    run['name'] = name
+                    run['reads_per_second'] = args.numReads / max(run['mapping_seconds'], 1e-9)
+                    # the mappings don't depend on the number of threads
+                    if output and not scored:
+                        stats = computeStats(samRecords(samName), args.numReads)
+                        run['precision'] = stats.precision()
+                        run['recall'] = stats.recall()
+                        run['f1'] = stats.f1()
+                        scored = True
+                        if stats.precision() < args.minPrecision or stats.recall() < args.minRecall:
+                            failures.append('{}: precision {:.2%}, recall {:.2%}'.format(
+                                name, stats.precision(), stats.recall()))
+                    if output:
+                        os.remove(samName)
+                    runs.append(run)
+                    print('{:<28} {:>12.0f} reads/s  load {:>6.2f}s  peak RSS {:>8.1f} MB{}'.format(
+                        name, run['reads_per_second'], run['index_load_seconds'],
+                        run['peak_rss_bytes'] / 1048576.0,
+                        '  precision {:.2%} recall {:.2%}'.format(run['precision'], run['recall'])
+                        if 'precision' in run else ''))
+
+    mins = minimumRates(args)
+    for run in runs:
+        if run['name'] in mins and run['reads_per_second'] < mins[run['name']]:
+            failures.append('{}: {:.0f} reads/s, below the threshold of {:.0f}'.format(
+                run['name'], run['reads_per_second'], mins[run['name']]))
+
+    results = {'config': {'transcripts': txpFile, 'num_transcripts': len(txps),
+                          'num_reads': args.numReads, 'read_length': args.readLength,
+                          'fragment_mean': args.fragmentMean, 'fragment_sd': args.fragmentSD,
+                          'seed': args.seed, 'index_args': args.indexArgs,
+                          'map_args': args.mapArgs},
+               'index_build_seconds': indexSeconds,
+               'runs': runs}
+    with open(args.results, 'w') as f:
+        json.dump(results, f, indent=2)
+
+    for failure in failures:
+        print('FAILED: ' + failure, file=sys.stderr)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description='End-to-end throughput benchmark of quasimap on simulated reads.')
+    parser.add_argument('--rapmap', type=str, default='rapmap', help='the rapmap executable')
+    parser.add_argument('--workDir', type=str, help='where to put the index, reads and logs (default: a new temporary directory)')
+    parser.add_argument('--transcripts', type=str, help='FASTA transcriptome to use (default: generate one)')
+    parser.add_argument('--numTranscripts', type=int, default=5000, help='number of transcripts to generate')
+    parser.add_argument('--numReads', type=int, default=500000, help='number of reads (or pairs) to simulate')
+    parser.add_argument('--readLength', type=int, default=100)
+    parser.add_argument('--fragmentMean', type=int, default=250)
+    parser.add_argument('--fragmentSD', type=int, default=25)
+    parser.add_argument('--errorRates', type=str, default='0.0,0.01', help='comma-separated per-base substitution rates')
+    parser.add_argument('--modes', type=str, default='se,pe', help='comma-separated: se, pe')
+    parser.add_argument('--threads', type=str, default='1,2,4,8', help='comma-separated thread counts')
+    parser.add_argument('--indexArgs', type=str, default='', help='extra arguments for quasiindex')
+    parser.add_argument('--mapArgs', type=str, default='', help='extra arguments for quasimap')
+    parser.add_argument('--seed', type=int, default=42)
+    parser.add_argument('--results', type=str, default='rapmap_e2e.json', help='where to write the results')
+    parser.add_argument('--thresholds', type=str, help='JSON file of minimum reads per second, by run name')
+    parser.add_argument('--baseline', type=str, help='results of an earlier run to compare against')
+    parser.add_argument('--maxSlowdown', type=float, default=0.10, help='allowed fractional slowdown relative to --baseline')
+    parser.add_argument('--minPrecision', type=float, default=0.0)
+    parser.add_argument('--minRecall', type=float, default=0.0)
+    args = parser.parse_args()
+    sys.exit(main(args))
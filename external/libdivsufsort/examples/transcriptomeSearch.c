@@ -10,7 +10,15 @@
 # include <strings.h>
 #include <assert.h>
 # include <sys/types.h>
-#include <divsufsort.h>
+#if defined(BUILD_DIVSUFSORT64)
+# include <divsufsort64.h>
+# define saidx_t saidx64_t
+# define PRIdSAIDX_T PRIdSAIDX64_T
+# define divsufsort divsufsort64
+# define sa_search sa_search64
+#else
+# include <divsufsort.h>
+#endif
 #include "lfs.h"
 #include "bit_array.h"
 
@@ -334,6 +342,116 @@ void get_test_cases(TestCase **tc, saidx_t *num_testcases)
 
 
 
+    // Patterns longer than a word, with boundaries inside the matched text
+    //Test case #21
+    current_tc->text = "ACGTACGTACGTACGTACGTTGCATGCATGCATGCATGCA";
+    current_tc->text_len = 40;
+    current_tc->pattern = "GCATGCATGCATGCATGCA";
+    current_tc->pattern_len = 19;
+    ba = bit_array_create(40);
+    bit_array_set_bit(ba, 19);
+    bit_array_set_bit(ba, 39);
+    current_tc->Ba = ba;
+
+    current_tc->expected_num_matches = 1;
+    current_tc->expected_index = 24;
+
+    current_tc++;
+    (*num_testcases)++;
+
+
+    //Test case #22
+    current_tc->text = "ACGTACGTACGTACGTACGTTGCATGCATGCATGCATGCA";
+    current_tc->text_len = 40;
+    current_tc->pattern = "CGTACGTACGTACGTACGTT";
+    current_tc->pattern_len = 20;
+    current_tc->Ba = ba;
+
+    current_tc->expected_num_matches = 0;
+    current_tc->expected_index = 20;
+
+    current_tc++;
+    (*num_testcases)++;
+
+
+    //Test case #23
+    current_tc->text = "GATTACAGATTACAGATTACACCCCCCCCCGATTACAGATTACAGA";
+    current_tc->text_len = 46;
+    current_tc->pattern = "CCCCCCCCCG";
+    current_tc->pattern_len = 10;
+    ba = bit_array_create(46);
+    bit_array_set_bit(ba, 20);
+    bit_array_set_bit(ba, 30);
+    bit_array_set_bit(ba, 45);
+    current_tc->Ba = ba;
+
+    current_tc->expected_num_matches = 1;
+    current_tc->expected_index = 21;
+
+    current_tc++;
+    (*num_testcases)++;
+
+
+    // Transcripts separated by '$', as laid out by the indexer
+    //Test case #24
+    current_tc->text = "ACGTACGTACGTACGTACGT$TGCATGCATGCATGCATGCA$";
+    current_tc->text_len = 42;
+    current_tc->pattern = "ACGTACGTACGTACGTACGT";
+    current_tc->pattern_len = 20;
+    ba = bit_array_create(42);
+    bit_array_set_bit(ba, 20);
+    bit_array_set_bit(ba, 41);
+    current_tc->Ba = ba;
+
+    current_tc->expected_num_matches = 1;
+    current_tc->expected_index = 7;
+
+    current_tc++;
+    (*num_testcases)++;
+
+
+    //Test case #25
+    current_tc->text = "ACGTACGTACGTACGTACGT$TGCATGCATGCATGCATGCA$";
+    current_tc->text_len = 42;
+    current_tc->pattern = "TACGTACGTACG";
+    current_tc->pattern_len = 12;
+    current_tc->Ba = ba;
+
+    current_tc->expected_num_matches = 2;
+    current_tc->expected_index = 35;
+
+    current_tc++;
+    (*num_testcases)++;
+
+
+    //Test case #26
+    current_tc->text = "ACGTACGTACGTACGTACGT$TGCATGCATGCATGCATGCA$";
+    current_tc->text_len = 42;
+    current_tc->pattern = "GCATGCATGCATGCATGCA";
+    current_tc->pattern_len = 19;
+    current_tc->Ba = ba;
+
+    current_tc->expected_num_matches = 1;
+    current_tc->expected_index = 26;
+
+    current_tc++;
+    (*num_testcases)++;
+
+
+    //Test case #27
+    current_tc->text = "ACGTACGTACGTACGTACGT$TGCATGCATGCATGCATGCA$";
+    current_tc->text_len = 42;
+    current_tc->pattern = "ACGTACGTACGTACGTACGTT";
+    current_tc->pattern_len = 21;
+    current_tc->Ba = ba;
+
+    current_tc->expected_num_matches = 0;
+    current_tc->expected_index = 8;
+
+    current_tc++;
+    (*num_testcases)++;
+
+
     //##############################
     return;
 }
@@ -349,7 +467,7 @@ main(int argc, const char *argv[]) {
     get_test_cases(&test, &num_testcases);
 
     for (i=0; i<num_testcases; i++, test++) {
-        printf("Test case (%d).\n", i+1);
+        printf("Test case (%" PRIdSAIDX_T ").\n", i+1);
         printf("===================\n");
 
         SA = (saidx_t *)malloc((size_t)test->text_len * sizeof(saidx_t));
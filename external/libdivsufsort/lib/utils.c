@@ -241,19 +241,51 @@ sufcheck(const sauchar_t *T, const saidx_t *SA,
 }
 
 
+/* Returns the first set bit of BA in [from, to), or to if there is none. */
+static INLINE
+saidx_t
+_next_boundary(const BIT_ARRAY *BA, saidx_t from, saidx_t to) {
+  const uint64_t *words = BA->words;
+  uint64_t w;
+  saidx_t k;
+  for(k = from & ~(saidx_t)63; k < to; k += 64) {
+    w = words[k >> 6];
+    if(k < from) { w &= ~(uint64_t)0 << (from - k); }
+    if((to - k) < 64) { w &= (((uint64_t)1) << (to - k)) - 1; }
+    if(w != 0) { return k + (saidx_t)trailing_zeros(w); }
+  }
+  return to;
+}
+
+/* Compares the pattern against the suffix at suf, skipping the first *match
+   characters.  If BA is given, a set bit marks the last character of a
+   transcript and the comparison stops there, as if the suffix ended.  The
+   characters are compared first, a word at a time, and the bits are only
+   consulted once, over the stretch that matched. */
 static
 int
 _compare(const sauchar_t *T, saidx_t Tsize,
          const sauchar_t *P, saidx_t Psize,
 		 const BIT_ARRAY *BA,
          saidx_t suf, saidx_t *match) {
-  saidx_t i, j;
+  saidx_t i, j, start, end;
+  uint64_t a, b;
   saint_t r;
-  for(i = suf + *match, j = *match, r = 0;
-      (i < Tsize) && (j < Psize) &&
-    		  (((BA != 0) && (j > 0)) ? (!bit_array_get_bit(BA, i-1)) : 1) &&
-			  ((r = T[i] - P[j]) == 0);
-      ++i, ++j) { }
+  start = suf + *match, i = start, j = *match, r = 0;
+  end = MIN(Tsize, i + (Psize - j));
+  for(; (i + 8) <= end; i += 8, j += 8) {
+    memcpy(&a, T + i, 8);
+    memcpy(&b, P + j, 8);
+    if(a != b) { break; }
+  }
+  for(; (i < end) && ((r = T[i] - P[j]) == 0); ++i, ++j) { }
+  if(BA != 0) {
+    /* A boundary at x stops the comparison before T[x + 1].  The characters
+       before start aren't checked again, so the first boundary that matters
+       is at start - 1 (or at start if none were matched). */
+    end = _next_boundary(BA, (0 < *match) ? (start - 1) : start, i);
+    if(end < i) { i = end + 1, j = i - suf, r = 0; }
+  }
   *match = j;
   return (r == 0) ? -(j != Psize) : r;
 }
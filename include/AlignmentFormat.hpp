@@ -0,0 +1,260 @@
+#ifndef __ALIGNMENT_FORMAT_HPP__
+#define __ALIGNMENT_FORMAT_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "MEMFormat.hpp"
+#include "RapMapUtils.hpp"
+
+/**
+ * The compact binary format rapmap quasimap --binary writes alignments
+ * in (and rapmap bin2sam turns back into SAM).  The file starts with the
+ * magic "RMAL", then (as little-endian uint32s) the format version, the
+ * flags (bit 0 is set for paired-end reads) and the number of
+ * transcripts, then for each transcript
+ *
+ *   varint  name length, then the name
+ *   varint  transcript length
+ *
+ * The alignments follow in chunks (one per parser job of a mapping
+ * thread), each of which is a uint32 byte length and a uint32 number of
+ * reads, followed by a record per mapped read:
+ *
+ *   varint  name length, then the name (trimmed as in the SAM output)
+ *   varint  read length (of the left mate, for paired-end reads)
+ *   varint  right mate length (paired-end files only)
+ *   varint  number of hits, then for each
+ *     varint  tid
+ *     uint8   bit 0: fwd, bit 1: mateIsFwd, bit 2: isPaired,
+ *             bits 3-4: mateStatus
+ *     varint  pos, zigzag encoded (a hit may hang off the left end)
+ *     varint  matePos, zigzag encoded (paired hits only)
+ *     varint  fragLen
+ *
+ * Varints are LEB128, as in MEMFormat.hpp.  A chunk doesn't depend on
+ * anything but the file header, so the chunks can be read one after
+ * another (skipping by their lengths) and decoded in parallel.
+ */
+namespace rapmap {
+    namespace aln {
+
+        constexpr uint32_t formatVersion = 1;
+        constexpr uint32_t pairedFlag = 0x1;
+
+        constexpr uint8_t hitFwd = 0x1;
+        constexpr uint8_t hitMateFwd = 0x2;
+        constexpr uint8_t hitPaired = 0x4;
+        constexpr uint8_t mateStatusShift = 3;
+
+        inline uint32_t zigzag(int32_t v) {
+            return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+        }
+
+        inline int32_t unzigzag(uint32_t v) {
+            return static_cast<int32_t>((v >> 1) ^ (~(v & 1) + 1));
+        }
+
+        template <typename LenT>
+        void appendHeader(std::string& out, const std::vector<std::string>& txpNames,
+                          const std::vector<LenT>& txpLens, bool paired) {
+            out.append("RMAL", 4);
+            rapmap::mems::append32(out, formatVersion);
+            rapmap::mems::append32(out, paired ? pairedFlag : 0);
+            rapmap::mems::append32(out, static_cast<uint32_t>(txpNames.size()));
+            for (size_t i = 0; i < txpNames.size(); ++i) {
+                rapmap::mems::appendVarint(out, txpNames[i].length());
+                out.append(txpNames[i]);
+                rapmap::mems::appendVarint(out, static_cast<uint64_t>(txpLens[i]));
+            }
+        }
+
+        /**
+         * Collects the records of the reads of one chunk.  Each mapping
+         * thread owns one, and flushes it at the end of every job.
+         */
+        class ChunkWriter {
+            public:
+                void add(const std::string& name, uint32_t readLen,
+                         const std::vector<rapmap::utils::QuasiAlignment>& hits) {
+                    appendName(name, false);
+                    rapmap::mems::appendVarint(records_, readLen);
+                    appendHits(hits);
+                }
+
+                void add(const std::string& name, uint32_t leftLen, uint32_t rightLen,
+                         const std::vector<rapmap::utils::QuasiAlignment>& hits) {
+                    appendName(name, true);
+                    rapmap::mems::appendVarint(records_, leftLen);
+                    rapmap::mems::appendVarint(records_, rightLen);
+                    appendHits(hits);
+                }
+
+                bool empty() const { return numReads_ == 0; }
+
+                // Append the chunk to out (if it holds any reads) and start a new one
+                void flush(std::string& out) {
+                    if (numReads_ == 0) { return; }
+                    rapmap::mems::append32(out, static_cast<uint32_t>(records_.size()));
+                    rapmap::mems::append32(out, numReads_);
+                    out.append(records_);
+                    records_.clear();
+                    numReads_ = 0;
+                }
+
+            private:
+                // Only the first word of the name, without a /1 or /2 for pairs
+                void appendName(const std::string& name, bool trimMateSuffix) {
+                    size_t len = std::min(name.find(' '), name.length());
+                    if (trimMateSuffix and len > 2 and name[len - 2] == '/') { len -= 2; }
+                    rapmap::mems::appendVarint(records_, len);
+                    records_.append(name, 0, len);
+                    ++numReads_;
+                }
+
+                void appendHits(const std::vector<rapmap::utils::QuasiAlignment>& hits) {
+                    rapmap::mems::appendVarint(records_, hits.size());
+                    for (auto& qa : hits) {
+                        uint8_t flags = (qa.fwd ? hitFwd : 0) |
+                                        (qa.mateIsFwd ? hitMateFwd : 0) |
+                                        (qa.isPaired ? hitPaired : 0) |
+                                        (static_cast<uint8_t>(qa.mateStatus) << mateStatusShift);
+                        rapmap::mems::appendVarint(records_, qa.tid);
+                        records_.push_back(static_cast<char>(flags));
+                        rapmap::mems::appendVarint(records_, zigzag(qa.pos));
+                        if (qa.isPaired) {
+                            rapmap::mems::appendVarint(records_, zigzag(qa.matePos));
+                        }
+                        rapmap::mems::appendVarint(records_, qa.fragLen);
+                    }
+                }
+
+                std::string records_;
+                uint32_t numReads_{0};
+        };
+
+        struct Header {
+            bool paired;
+            std::vector<std::string> txpNames;
+            std::vector<uint32_t> txpLens;
+        };
+
+        // A chunk as read from the file, still encoded
+        struct Chunk {
+            std::string data;
+            uint32_t numReads;
+        };
+
+        struct Read {
+            std::string name;
+            uint32_t leftLen;
+            // 0 for single-end reads
+            uint32_t rightLen;
+            std::vector<rapmap::utils::QuasiAlignment> hits;
+        };
+
+        namespace detail {
+            inline bool read32(std::istream& in, uint32_t& v) {
+                unsigned char b[4];
+                if (!in.read(reinterpret_cast<char*>(b), 4)) { return false; }
+                v = 0;
+                for (size_t i = 0; i < 4; ++i) { v |= static_cast<uint32_t>(b[i]) << (8 * i); }
+                return true;
+            }
+        }
+
+        // Returns false if the stream doesn't start with a header we can read
+        inline bool readHeader(std::istream& in, Header& h) {
+            char magic[4];
+            uint32_t version, flags, numTxps;
+            if (!in.read(magic, 4) or std::string(magic, 4) != "RMAL") { return false; }
+            if (!detail::read32(in, version) or version != formatVersion) { return false; }
+            if (!detail::read32(in, flags) or !detail::read32(in, numTxps)) { return false; }
+            h.paired = (flags & pairedFlag);
+            h.txpNames.resize(numTxps);
+            h.txpLens.resize(numTxps);
+            for (uint32_t i = 0; i < numTxps; ++i) {
+                uint64_t nameLen, len;
+                if (!rapmap::mems::readVarint(in, nameLen)) { return false; }
+                h.txpNames[i].resize(nameLen);
+                if (nameLen > 0 and !in.read(&h.txpNames[i][0], nameLen)) { return false; }
+                if (!rapmap::mems::readVarint(in, len)) { return false; }
+                h.txpLens[i] = static_cast<uint32_t>(len);
+            }
+            return true;
+        }
+
+        // Returns false at the end of the stream (or on a truncated chunk)
+        inline bool readChunk(std::istream& in, Chunk& c) {
+            uint32_t len;
+            if (!detail::read32(in, len) or !detail::read32(in, c.numReads)) { return false; }
+            c.data.resize(len);
+            return len == 0 or static_cast<bool>(in.read(&c.data[0], len));
+        }
+
+        /**
+         * Decodes the reads of a chunk in turn.  The hits come back as
+         * the mapper made them; for an orphan, readLen is the length of
+         * the mate that aligned and mateLen that of the other.
+         */
+        class ChunkDecoder {
+            public:
+                ChunkDecoder(const Chunk& c, bool paired) :
+                    p_(c.data.data()), end_(c.data.data() + c.data.size()), paired_(paired) {}
+
+                // Returns false once the chunk is exhausted (or malformed)
+                bool next(Read& r) {
+                    uint64_t nameLen, leftLen, rightLen{0}, numHits;
+                    if (!varint(nameLen) or static_cast<uint64_t>(end_ - p_) < nameLen) { return false; }
+                    r.name.assign(p_, nameLen);
+                    p_ += nameLen;
+                    if (!varint(leftLen) or (paired_ and !varint(rightLen)) or !varint(numHits)) {
+                        return false;
+                    }
+                    r.leftLen = static_cast<uint32_t>(leftLen);
+                    r.rightLen = static_cast<uint32_t>(rightLen);
+                    r.hits.resize(numHits);
+                    for (auto& qa : r.hits) {
+                        uint64_t tid, pos, matePos{0}, fragLen;
+                        if (!varint(tid) or p_ == end_) { return false; }
+                        uint8_t flags = static_cast<uint8_t>(*p_++);
+                        if (!varint(pos)) { return false; }
+                        if ((flags & hitPaired) and !varint(matePos)) { return false; }
+                        if (!varint(fragLen)) { return false; }
+                        qa.tid = static_cast<uint32_t>(tid);
+                        qa.fwd = (flags & hitFwd);
+                        qa.mateIsFwd = (flags & hitMateFwd);
+                        qa.isPaired = (flags & hitPaired);
+                        qa.mateStatus = static_cast<rapmap::utils::MateStatus>((flags >> mateStatusShift) & 0x3);
+                        qa.pos = unzigzag(static_cast<uint32_t>(pos));
+                        qa.matePos = unzigzag(static_cast<uint32_t>(matePos));
+                        qa.fragLen = static_cast<uint32_t>(fragLen);
+                        bool rightOrphan = (qa.mateStatus == rapmap::utils::MateStatus::PAIRED_END_RIGHT);
+                        qa.readLen = rightOrphan ? r.rightLen : r.leftLen;
+                        qa.mateLen = rightOrphan ? r.leftLen : r.rightLen;
+                    }
+                    return true;
+                }
+
+            private:
+                bool varint(uint64_t& v) {
+                    v = 0;
+                    for (uint32_t shift = 0; shift < 64 and p_ < end_; shift += 7) {
+                        uint8_t c = static_cast<uint8_t>(*p_++);
+                        v |= static_cast<uint64_t>(c & 0x7f) << shift;
+                        if (!(c & 0x80)) { return true; }
+                    }
+                    return false;
+                }
+
+                const char* p_;
+                const char* end_;
+                bool paired_;
+        };
+    }
+}
+
+#endif // __ALIGNMENT_FORMAT_HPP__
@@ -0,0 +1,16 @@
+#ifndef __ALLOCATION_COUNTER_HPP__
+#define __ALLOCATION_COUNTER_HPP__
+
+#include <cstdint>
+
+namespace rapmap {
+    namespace utils {
+        // Number of times the calling thread has called operator new.
+        // Counting is only compiled in when RapMap is configured with
+        // -DCOUNT_ALLOCATIONS=TRUE (which defines RAPMAP_COUNT_ALLOCATIONS);
+        // otherwise this always returns 0.
+        uint64_t threadAllocationCount();
+    }
+}
+
+#endif //__ALLOCATION_COUNTER_HPP__
@@ -0,0 +1,219 @@
+#ifndef __BAM_UTILS_HPP__
+#define __BAM_UTILS_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "spdlog/details/format.h"
+
+/**
+ * Encoding of BAM headers and alignment records, following section 4.2
+ * of the SAM/BAM specification.  Integers are written little-endian.
+ */
+namespace rapmap {
+    namespace bam {
+
+        // CIGAR operation codes
+        enum : uint32_t { CIGAR_MATCH = 0, CIGAR_SOFT_CLIP = 4 };
+
+        // The longest read name a BAM record can hold
+        constexpr size_t maxNameLen = 254;
+
+        // Our alignments have at most a clip and a match
+        struct Cigar {
+            uint32_t ops[2];
+            uint16_t numOps{0};
+
+            void clear() { numOps = 0; }
+            void push(uint32_t len, uint32_t op) { ops[numOps++] = (len << 4) | op; }
+
+            // Number of reference bases covered
+            int32_t refLen() const {
+                int32_t l{0};
+                for (uint16_t i = 0; i < numOps; ++i) {
+                    if ((ops[i] & 0xf) == CIGAR_MATCH) { l += ops[i] >> 4; }
+                }
+                return l;
+            }
+        };
+
+        // The BAM counterpart of rapmap::utils::adjustOverhang
+        inline void adjustOverhang(int32_t& pos, uint32_t readLen,
+                                   uint32_t txpLen, Cigar& cigar) {
+            cigar.clear();
+            int32_t rlen = static_cast<int32_t>(readLen);
+            int32_t tlen = static_cast<int32_t>(txpLen);
+            if (pos + rlen <= 0) {
+                cigar.push(readLen, CIGAR_SOFT_CLIP);
+                pos = 0;
+            } else if (pos < 0) {
+                int32_t matchLen = rlen + pos;
+                int32_t clipLen = rlen - matchLen;
+                cigar.push(clipLen, CIGAR_SOFT_CLIP);
+                cigar.push(matchLen, CIGAR_MATCH);
+                pos = 0;
+            } else if (pos > tlen) {
+                cigar.push(readLen, CIGAR_SOFT_CLIP);
+            } else if (pos + rlen > tlen) {
+                int32_t matchLen = tlen - pos;
+                int32_t clipLen = rlen - matchLen;
+                cigar.push(matchLen, CIGAR_MATCH);
+                cigar.push(clipLen, CIGAR_SOFT_CLIP);
+            } else {
+                cigar.push(readLen, CIGAR_MATCH);
+            }
+        }
+
+        // Compute the bin of [beg, end) (0-based, end exclusive); from the SAM spec
+        inline uint16_t reg2bin(int32_t beg, int32_t end) {
+            --end;
+            if (beg >> 14 == end >> 14) return ((1 << 15) - 1) / 7 + (beg >> 14);
+            if (beg >> 17 == end >> 17) return ((1 << 12) - 1) / 7 + (beg >> 17);
+            if (beg >> 20 == end >> 20) return ((1 << 9) - 1) / 7 + (beg >> 20);
+            if (beg >> 23 == end >> 23) return ((1 << 6) - 1) / 7 + (beg >> 23);
+            if (beg >> 26 == end >> 26) return ((1 << 3) - 1) / 7 + (beg >> 26);
+            return 0;
+        }
+
+        inline void append8(std::string& out, uint8_t v) {
+            out.push_back(static_cast<char>(v));
+        }
+
+        inline void append16(std::string& out, uint16_t v) {
+            char b[2] = {static_cast<char>(v & 0xff), static_cast<char>(v >> 8)};
+            out.append(b, 2);
+        }
+
+        inline void append32(std::string& out, uint32_t v) {
+            char b[4];
+            for (size_t i = 0; i < 4; ++i) { b[i] = static_cast<char>((v >> (8 * i)) & 0xff); }
+            out.append(b, 4);
+        }
+
+        // 4-bit encoding of a base, "=ACMGRSVTWYHKDBN"; anything else is N
+        inline uint8_t baseCode(char c) {
+            switch (c) {
+                case '=': return 0;
+                case 'A': case 'a': return 1;
+                case 'C': case 'c': return 2;
+                case 'M': return 3;
+                case 'G': case 'g': return 4;
+                case 'R': return 5;
+                case 'S': return 6;
+                case 'V': return 7;
+                case 'T': case 't': return 8;
+                case 'W': return 9;
+                case 'Y': return 10;
+                case 'H': return 11;
+                case 'K': return 12;
+                case 'D': return 13;
+                case 'B': return 14;
+                default: return 15;
+            }
+        }
+
+        /**
+         * Append one alignment record to out.  pos and nextPos are 0-based
+         * (-1 if unavailable), refID and nextRefID are -1 for '*'.  If qual
+         * isn't the same length as seq (e.g. FASTA input), the qualities
+         * are written as missing.  The record carries a single NH tag.
+         * Names longer than the 254 characters BAM allows are truncated
+         * (l_read_name, which counts the NUL, is a single byte).
+         */
+        inline void appendRecord(std::string& out,
+                                 const char* name, size_t nameLen,
+                                 uint16_t flag, int32_t refID, int32_t pos,
+                                 uint8_t mapq, const Cigar& cigar,
+                                 int32_t nextRefID, int32_t nextPos, int32_t tlen,
+                                 const std::string& seq, const std::string& qual,
+                                 uint32_t numHits) {
+            nameLen = std::min(nameLen, maxNameLen);
+            uint32_t seqLen = static_cast<uint32_t>(seq.length());
+            // NH, with the smallest integer type that holds it
+            size_t tagLen = 3 + ((numHits <= 0xff) ? 1 : ((numHits <= 0xffff) ? 2 : 4));
+            uint32_t blockSize = 32 + (nameLen + 1) + 4 * cigar.numOps +
+                                 ((seqLen + 1) / 2) + seqLen + tagLen;
+            int32_t refLen = cigar.refLen();
+            int32_t end = pos + ((refLen > 0) ? refLen : 1);
+
+            out.reserve(out.size() + blockSize + 4);
+            append32(out, blockSize);
+            append32(out, static_cast<uint32_t>(refID));
+            append32(out, static_cast<uint32_t>(pos));
+            append8(out, static_cast<uint8_t>(nameLen + 1));
+            append8(out, mapq);
+            append16(out, reg2bin(pos, end));
+            append16(out, cigar.numOps);
+            append16(out, flag);
+            append32(out, seqLen);
+            append32(out, static_cast<uint32_t>(nextRefID));
+            append32(out, static_cast<uint32_t>(nextPos));
+            append32(out, static_cast<uint32_t>(tlen));
+            out.append(name, nameLen);
+            out.push_back('\0');
+            for (uint16_t i = 0; i < cigar.numOps; ++i) { append32(out, cigar.ops[i]); }
+
+            size_t seqStart = out.size();
+            out.resize(seqStart + (seqLen + 1) / 2);
+            char* packed = &out[seqStart];
+            for (uint32_t i = 0; i + 1 < seqLen; i += 2) {
+                packed[i >> 1] = static_cast<char>((baseCode(seq[i]) << 4) | baseCode(seq[i + 1]));
+            }
+            if (seqLen & 1) {
+                packed[seqLen >> 1] = static_cast<char>(baseCode(seq[seqLen - 1]) << 4);
+            }
+
+            if (qual.length() == seqLen) {
+                size_t qualStart = out.size();
+                out.append(qual);
+                for (size_t i = qualStart; i < out.size(); ++i) { out[i] -= 33; }
+            } else {
+                out.append(seqLen, static_cast<char>(0xff));
+            }
+
+            out.append("NH", 2);
+            if (numHits <= 0xff) {
+                out.push_back('C');
+                append8(out, static_cast<uint8_t>(numHits));
+            } else if (numHits <= 0xffff) {
+                out.push_back('S');
+                append16(out, static_cast<uint16_t>(numHits));
+            } else {
+                out.push_back('I');
+                append32(out, numHits);
+            }
+        }
+
+        /**
+         * Append the BAM header for the transcripts of rmi to out;
+         * the text is the same header writeSAMHeader emits.
+         */
+        template <typename IndexT>
+        void appendHeader(IndexT& rmi, std::string& out) {
+            fmt::MemoryWriter hd;
+            hd.write("@HD\tVN:0.1\tSO:unknown\n");
+
+            auto& txpNames = rmi.txpNames;
+            auto& txpLens = rmi.txpLens;
+            auto numRef = txpNames.size();
+            for (size_t i = 0; i < numRef; ++i) {
+                hd.write("@SQ\tSN:{}\tLN:{:d}\n", txpNames[i], txpLens[i]);
+            }
+
+            out.append("BAM\1", 4);
+            append32(out, static_cast<uint32_t>(hd.size()));
+            out.append(hd.data(), hd.size());
+            append32(out, static_cast<uint32_t>(numRef));
+            for (size_t i = 0; i < numRef; ++i) {
+                append32(out, static_cast<uint32_t>(txpNames[i].length() + 1));
+                out.append(txpNames[i]);
+                out.push_back('\0');
+                append32(out, static_cast<uint32_t>(txpLens[i]));
+            }
+        }
+    }
+}
+
+#endif // __BAM_UTILS_HPP__
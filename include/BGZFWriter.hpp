@@ -0,0 +1,95 @@
+#ifndef __BGZF_WRITER_HPP__
+#define __BGZF_WRITER_HPP__
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+namespace rapmap {
+    namespace bam {
+
+        /**
+         * Writes BGZF (blocked gzip, as used by BAM) to an output stream.
+         *
+         * Producers (the mapping threads) hand over chunks of uncompressed
+         * data with write().  Each chunk is compressed, as one or more BGZF
+         * blocks, by a pool of compression threads, and a single writer
+         * thread emits the compressed chunks in the order in which they were
+         * handed over.  A chunk is never interleaved with another, so a
+         * producer that only submits whole BAM records gets whole records in
+         * the output.
+         *
+         * At most maxQueued chunks may be waiting to be compressed or
+         * written; write() blocks beyond that, so a slow disk throttles the
+         * mapping threads rather than exhausting memory.
+         */
+        class BGZFWriter {
+            public:
+                BGZFWriter(std::ostream& out, uint32_t numThreads,
+                           int level = Z_DEFAULT_COMPRESSION, size_t maxQueued = 64);
+                ~BGZFWriter();
+
+                /**
+                 * Queue the contents of data for compression.  data is left
+                 * empty (but with the capacity of a previously written chunk),
+                 * so a caller can keep reusing the same buffer.
+                 */
+                void write(std::string& data);
+
+                /**
+                 * Wait for every queued chunk to be written, then write the
+                 * BGZF end-of-file marker and stop the worker threads.
+                 * Returns false if writing to the stream failed at any
+                 * point (the rest of the output is then discarded).
+                 */
+                bool close();
+
+            private:
+                struct Chunk {
+                    std::string raw;
+                    std::string compressed;
+                    bool done{false};
+                };
+
+                void compressLoop_();
+                void writeLoop_();
+                void compressChunk_(Chunk& c, z_stream& strm, z_stream& storeStrm);
+                void appendBlock_(const char* data, size_t len, std::string& out,
+                                  z_stream& strm, z_stream& storeStrm);
+
+                std::ostream& out_;
+                int level_;
+                size_t maxQueued_;
+                bool closed_{false};
+                // only touched by the writer thread until it's joined
+                bool failed_{false};
+
+                std::mutex mutex_;
+                std::condition_variable workAvailable_;
+                std::condition_variable chunkDone_;
+                std::condition_variable spaceAvailable_;
+                bool closing_{false};
+                // Chunks in submission order that have not yet been written;
+                // the first nextToCompress_ of them have been claimed by a
+                // compression thread.
+                std::deque<Chunk*> queue_;
+                size_t nextToCompress_{0};
+                // Every chunk we've allocated, and the ones free for reuse
+                std::vector<std::unique_ptr<Chunk>> chunks_;
+                std::vector<Chunk*> free_;
+
+                std::vector<std::thread> compressors_;
+                std::thread writer_;
+        };
+    }
+}
+
+#endif // __BGZF_WRITER_HPP__
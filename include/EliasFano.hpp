@@ -0,0 +1,154 @@
+#ifndef __ELIAS_FANO_HPP__
+#define __ELIAS_FANO_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifdef __BMI2__
+#include <x86intrin.h>
+#endif
+
+/**
+ * An Elias-Fano encoding of a strictly increasing sequence of integers
+ * drawn from [0, universe).  Each value is split into l = floor(log2(universe / n))
+ * low bits, which are stored verbatim, and high bits, which are stored in
+ * unary in a bit vector of n + (universe >> l) + 1 bits.  That takes about
+ * 2 + l bits per value.
+ *
+ * In the quasi index this holds the transcript start offsets, where
+ * predecessor(p) returns the transcript containing text position p and
+ * the offset at which that transcript starts.
+ */
+class EliasFano {
+    public:
+        EliasFano() = default;
+
+        // Encode values, which must be strictly increasing and < universe.
+        EliasFano(const std::vector<uint64_t>& values, uint64_t universe);
+
+        uint64_t size() const { return n_; }
+        uint64_t universe() const { return universe_; }
+        bool empty() const { return n_ == 0; }
+
+        // The i-th value of the sequence.
+        uint64_t access(uint64_t i) const;
+
+        /**
+         * Return the index of the largest value <= x, and place that
+         * value in valueOut.  x must be at least the first value of the
+         * sequence (for transcript starts, that value is always 0).
+         */
+        inline uint64_t predecessor(uint64_t x, uint64_t& valueOut) const {
+            uint64_t h = x >> l_;
+            uint64_t xLow = x & lowMask_;
+
+            // The h-th 0 in the upper bits closes bucket h, so there are
+            // (zeroPos - h) values whose high part is <= h.
+            uint64_t zeroPos = select0_(h);
+            uint64_t i = zeroPos - h;
+            uint64_t pos = zeroPos;
+            // Scan back through bucket h for the last value with a low part <= xLow
+            while (pos > 0 and getBit_(high_, pos - 1)) {
+                --pos;
+                --i;
+                uint64_t low = lowAt_(i);
+                if (low <= xLow) {
+                    valueOut = (h << l_) | low;
+                    return i;
+                }
+            }
+            // Otherwise the predecessor is the last value of an earlier bucket
+            --i;
+            uint64_t onePos = prevOne_(pos);
+            valueOut = ((onePos - i) << l_) | lowAt_(i);
+            return i;
+        }
+
+        // Number of bytes used by the encoding.
+        size_t sizeInBytes() const {
+            return sizeof(uint64_t) * (low_.size() + high_.size() + zeroSamples_.size());
+        }
+
+        template <typename Archive>
+        void save(Archive& ar) const {
+            ar(n_, universe_, l_, low_, high_, zeroSamples_);
+        }
+
+        template <typename Archive>
+        void load(Archive& ar) {
+            ar(n_, universe_, l_, low_, high_, zeroSamples_);
+            lowMask_ = (l_ == 0) ? 0 : ((~uint64_t(0)) >> (64 - l_));
+        }
+
+    private:
+        // Record the position of every (1 << zeroSampleShift_)-th 0 of the
+        // upper bits, so that select0 scans at most that many 0s.
+        static constexpr uint64_t zeroSampleShift_ = 6;
+
+        static inline bool getBit_(const std::vector<uint64_t>& bits, uint64_t p) {
+            return (bits[p >> 6] >> (p & 63)) & 1;
+        }
+
+        // Position of the k-th (0-based) set bit of w
+        static inline uint64_t selectInWord_(uint64_t w, uint64_t k) {
+#ifdef __BMI2__
+            return __builtin_ctzll(_pdep_u64(uint64_t(1) << k, w));
+#else
+            uint64_t shift{0};
+            uint64_t c = __builtin_popcountll(w & 0xFF);
+            while (k >= c) {
+                k -= c;
+                w >>= 8;
+                shift += 8;
+                c = __builtin_popcountll(w & 0xFF);
+            }
+            for (; k > 0; --k) { w &= w - 1; }
+            return shift + __builtin_ctzll(w);
+#endif
+        }
+
+        inline uint64_t lowAt_(uint64_t i) const {
+            if (l_ == 0) { return 0; }
+            uint64_t bitPos = i * l_;
+            uint64_t w = bitPos >> 6;
+            uint64_t off = bitPos & 63;
+            uint64_t v = low_[w] >> off;
+            if (off + l_ > 64) { v |= low_[w + 1] << (64 - off); }
+            return v & lowMask_;
+        }
+
+        // Position of the r-th (0-based) 0 in the upper bits
+        inline uint64_t select0_(uint64_t r) const {
+            uint64_t start = zeroSamples_[r >> zeroSampleShift_];
+            uint64_t k = r & ((uint64_t(1) << zeroSampleShift_) - 1);
+            uint64_t w = start >> 6;
+            uint64_t word = ~high_[w] & ((~uint64_t(0)) << (start & 63));
+            uint64_t c = __builtin_popcountll(word);
+            while (k >= c) {
+                k -= c;
+                word = ~high_[++w];
+                c = __builtin_popcountll(word);
+            }
+            return (w << 6) + selectInWord_(word, k);
+        }
+
+        // Position of the last set bit strictly before p
+        inline uint64_t prevOne_(uint64_t p) const {
+            uint64_t w = p >> 6;
+            uint64_t off = p & 63;
+            uint64_t word = (off == 0) ? 0 : (high_[w] & ((~uint64_t(0)) >> (64 - off)));
+            while (word == 0) { word = high_[--w]; }
+            return (w << 6) + 63 - __builtin_clzll(word);
+        }
+
+        uint64_t n_{0};
+        uint64_t universe_{0};
+        uint64_t l_{0};
+        uint64_t lowMask_{0};
+        std::vector<uint64_t> low_;
+        std::vector<uint64_t> high_;
+        std::vector<uint64_t> zeroSamples_;
+};
+
+#endif // __ELIAS_FANO_HPP__
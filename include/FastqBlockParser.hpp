@@ -0,0 +1,309 @@
+#ifndef __FASTQ_BLOCK_PARSER_HPP__
+#define __FASTQ_BLOCK_PARSER_HPP__
+
+#include <condition_variable>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "jellyfish/whole_sequence_parser.hpp"
+#include "PairSequenceParser.hpp"
+
+namespace rapmap {
+    namespace io {
+
+        namespace simd {
+            /**
+             * The address just past the n-th newline in [b, e), or nullptr
+             * if there are fewer; count is set to the number of newlines
+             * seen.  Uses SSE2 where available.
+             */
+            const char* findNthNewline(const char* b, const char* e, size_t n, size_t& count);
+
+            // Append the addresses of all the newlines in [b, e) to out
+            void findNewlines(const char* b, const char* e, std::vector<const char*>& out);
+        }
+
+        // Reusable read buffers, shared by every file of a parser
+        class BlockPool {
+            public:
+                struct Block {
+                    std::unique_ptr<char[]> data;
+                    size_t capacity{0};
+                };
+
+                explicit BlockPool(size_t maxBlocks) : maxBlocks_(maxBlocks) {}
+
+                /**
+                 * A block of at least minSize bytes; waits while maxBlocks
+                 * are in use.  The block returns to the pool when the last
+                 * copy of the pointer goes away.
+                 */
+                static std::shared_ptr<Block> acquire(const std::shared_ptr<BlockPool>& pool, size_t minSize);
+
+            private:
+                void release_(Block* b);
+
+                std::mutex mutex_;
+                std::condition_variable blockFree_;
+                std::vector<std::unique_ptr<Block>> blocks_;
+                std::vector<Block*> free_;
+                size_t maxBlocks_;
+        };
+
+        /**
+         * The records of one FASTQ file, handed out a range at a time.  A
+         * regular, uncompressed file is mmap'd and the ranges point straight
+         * into the mapping.  Anything else (gzipped files, pipes) is read
+         * through openReadStream into pooled blocks; a record that straddles
+         * two blocks is moved to the start of the next one.
+         */
+        class FastqSource {
+            public:
+                FastqSource(const std::string& fname, uint32_t decompressThreads,
+                            std::shared_ptr<BlockPool> pool, size_t blockSize);
+                ~FastqSource();
+
+                /**
+                 * Take the next (up to) n records.  [b, e) covers them
+                 * exactly, and holder keeps their bytes alive.  Returns the
+                 * number of records taken; 0 at the end of the file.
+                 */
+                size_t take(size_t n, const char*& b, const char*& e,
+                            std::shared_ptr<const char>& holder);
+
+            private:
+                bool refill_(size_t minSize);
+
+                std::string fname_;
+                std::shared_ptr<const char> holder_;
+                const char* cur_{nullptr};
+                const char* end_{nullptr};
+                bool eof_{false};
+
+                std::unique_ptr<std::istream> stream_;
+                std::shared_ptr<BlockPool> pool_;
+                size_t blockSize_;
+        };
+
+        // The record of mate m in a parser job's data
+        inline jellyfish::header_sequence_qual& mateRecord(jellyfish::header_sequence_qual& r, uint32_t) {
+            return r;
+        }
+        inline header_sequence_qual& mateRecord(std::pair<header_sequence_qual, header_sequence_qual>& r, uint32_t m) {
+            return (m == 0) ? r.first : r.second;
+        }
+
+        /**
+         * Fill the records of a job from NumMates ranges of FASTQ text
+         * holding the same number of records each.
+         */
+        template <typename SequenceListT>
+        void fillRecords(SequenceListT& list, uint32_t numMates, size_t numRecords,
+                         const char* const* b, const char* const* e,
+                         std::vector<const char*>& newlines);
+
+        /**
+         * A FASTQ parser with the job interface of jellyfish's
+         * whole_sequence_parser (NumMates == 1) and pair_sequence_parser
+         * (NumMates == 2), for the mapping threads.
+         *
+         * Finding the records is cheap -- a SIMD count of newlines in a
+         * block that is already in memory -- so that's all that happens
+         * under the parser's lock.  Splitting the records and copying them
+         * into the job's strings (one memcpy per field, into buffers that
+         * are reused from job to job) happens on the mapping thread that
+         * took the job, the first time it looks at the job's reads.  A
+         * mapper that takes jobs under a lock of its own (to number them,
+         * for ordered output) so only holds it while the records are found.
+         * A job pins the blocks its records came from until it's destroyed.
+         *
+         * Only FASTQ with one line per sequence and quality is accepted.
+         */
+        template <typename SequenceListT, uint32_t NumMates>
+        class FastqBlockParser {
+            public:
+                class job {
+                    public:
+                        explicit job(FastqBlockParser& parser);
+                        ~job();
+                        job(const job&) = delete;
+                        job& operator=(const job&) = delete;
+
+                        bool is_empty() const { return list_ == nullptr; }
+                        SequenceListT* operator->() { fill_(); return list_; }
+                        SequenceListT& operator*() { fill_(); return *list_; }
+
+                    private:
+                        void fill_();
+
+                        FastqBlockParser& parser_;
+                        SequenceListT* list_{nullptr};
+                        std::shared_ptr<const char> holders_[NumMates];
+                        // the records' text, until they're filled in
+                        const char* b_[NumMates];
+                        const char* e_[NumMates];
+                        size_t numRecords_{0};
+                        bool filled_{false};
+                };
+
+                /**
+                 * paths holds NumMates files per sample, mates adjacent (as
+                 * for pair_sequence_parser).  numConsumers is the number of
+                 * threads taking jobs, which bounds the buffers we need.
+                 */
+                FastqBlockParser(std::vector<std::string> paths, uint32_t maxReadGroup,
+                                 uint32_t numConsumers, uint32_t decompressThreads = 2,
+                                 size_t blockSize = 4 << 20) :
+                    paths_(std::move(paths)), maxReadGroup_(maxReadGroup),
+                    decompressThreads_(decompressThreads), blockSize_(blockSize),
+                    // every consumer pins at most one block per mate, and
+                    // each source holds on to its current one
+                    pool_(new BlockPool((numConsumers + 1) * NumMates)) {
+                    if (paths_.size() % NumMates != 0) {
+                        throw std::runtime_error("Every read file needs its mate");
+                    }
+                }
+
+            private:
+                bool openNext_();
+                SequenceListT* takeList_();
+                void returnList_(SequenceListT* l);
+
+                std::mutex mutex_;
+                std::vector<std::string> paths_;
+                size_t nextPath_{0};
+                std::unique_ptr<FastqSource> sources_[NumMates];
+                uint32_t maxReadGroup_;
+                uint32_t decompressThreads_;
+                size_t blockSize_;
+                std::shared_ptr<BlockPool> pool_;
+
+                std::vector<std::unique_ptr<SequenceListT>> lists_;
+                std::vector<SequenceListT*> freeLists_;
+        };
+
+        template <typename SequenceListT, uint32_t NumMates>
+        FastqBlockParser<SequenceListT, NumMates>::job::job(FastqBlockParser& parser) : parser_(parser) {
+            std::lock_guard<std::mutex> lock(parser_.mutex_);
+            while (numRecords_ == 0) {
+                if (!parser_.sources_[0] and !parser_.openNext_()) { return; }
+                numRecords_ = parser_.sources_[0]->take(parser_.maxReadGroup_, b_[0], e_[0], holders_[0]);
+                for (uint32_t m = 1; m < NumMates; ++m) {
+                    // the mates must have exactly as many records
+                    size_t mateRecords = parser_.sources_[m]->take(numRecords_, b_[m], e_[m], holders_[m]);
+                    if (mateRecords != numRecords_) {
+                        throw std::runtime_error("The mate files have different numbers of reads");
+                    }
+                }
+                if (numRecords_ == 0) {
+                    if (NumMates > 1) {
+                        // the left file is done, so the right one must be too
+                        size_t extra = parser_.sources_[1]->take(1, b_[1], e_[1], holders_[1]);
+                        if (extra != 0) {
+                            throw std::runtime_error("The mate files have different numbers of reads");
+                        }
+                    }
+                    for (auto& s : parser_.sources_) { s.reset(); }
+                }
+            }
+            list_ = parser_.takeList_();
+        }
+
+        template <typename SequenceListT, uint32_t NumMates>
+        void FastqBlockParser<SequenceListT, NumMates>::job::fill_() {
+            if (filled_ or list_ == nullptr) { return; }
+            filled_ = true;
+            thread_local std::vector<const char*> newlines;
+            fillRecords(*list_, NumMates, numRecords_, b_, e_, newlines);
+        }
+
+        template <typename SequenceListT, uint32_t NumMates>
+        FastqBlockParser<SequenceListT, NumMates>::job::~job() {
+            // Let go of the blocks first: a thread holding the parser's lock
+            // may be waiting for one of them.
+            for (auto& h : holders_) { h.reset(); }
+            if (list_ != nullptr) {
+                std::lock_guard<std::mutex> lock(parser_.mutex_);
+                parser_.returnList_(list_);
+            }
+        }
+
+        template <typename SequenceListT, uint32_t NumMates>
+        bool FastqBlockParser<SequenceListT, NumMates>::openNext_() {
+            if (nextPath_ >= paths_.size()) { return false; }
+            for (uint32_t m = 0; m < NumMates; ++m) {
+                sources_[m].reset(new FastqSource(paths_[nextPath_++], decompressThreads_,
+                                                  pool_, blockSize_));
+            }
+            return true;
+        }
+
+        template <typename SequenceListT, uint32_t NumMates>
+        SequenceListT* FastqBlockParser<SequenceListT, NumMates>::takeList_() {
+            if (freeLists_.empty()) {
+                lists_.emplace_back(new SequenceListT);
+                lists_.back()->nb_filled = 0;
+                lists_.back()->data.resize(maxReadGroup_);
+                return lists_.back().get();
+            }
+            SequenceListT* l = freeLists_.back();
+            freeLists_.pop_back();
+            return l;
+        }
+
+        template <typename SequenceListT, uint32_t NumMates>
+        void FastqBlockParser<SequenceListT, NumMates>::returnList_(SequenceListT* l) {
+            freeLists_.push_back(l);
+        }
+
+        template <typename SequenceListT>
+        void fillRecords(SequenceListT& list, uint32_t numMates, size_t numRecords,
+                         const char* const* b, const char* const* e,
+                         std::vector<const char*>& newlines) {
+            list.nb_filled = numRecords;
+            for (uint32_t m = 0; m < numMates; ++m) {
+                newlines.clear();
+                simd::findNewlines(b[m], e[m], newlines);
+                // the file's last line may not end in a newline
+                if (newlines.size() < 4 * numRecords) { newlines.push_back(e[m]); }
+
+                const char* lineStart = b[m];
+                auto line = [&](size_t i, const char*& s, size_t& len) {
+                    s = (i == 0) ? lineStart : newlines[i - 1] + 1;
+                    len = newlines[i] - s;
+                    if (len > 0 and s[len - 1] == '\r') { --len; }
+                };
+                for (size_t r = 0; r < numRecords; ++r) {
+                    auto& rec = mateRecord(list.data[r], m);
+                    const char* s;
+                    size_t len;
+                    line(4 * r, s, len);
+                    if (len == 0 or s[0] != '@') {
+                        throw std::runtime_error("Invalid FASTQ record: header missing");
+                    }
+                    rec.header.assign(s + 1, len - 1);
+                    line(4 * r + 1, s, len);
+                    rec.seq.assign(s, len);
+                    line(4 * r + 2, s, len);
+                    if (len == 0 or s[0] != '+') {
+                        throw std::runtime_error("Invalid FASTQ record (multi-line FASTQ isn't supported): "
+                                                 "'+' line missing");
+                    }
+                    line(4 * r + 3, s, len);
+                    rec.qual.assign(s, len);
+                    if (rec.qual.size() != rec.seq.size()) {
+                        throw std::runtime_error("Invalid FASTQ record: wrong number of quals");
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif // __FASTQ_BLOCK_PARSER_HPP__
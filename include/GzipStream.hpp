@@ -0,0 +1,206 @@
+#ifndef __GZIP_STREAM_HPP__
+#define __GZIP_STREAM_HPP__
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rapmap {
+    namespace io {
+
+        /**
+         * Decompresses a gzip file on background threads, handing the
+         * decompressed data out in order, one chunk at a time.
+         *
+         * A reader thread reads the file.  If its members are BGZF blocks
+         * (they carry the BGZF block size in an extra field), batches of
+         * blocks are inflated in parallel by numThreads worker threads.
+         * Otherwise (a plain, possibly multi-member, gzip file) member
+         * boundaries can't be found without inflating, so the reader
+         * thread inflates the file itself -- still off the parsing thread.
+         * At most a fixed number of chunks are buffered at any time.
+         *
+         * The decompressor owns file; prefix holds any bytes already read
+         * from it (to sniff the format), which come before the rest of the
+         * file.  fname is only used in error messages.
+         */
+        class GzipDecompressor {
+            public:
+                GzipDecompressor(FILE* file, std::string prefix,
+                                 const std::string& fname, uint32_t numThreads);
+                ~GzipDecompressor();
+
+                /**
+                 * Swap the next chunk of decompressed data into chunk;
+                 * returns false at the end of the file.  Exits with an
+                 * error message if the file is corrupt.
+                 */
+                bool next(std::string& chunk);
+
+            private:
+                struct Task {
+                    // whole BGZF blocks, or nothing if out is already filled
+                    // (serial mode); done is only ever set by a worker
+                    std::string in;
+                    std::string out;
+                    bool done{false};
+                };
+
+                void readLoop_();
+                void inflateLoop_();
+                bool readBGZF_(std::string& pending);
+                void readSerial_(std::string& pending);
+                void inflateBlocks_(Task& t);
+                Task* newTask_();
+                void submit_(Task* t);
+                void fail_(const std::string& msg);
+
+                std::string fname_;
+                FILE* file_{nullptr};
+                std::string prefix_;
+
+                std::mutex mutex_;
+                std::condition_variable workAvailable_;
+                std::condition_variable taskDone_;
+                std::condition_variable spaceAvailable_;
+                // Tasks in file order; the first nextToInflate_ of them have
+                // been claimed by a worker.
+                std::deque<Task*> queue_;
+                size_t nextToInflate_{0};
+                size_t maxQueued_;
+                std::vector<std::unique_ptr<Task>> tasks_;
+                std::vector<Task*> free_;
+                bool readDone_{false};
+                bool stopping_{false};
+                std::string error_;
+
+                std::thread reader_;
+                std::vector<std::thread> workers_;
+        };
+
+        // A std::streambuf reading the decompressed contents of a gzip file
+        class GzipStreamBuf : public std::streambuf {
+            public:
+                GzipStreamBuf(FILE* file, std::string prefix,
+                              const std::string& fname, uint32_t numThreads) :
+                    decompressor_(file, std::move(prefix), fname, numThreads) {}
+
+            protected:
+                int_type underflow() override;
+
+            private:
+                GzipDecompressor decompressor_;
+                std::string chunk_;
+        };
+
+        class GzipIStream : public std::istream {
+            public:
+                GzipIStream(FILE* file, std::string prefix,
+                            const std::string& fname, uint32_t numThreads) :
+                    std::istream(nullptr), buf_(file, std::move(prefix), fname, numThreads) {
+                    rdbuf(&buf_);
+                }
+
+            private:
+                GzipStreamBuf buf_;
+        };
+
+        /**
+         * A std::streambuf reading an uncompressed file it owns, starting
+         * with the bytes in prefix (already read from the file).
+         */
+        class FileStreamBuf : public std::streambuf {
+            public:
+                FileStreamBuf(FILE* file, std::string prefix, const std::string& fname) :
+                    file_(file), fname_(fname), buffer_(std::move(prefix)) {}
+                ~FileStreamBuf() { std::fclose(file_); }
+
+            protected:
+                int_type underflow() override;
+
+            private:
+                FILE* file_;
+                std::string fname_;
+                std::string buffer_;
+                bool started_{false};
+        };
+
+        class FileIStream : public std::istream {
+            public:
+                FileIStream(FILE* file, std::string prefix, const std::string& fname) :
+                    std::istream(nullptr), buf_(file, std::move(prefix), fname) {
+                    rdbuf(&buf_);
+                }
+
+            private:
+                FileStreamBuf buf_;
+        };
+
+        /**
+         * Open a read file, decompressing it on numThreads threads if it's
+         * gzipped (decided by its magic number, not its name).  The file is
+         * opened once and the magic number read through the same handle, so
+         * pipes and process substitutions work too.  Throws a
+         * std::runtime_error if the file can't be opened or read.
+         */
+        std::unique_ptr<std::istream> openReadStream(const std::string& fname, uint32_t numThreads);
+
+        // As above, for a file that's already open (the stream takes it over)
+        std::unique_ptr<std::istream> openReadStream(FILE* file, const std::string& fname,
+                                                     uint32_t numThreads);
+
+        /**
+         * A drop-in replacement for jellyfish::stream_manager, for
+         * whole_sequence_parser, that opens gzipped files with
+         * openReadStream.
+         */
+        template <typename PathIterator>
+        class ReadStreamManager {
+            public:
+                typedef std::unique_ptr<std::istream> stream_type;
+
+                ReadStreamManager(PathIterator paths_begin, PathIterator paths_end,
+                                  int concurrent_files = 1, uint32_t decompress_threads = 2) :
+                    paths_cur_(paths_begin), paths_end_(paths_end),
+                    concurrent_files_(concurrent_files),
+                    decompress_threads_(decompress_threads) {}
+
+                // The next file to parse, or nullptr once they're all handed out
+                stream_type next() {
+                    std::string path;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        if (paths_cur_ == paths_end_) { return stream_type(); }
+                        path = *paths_cur_;
+                        ++paths_cur_;
+                    }
+                    stream_type res(openReadStream(path, decompress_threads_));
+                    if (!res->good()) {
+                        throw std::runtime_error("Can't open file '" + path + "'");
+                    }
+                    return res;
+                }
+
+                int concurrent_files() const { return concurrent_files_; }
+                int nb_streams() const { return concurrent_files_; }
+
+            private:
+                std::mutex mutex_;
+                PathIterator paths_cur_;
+                PathIterator paths_end_;
+                int concurrent_files_;
+                uint32_t decompress_threads_;
+        };
+    }
+}
+
+#endif // __GZIP_STREAM_HPP__
@@ -4,6 +4,8 @@
 #include "RapMapUtils.hpp"
 #include "RapMapIndex.hpp"
 #include "RapMapSAIndex.hpp"
+#include "SAHitMap.hpp"
+#include "SALocator.hpp"
 
 //#include "eytzinger_array.h"
 
@@ -25,7 +27,6 @@ namespace rapmap {
 
         template <typename T>
         using SAIntervalHit = rapmap::utils::SAIntervalHit<T>;
-        using SAHitMap = std::map<int, rapmap::utils::ProcessedSAHit>;
         using ProcessedSAHit = rapmap::utils::ProcessedSAHit;
 
         class SAProcessedHitVec {
@@ -33,6 +34,38 @@ namespace rapmap {
                 std::vector<ProcessedSAHit> hits;
                 std::vector<uint32_t> txps;
         };
+        /**
+         * A set of transcripts, as a bit per transcript.  A mapping
+         * thread keeps one (sized to the index) and refills it for each
+         * read; clearing it costs as much as filling it did.
+         */
+        class TxpBitmap {
+            public:
+                void resize(size_t numTxps) {
+                    words_.assign((numTxps + 63) / 64, 0);
+                    tids_.clear();
+                }
+                void insert(uint32_t tid) {
+                    uint64_t bit = uint64_t(1) << (tid & 63);
+                    if (!(words_[tid >> 6] & bit)) {
+                        words_[tid >> 6] |= bit;
+                        tids_.push_back(tid);
+                    }
+                }
+                bool contains(uint32_t tid) const {
+                    return words_[tid >> 6] & (uint64_t(1) << (tid & 63));
+                }
+                bool empty() const { return tids_.empty(); }
+                void clear() {
+                    for (auto tid : tids_) { words_[tid >> 6] = 0; }
+                    tids_.clear();
+                }
+            private:
+                std::vector<uint64_t> words_;
+                // the members, so clear() only touches their words
+                std::vector<uint32_t> tids_;
+        };
+
         /*
         using SAProcessedHitVec = std::tuple<std::vector<ProcessedSAHit>, std::vector<uint32_t>>;
         */
@@ -70,11 +103,16 @@ namespace rapmap {
         void intersectWithOutput(HitInfo& h2, RapMapIndex& rmi,
                 std::vector<ProcessedHit>& outHits);
 
+        // Returns the number of transcripts in outHits hit by all
+        // intervalCounter intervals so far.  If txpFilter isn't null,
+        // outHits only holds transcripts in it.
         template <typename RapMapIndexT>
-        void intersectSAIntervalWithOutput(SAIntervalHit<typename RapMapIndexT::IndexType>& h,
-                                           RapMapIndexT& rmi,
-                                           uint32_t intervalCounter,
-                                           SAHitMap& outHits);
+        size_t intersectSAIntervalWithOutput(SAIntervalHit<typename RapMapIndexT::IndexType>& h,
+                                             RapMapIndexT& rmi,
+                                             SALocator<RapMapIndexT>& locator,
+                                             uint32_t intervalCounter,
+                                             SAHitMap& outHits,
+                                             const TxpBitmap* txpFilter = nullptr);
                                            
 
         template <typename RapMapIndexT>
@@ -92,11 +130,18 @@ namespace rapmap {
                 std::vector<HitInfo>& inHits,
                 RapMapIndex& rmi);
 
+        // Intersects the SA intervals in inHits, leaving the transcripts
+        // (and positions) hit by every interval marked active in outHits.
+        // outHits is cleared first; its storage is reused.  If txpFilter
+        // isn't null, only the transcripts in it are considered.
         template <typename RapMapIndexT>
-        SAHitMap intersectSAHits(
-                                 std::vector<SAIntervalHit<typename RapMapIndexT::IndexType>>& inHits,
-                                 RapMapIndexT& rmi, 
-                                 bool strictFilter=false);
+        void intersectSAHits(
+                             std::vector<SAIntervalHit<typename RapMapIndexT::IndexType>>& inHits,
+                             RapMapIndexT& rmi,
+                             SALocator<RapMapIndexT>& locator,
+                             SAHitMap& outHits,
+                             bool strictFilter=false,
+                             const TxpBitmap* txpFilter=nullptr);
 
         template <typename RapMapIndexT>
         std::vector<ProcessedSAHit> intersectSAHits2(
@@ -0,0 +1,122 @@
+#ifndef __HIT_VERIFIER_HPP__
+#define __HIT_VERIFIER_HPP__
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "RapMapUtils.hpp"
+
+namespace rapmap {
+    namespace verify {
+
+        // The widest band bandedEditDistance handles: diagonals -7 .. 7
+        constexpr uint32_t kMaxBand = 7;
+        // A reference character that matches anything
+        constexpr char kWildcard = '\0';
+
+        /**
+         * The edit distance between query[0, m) and the reference, when
+         * the query may start and end on any diagonal within `band` (at
+         * most kMaxBand) of the one it was expected on.  ref points
+         * kMaxBand characters before the expected start of the query, and
+         * must have m + 16 readable characters; kWildcard characters match
+         * any query character.  Returns maxEdits + 1 for anything further
+         * than maxEdits (which stops the computation early).
+         *
+         * The band of a row fits in one SSE2 register (a lane of
+         * saturating bytes per diagonal), so a row takes a constant number
+         * of vector operations; there is a scalar fallback.
+         */
+        uint32_t bandedEditDistance(const char* query, uint32_t m, const char* ref,
+                                    uint32_t band, uint32_t maxEdits);
+
+        /**
+         * Checks candidate hits of a read against the text of their
+         * transcripts, and drops those that need more than maxEdits edits.
+         * Each mapping thread owns one, so its buffers are reused for
+         * every read it verifies.
+         */
+        template <typename RapMapIndexT>
+        class HitVerifier {
+            public:
+                HitVerifier(RapMapIndexT* rmi, uint32_t maxEdits) :
+                    rmi_(rmi), maxEdits_(maxEdits), band_(std::min(maxEdits, kMaxBand)) {}
+
+                /**
+                 * Remove the hits of read, from hits[first] on, that don't
+                 * align at their position; returns the number removed.
+                 */
+                size_t filter(const std::string& read,
+                              std::vector<rapmap::utils::QuasiAlignment>& hits,
+                              size_t first = 0) {
+                    if (first >= hits.size()) { return 0; }
+                    fwd_.resize(read.length());
+                    std::transform(read.begin(), read.end(), fwd_.begin(), ::toupper);
+                    rc_.clear();
+
+                    auto out = hits.begin() + first;
+                    for (auto it = out; it != hits.end(); ++it) {
+                        if (!it->fwd and rc_.length() != fwd_.length()) { reverseComplement(); }
+                        if (verify(*it)) {
+                            if (out != it) { *out = std::move(*it); }
+                            ++out;
+                        }
+                    }
+                    size_t numDropped = std::distance(out, hits.end());
+                    hits.erase(out, hits.end());
+                    return numDropped;
+                }
+
+            private:
+                void reverseComplement() {
+                    rc_.resize(fwd_.length());
+                    for (size_t i = 0; i < fwd_.length(); ++i) {
+                        char c = fwd_[fwd_.length() - 1 - i];
+                        switch (c) {
+                            case 'A': c = 'T'; break;
+                            case 'C': c = 'G'; break;
+                            case 'G': c = 'C'; break;
+                            case 'T': c = 'A'; break;
+                            default: c = 'N';
+                        }
+                        rc_[i] = c;
+                    }
+                }
+
+                bool verify(const rapmap::utils::QuasiAlignment& hit) {
+                    const std::string& query = hit.fwd ? fwd_ : rc_;
+                    const std::string& seq = rmi_->seq;
+                    int64_t m = static_cast<int64_t>(query.length());
+                    int64_t txpStart = rmi_->txpOffsets[hit.tid];
+                    int64_t txpLen = rmi_->txpLens[hit.tid];
+
+                    // The text around the hit; the bases past either end
+                    // of the transcript are wildcards, just as a read
+                    // hanging off the end of one is soft clipped
+                    int64_t windowStart = static_cast<int64_t>(hit.pos) - kMaxBand;
+                    int64_t windowLen = m + 16;
+                    ref_.assign(windowLen, kWildcard);
+                    int64_t b = std::max(windowStart, static_cast<int64_t>(0));
+                    int64_t e = std::min(windowStart + windowLen, txpLen);
+                    if (b < e) {
+                        std::memcpy(&ref_[b - windowStart], seq.data() + txpStart + b, e - b);
+                    }
+                    return bandedEditDistance(query.data(), static_cast<uint32_t>(m), ref_.data(),
+                                              band_, maxEdits_) <= maxEdits_;
+                }
+
+                RapMapIndexT* rmi_;
+                uint32_t maxEdits_;
+                uint32_t band_;
+                std::string fwd_;
+                std::string rc_;
+                std::string ref_;
+        };
+    }
+}
+
+#endif // __HIT_VERIFIER_HPP__
@@ -13,13 +13,14 @@ enum class IndexType : uint8_t {
 
 class IndexHeader {
     public:
-        IndexHeader () : type_(IndexType::INVALID), versionString_("invalid"), usesKmers_(false), kmerLen_(0), perfectHash_(false) {}
+        IndexHeader () : type_(IndexType::INVALID), versionString_("invalid"), usesKmers_(false), kmerLen_(0), perfectHash_(false), generalizedSA_(false) {}
 
         IndexHeader(IndexType typeIn, const std::string& versionStringIn,
-                    bool usesKmersIn, uint32_t kmerLenIn, bool bigSA = false, bool perfectHash = false):
+                    bool usesKmersIn, uint32_t kmerLenIn, bool bigSA = false, bool perfectHash = false,
+                    bool generalizedSA = false):
                     type_(typeIn), versionString_(versionStringIn),
                     usesKmers_(usesKmersIn), kmerLen_(kmerLenIn), bigSA_(bigSA),
-                    perfectHash_(perfectHash) {}
+                    perfectHash_(perfectHash), generalizedSA_(generalizedSA) {}
 
         template <typename Archive>
             void save(Archive& ar) const {
@@ -29,6 +30,7 @@ class IndexHeader {
                 ar( cereal::make_nvp("KmerLen", kmerLen_) );
                 ar( cereal::make_nvp("BigSA", bigSA_) );
                 ar( cereal::make_nvp("PerfectHash", perfectHash_) );
+                ar( cereal::make_nvp("GeneralizedSA", generalizedSA_) );
             }
 
         template <typename Archive>
@@ -48,6 +50,13 @@ class IndexHeader {
                 cerrLog->flush(); 
                 std::exit(1);
             }
+            // Indices built before this was recorded don't separate their
+            // transcripts
+            try {
+                ar( cereal::make_nvp("GeneralizedSA", generalizedSA_) );
+            } catch (const cereal::Exception& e) {
+                generalizedSA_ = false;
+            }
         }
 
         IndexType indexType() const { return type_; }
@@ -56,6 +65,7 @@ class IndexHeader {
         uint32_t kmerLen() const { return kmerLen_; }
         bool bigSA() const { return bigSA_; }
         bool perfectHash() const { return perfectHash_; }
+        bool generalizedSA() const { return generalizedSA_; }
 
     private:
         // The type of index we have
@@ -71,6 +81,9 @@ class IndexHeader {
         bool bigSA_;
         // Are we using a perfect hash in the index or not?
         bool perfectHash_;
+        // Is every transcript followed by a '$' terminator (so that no
+        // suffix is ordered, or matched, past the end of its transcript)?
+        bool generalizedSA_;
 };
 
 
@@ -0,0 +1,137 @@
+#ifndef __MEM_FORMAT_HPP__
+#define __MEM_FORMAT_HPP__
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+/**
+ * The binary format rapmap quasimap --mems writes the SMEMs of each read
+ * in.  The file starts with the magic "RMEM", then (as little-endian
+ * uint32s) the format version and the minimum SMEM length.  Each read
+ * (each mate, for paired-end reads) follows as a record of
+ *
+ *   varint  name length, then the name (the FASTA/FASTQ header)
+ *   uint8   mate: 0 for single-end reads and left mates, 1 for right mates
+ *   varint  number of SMEMs, then for each
+ *     varint  (queryStart << 1) | rc, where rc SMEMs are matches of the
+ *             reverse complement of the read, and queryStart is in it
+ *     varint  length
+ *     varint  lb, the start of the SMEM's suffix array interval
+ *     varint  ub - lb, its number of occurrences
+ *
+ * Varints are LEB128: 7 bits per byte, least significant first, with the
+ * high bit set on all but the last byte.
+ */
+namespace rapmap {
+    namespace mems {
+
+        constexpr uint32_t formatVersion = 1;
+
+        inline void appendVarint(std::string& out, uint64_t v) {
+            while (v >= 0x80) {
+                out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+                v >>= 7;
+            }
+            out.push_back(static_cast<char>(v));
+        }
+
+        inline void append32(std::string& out, uint32_t v) {
+            char b[4];
+            for (size_t i = 0; i < 4; ++i) { b[i] = static_cast<char>((v >> (8 * i)) & 0xff); }
+            out.append(b, 4);
+        }
+
+        inline void appendHeader(std::string& out, uint32_t minLen) {
+            out.append("RMEM", 4);
+            append32(out, formatVersion);
+            append32(out, minLen);
+        }
+
+        /**
+         * Append the record of a read to out; fwd and rc are the SMEMs
+         * (as SASearcher::SMEM) of the read and of its reverse complement.
+         */
+        template <typename SMEMT>
+        void appendRecord(std::string& out, const std::string& name, uint8_t mate,
+                          const std::vector<SMEMT>& fwd, const std::vector<SMEMT>& rc) {
+            appendVarint(out, name.length());
+            out.append(name);
+            out.push_back(static_cast<char>(mate));
+            appendVarint(out, fwd.size() + rc.size());
+            for (uint64_t strand = 0; strand < 2; ++strand) {
+                for (auto& mem : (strand == 0) ? fwd : rc) {
+                    appendVarint(out, (static_cast<uint64_t>(mem.queryStart) << 1) | strand);
+                    appendVarint(out, mem.len);
+                    appendVarint(out, static_cast<uint64_t>(mem.lb));
+                    appendVarint(out, static_cast<uint64_t>(mem.ub - mem.lb));
+                }
+            }
+        }
+
+        // A decoded SMEM; [lb, ub) is its suffix array interval
+        struct MEM {
+            uint32_t queryStart;
+            uint32_t len;
+            bool rc;
+            uint64_t lb;
+            uint64_t ub;
+        };
+
+        struct Record {
+            std::string name;
+            uint8_t mate;
+            std::vector<MEM> mems;
+        };
+
+        inline bool readVarint(std::istream& in, uint64_t& v) {
+            v = 0;
+            for (uint32_t shift = 0; shift < 64; shift += 7) {
+                int c = in.get();
+                if (c == std::char_traits<char>::eof()) { return false; }
+                v |= static_cast<uint64_t>(c & 0x7f) << shift;
+                if (!(c & 0x80)) { return true; }
+            }
+            return false;
+        }
+
+        // Returns false if the stream doesn't start with a header we can read
+        inline bool readHeader(std::istream& in, uint32_t& minLen) {
+            char b[12];
+            if (!in.read(b, 12) or std::string(b, 4) != "RMEM") { return false; }
+            auto get32 = [&b](size_t o) -> uint32_t {
+                uint32_t v{0};
+                for (size_t i = 0; i < 4; ++i) { v |= static_cast<uint32_t>(static_cast<uint8_t>(b[o + i])) << (8 * i); }
+                return v;
+            };
+            minLen = get32(8);
+            return get32(4) == formatVersion;
+        }
+
+        // Returns false at the end of the stream (or on a truncated record)
+        inline bool readRecord(std::istream& in, Record& r) {
+            uint64_t nameLen, numMems;
+            if (!readVarint(in, nameLen)) { return false; }
+            r.name.resize(nameLen);
+            if (nameLen > 0 and !in.read(&r.name[0], nameLen)) { return false; }
+            int mate = in.get();
+            if (mate == std::char_traits<char>::eof() or !readVarint(in, numMems)) { return false; }
+            r.mate = static_cast<uint8_t>(mate);
+            r.mems.resize(numMems);
+            for (auto& mem : r.mems) {
+                uint64_t start, len, lb, count;
+                if (!readVarint(in, start) or !readVarint(in, len) or
+                    !readVarint(in, lb) or !readVarint(in, count)) { return false; }
+                mem.queryStart = static_cast<uint32_t>(start >> 1);
+                mem.rc = (start & 1);
+                mem.len = static_cast<uint32_t>(len);
+                mem.lb = lb;
+                mem.ub = lb + count;
+            }
+            return true;
+        }
+    }
+}
+
+#endif // __MEM_FORMAT_HPP__
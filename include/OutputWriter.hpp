@@ -0,0 +1,237 @@
+#ifndef __OUTPUT_WRITER_HPP__
+#define __OUTPUT_WRITER_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct iovec;
+
+namespace rapmap {
+    namespace io {
+
+        class OutputChannel;
+
+        // A reusable, fixed-capacity output buffer
+        struct OutputBlock {
+            std::unique_ptr<char[]> data;
+            size_t capacity{0};
+            size_t size{0};
+            OutputChannel* owner{nullptr};
+            // the parser job this block holds, in ordered mode
+            uint64_t seq{0};
+        };
+
+        /**
+         * Numbers parser jobs in input order, for ordered output.  A mapping
+         * thread holds the mutex only while it takes a job from the parser
+         * and its number, so that the numbers follow the order in which the
+         * parser hands out jobs; the mapping itself isn't serialized.
+         */
+        struct JobSequencer {
+            std::mutex mutex;
+            uint64_t next{0};
+        };
+
+        /**
+         * A bounded, lock-free single-producer / single-consumer queue of
+         * pointers.  push() and pop() never block; they fail when the ring
+         * is full or empty, respectively.
+         */
+        template <typename T>
+        class SPSCRing {
+            public:
+                explicit SPSCRing(size_t capacity) : slots_(capacity + 1) {}
+
+                bool push(T v) {
+                    size_t t = tail_.load(std::memory_order_relaxed);
+                    size_t n = next_(t);
+                    if (n == head_.load(std::memory_order_acquire)) { return false; }
+                    slots_[t] = v;
+                    tail_.store(n, std::memory_order_release);
+                    return true;
+                }
+
+                bool pop(T& v) {
+                    size_t h = head_.load(std::memory_order_relaxed);
+                    if (h == tail_.load(std::memory_order_acquire)) { return false; }
+                    v = slots_[h];
+                    head_.store(next_(h), std::memory_order_release);
+                    return true;
+                }
+
+                // Only meaningful to the consumer
+                bool empty() const {
+                    return head_.load(std::memory_order_relaxed) ==
+                           tail_.load(std::memory_order_acquire);
+                }
+
+            private:
+                size_t next_(size_t i) const { return (i + 1 == slots_.size()) ? 0 : i + 1; }
+
+                std::vector<T> slots_;
+                // keep the producer's and consumer's indices on separate cache lines
+                char pad0_[64];
+                std::atomic<size_t> head_{0};
+                char pad1_[64];
+                std::atomic<size_t> tail_{0};
+                char pad2_[64];
+        };
+
+        class OutputWriter;
+
+        /**
+         * One mapping thread's end of the output pipeline.  A channel owns a
+         * fixed number of blocks; write() copies into the current block, and
+         * full blocks are passed to the writer thread, which hands them back
+         * once they are on disk.  When every block is in flight the producer
+         * waits (a "stall") -- that's the backpressure that keeps memory
+         * bounded when mapping outruns the disk.
+         *
+         * Only one thread may use a channel at a time.
+         */
+        class OutputChannel {
+            public:
+                OutputChannel(OutputWriter* writer, size_t blockSize, size_t numBlocks);
+
+                /**
+                 * Append len bytes.  The bytes of a single write() are never
+                 * split across blocks, so as long as callers only write whole
+                 * records, records from different channels never interleave.
+                 */
+                void write(const char* data, size_t len);
+                void write(const std::string& s) { write(s.data(), s.size()); }
+
+                /**
+                 * In ordered mode, the whole output of parser job seq
+                 * (possibly nothing).  Every job number must be written
+                 * exactly once, by some channel, since the writer emits the
+                 * jobs strictly in order.
+                 */
+                void writeJob(uint64_t seq, const char* data, size_t len);
+
+                // Hand the current (partial) block to the writer thread
+                void flush();
+
+                // Times write() had to wait for a free block, and for how long
+                uint64_t numStalls() const { return numStalls_; }
+                uint64_t stallNanos() const { return stallNanos_; }
+
+            private:
+                friend class OutputWriter;
+
+                void acquire_();
+
+                OutputWriter* writer_;
+                std::vector<OutputBlock> blocks_;
+                // blocks waiting to be written, and blocks ready for reuse
+                SPSCRing<OutputBlock*> full_;
+                SPSCRing<OutputBlock*> free_;
+                OutputBlock* current_{nullptr};
+
+                uint64_t numStalls_{0};
+                uint64_t stallNanos_{0};
+        };
+
+        struct OutputStats {
+            uint64_t bytesWritten{0};
+            uint64_t numWritev{0};
+            // producer-side waits for a free block (the disk is the bottleneck)
+            uint64_t producerStalls{0};
+            double producerStallSeconds{0.0};
+            // writer-side waits for a full block (mapping is the bottleneck)
+            uint64_t writerIdleWaits{0};
+            // in ordered mode, the most jobs ever held back waiting for an
+            // earlier one
+            uint64_t maxReorderDepth{0};
+        };
+
+        /**
+         * Writes the output of the mapping threads to a file descriptor.
+         *
+         * Each mapping thread gets its own OutputChannel; a single writer
+         * thread collects full blocks from all the channels and writes them
+         * with writev(2).  Memory use is bounded by
+         * numChannels * blocksPerChannel * blockSize (plus any single write
+         * larger than a block).  Blocks from a given channel are written in
+         * the order they were filled.
+         *
+         * In ordered mode, channels submit whole parser jobs with writeJob(),
+         * and the writer emits them by job number, holding early arrivals in
+         * a reorder window.  The window never needs more than one slot per
+         * block plus one per channel: every job between the next one to write
+         * and the newest one submitted either holds a block or is still being
+         * mapped, and a channel maps one job at a time.  The thread mapping
+         * the oldest unwritten job always gets its blocks back (everything
+         * before it can be written), so the window can't deadlock.
+         */
+        class OutputWriter {
+            public:
+                // An empty fname means standard output.
+                OutputWriter(const std::string& fname, uint32_t numChannels,
+                             bool ordered = false,
+                             size_t blockSize = 1 << 20, size_t blocksPerChannel = 4);
+                ~OutputWriter();
+
+                OutputChannel& channel(uint32_t i) { return *channels_[i]; }
+                uint32_t numChannels() const { return static_cast<uint32_t>(channels_.size()); }
+                bool ordered() const { return ordered_; }
+
+                /**
+                 * Write data (a file header) straight to the output, ahead of
+                 * anything the channels will write.  It must be called before
+                 * any channel is written to.
+                 */
+                void writeHeader(const char* data, size_t len);
+                void writeHeader(const std::string& data) { writeHeader(data.data(), data.size()); }
+
+                /**
+                 * Flush every channel, wait for everything to be written, and
+                 * stop the writer thread.  The mapping threads must be done
+                 * with their channels.
+                 */
+                void close();
+
+                // Only meaningful after close()
+                OutputStats stats() const;
+
+            private:
+                friend class OutputChannel;
+
+                void writeLoop_();
+                void orderedWriteLoop_();
+                void idleWait_();
+                void writeAll_(iovec* iov, int iovcnt);
+                void notifyWriter_();
+
+                int fd_;
+                bool ownFd_;
+                bool closed_{false};
+                bool ordered_;
+                std::vector<std::unique_ptr<OutputChannel>> channels_;
+                // ordered mode: blocks by job number modulo the window size
+                std::vector<OutputBlock*> window_;
+                uint64_t nextSeq_{0};
+
+                std::atomic<bool> closing_{false};
+                std::atomic<bool> writerSleeping_{false};
+                std::mutex mutex_;
+                std::condition_variable workAvailable_;
+
+                uint64_t headerBytes_{0};
+                uint64_t bytesWritten_{0};
+                uint64_t numWritev_{0};
+                uint64_t writerIdleWaits_{0};
+                uint64_t maxReorderDepth_{0};
+
+                std::thread writer_;
+        };
+    }
+}
+
+#endif // __OUTPUT_WRITER_HPP__
@@ -0,0 +1,84 @@
+#ifndef __PACKED_INT_VECTOR_HPP__
+#define __PACKED_INT_VECTOR_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * A fixed-size array of unsigned integers, each stored in exactly
+ * width() bits (1 <= width <= 32).  Values may straddle a word boundary,
+ * so a lookup costs at most two (adjacent) word reads.
+ *
+ * The quasi index uses this for the optional per-position transcript
+ * IDs (positionIDs), stored in ceil(log2(# transcripts)) bits each.
+ */
+class PackedIntVector {
+    public:
+        PackedIntVector() = default;
+
+        PackedIntVector(size_t size, uint32_t width) { resize(size, width); }
+
+        // The number of bits needed to store every value in [0, maxVal]
+        static uint32_t bitsFor(uint64_t maxVal) {
+            uint32_t w{1};
+            while (w < 32 and (maxVal >> w) > 0) { ++w; }
+            return w;
+        }
+
+        void resize(size_t size, uint32_t width) {
+            size_ = size;
+            width_ = width;
+            mask_ = (width_ >= 64) ? ~uint64_t(0) : ((uint64_t(1) << width_) - 1);
+            // one extra word so that a read of the last value never
+            // runs off the end
+            words_.assign(((size_ * width_ + 63) >> 6) + 1, 0);
+        }
+
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        uint32_t width() const { return width_; }
+
+        inline uint32_t operator[](size_t i) const {
+            uint64_t bitPos = i * width_;
+            uint64_t w = bitPos >> 6;
+            uint64_t off = bitPos & 63;
+            uint64_t v = words_[w] >> off;
+            if (off + width_ > 64) { v |= words_[w + 1] << (64 - off); }
+            return static_cast<uint32_t>(v & mask_);
+        }
+
+        inline void set(size_t i, uint32_t val) {
+            uint64_t v = val & mask_;
+            uint64_t bitPos = i * width_;
+            uint64_t w = bitPos >> 6;
+            uint64_t off = bitPos & 63;
+            words_[w] = (words_[w] & ~(mask_ << off)) | (v << off);
+            if (off + width_ > 64) {
+                uint64_t shift = 64 - off;
+                words_[w + 1] = (words_[w + 1] & ~(mask_ >> shift)) | (v >> shift);
+            }
+        }
+
+        // Number of bytes used by the packed values.
+        size_t sizeInBytes() const { return sizeof(uint64_t) * words_.size(); }
+
+        template <typename Archive>
+        void save(Archive& ar) const {
+            ar(size_, width_, words_);
+        }
+
+        template <typename Archive>
+        void load(Archive& ar) {
+            ar(size_, width_, words_);
+            mask_ = (width_ >= 64) ? ~uint64_t(0) : ((uint64_t(1) << width_) - 1);
+        }
+
+    private:
+        uint64_t size_{0};
+        uint32_t width_{0};
+        uint64_t mask_{0};
+        std::vector<uint64_t> words_;
+};
+
+#endif // __PACKED_INT_VECTOR_HPP__
@@ -11,7 +11,8 @@ struct PairAlignmentFormatter {
     read2Temp(1000, 'A'),
     qual2Temp(1000, '~'),
     cigarStr1(buff1, 1000),
-    cigarStr2(buff2, 1000) {
+    cigarStr2(buff2, 1000),
+    numHitFlag(nhBuff, 32) {
     }
 
     // Data members
@@ -24,6 +25,9 @@ struct PairAlignmentFormatter {
     char buff2[1000];
     rapmap::utils::FixedWriter cigarStr1;
     rapmap::utils::FixedWriter cigarStr2;
+    // NH:i:<count> tag, rewritten for each read
+    char nhBuff[32];
+    rapmap::utils::FixedWriter numHitFlag;
 };
 
 #endif //__PAIR_ALIGNMENT_FORMATTER_HPP__
@@ -13,6 +13,8 @@
 #include <jellyfish/cooperative_pool2.hpp>
 #include <jellyfish/cpp_array.hpp>
 
+#include "GzipStream.hpp"
+
 struct header_sequence_qual {
   std::string header;
   std::string seq;
@@ -40,18 +42,22 @@ class pair_sequence_parser : public jellyfish::cooperative_pool2<pair_sequence_p
   jellyfish::cpp_array<stream_status> streams_;
   PathIterator                        path_begin_, path_end_;
   std::mutex                          path_mutex_;
+  uint32_t                            decompress_threads_;
 
 public:
   /// Size is the number of buffers to keep around. It should be
   /// larger than the number of thread expected to read from this
   /// class. nb_sequences is the number of sequences to read into a
   /// buffer. 'begin' and 'end' are iterators to a range of istream.
+  /// Gzipped files are decompressed on decompress_threads threads each.
   pair_sequence_parser(uint32_t size, uint32_t nb_sequences,
                        uint32_t max_producers,
-                       PathIterator path_begin, PathIterator path_end) :
+                       PathIterator path_begin, PathIterator path_end,
+                       uint32_t decompress_threads = 2) :
     super(max_producers, size),
     streams_(max_producers),
-    path_begin_(path_begin), path_end_(path_end)
+    path_begin_(path_begin), path_end_(path_end),
+    decompress_threads_(decompress_threads)
   {
     for(auto it = super::element_begin(); it != super::element_end(); ++it) {
       it->nb_filled = 0;
@@ -116,8 +122,8 @@ protected:
       st.type = DONE_TYPE;
       return;
     }
-    st.stream1.reset(new std::ifstream(p1));
-    st.stream2.reset(new std::ifstream(p2));
+    st.stream1 = rapmap::io::openReadStream(p1, decompress_threads_);
+    st.stream2 = rapmap::io::openReadStream(p2, decompress_threads_);
     if(!*st.stream1 || !*st.stream2) {
       st.type = DONE_TYPE;
       return;
@@ -0,0 +1,109 @@
+/* 
+ *  Copyright (c) 2012 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef RSDIC_RSDIC_HPP_
+#define RSDIC_RSDIC_HPP_
+
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+#include "Const.hpp"
+
+namespace rsdic{
+
+/*
+ * A compressed rank/select dictionary.  The bit vector is cut into
+ * blocks of kSmallBlockSize bits, and each block is stored as its
+ * enumerative code (see EnumCoder) in EnumCoder::Len(popcount) bits.
+ * Blocks that are all 0s or all 1s take no space at all, so sparse
+ * vectors (e.g. the transcript boundaries of the quasi index) shrink
+ * to a small fraction of a bit per bit.
+ */
+class RSDic{
+public:
+  RSDic();
+  ~RSDic();
+
+  void Clear();
+
+  bool GetBit(uint64_t pos) const;
+  // The number of bits equal to bit in [0, pos)
+  uint64_t Rank(uint64_t pos, bool bit) const;
+  // The position of the (ind+1)-th bit equal to bit
+  uint64_t Select(uint64_t ind, bool bit) const;
+  // (GetBit(pos), Rank(pos, GetBit(pos))) with a single block decode
+  std::pair<uint64_t, uint64_t> GetBitAndRank(uint64_t pos) const;
+
+  void Save(std::ostream& os) const;
+  void Load(std::istream& is);
+
+  uint64_t num() const{
+    return num_;
+  }
+
+  uint64_t one_num() const{
+    return one_num_;
+  }
+
+  uint64_t zero_num() const{
+    return num_ - one_num_;
+  }
+
+  uint64_t GetUsageBytes() const;
+
+  bool operator == (const RSDic& bv) const;
+
+private:
+  uint64_t Select0(uint64_t ind) const;
+  uint64_t Select1(uint64_t ind) const;
+
+  template <class T>
+  void Save(std::ostream& os, const std::vector<T>& vs) const{
+    uint64_t size = vs.size();
+    os.write((const char*)&size, sizeof(size));
+    if (size > 0){
+      os.write((const char*)&vs[0], sizeof(vs[0]) * size);
+    }
+  }
+
+  template <class T>
+  void Load(std::istream& is, std::vector<T>& vs){
+    uint64_t size = 0;
+    is.read((char*)&size, sizeof(size));
+    vs.resize(size);
+    if (size > 0){
+      is.read((char*)&vs[0], sizeof(vs[0]) * size);
+    }
+  }
+
+  std::vector<uint64_t> bits_;
+  std::vector<uint64_t> pointer_blocks_;
+  std::vector<uint64_t> rank_blocks_;
+  std::vector<uint64_t> select_one_inds_;
+  std::vector<uint64_t> select_zero_inds_;
+  std::vector<uint8_t> rank_small_blocks_;
+  uint64_t num_;
+  uint64_t one_num_;
+
+  friend class RSDicBuilder;
+};
+
+}
+
+#endif // RSDIC_RSDIC_HPP_
@@ -0,0 +1,56 @@
+/* 
+ *  Copyright (c) 2012 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#ifndef RSDIC_RSDIC_BUILDER_HPP_
+#define RSDIC_RSDIC_BUILDER_HPP_
+
+#include <vector>
+#include <stdint.h>
+#include "RSDic.hpp"
+
+namespace rsdic{
+
+class RSDicBuilder{
+public:
+  RSDicBuilder();
+  ~RSDicBuilder();
+
+  void Clear();
+  void PushBack(bool bit);
+  // Move the bits pushed so far into bv; the builder is cleared afterward.
+  void Build(RSDic& bv);
+
+private:
+  void WriteBlock();
+
+  std::vector<uint64_t> bits_;
+  std::vector<uint64_t> pointer_blocks_;
+  std::vector<uint64_t> rank_blocks_;
+  std::vector<uint64_t> select_one_inds_;
+  std::vector<uint64_t> select_zero_inds_;
+  std::vector<uint8_t> rank_small_blocks_;
+  uint64_t buf_;
+  uint64_t offset_;
+  uint64_t one_num_;
+  uint64_t num_;
+};
+
+}
+
+#endif // RSDIC_RSDIC_BUILDER_HPP_
@@ -0,0 +1,112 @@
+#ifndef __RANK_DICTIONARY_HPP__
+#define __RANK_DICTIONARY_HPP__
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "bit_array.h"
+#include "rank9b.h"
+#include "RSDic.hpp"
+
+/**
+ * The interface shared by the rank dictionaries that can back the
+ * transcript boundary bit vector of the quasi index (rsd.bin).
+ */
+class RankDictionary {
+    public:
+        virtual ~RankDictionary() {}
+        // The number of set bits in [0, pos)
+        virtual uint64_t rank(uint64_t pos) = 0;
+        // The number of bits in the underlying bit vector
+        virtual uint64_t numBits() const = 0;
+        // The number of set bits in the underlying bit vector
+        virtual uint64_t numOnes() const = 0;
+        // Bytes used by the bit vector and the rank structure together
+        virtual uint64_t sizeInBytes() const = 0;
+        virtual const char* name() const = 0;
+};
+
+/**
+ * An uncompressed bit vector (bit_array) with the rank9b rank structure
+ * on top; about 1.25 bits per bit, and a rank is a couple of loads.
+ */
+class Rank9bDictionary : public RankDictionary {
+    public:
+        struct BitArrayDeleter {
+            void operator()(BIT_ARRAY* b) {
+                if (b != nullptr) {
+                    bit_array_free(b);
+                }
+            }
+        };
+
+        using BitArrayPointer = std::unique_ptr<BIT_ARRAY, BitArrayDeleter>;
+
+        // Takes ownership of bits
+        Rank9bDictionary(BIT_ARRAY* bits) :
+            bitArray_(bits), rank_(bitArray_->words, bitArray_->num_of_bits) {}
+
+        // Load a bit_array written with bit_array_save; returns nullptr on failure.
+        static std::unique_ptr<Rank9bDictionary> load(const std::string& fname) {
+            FILE* f = fopen(fname.c_str(), "r");
+            if (f == nullptr) { return nullptr; }
+            BIT_ARRAY* bits = bit_array_create(0);
+            bool ok = bit_array_load(bits, f);
+            fclose(f);
+            if (!ok) {
+                bit_array_free(bits);
+                return nullptr;
+            }
+            return std::unique_ptr<Rank9bDictionary>(new Rank9bDictionary(bits));
+        }
+
+        uint64_t rank(uint64_t pos) override { return rank_.rank(pos); }
+        uint64_t numBits() const override { return bitArray_->num_of_bits; }
+        uint64_t numOnes() const override { return bit_array_num_bits_set(bitArray_.get()); }
+        uint64_t sizeInBytes() const override {
+            // rank9b keeps 2 words of counts for every 8 words of bits
+            uint64_t numWords = bitArray_->num_of_words;
+            return sizeof(uint64_t) * (numWords + ((numWords + 7) / 8) * 2 + 1);
+        }
+        const char* name() const override { return "rank9b"; }
+
+    private:
+        BitArrayPointer bitArray_;
+        rank9b rank_;
+};
+
+/**
+ * A compressed (enumerative-coded) rank/select dictionary; well under a
+ * bit per bit for sparse vectors, at the cost of decoding a 64-bit block
+ * and summing up to 15 small-block ranks per query.
+ */
+class RSDicDictionary : public RankDictionary {
+    public:
+        RSDicDictionary() {}
+
+        // Load a dictionary written with rsdic::RSDic::Save; returns nullptr on failure.
+        static std::unique_ptr<RSDicDictionary> load(const std::string& fname) {
+            std::ifstream is(fname, std::ios::binary);
+            if (!is.good()) { return nullptr; }
+            std::unique_ptr<RSDicDictionary> d(new RSDicDictionary);
+            d->dict_.Load(is);
+            if (!is) { return nullptr; }
+            return d;
+        }
+
+        rsdic::RSDic& dict() { return dict_; }
+
+        uint64_t rank(uint64_t pos) override { return dict_.Rank(pos, true); }
+        uint64_t numBits() const override { return dict_.num(); }
+        uint64_t numOnes() const override { return dict_.one_num(); }
+        uint64_t sizeInBytes() const override { return dict_.GetUsageBytes(); }
+        const char* name() const override { return "rsdic"; }
+
+    private:
+        rsdic::RSDic dict_;
+};
+
+#endif // __RANK_DICTIONARY_HPP__
@@ -14,6 +14,9 @@
 //#include "bitmap.h"
 //#include "shared.h"
 #include "rank9b.h"
+#include "RankDictionary.hpp"
+#include "EliasFano.hpp"
+#include "PackedIntVector.hpp"
 
 #include <cstdio>
 #include <vector>
@@ -28,34 +31,59 @@ class RapMapSAIndex {
     using IndexType = IndexT;
     using HashType = HashT;
 
-      struct BitArrayDeleter {
-        void operator()(BIT_ARRAY* b) {
-          if(b != nullptr) {
-            bit_array_free(b);
-          }
-        }
-      };
-
-	  using BitArrayPointer = std::unique_ptr<BIT_ARRAY, BitArrayDeleter>;
-
     RapMapSAIndex();
 
   	// Given a position, p, in the concatenated text,
   	// return the corresponding transcript
-  	IndexT transcriptAtPosition(IndexT p);
+  	inline IndexT transcriptAtPosition(IndexT p) {
+        if (!positionIDs.empty()) {
+            return positionIDs[p];
+        }
+        if (!txpBoundaries.empty()) {
+            uint64_t txpStart;
+            return txpBoundaries.predecessor(p, txpStart);
+        }
+        return rankDict->rank(p);
+    }
+
+    // As above, but also return the offset at which that transcript
+    // starts in the concatenated text
+    inline IndexT transcriptAtPosition(IndexT p, IndexT& txpStart) {
+        if (!positionIDs.empty()) {
+            IndexT tid = positionIDs[p];
+            txpStart = txpOffsets[tid];
+            return tid;
+        }
+        if (!txpBoundaries.empty()) {
+            uint64_t start;
+            IndexT tid = txpBoundaries.predecessor(p, start);
+            txpStart = start;
+            return tid;
+        }
+        IndexT tid = rankDict->rank(p);
+        txpStart = txpOffsets[tid];
+        return tid;
+    }
 
     bool load(const std::string& indDir);
 
     std::vector<IndexT> SA;
 
-    BitArrayPointer bitArray{nullptr};
-    std::unique_ptr<rank9b> rankDict{nullptr};
+    // Rank dictionary over the transcript boundary bits (rank9b over
+    // rsd.bin, or the compressed rsdic.bin)
+    std::unique_ptr<RankDictionary> rankDict{nullptr};
+    // Transcript start offsets; when the index has them (and has no
+    // rsdic.bin), these replace rankDict for finding the transcript of
+    // a text position
+    EliasFano txpBoundaries;
 
     std::string seq;
     std::vector<std::string> txpNames;
     std::vector<IndexT> txpOffsets;
     std::vector<IndexT> txpLens;
-    std::vector<IndexT> positionIDs;
+    // The transcript of every text position; only present (non-empty)
+    // if the index was built with --fastLocate
+    PackedIntVector positionIDs;
     std::vector<rapmap::utils::SAIntervalWithKey<IndexT>> kintervals;
     HashT khash;
 };
@@ -3,13 +3,19 @@
 
 #include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "xxhash.h"
 #include <cereal/archives/binary.hpp>
 #include "jellyfish/mer_dna.hpp"
 #include "spdlog/spdlog.h"
 #include "spdlog/details/format.h"
 #include "PairSequenceParser.hpp"
+#include "OutputWriter.hpp"
 
 #ifdef RAPMAP_SALMON_SUPPORT
 #include "LibraryFormat.hpp"
@@ -83,6 +89,23 @@ namespace rapmap {
             outStream << hd.str();
         }
 
+    // Written before the mapping threads start, so it comes first whatever
+    // order the threads' output is written in.
+    template <typename IndexT>
+        void writeSAMHeader(IndexT& rmi, rapmap::io::OutputWriter& out) {
+            fmt::MemoryWriter hd;
+            hd.write("@HD\tVN:0.1\tSO:unknown\n");
+
+            auto& txpNames = rmi.txpNames;
+            auto& txpLens = rmi.txpLens;
+
+            auto numRef = txpNames.size();
+            for (size_t i = 0; i < numRef; ++i) {
+                hd.write("@SQ\tSN:{}\tLN:{:d}\n", txpNames[i], txpLens[i]);
+            }
+            out.writeHeader(hd.data(), hd.size());
+        }
+
     // from http://stackoverflow.com/questions/9435385/split-a-string-using-c11
     std::vector<std::string> tokenize(const std::string &s, char delim);
 
@@ -147,14 +170,99 @@ namespace rapmap {
     };
 
 
+    /**
+     * A counter that only one thread updates, but that any thread may
+     * read.  An update is a relaxed load and store, with no locked
+     * read-modify-write.
+     */
+    class ThreadCounter {
+        public:
+            ThreadCounter& operator++() { return (*this += 1); }
+            ThreadCounter& operator+=(uint64_t x) {
+                v_.store(v_.load(std::memory_order_relaxed) + x, std::memory_order_relaxed);
+                return *this;
+            }
+            operator uint64_t() const { return v_.load(std::memory_order_relaxed); }
+
+        private:
+            std::atomic<uint64_t> v_{0};
+    };
+
+    // The counters of one mapping thread; see HitCounterSet
     struct HitCounters {
-        std::atomic<uint64_t> peHits{0};
-        std::atomic<uint64_t> seHits{0};
-        std::atomic<uint64_t> trueHits{0};
-        std::atomic<uint64_t> totHits{0};
-        std::atomic<uint64_t> numReads{0};
-        std::atomic<uint64_t> tooManyHits{0};
-        std::atomic<uint64_t> lastPrint{0};
+        ThreadCounter peHits;
+        ThreadCounter seHits;
+        ThreadCounter trueHits;
+        ThreadCounter totHits;
+        ThreadCounter numReads;
+        ThreadCounter tooManyHits;
+        // heap allocations made while mapping and formatting reads
+        // (only counted in builds with RAPMAP_COUNT_ALLOCATIONS)
+        ThreadCounter mappingAllocs;
+        // hits dropped by --maxEdits verification
+        ThreadCounter unverifiedHits;
+        // pairs whose second mate found nothing on the first mate's
+        // transcripts, and was searched again in full (--mateConstrained)
+        ThreadCounter mateRescans;
+        // keeps the next thread's counters off our cache line
+        char padding[64];
+    };
+
+    // The sum of every thread's counters at some point
+    struct HitTotals {
+        uint64_t peHits{0};
+        uint64_t seHits{0};
+        uint64_t trueHits{0};
+        uint64_t totHits{0};
+        uint64_t numReads{0};
+        uint64_t tooManyHits{0};
+        uint64_t mappingAllocs{0};
+        uint64_t unverifiedHits{0};
+        uint64_t mateRescans{0};
+    };
+
+    /**
+     * One HitCounters per mapping thread, so the per-read updates never
+     * touch a cache line another thread is writing.  total() can be
+     * called while the threads are running.
+     */
+    class HitCounterSet {
+        public:
+            explicit HitCounterSet(uint32_t numThreads) : counters_(numThreads) {}
+
+            HitCounters& local(uint32_t i) { return counters_[i]; }
+            size_t size() const { return counters_.size(); }
+            HitTotals total() const;
+
+        private:
+            std::vector<HitCounters> counters_;
+    };
+
+    /**
+     * Polls a HitCounterSet on a thread of its own and calls report with
+     * the totals whenever another interval reads have been mapped, so the
+     * mapping threads never have to print progress themselves.
+     */
+    class ProgressReporter {
+        public:
+            ProgressReporter(const HitCounterSet& counters,
+                             std::function<void(const HitTotals&)> report,
+                             uint64_t interval = 1000000);
+            ~ProgressReporter();
+
+            // Stop reporting; called by the destructor if need be
+            void stop();
+
+        private:
+            void run_();
+
+            const HitCounterSet& counters_;
+            std::function<void(const HitTotals&)> report_;
+            uint64_t interval_;
+            std::mutex mutex_;
+            std::condition_variable stopRequested_;
+            bool stopping_{false};
+            std::thread thread_;
     };
 
     class JFMerKeyHasher{
@@ -649,6 +757,23 @@ namespace rapmap {
                 std::vector<QuasiAlignment>& jointHits,
                 fmt::MemoryWriter& sstream);
 
+        // As writeAlignmentsToStream, but append BAM records to bamBuffer
+        template <typename ReadPairT, typename IndexT>
+        uint32_t writeAlignmentsToBAM(
+                ReadPairT& r,
+                PairAlignmentFormatter<IndexT>& formatter,
+                HitCounters& hctr,
+                std::vector<QuasiAlignment>& jointHits,
+                std::string& bamBuffer);
+
+        template <typename ReadT, typename IndexT>
+        uint32_t writeAlignmentsToBAM(
+                ReadT& r,
+                SingleAlignmentFormatter<IndexT>& formatter,
+                HitCounters& hctr,
+                std::vector<QuasiAlignment>& jointHits,
+                std::string& bamBuffer);
+
         inline void mergeLeftRightHitsFuzzy(
                 bool leftMatches,
                 bool rightMatches,
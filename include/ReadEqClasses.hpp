@@ -0,0 +1,60 @@
+#ifndef __READ_EQ_CLASSES_HPP__
+#define __READ_EQ_CLASSES_HPP__
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xxhash.h"
+
+namespace rapmap {
+    namespace utils {
+
+        class TxpListHasher {
+            public:
+                size_t operator()(const std::vector<uint32_t>& tids) const {
+                    return XXH64(static_cast<const void*>(tids.data()),
+                                 tids.size() * sizeof(uint32_t), 0);
+                }
+        };
+
+        /**
+         * Read counts per equivalence class: the set of transcripts a
+         * read maps to.  Each mapping thread fills its own table, and the
+         * tables are merged once the reads are done.
+         */
+        class ReadEqClassTable {
+            public:
+                /**
+                 * Count one read mapping to the transcripts in tids, which
+                 * is sorted and deduplicated in place (so a thread can pass
+                 * the same buffer for every read, and a class already seen
+                 * costs no allocation).
+                 */
+                void add(std::vector<uint32_t>& tids);
+
+                // Add the counts of other to ours
+                void merge(const ReadEqClassTable& other);
+
+                size_t numClasses() const { return counts_.size(); }
+                uint64_t numReads() const { return numReads_; }
+
+                /**
+                 * Write the classes, sorted by their transcript lists, as
+                 * the number of transcripts, the number of classes, the
+                 * transcript names (one per line) and a line per class:
+                 * its number of transcripts, their ids and its read count.
+                 * Returns false if the file couldn't be written.
+                 */
+                bool write(const std::string& fname,
+                           const std::vector<std::string>& txpNames) const;
+
+            private:
+                std::unordered_map<std::vector<uint32_t>, uint64_t, TxpListHasher> counts_;
+                uint64_t numReads_{0};
+        };
+    }
+}
+
+#endif // __READ_EQ_CLASSES_HPP__
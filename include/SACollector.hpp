@@ -4,30 +4,118 @@
 #include "RapMapUtils.hpp"
 #include "RapMapSAIndex.hpp"
 #include "SASearcher.hpp"
+#include "HitManager.hpp"
+#include "SALocator.hpp"
+#include "StageTimer.hpp"
 
 #include <iostream>
 #include <algorithm>
 #include <iterator>
+#include <limits>
 
 template <typename RapMapIndexT>
 class SACollector {
     public:
     using OffsetT = typename RapMapIndexT::IndexType;
+    using SAIntervalHit = rapmap::utils::SAIntervalHit<OffsetT>;
+
+    enum HitStatus { ABSENT = -1, UNTESTED = 0, PRESENT = 1 };
+    // Record if k-mers are hits in the
+    // fwd direction, rc direction or both
+    struct KmerDirScore {
+        KmerDirScore(rapmap::utils::my_mer kmerIn, int32_t kposIn, HitStatus fwdScoreIn, HitStatus rcScoreIn) :
+            kmer(kmerIn), kpos(kposIn), fwdScore(fwdScoreIn), rcScore(rcScoreIn) {}
+        KmerDirScore() : kpos(0), fwdScore(UNTESTED), rcScore(UNTESTED) {}
+        bool operator==(const KmerDirScore& other) const { return kpos == other.kpos; }
+        bool operator<(const KmerDirScore& other) const { return kpos < other.kpos; }
+        void print() {
+            std::cerr << "{ " << kmer.to_str() << ", " <<  kpos << ", " << ((fwdScore) ? "PRESENT" : "ABSENT") << ", " << ((rcScore) ? "PRESENT" : "ABSENT") << "}\t";
+        }
+        rapmap::utils::my_mer kmer;
+        int32_t kpos;
+        HitStatus fwdScore;
+        HitStatus rcScore;
+    };
+
+    /**
+     * Working storage for operator().  Each mapping thread owns one
+     * Scratch and passes it to every call, so these buffers are cleared
+     * and refilled rather than reallocated for each read.
+     */
+    struct Scratch {
+        Scratch(RapMapIndexT* rmi) : locator(rmi) {}
 
-    SACollector(RapMapIndexT* rmi) : rmi_(rmi) {}
+        std::vector<KmerDirScore> kmerScores;
+        std::vector<SAIntervalHit> fwdSAInts;
+        std::vector<SAIntervalHit> rcSAInts;
+        rapmap::hit_manager::SAHitMap processedHits;
+        SALocator<RapMapIndexT> locator;
+        // used to merge the forward and rc hits
+        std::vector<rapmap::utils::QuasiAlignment> mergedHits;
+        // used by the mismatch rescue of reads without an exact seed
+        std::string rescueRead;
+        std::vector<typename SASearcher<RapMapIndexT>::MismatchInterval> fwdRescueInts;
+        std::vector<typename SASearcher<RapMapIndexT>::MismatchInterval> rcRescueInts;
+        std::vector<uint32_t> rescueLowerBound;
+    };
+
+    /**
+     * If rescueMismatches > 0, reads none of whose k-mers occur in the
+     * index are searched for whole, with up to that many substitutions,
+     * giving up on a strand after rescueWork steps of the search.
+     */
+    SACollector(RapMapIndexT* rmi, uint32_t rescueMismatches = 0,
+                uint32_t rescueWork = 2000) :
+        rmi_(rmi), rescueMismatches_(rescueMismatches), rescueWork_(rescueWork) {}
+
+    /**
+     * The number of occurrences (on both strands) of the first k-mer of
+     * read without an N, as a cheap guess at how specific its seeds
+     * are; reads without such a k-mer in the index get the largest
+     * value.
+     */
+    OffsetT firstSeedWidth(const std::string& read) {
+        auto& khash = rmi_->khash;
+        auto k = rapmap::utils::my_mer::k();
+        size_t pos{0};
+        while (pos + k <= read.length()) {
+            auto invalidPos = read.find_first_of("nN", pos);
+            if (invalidPos < pos + k) {
+                pos = invalidPos + 1;
+                continue;
+            }
+            rapmap::utils::my_mer mer(read.c_str() + pos);
+            auto rcMer = mer.get_reverse_complement();
+            OffsetT width{0};
+            auto merIt = khash.find(mer.get_bits(0, 2*k));
+            if (merIt != khash.end()) { width += merIt->second.end - merIt->second.begin; }
+            auto rcMerIt = khash.find(rcMer.get_bits(0, 2*k));
+            if (rcMerIt != khash.end()) { width += rcMerIt->second.end - rcMerIt->second.begin; }
+            return (width > 0) ? width : std::numeric_limits<OffsetT>::max();
+        }
+        return std::numeric_limits<OffsetT>::max();
+    }
+
+    /**
+     * Collect the hits of read.  If txpFilter isn't null, only hits on
+     * the transcripts in it are collected (and the intersection skips
+     * every other transcript), as when the mate of a paired-end read
+     * has already been mapped.
+     */
     bool operator()(std::string& read,
                     std::vector<rapmap::utils::QuasiAlignment>& hits,
                     SASearcher<RapMapIndexT>& saSearcher,
+                    Scratch& scratch,
                     rapmap::utils::MateStatus mateStatus,
                     bool strictCheck=false,
-                    bool consistentHits=false) {
+                    bool consistentHits=false,
+                    const rapmap::hit_manager::TxpBitmap* txpFilter=nullptr) {
 
         using QuasiAlignment = rapmap::utils::QuasiAlignment;
         using MateStatus = rapmap::utils::MateStatus;
 
         //auto& posIDs = rmi_->positionIDs;
         auto& rankDict = rmi_->rankDict;
-        auto& txpStarts = rmi_->txpOffsets;
         auto& SA = rmi_->SA;
         auto& khash = rmi_->khash;
         auto& text = rmi_->seq;
@@ -59,35 +147,16 @@ class SACollector {
         rapmap::utils::my_mer mer;
         rapmap::utils::my_mer rcMer;
 
-        enum HitStatus { ABSENT = -1, UNTESTED = 0, PRESENT = 1 };
-        // Record if k-mers are hits in the
-        // fwd direction, rc direction or both
-        struct KmerDirScore {
-	  KmerDirScore(rapmap::utils::my_mer kmerIn, int32_t kposIn, HitStatus fwdScoreIn, HitStatus rcScoreIn) :
-	    kmer(kmerIn), kpos(kposIn), fwdScore(fwdScoreIn), rcScore(rcScoreIn) {}
-	  KmerDirScore() : kpos(0), fwdScore(UNTESTED), rcScore(UNTESTED) {}
-	  bool operator==(const KmerDirScore& other) const { return kpos == other.kpos; }
-	  bool operator<(const KmerDirScore& other) const { return kpos < other.kpos; }
-          void print() { 
-	    std::cerr << "{ " << kmer.to_str() << ", " <<  kpos << ", " << ((fwdScore) ? "PRESENT" : "ABSENT") << ", " << ((rcScore) ? "PRESENT" : "ABSENT") << "}\t";
-	  }
-            rapmap::utils::my_mer kmer;
-	    int32_t kpos;
-            HitStatus fwdScore;
-            HitStatus rcScore;
-        };
-
         // This allows implementing our heurisic for comparing
         // forward and reverse-complement strand matches
-        std::vector<KmerDirScore> kmerScores;
+        auto& kmerScores = scratch.kmerScores;
+        kmerScores.clear();
 
-        using SAIntervalHit = rapmap::utils::SAIntervalHit<OffsetT>;
+        auto& fwdSAInts = scratch.fwdSAInts;
+        auto& rcSAInts = scratch.rcSAInts;
+        fwdSAInts.clear();
+        rcSAInts.clear();
 
-        std::vector<SAIntervalHit> fwdSAInts;
-        std::vector<SAIntervalHit> rcSAInts;
-
-        std::vector<uint32_t> leftTxps, leftTxpsRC;
-        std::vector<uint32_t> rightTxps, rightTxpsRC;
         OffsetT maxInterval{1000};
 
         // The number of bases that a new query position (to which
@@ -120,8 +189,8 @@ class SACollector {
             rcMer = mer.get_reverse_complement();
 
             // See if we can find this k-mer in the hash
-            auto merIt = khash.find(mer.get_bits(0, 2*k));
-            auto rcMerIt = khash.find(rcMer.get_bits(0, 2*k));
+            auto merIt = RAPMAP_TIMED(HashProbe, khash.find(mer.get_bits(0, 2*k)));
+            auto rcMerIt = RAPMAP_TIMED(HashProbe, khash.find(rcMer.get_bits(0, 2*k)));
 
             // If we can find the k-mer in the hash, get its SA interval
             if (merIt != khash.end()) {
@@ -133,7 +202,7 @@ class SACollector {
                 // Extend the SA interval using the read sequence as far as
                 // possible
                 std::tie(lbLeftFwd, ubLeftFwd, matchedLen) =
-                    saSearcher.extendSearchNaive(lbRestart, ub, k, rb, readEndIt);
+                    RAPMAP_TIMED(ExtendSearch, saSearcher.extendSearchNaive(lbRestart, ub, k, rb, readEndIt));
 
                 // If the SA interval is valid, and not too wide, then record
                 // the hit.
@@ -192,8 +261,13 @@ class SACollector {
         }
 
         // If we went the entire length of the read without finding a hit
-        // then we can bail.
-        if (!foundHit) { return false; }
+        // then we can bail (unless the whole read matches with a few
+        // substitutions).
+        if (!foundHit) {
+            if (rescueMismatches_ == 0) { return false; }
+            return RAPMAP_TIMED(MismatchRescue, rescueWithMismatches(read, hits, saSearcher,
+                                                                     scratch, mateStatus, txpFilter));
+        }
 
         bool lastSearch{false};
         // If we had a hit on the forward strand
@@ -209,7 +283,7 @@ class SACollector {
             // is the position after the LCE (longest common extension) of
             // T[SA[lb]:] and T[SA[ub-1]:]
             auto remainingLength = std::distance(rb + matchLen, readEndIt);
-            auto lce = saSearcher.lce(lbLeftFwd, ubLeftFwd-1, matchLen, remainingLength);
+            auto lce = RAPMAP_TIMED(LCE, saSearcher.lce(lbLeftFwd, ubLeftFwd-1, matchLen, remainingLength));
             auto fwdSkip = std::max(static_cast<OffsetT>(matchLen) - skipOverlap,
                                     static_cast<OffsetT>(lce) - skipOverlap);
 
@@ -250,14 +324,14 @@ class SACollector {
 
                     mer = rapmap::utils::my_mer(read.c_str() + pos);
                     if (mer.is_homopolymer()) { rb += homoPolymerSkip; re = rb + k; continue; }
-                    auto merIt = khash.find(mer.get_bits(0, 2*k));
+                    auto merIt = RAPMAP_TIMED(HashProbe, khash.find(mer.get_bits(0, 2*k)));
 
                     if (merIt != khash.end()) {
                         if (strictCheck) {
                             ++fwdHit;
                             kmerScores.emplace_back(mer, pos, PRESENT, UNTESTED);
                             auto rcMer = mer.get_reverse_complement();
-                            auto rcMerIt = khash.find(rcMer.get_bits(0, 2*k));
+                            auto rcMerIt = RAPMAP_TIMED(HashProbe, khash.find(rcMer.get_bits(0, 2*k)));
                             if (rcMerIt != khash.end()) {
                                 ++rcHit;
                                 kmerScores.back().rcScore = PRESENT;
@@ -270,8 +344,8 @@ class SACollector {
                         // lb must be 1 *less* then the current lb
                         lbRightFwd = std::max(static_cast<OffsetT>(0), lbRightFwd - 1);
                         std::tie(lbRightFwd, ubRightFwd, matchedLen) =
-                            saSearcher.extendSearchNaive(lbRightFwd, ubRightFwd,
-                                    k, rb, readEndIt);
+                            RAPMAP_TIMED(ExtendSearch, saSearcher.extendSearchNaive(lbRightFwd, ubRightFwd,
+                                    k, rb, readEndIt));
 
                         OffsetT diff = ubRightFwd - lbRightFwd;
                         if (ubRightFwd > lbRightFwd and diff < maxInterval) {
@@ -293,7 +367,7 @@ class SACollector {
                         auto mismatchIt = rb + matchedLen;
                         if (mismatchIt < readEndIt) {
                             auto remainingDistance = std::distance(mismatchIt, readEndIt);
-                            auto lce = saSearcher.lce(lbRightFwd, ubRightFwd-1, matchedLen, remainingDistance);
+                            auto lce = RAPMAP_TIMED(LCE, saSearcher.lce(lbRightFwd, ubRightFwd-1, matchedLen, remainingDistance));
 
                             // Where we would jump if we just used the MMP
                             auto skipMatch = mismatchIt - skipOverlap;
@@ -361,14 +435,14 @@ class SACollector {
                 mer = rapmap::utils::my_mer(read.c_str() + pos);
                 if (mer.is_homopolymer()) { revRB += homoPolymerSkip; revRE += homoPolymerSkip; continue; }
                 rcMer = mer.get_reverse_complement();
-                auto rcMerIt = khash.find(rcMer.get_bits(0, 2*k));
+                auto rcMerIt = RAPMAP_TIMED(HashProbe, khash.find(rcMer.get_bits(0, 2*k)));
 
                 // If we found the k-mer
                 if (rcMerIt != khash.end()) {
                     if (strictCheck) {
                         ++rcHit;
                         kmerScores.emplace_back(mer, pos, UNTESTED, PRESENT);
-                        auto merIt = khash.find(mer.get_bits(0, 2*k));
+                        auto merIt = RAPMAP_TIMED(HashProbe, khash.find(mer.get_bits(0, 2*k)));
                         if (merIt != khash.end()) {
                             ++fwdHit;
                             kmerScores.back().fwdScore = PRESENT;
@@ -383,8 +457,8 @@ class SACollector {
                     // We can't move any further in the reverse complement direction
                     lbRightRC = std::max(static_cast<OffsetT>(0), lbRightRC - 1);
                     std::tie(lbRightRC, ubRightRC, matchedLen) =
-                        saSearcher.extendSearchNaive(lbRightRC, ubRightRC, k,
-                                revRB, revReadEndIt, true);
+                        RAPMAP_TIMED(ExtendSearch, saSearcher.extendSearchNaive(lbRightRC, ubRightRC, k,
+                                revRB, revReadEndIt, true));
 
                     OffsetT diff = ubRightRC - lbRightRC;
                     if (ubRightRC > lbRightRC and diff < maxInterval) {
@@ -405,7 +479,7 @@ class SACollector {
                     auto mismatchIt = revRB + matchedLen;
                     if (mismatchIt < revReadEndIt) {
                         auto remainingDistance = std::distance(mismatchIt, revReadEndIt);
-                        auto lce = saSearcher.lce(lbRightRC, ubRightRC-1, matchedLen, remainingDistance);
+                        auto lce = RAPMAP_TIMED(LCE, saSearcher.lce(lbRightRC, ubRightRC-1, matchedLen, remainingDistance));
 
                         // Where we would jump if we just used the MMP
                         auto skipMatch = mismatchIt - skipOverlap;
@@ -451,7 +525,7 @@ class SACollector {
    		    auto& kms = *kmsIt;
                     // If the forward k-mer is untested, then test it
                     if (kms.fwdScore == UNTESTED) {
-                        auto merIt = khash.find(kms.kmer.get_bits(0, 2*k));
+                        auto merIt = RAPMAP_TIMED(HashProbe, khash.find(kms.kmer.get_bits(0, 2*k)));
                         kms.fwdScore = (merIt != khash.end()) ? PRESENT : ABSENT;
                     }
                     // accumulate the score
@@ -460,7 +534,7 @@ class SACollector {
                     // If the rc k-mer is untested, then test it
                     if (kms.rcScore == UNTESTED) {
                         rcMer = kms.kmer.get_reverse_complement();
-                        auto rcMerIt = khash.find(rcMer.get_bits(0, 2*k));
+                        auto rcMerIt = RAPMAP_TIMED(HashProbe, khash.find(rcMer.get_bits(0, 2*k)));
                         kms.rcScore = (rcMerIt != khash.end()) ? PRESENT : ABSENT;
                     }
                     // accumulate the score
@@ -481,100 +555,150 @@ class SACollector {
             }
         }
 
+        auto& processedHits = scratch.processedHits;
+        auto& locator = scratch.locator;
         auto fwdHitsStart = hits.size();
         // If we had > 1 forward hit
         if (fwdSAInts.size() > 1) {
-            auto processedHits = rapmap::hit_manager::intersectSAHits(fwdSAInts, *rmi_, consistentHits);
+            RAPMAP_STAGE_BEGIN(intersectStart);
+            rapmap::hit_manager::intersectSAHits(fwdSAInts, *rmi_, locator, processedHits, consistentHits, txpFilter);
+            RAPMAP_STAGE_END(IntersectHits, intersectStart);
             rapmap::hit_manager::collectHitsSimpleSA(processedHits, readLen, maxDist, hits, mateStatus);
         } else if (fwdSAInts.size() == 1) { // only 1 hit!
             auto& saIntervalHit = fwdSAInts.front();
-                auto initialSize = hits.size();
-                for (OffsetT i = saIntervalHit.begin; i != saIntervalHit.end; ++i) {
-                        auto globalPos = SA[i];
-		            	auto txpID = rmi_->transcriptAtPosition(globalPos);
-                        // the offset into this transcript
-                        auto pos = globalPos - txpStarts[txpID];
-                        int32_t hitPos = pos - saIntervalHit.queryPos;
-                        hits.emplace_back(txpID, hitPos, true, readLen);
-                        hits.back().mateStatus = mateStatus;
-                }
-                // Now sort by transcript ID (then position) and eliminate
-                // duplicates
-                auto sortStartIt = hits.begin() + initialSize;
-                auto sortEndIt = hits.end();
-                std::sort(sortStartIt, sortEndIt,
-                                [](const QuasiAlignment& a, const QuasiAlignment& b) -> bool {
-                                if (a.tid == b.tid) {
-                                return a.pos < b.pos;
-                                } else {
-                                return a.tid < b.tid;
-                                }
-                                });
-                auto newEnd = std::unique(hits.begin() + initialSize, hits.end(),
-                                [] (const QuasiAlignment& a, const QuasiAlignment& b) -> bool {
-                                return a.tid == b.tid;
-                                });
-                hits.resize(std::distance(hits.begin(), newEnd));
+            // The located hits are sorted by transcript (then position),
+            // so the first hit on each transcript is the one we keep.
+            uint32_t lastTid = std::numeric_limits<uint32_t>::max();
+            for (auto& lh : locator.locate(saIntervalHit.begin, saIntervalHit.end)) {
+                if (lh.tid == lastTid) { continue; }
+                lastTid = lh.tid;
+                if (txpFilter and !txpFilter->contains(lh.tid)) { continue; }
+                int32_t hitPos = lh.pos - saIntervalHit.queryPos;
+                hits.emplace_back(lh.tid, hitPos, true, readLen);
+                hits.back().mateStatus = mateStatus;
+            }
         }
         auto fwdHitsEnd = hits.size();
 
         auto rcHitsStart = fwdHitsEnd;
         // If we had > 1 rc hit
         if (rcSAInts.size() > 1) {
-            auto processedHits = rapmap::hit_manager::intersectSAHits(rcSAInts, *rmi_, consistentHits);
+            RAPMAP_STAGE_BEGIN(intersectStart);
+            rapmap::hit_manager::intersectSAHits(rcSAInts, *rmi_, locator, processedHits, consistentHits, txpFilter);
+            RAPMAP_STAGE_END(IntersectHits, intersectStart);
             rapmap::hit_manager::collectHitsSimpleSA(processedHits, readLen, maxDist, hits, mateStatus);
         } else if (rcSAInts.size() == 1) { // only 1 hit!
             auto& saIntervalHit = rcSAInts.front();
-            auto initialSize = hits.size();
-            for (OffsetT i = saIntervalHit.begin; i != saIntervalHit.end; ++i) {
-                auto globalPos = SA[i];
-		        auto txpID = rmi_->transcriptAtPosition(globalPos);
-                // the offset into this transcript
-                auto pos = globalPos - txpStarts[txpID];
-                int32_t hitPos = pos - saIntervalHit.queryPos;
-                hits.emplace_back(txpID, hitPos, false, readLen);
+            uint32_t lastTid = std::numeric_limits<uint32_t>::max();
+            for (auto& lh : locator.locate(saIntervalHit.begin, saIntervalHit.end)) {
+                if (lh.tid == lastTid) { continue; }
+                lastTid = lh.tid;
+                if (txpFilter and !txpFilter->contains(lh.tid)) { continue; }
+                int32_t hitPos = lh.pos - saIntervalHit.queryPos;
+                hits.emplace_back(lh.tid, hitPos, false, readLen);
                 hits.back().mateStatus = mateStatus;
             }
-            // Now sort by transcript ID (then position) and eliminate
-            // duplicates
-            auto sortStartIt = hits.begin() + rcHitsStart;
-            auto sortEndIt = hits.end();
-            std::sort(sortStartIt, sortEndIt,
-                    [](const QuasiAlignment& a, const QuasiAlignment& b) -> bool {
-                    if (a.tid == b.tid) {
-                    return a.pos < b.pos;
-                    } else {
-                    return a.tid < b.tid;
-                    }
-                    });
-            auto newEnd = std::unique(sortStartIt, sortEndIt,
-                    [] (const QuasiAlignment& a, const QuasiAlignment& b) -> bool {
-                    return a.tid == b.tid;
-                    });
-            hits.resize(std::distance(hits.begin(), newEnd));
         }
         auto rcHitsEnd = hits.size();
 
         // If we had both forward and RC hits, then merge them
         if ((fwdHitsEnd > fwdHitsStart) and (rcHitsEnd > rcHitsStart)) {
-            // Merge the forward and reverse hits
-            std::inplace_merge(hits.begin() + fwdHitsStart, hits.begin() + fwdHitsEnd, hits.begin() + rcHitsEnd,
+            // Merge the forward and reverse hits.  The merge goes
+            // through scratch storage since std::inplace_merge
+            // allocates a temporary buffer on every call.
+            auto& mergedHits = scratch.mergedHits;
+            mergedHits.clear();
+            std::merge(hits.begin() + fwdHitsStart, hits.begin() + fwdHitsEnd,
+                    hits.begin() + fwdHitsEnd, hits.begin() + rcHitsEnd,
+                    std::back_inserter(mergedHits),
                     [](const QuasiAlignment& a, const QuasiAlignment& b) -> bool {
                     return a.tid < b.tid;
                     });
             // And get rid of duplicate transcript IDs
-            auto newEnd = std::unique(hits.begin() + fwdHitsStart, hits.begin() + rcHitsEnd,
+            auto newEnd = std::unique(mergedHits.begin(), mergedHits.end(),
                     [] (const QuasiAlignment& a, const QuasiAlignment& b) -> bool {
                     return a.tid == b.tid;
                     });
-            hits.resize(std::distance(hits.begin(), newEnd));
+            hits.resize(fwdHitsStart);
+            std::move(mergedHits.begin(), newEnd, std::back_inserter(hits));
         }
         // Return true if we had any valid hits and false otherwise.
         return foundHit;
     }
 
     private:
+        /**
+         * Place the whole read, on either strand, with the fewest (and at
+         * most rescueMismatches_) substitutions, and add a hit on each
+         * transcript it lands on.  Intervals as wide as the exact search
+         * would discard are skipped.
+         */
+        bool rescueWithMismatches(const std::string& read,
+                                  std::vector<rapmap::utils::QuasiAlignment>& hits,
+                                  SASearcher<RapMapIndexT>& saSearcher,
+                                  Scratch& scratch,
+                                  rapmap::utils::MateStatus mateStatus,
+                                  const rapmap::hit_manager::TxpBitmap* txpFilter) {
+            using QuasiAlignment = rapmap::utils::QuasiAlignment;
+            OffsetT maxInterval{1000};
+            auto readLen = read.length();
+            auto& query = scratch.rescueRead;
+            auto& fwdInts = scratch.fwdRescueInts;
+            auto& rcInts = scratch.rcRescueInts;
+
+            query = read;
+            std::transform(query.begin(), query.end(), query.begin(), ::toupper);
+            saSearcher.mismatchSearch(query, rescueMismatches_, rescueWork_, fwdInts,
+                                      scratch.rescueLowerBound);
+            // the reverse complement (anything but ACGT becomes N)
+            std::reverse(query.begin(), query.end());
+            for (auto& c : query) {
+                switch (c) {
+                    case 'A': c = 'T'; break;
+                    case 'C': c = 'G'; break;
+                    case 'G': c = 'C'; break;
+                    case 'T': c = 'A'; break;
+                    default: c = 'N';
+                }
+            }
+            saSearcher.mismatchSearch(query, rescueMismatches_, rescueWork_, rcInts,
+                                      scratch.rescueLowerBound);
+
+            // Only keep the strand(s) with the fewest mismatches
+            uint32_t fwdBest = fwdInts.empty() ? std::numeric_limits<uint32_t>::max() : fwdInts.front().numMismatches;
+            uint32_t rcBest = rcInts.empty() ? std::numeric_limits<uint32_t>::max() : rcInts.front().numMismatches;
+            if (fwdBest > rcBest) { fwdInts.clear(); }
+            if (rcBest > fwdBest) { rcInts.clear(); }
+
+            auto& locator = scratch.locator;
+            auto hitsStart = hits.size();
+            for (uint32_t strand = 0; strand < 2; ++strand) {
+                bool isFwd = (strand == 0);
+                for (auto& mi : isFwd ? fwdInts : rcInts) {
+                    if (mi.ub - mi.lb >= maxInterval) { continue; }
+                    for (auto& lh : locator.locate(mi.lb, mi.ub)) {
+                        if (txpFilter and !txpFilter->contains(lh.tid)) { continue; }
+                        hits.emplace_back(lh.tid, lh.pos, isFwd, readLen);
+                        hits.back().mateStatus = mateStatus;
+                    }
+                }
+            }
+            // As for the exact hits, keep one hit per transcript
+            std::stable_sort(hits.begin() + hitsStart, hits.end(),
+                             [](const QuasiAlignment& a, const QuasiAlignment& b) -> bool {
+                                 return a.tid < b.tid;
+                             });
+            auto newEnd = std::unique(hits.begin() + hitsStart, hits.end(),
+                                      [] (const QuasiAlignment& a, const QuasiAlignment& b) -> bool {
+                                          return a.tid == b.tid;
+                                      });
+            hits.erase(newEnd, hits.end());
+            return hits.size() > hitsStart;
+        }
+
         RapMapIndexT* rmi_;
+        uint32_t rescueMismatches_;
+        uint32_t rescueWork_;
 };
 
 #endif // SA_COLLECTOR_HPP
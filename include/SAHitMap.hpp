@@ -0,0 +1,191 @@
+#ifndef __SA_HIT_MAP_HPP__
+#define __SA_HIT_MAP_HPP__
+
+#include "RapMapUtils.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace rapmap {
+    namespace hit_manager {
+
+        /**
+         * A flat map from a transcript ID to the hits of the current read on
+         * that transcript; this is what intersectSAHits fills in.
+         *
+         * The entries live in a single vector sorted by transcript ID, and the
+         * position lists of all entries are chained through one shared arena
+         * of SATxpQueryPos records.  clear() keeps the capacity of every
+         * buffer, so a map that is owned by a mapping thread and reused for
+         * each read stops allocating once it has seen its largest read.
+         */
+        class SAHitMap {
+            using SATxpQueryPos = rapmap::utils::SATxpQueryPos;
+            enum : uint32_t { EndOfList = std::numeric_limits<uint32_t>::max() };
+
+            public:
+                struct Entry {
+                    Entry(uint32_t tidIn, uint32_t headIn) :
+                        tid(tidIn), numActive(1), active(false),
+                        head(headIn), tail(headIn), numPos(1) {}
+
+                    uint32_t tid;
+                    // number of intervals (so far) that hit this transcript
+                    uint32_t numActive;
+                    bool active;
+                    // first and last arena slot of this entry's position list
+                    uint32_t head;
+                    uint32_t tail;
+                    uint32_t numPos;
+                };
+
+                using iterator = std::vector<Entry>::iterator;
+                using const_iterator = std::vector<Entry>::const_iterator;
+
+                void clear() {
+                    entries_.clear();
+                    seeds_.clear();
+                    arena_.clear();
+                    next_.clear();
+                }
+
+                bool empty() const { return entries_.empty(); }
+                size_t size() const { return entries_.size(); }
+
+                iterator begin() { return entries_.begin(); }
+                iterator end() { return entries_.end(); }
+                const_iterator begin() const { return entries_.begin(); }
+                const_iterator end() const { return entries_.end(); }
+
+                /**
+                 * Record a position of the first (seed) interval.  Seed
+                 * positions may arrive in any transcript order; once they have
+                 * all been added, seal() must be called before the map is
+                 * searched or extended.
+                 */
+                inline void addSeed(uint32_t tid, uint32_t pos, uint32_t queryPos, bool queryRC) {
+                    seeds_.emplace_back(tid, SATxpQueryPos(pos, queryPos, queryRC));
+                }
+
+                /**
+                 * Group the seed positions by transcript and build the
+                 * (sorted) entry list.
+                 */
+                void seal() {
+                    std::sort(seeds_.begin(), seeds_.end(),
+                              [](const SeedT& a, const SeedT& b) -> bool {
+                                  return (a.first == b.first) ? (a.second.pos < b.second.pos) :
+                                                                (a.first < b.first);
+                              });
+                    for (auto& s : seeds_) {
+                        uint32_t slot = static_cast<uint32_t>(arena_.size());
+                        arena_.push_back(s.second);
+                        next_.push_back(EndOfList);
+                        if (entries_.empty() or entries_.back().tid != s.first) {
+                            entries_.emplace_back(s.first, slot);
+                        } else {
+                            auto& e = entries_.back();
+                            next_[e.tail] = slot;
+                            e.tail = slot;
+                            ++e.numPos;
+                        }
+                    }
+                    seeds_.clear();
+                }
+
+                /**
+                 * Return the entry for transcript tid, or nullptr if
+                 * tid was not hit by the seed interval.
+                 */
+                inline Entry* find(uint32_t tid) {
+                    auto it = std::lower_bound(entries_.begin(), entries_.end(), tid,
+                                               [](const Entry& e, uint32_t t) -> bool {
+                                                   return e.tid < t;
+                                               });
+                    return (it != entries_.end() and it->tid == tid) ? &(*it) : nullptr;
+                }
+
+                /**
+                 * Append a position to the position list of entry e.
+                 */
+                inline void append(Entry& e, uint32_t pos, uint32_t queryPos, bool queryRC) {
+                    uint32_t slot = static_cast<uint32_t>(arena_.size());
+                    arena_.emplace_back(pos, queryPos, queryRC);
+                    next_.push_back(EndOfList);
+                    next_[e.tail] = slot;
+                    e.tail = slot;
+                    ++e.numPos;
+                }
+
+                /**
+                 * The position (of this entry) with the smallest transcript
+                 * coordinate.
+                 */
+                const SATxpQueryPos& minPos(const Entry& e) const {
+                    const SATxpQueryPos* best = &arena_[e.head];
+                    for (uint32_t i = next_[e.head]; i != EndOfList; i = next_[i]) {
+                        if (arena_[i].pos < best->pos) { best = &arena_[i]; }
+                    }
+                    return *best;
+                }
+
+                /**
+                 * This enforces a more stringent consistency check on
+                 * the hits for this transcript; it has the same contract as
+                 * ProcessedSAHit::checkConsistent.  The hits must be co-linear
+                 * with respect to the query and target.
+                 *
+                 * input: numToCheck --- the number of hits to check in sorted order
+                 *                       hits after the last of these need not be consistent.
+                 * return: numToCheck if the first numToCheck hits are consistent;
+                 *         -1 otherwise
+                 **/
+                int32_t checkConsistent(const Entry& e, int32_t numToCheck) {
+                    if (e.numPos == 1) {
+                        return numToCheck;
+                    } else if (e.numPos == 2) {
+                        auto& a = arena_[e.head];
+                        auto& b = arena_[e.tail];
+                        auto& h1 = (a.queryPos < b.queryPos) ? a : b;
+                        auto& h2 = (a.queryPos < b.queryPos) ? b : a;
+                        return (h2.pos > h1.pos) ? (numToCheck) : -1;
+                    }
+
+                    // gather and sort this entry's hits by query position
+                    consistencyBuf_.clear();
+                    for (uint32_t i = e.head; i != EndOfList; i = next_[i]) {
+                        consistencyBuf_.push_back(arena_[i]);
+                    }
+                    std::sort(consistencyBuf_.begin(), consistencyBuf_.end(),
+                              [](const SATxpQueryPos& q1, const SATxpQueryPos& q2) -> bool {
+                                  return q1.queryPos < q2.queryPos;
+                              });
+
+                    int32_t lastRefPos{std::numeric_limits<int32_t>::min()};
+                    for (int32_t i = 0; i < numToCheck; ++i) {
+                        int32_t refPos = static_cast<int32_t>(consistencyBuf_[i].pos);
+                        if (refPos > lastRefPos) {
+                            lastRefPos = refPos;
+                        } else {
+                            return i;
+                        }
+                    }
+                    return numToCheck;
+                }
+
+            private:
+                using SeedT = std::pair<uint32_t, SATxpQueryPos>;
+
+                std::vector<Entry> entries_;
+                std::vector<SeedT> seeds_;
+                // All position lists share these two buffers
+                std::vector<SATxpQueryPos> arena_;
+                std::vector<uint32_t> next_;
+                std::vector<SATxpQueryPos> consistencyBuf_;
+        };
+    }
+}
+
+#endif // __SA_HIT_MAP_HPP__
@@ -0,0 +1,141 @@
+#ifndef SA_LOCATOR_HPP
+#define SA_LOCATOR_HPP
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "RapMapSAIndex.hpp"
+
+/**
+ * Turns an SA interval into (transcript, position) pairs.
+ *
+ * Rather than issuing one transcriptAtPosition() query per suffix, the
+ * locator gathers the text positions of the whole interval, sorts them
+ * (with an LSD radix sort once the interval is wide enough) and walks
+ * them once against the transcript offsets.  The located hits therefore
+ * come out sorted by transcript and then by position, which lets callers
+ * skip any later sort / unique on the transcript ID.
+ *
+ * A locator holds its own buffers, so it should be owned by a single
+ * mapping thread and reused across reads.
+ */
+template <typename RapMapIndexT>
+class SALocator {
+    public:
+        using OffsetT = typename RapMapIndexT::IndexType;
+
+        struct LocatedHit {
+            uint32_t tid;
+            // position of the suffix relative to the start of transcript tid
+            OffsetT pos;
+        };
+
+        // Intervals at least this wide are worth locating in bulk when
+        // intersecting them against an existing set of transcripts.
+        static constexpr size_t wideIntervalThreshold = 64;
+        // Intervals at least this wide are sorted with a radix sort
+        // rather than std::sort.
+        static constexpr size_t radixSortThreshold = 256;
+
+        SALocator(RapMapIndexT* rmi) : rmi_(rmi) {}
+
+        /**
+         * Locate every suffix in the SA interval [lb, ub).  The result is
+         * sorted by (tid, pos) and is valid until the next call.
+         */
+        const std::vector<LocatedHit>& locate(OffsetT lb, OffsetT ub) {
+            auto& SA = rmi_->SA;
+            auto& txpStarts = rmi_->txpOffsets;
+
+            located_.clear();
+            if (ub <= lb) { return located_; }
+
+            textPos_.resize(ub - lb);
+            std::copy(SA.begin() + lb, SA.begin() + ub, textPos_.begin());
+            if (textPos_.size() >= radixSortThreshold) {
+                radixSort_();
+            } else {
+                std::sort(textPos_.begin(), textPos_.end());
+            }
+
+            // Walk the sorted positions against the transcript starts.
+            // Only the first position needs a rank query; afterward we
+            // gallop forward through txpStarts.
+            size_t numTxps = txpStarts.size();
+            size_t tid = rmi_->transcriptAtPosition(textPos_.front());
+            for (auto p : textPos_) {
+                if (tid + 1 < numTxps and txpStarts[tid + 1] <= p) {
+                    size_t lo = tid + 1;
+                    size_t step = 1;
+                    size_t hi = lo + step;
+                    while (hi < numTxps and txpStarts[hi] <= p) {
+                        lo = hi;
+                        step <<= 1;
+                        hi = lo + step;
+                    }
+                    hi = std::min(hi, numTxps);
+                    // the last start in [lo, hi) that is <= p
+                    tid = std::distance(txpStarts.begin(),
+                            std::upper_bound(txpStarts.begin() + lo, txpStarts.begin() + hi, p)) - 1;
+                }
+                located_.push_back({static_cast<uint32_t>(tid), static_cast<OffsetT>(p - txpStarts[tid])});
+            }
+            return located_;
+        }
+
+    private:
+        // LSD radix sort of textPos_ on 8-bit digits.  The histograms of
+        // all digits are built in a single pass, and a digit that is the
+        // same for every key (e.g. the high bytes of a 64-bit position in
+        // a small text) costs nothing beyond that pass.
+        void radixSort_() {
+            using UOffsetT = typename std::make_unsigned<OffsetT>::type;
+            constexpr size_t numDigits = sizeof(OffsetT);
+            size_t n = textPos_.size();
+
+            size_t counts[numDigits][256];
+            std::memset(counts, 0, sizeof(counts));
+            for (auto x : textPos_) {
+                UOffsetT u = static_cast<UOffsetT>(x);
+                for (size_t d = 0; d < numDigits; ++d) {
+                    ++counts[d][(u >> (8 * d)) & 0xFF];
+                }
+            }
+
+            sortTemp_.resize(n);
+            OffsetT* src = textPos_.data();
+            OffsetT* dst = sortTemp_.data();
+            for (size_t d = 0; d < numDigits; ++d) {
+                size_t shift = 8 * d;
+                auto& count = counts[d];
+                if (count[(static_cast<UOffsetT>(src[0]) >> shift) & 0xFF] == n) { continue; }
+
+                size_t offset{0};
+                for (size_t b = 0; b < 256; ++b) {
+                    size_t c = count[b];
+                    count[b] = offset;
+                    offset += c;
+                }
+                for (size_t i = 0; i < n; ++i) {
+                    auto b = (static_cast<UOffsetT>(src[i]) >> shift) & 0xFF;
+                    dst[count[b]++] = src[i];
+                }
+                std::swap(src, dst);
+            }
+            if (src != textPos_.data()) { textPos_.swap(sortTemp_); }
+        }
+
+        RapMapIndexT* rmi_;
+        std::vector<OffsetT> textPos_;
+        std::vector<OffsetT> sortTemp_;
+        std::vector<LocatedHit> located_;
+};
+
+template <typename RapMapIndexT>
+constexpr size_t SALocator<RapMapIndexT>::wideIntervalThreshold;
+template <typename RapMapIndexT>
+constexpr size_t SALocator<RapMapIndexT>::radixSortThreshold;
+
+#endif // SA_LOCATOR_HPP
@@ -4,6 +4,9 @@
 #include <vector>
 #include <algorithm>
 #include <iterator>
+#include <string>
+#include <tuple>
+#include <utility>
 #include "jellyfish/mer_dna.hpp"
 
 #include "RapMapUtils.hpp"
@@ -15,7 +18,8 @@ class SASearcher {
         using OffsetT = typename RapMapIndexT::IndexType;
 
         SASearcher(RapMapIndexT* rmi) :
-            rmi_(rmi), seq_(&rmi->seq), sa_(&rmi->SA) {}
+            rmi_(rmi), seq_(&rmi->seq), sa_(&rmi->SA),
+            textLen_(static_cast<OffsetT>(rmi->seq.length())) {}
 
         int cmp(std::string::iterator abeg,
                 std::string::iterator aend,
@@ -287,6 +291,180 @@ class SASearcher {
             return std::make_tuple(static_cast<OffsetT>(res1.bound), static_cast<OffsetT>(res2.bound), static_cast<OffsetT>(res1.maxLen));
         }
 
+        /**
+         * The SA interval [lb, ub) of the suffixes that begin with the
+         * (upper case) query [qb, qe).  Only [lbIn, ubIn) is searched, and
+         * every suffix there must already match the first `startAt`
+         * characters of the query (e.g. the interval of its first k-mer;
+         * use [0, |SA|) and 0 to search the whole array).  lb == ub if
+         * the query doesn't occur.
+         */
+        template <typename IteratorT>
+        std::pair<OffsetT, OffsetT> exactInterval(OffsetT lbIn, OffsetT ubIn, OffsetT startAt,
+                                                  IteratorT qb, IteratorT qe) {
+            std::vector<OffsetT>& SA = *sa_;
+            std::string& seq = *seq_;
+            OffsetT m = static_cast<OffsetT>(std::distance(qb, qe));
+            OffsetT n = textLen_;
+
+            // Compare the suffix SA[i] to the query, knowing they agree
+            // on the first `match` characters; returns < 0, 0 or > 0 as
+            // the suffix sorts before, starts with, or sorts after the
+            // query, and leaves `match` at their common prefix length.
+            auto compare = [&](OffsetT i, OffsetT& match) -> int {
+                OffsetT p = SA[i] + match;
+                while (match < m) {
+                    // a suffix that ends first sorts first
+                    if (p >= n) { return -1; }
+                    char c = seq[p];
+                    char q = *(qb + match);
+                    if (c != q) { return (c < q) ? -1 : 1; }
+                    ++match;
+                    ++p;
+                }
+                return 0;
+            };
+
+            // The usual binary searches, starting each comparison after
+            // what the query is known to share with both ends of the range
+            auto bound = [&](OffsetT lo, OffsetT hi, bool upper) -> OffsetT {
+                OffsetT loMatch = startAt, hiMatch = startAt;
+                while (lo < hi) {
+                    OffsetT mid = lo + (hi - lo) / 2;
+                    OffsetT match = std::min(loMatch, hiMatch);
+                    int r = compare(mid, match);
+                    if (r < 0 or (upper and r == 0)) {
+                        lo = mid + 1;
+                        loMatch = match;
+                    } else {
+                        hi = mid;
+                        hiMatch = match;
+                    }
+                }
+                return lo;
+            };
+
+            if (startAt >= m) { return std::make_pair(lbIn, ubIn); }
+            OffsetT lb = bound(lbIn, ubIn, false);
+            OffsetT ub = bound(lb, ubIn, true);
+            return std::make_pair(lb, ub);
+        }
+
+        /**
+         * The longest prefix of the (upper case) query [qb, qe) that
+         * occurs in the text, as (lb, ub, len): the SA interval of the
+         * suffixes beginning with its first len characters.  As for
+         * exactInterval, every suffix of the (non-empty) interval [lbIn,
+         * ubIn) must already match the first `startAt` characters.
+         *
+         * Rather than binary searching for each extra character, the
+         * query is compared directly to the text for as long as the first
+         * and last suffixes of the current interval (and so all of them)
+         * agree; only where they part is the interval narrowed by a search.
+         */
+        template <typename IteratorT>
+        std::tuple<OffsetT, OffsetT, OffsetT> longestMatch(OffsetT lbIn, OffsetT ubIn,
+                                                           OffsetT startAt,
+                                                           IteratorT qb, IteratorT qe) {
+            std::vector<OffsetT>& SA = *sa_;
+            std::string& seq = *seq_;
+            OffsetT m = static_cast<OffsetT>(std::distance(qb, qe));
+            OffsetT n = textLen_;
+
+            OffsetT lb = lbIn, ub = ubIn, len = startAt;
+            while (len < m) {
+                OffsetT first = SA[lb];
+                OffsetT last = SA[ub - 1];
+                bool shared{false};
+                while (len < m) {
+                    shared = (first + len < n and last + len < n and
+                              seq[first + len] == seq[last + len]);
+                    if (!shared or seq[first + len] != *(qb + len)) { break; }
+                    ++len;
+                }
+                // Either the query left a stretch all of the suffixes share,
+                // or there's a single suffix and it's done
+                if (len == m or shared or ub - lb == 1) { break; }
+                OffsetT nlb, nub;
+                std::tie(nlb, nub) = exactInterval(lb, ub, len, qb, qb + len + 1);
+                if (nlb == nub) { break; }
+                lb = nlb;
+                ub = nub;
+                ++len;
+            }
+            return std::make_tuple(lb, ub, len);
+        }
+
+        /**
+         * A super-maximal exact match (SMEM): query[queryStart, queryStart
+         * + len) occurs in the text (at the suffixes [lb, ub) of the SA),
+         * and no other exact match of the query contains it.
+         */
+        struct SMEM {
+            uint32_t queryStart;
+            uint32_t len;
+            OffsetT lb;
+            OffsetT ub;
+        };
+
+        /**
+         * Append every SMEM of the (upper case) query that is at least
+         * `minLen` long to `mems`, in order of query position.
+         *
+         * This computes the longest match starting at each query position
+         * (its matching statistics); a position begins an SMEM exactly
+         * when its match reaches further than the previous position's.  A
+         * position whose k-mer is in the hash starts its search from the
+         * k-mer's interval; one whose k-mer isn't matches fewer than k
+         * characters, so when minLen >= k it needn't be searched at all.
+         */
+        void smems(const std::string& query, uint32_t minLen, std::vector<SMEM>& mems) {
+            auto& khash = rmi_->khash;
+            OffsetT saLen = static_cast<OffsetT>(sa_->size());
+            int32_t k = static_cast<int32_t>(rapmap::utils::my_mer::k());
+            int32_t m = static_cast<int32_t>(query.length());
+            if (minLen == 0) { minLen = 1; }
+
+            // where the previous position's match ends, or -1 if it is
+            // known to end before any later SMEM can
+            int64_t prevEnd{-1};
+            // the first non-ACGT character at or after the current position
+            auto nextInvalid = query.find_first_not_of("ACGT");
+            for (int32_t i = 0; i + static_cast<int64_t>(minLen) <= m; ++i) {
+                if (nextInvalid != std::string::npos and nextInvalid < static_cast<size_t>(i)) {
+                    nextInvalid = query.find_first_not_of("ACGT", i);
+                }
+                OffsetT lb{0}, ub{0}, len{0};
+                bool searched{false};
+                if (i + k <= m and (nextInvalid == std::string::npos or
+                                    nextInvalid >= static_cast<size_t>(i + k))) {
+                    rapmap::utils::my_mer mer(query.c_str() + i);
+                    auto it = khash.find(mer.get_bits(0, 2*k));
+                    if (it != khash.end()) {
+                        std::tie(lb, ub, len) = longestMatch(it->second.begin, it->second.end,
+                                                             k, query.begin() + i, query.end());
+                        searched = true;
+                    }
+                }
+                if (!searched and static_cast<int32_t>(minLen) < k) {
+                    std::tie(lb, ub, len) = longestMatch(0, saLen, 0, query.begin() + i, query.end());
+                    searched = true;
+                }
+
+                if (!searched) {
+                    prevEnd = -1;
+                    continue;
+                }
+                int64_t end = i + static_cast<int64_t>(len);
+                if (len >= static_cast<OffsetT>(minLen) and end > prevEnd) {
+                    mems.push_back({static_cast<uint32_t>(i), static_cast<uint32_t>(len), lb, ub});
+                }
+                // nothing starting later can reach past the end of the query
+                if (end == m) { break; }
+                prevEnd = end;
+            }
+        }
+
 
         /**
          * Compute the longest common extension between the suffixes
@@ -312,7 +490,161 @@ class SASearcher {
             return len;
         }
 
+        /**
+         * The suffixes that begin with query[0, m) up to a few
+         * substitutions, as an SA interval and the number of mismatches.
+         */
+        struct MismatchInterval {
+            OffsetT lb;
+            OffsetT ub;
+            uint32_t numMismatches;
+        };
+
+        /**
+         * Find the occurrences of the whole (upper case) query with at
+         * most maxMismatches substitutions, by depth-first backtracking
+         * over SA intervals: at each query position the interval is
+         * narrowed by the query's own base first, then by each other base
+         * at the cost of a mismatch.  Only the best stratum is kept, so
+         * `out` ends up holding the intervals with the fewest mismatches
+         * found (and the bound tightens as better ones turn up).
+         *
+         * Branches are pruned with a lower bound on the mismatches the
+         * rest of the query needs: the query is cut, from the left, into
+         * the shortest pieces that don't occur in the text, and a suffix
+         * of it must have a mismatch in each piece it wholly contains.
+         * `lowerBound` is the caller's buffer for that table.
+         *
+         * The search gives up, returning false with `out` empty, once it
+         * has narrowed maxWork intervals.
+         */
+        bool mismatchSearch(const std::string& query, uint32_t maxMismatches, uint32_t maxWork,
+                            std::vector<MismatchInterval>& out,
+                            std::vector<uint32_t>& lowerBound) {
+            OffsetT m = static_cast<OffsetT>(query.length());
+            OffsetT saLen = static_cast<OffsetT>(sa_->size());
+            out.clear();
+
+            // The pieces are found by extending an exact match until it
+            // fails; lowerBound[i] counts the pieces starting at or after i
+            lowerBound.assign(m + 1, 0);
+            OffsetT lb{0}, ub{saLen}, start{0};
+            for (OffsetT i = 0; i < m; ++i) {
+                std::tie(lb, ub) = childInterval(lb, ub, i - start, query[i]);
+                if (lb == ub) {
+                    lowerBound[start] += 1;
+                    start = i + 1;
+                    lb = 0;
+                    ub = saLen;
+                }
+            }
+            for (OffsetT i = m; i > 0; --i) { lowerBound[i - 1] += lowerBound[i]; }
+            if (lowerBound[0] > maxMismatches) { return true; }
+
+            MismatchSearch search{query, lowerBound, out, maxMismatches, maxWork, 0, false};
+            backtrack(search, 0, saLen, 0, 0);
+            if (search.gaveUp) {
+                out.clear();
+                return false;
+            }
+            return true;
+        }
+
     private:
+        // The state of a mismatchSearch
+        struct MismatchSearch {
+            const std::string& query;
+            const std::vector<uint32_t>& lowerBound;
+            std::vector<MismatchInterval>& out;
+            uint32_t maxMismatches;
+            uint32_t maxWork;
+            uint32_t work;
+            bool gaveUp;
+        };
+
+        // Record the interval [lb, ub), matched with numMismatches
+        void addMismatchInterval(MismatchSearch& s, OffsetT lb, OffsetT ub, uint32_t numMismatches) {
+            if (numMismatches < s.maxMismatches) {
+                s.out.clear();
+                s.maxMismatches = numMismatches;
+            }
+            s.out.push_back({lb, ub, numMismatches});
+        }
+
+        // Every suffix of [lb, ub) matches the query's first `depth`
+        // characters with `numMismatches` substitutions
+        void backtrack(MismatchSearch& s, OffsetT lb, OffsetT ub, OffsetT depth,
+                       uint32_t numMismatches) {
+            const std::string& query = s.query;
+            OffsetT m = static_cast<OffsetT>(query.length());
+            if (s.gaveUp or numMismatches + s.lowerBound[depth] > s.maxMismatches) { return; }
+            if (depth == m) {
+                addMismatchInterval(s, lb, ub, numMismatches);
+                return;
+            }
+            if (++s.work > s.maxWork) {
+                s.gaveUp = true;
+                return;
+            }
+
+            // A single suffix can just be compared to the rest of the query
+            if (ub - lb == 1) {
+                std::string& seq = *seq_;
+                OffsetT p = (*sa_)[lb];
+                for (OffsetT i = depth; i < m; ++i) {
+                    if (p + i >= textLen_ or seq[p + i] == '$') { return; }
+                    if (seq[p + i] != query[i] and ++numMismatches > s.maxMismatches) { return; }
+                }
+                addMismatchInterval(s, lb, ub, numMismatches);
+                return;
+            }
+            // Nothing left to spend, so the rest has to match exactly
+            if (numMismatches == s.maxMismatches) {
+                OffsetT elb, eub;
+                std::tie(elb, eub) = exactInterval(lb, ub, depth, query.begin(), query.end());
+                if (elb < eub) { addMismatchInterval(s, elb, eub, numMismatches); }
+                return;
+            }
+
+            char qc = query[depth];
+            OffsetT clb, cub;
+            std::tie(clb, cub) = childInterval(lb, ub, depth, qc);
+            if (clb < cub) { backtrack(s, clb, cub, depth + 1, numMismatches); }
+            for (char c : {'A', 'C', 'G', 'T'}) {
+                if (c == qc) { continue; }
+                if (++s.work > s.maxWork) {
+                    s.gaveUp = true;
+                    return;
+                }
+                std::tie(clb, cub) = childInterval(lb, ub, depth, c);
+                if (clb < cub) { backtrack(s, clb, cub, depth + 1, numMismatches + 1); }
+            }
+        }
+
+        // The sub-interval of [lb, ub) (whose suffixes share their first
+        // `depth` characters) of the suffixes with c at position depth
+        std::pair<OffsetT, OffsetT> childInterval(OffsetT lb, OffsetT ub, OffsetT depth, char c) {
+            std::vector<OffsetT>& SA = *sa_;
+            std::string& seq = *seq_;
+            // a suffix that ends first sorts first
+            auto charAt = [&](OffsetT i) -> char {
+                OffsetT p = SA[i] + depth;
+                return (p < textLen_) ? seq[p] : '\0';
+            };
+            OffsetT lo = lb, hi = ub;
+            while (lo < hi) {
+                OffsetT mid = lo + (hi - lo) / 2;
+                if (charAt(mid) < c) { lo = mid + 1; } else { hi = mid; }
+            }
+            OffsetT first = lo;
+            hi = ub;
+            while (lo < hi) {
+                OffsetT mid = lo + (hi - lo) / 2;
+                if (charAt(mid) <= c) { lo = mid + 1; } else { hi = mid; }
+            }
+            return std::make_pair(first, lo);
+        }
+
         RapMapIndexT* rmi_;
         std::string* seq_;
         std::vector<OffsetT>* sa_;
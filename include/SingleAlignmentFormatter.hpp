@@ -8,7 +8,8 @@ struct SingleAlignmentFormatter {
     SingleAlignmentFormatter(IndexPtrT indexIn) : index(indexIn),
     readTemp(1000, 'A'),
     qualTemp(1000, '~'),
-    cigarStr(buff, 1000){
+    cigarStr(buff, 1000),
+    numHitFlag(nhBuff, 32){
     }
 
     // Data members
@@ -17,6 +18,9 @@ struct SingleAlignmentFormatter {
     std::string qualTemp;
     char buff[1000];
     rapmap::utils::FixedWriter cigarStr;
+    // NH:i:<count> tag, rewritten for each read
+    char nhBuff[32];
+    rapmap::utils::FixedWriter numHitFlag;
 };
 
 #endif //__PAIR_ALIGNMENT_FORMATTER_HPP__
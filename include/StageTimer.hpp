@@ -0,0 +1,146 @@
+#ifndef __STAGE_TIMER_HPP__
+#define __STAGE_TIMER_HPP__
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Per-stage timing of the mapping path.  The RAPMAP_* macros below are
+ * only compiled in when RapMap is configured with -DSTAGE_TIMING=TRUE
+ * (which defines RAPMAP_STAGE_TIMING); otherwise they cost nothing.
+ *
+ *   RAPMAP_TIMED(Stage, expr)       evaluates expr, timing it
+ *   RAPMAP_STAGE_BEGIN(var)         starts timing a block of statements
+ *   RAPMAP_STAGE_END(Stage, var)    and ends it
+ *   RAPMAP_READ_BEGIN() / RAPMAP_READ_END()
+ *                                   bracket the work done for one read,
+ *                                   for the per-read distributions
+ *
+ * Every thread accumulates into its own counters, which are folded into
+ * the run's totals when the thread exits.
+ */
+namespace rapmap {
+    namespace timing {
+
+        enum class Stage : uint32_t {
+            ParserWait = 0,  // getting a job from the parser (per job)
+            HashProbe,       // k-mer lookups in the hash
+            ExtendSearch,    // SASearcher::extendSearchNaive
+            LCE,             // SASearcher::lce
+            IntersectHits,   // hit_manager::intersectSAHits
+            MismatchRescue,  // SACollector's search of reads with no exact seed
+            VerifyHits,      // HitVerifier::filter
+            Format,          // SAM / BAM formatting
+            Output,          // handing a job's output to the writer (per job)
+            NumStages
+        };
+        constexpr size_t kNumStages = static_cast<size_t>(Stage::NumStages);
+        // log2 buckets of ticks: bucket 0 holds 0, bucket b holds [2^(b-1), 2^b)
+        constexpr size_t kNumBuckets = 65;
+
+        const char* stageName(Stage s);
+
+        // Whether a stage's distribution is per read (or else per call)
+        inline bool stageIsPerRead(Stage s) {
+            return s != Stage::ParserWait and s != Stage::Output;
+        }
+
+        inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+
+        struct StageTimes {
+            uint64_t ticks[kNumStages] = {};
+            uint64_t calls[kNumStages] = {};
+            // per read (or per call) ticks of each stage; the last row
+            // is the whole of each read
+            uint64_t buckets[kNumStages + 1][kNumBuckets] = {};
+            uint64_t numReads{0};
+            uint64_t readTicks{0};
+
+            void add(const StageTimes& o);
+        };
+
+        // The calling thread's counters
+        class ThreadStageTimes {
+            public:
+                ~ThreadStageTimes();
+
+                void record(Stage s, uint64_t elapsed) {
+                    auto i = static_cast<size_t>(s);
+                    times_.ticks[i] += elapsed;
+                    ++times_.calls[i];
+                    if (stageIsPerRead(s)) {
+                        current_[i] += elapsed;
+                    } else {
+                        ++times_.buckets[i][bucket(elapsed)];
+                    }
+                }
+                void beginRead() {
+                    for (auto& c : current_) { c = 0; }
+                    readStart_ = ticks();
+                }
+                void endRead();
+
+                static size_t bucket(uint64_t t) {
+                    return (t == 0) ? 0 : 64 - __builtin_clzll(t);
+                }
+
+            private:
+                StageTimes times_;
+                uint64_t current_[kNumStages] = {};
+                uint64_t readStart_{0};
+        };
+
+        ThreadStageTimes& threadStageTimes();
+
+        inline void record(Stage s, uint64_t start) {
+            threadStageTimes().record(s, ticks() - start);
+        }
+
+        template <typename F>
+        auto timed(Stage s, F f) -> decltype(f()) {
+            uint64_t start = ticks();
+            auto r = f();
+            record(s, start);
+            return r;
+        }
+
+        // Clears the totals and notes the start time (to convert ticks to seconds)
+        void startStageTiming();
+
+        /**
+         * Writes the totals of every thread that has exited as JSON;
+         * returns false if fname can't be written.
+         */
+        bool writeStageReport(const std::string& fname);
+    }
+}
+
+#ifdef RAPMAP_STAGE_TIMING
+#define RAPMAP_TIMED(stage, expr) \
+    rapmap::timing::timed(rapmap::timing::Stage::stage, [&]() { return (expr); })
+#define RAPMAP_STAGE_BEGIN(var) uint64_t var = rapmap::timing::ticks()
+#define RAPMAP_STAGE_END(stage, var) rapmap::timing::record(rapmap::timing::Stage::stage, var)
+#define RAPMAP_READ_BEGIN() rapmap::timing::threadStageTimes().beginRead()
+#define RAPMAP_READ_END() rapmap::timing::threadStageTimes().endRead()
+#else
+#define RAPMAP_TIMED(stage, expr) (expr)
+#define RAPMAP_STAGE_BEGIN(var)
+#define RAPMAP_STAGE_END(stage, var)
+#define RAPMAP_READ_BEGIN()
+#define RAPMAP_READ_END()
+#endif // RAPMAP_STAGE_TIMING
+
+#endif // __STAGE_TIMER_HPP__
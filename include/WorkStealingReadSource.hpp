@@ -0,0 +1,238 @@
+#ifndef __WORK_STEALING_READ_SOURCE_HPP__
+#define __WORK_STEALING_READ_SOURCE_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace rapmap {
+    namespace io {
+
+        // What one mapping thread did over a run
+        struct WorkerUtilization {
+            uint64_t numReads{0};
+            uint64_t numTasks{0};
+            // tasks taken from another thread's queue
+            uint64_t numStolen{0};
+            // parser jobs this thread split into tasks
+            uint64_t numFetched{0};
+            // mapping (from getting a task until it's done)
+            double busySeconds{0.0};
+            // getting tasks: waiting on the parser, stealing, or idle
+            double waitSeconds{0.0};
+
+            double utilization() const {
+                double total = busySeconds + waitSeconds;
+                return (total > 0.0) ? busySeconds / total : 0.0;
+            }
+        };
+
+        /**
+         * Work stealing on top of a read parser.  Jobs from the parser
+         * (up to maxReadGroup reads) are split into tasks of taskSize
+         * reads, which go into the queue of the thread that fetched them.
+         * A thread works from the back of its own queue; when that's
+         * empty, it steals from the front of another thread's queue, and
+         * only when there's nothing to steal does it go to the parser.
+         * A read that hits a repeat then holds up just its own task,
+         * rather than the rest of a 1000-read job.
+         *
+         * Has the parser's job interface, so the mapping threads take
+         * work from it exactly as they would from the parser; each thread
+         * must only hold one job at a time.  A parser job lives until the
+         * last of its tasks is done.
+         */
+        template <typename ParserT>
+        class WorkStealingReadSource {
+            private:
+                using parser_job = typename ParserT::job;
+                using read_list = typename std::remove_reference<
+                    decltype(*std::declval<parser_job&>())>::type;
+                using record_type = typename decltype(std::declval<read_list&>().data)::value_type;
+
+                struct Task {
+                    std::shared_ptr<parser_job> job;
+                    size_t begin;
+                    size_t end;
+                };
+
+            public:
+                // The reads of one task, laid out like the parser's read list
+                struct TaskReads {
+                    struct Reads {
+                        record_type* first{nullptr};
+                        record_type& operator[](size_t i) const { return first[i]; }
+                    };
+                    size_t nb_filled{0};
+                    Reads data;
+                };
+
+                class job {
+                    public:
+                        explicit job(WorkStealingReadSource& source);
+                        ~job();
+                        job(const job&) = delete;
+                        job& operator=(const job&) = delete;
+
+                        bool is_empty() const { return reads_.nb_filled == 0; }
+                        TaskReads* operator->() { return &reads_; }
+                        TaskReads& operator*() { return reads_; }
+
+                    private:
+                        WorkStealingReadSource& source_;
+                        uint32_t worker_;
+                        Task task_;
+                        TaskReads reads_;
+                        std::chrono::steady_clock::time_point start_;
+                };
+
+                WorkStealingReadSource(ParserT& parser, uint32_t numWorkers, uint32_t taskSize) :
+                    parser_(parser), workers_(numWorkers),
+                    taskSize_((taskSize > 0) ? taskSize : 1) {}
+
+                // Per-thread statistics; only meaningful once the threads are done
+                std::vector<WorkerUtilization> utilization() const {
+                    std::vector<WorkerUtilization> u;
+                    for (auto& w : workers_) { u.push_back(w.stats); }
+                    return u;
+                }
+
+            private:
+                struct Worker {
+                    std::mutex mutex;
+                    std::deque<Task> tasks;
+                    WorkerUtilization stats;
+                    // keep the workers' stats off each other's cache lines
+                    char padding[64];
+                };
+
+                uint32_t workerId_();
+                bool popLocal_(uint32_t w, Task& t);
+                bool steal_(uint32_t w, Task& t);
+                void fetch_(uint32_t w);
+
+                ParserT& parser_;
+                std::vector<Worker> workers_;
+                size_t taskSize_;
+                std::atomic<uint32_t> nextWorker_{0};
+
+                // Only one thread talks to the parser at a time
+                std::mutex fetchMutex_;
+                std::atomic<bool> inputDone_{false};
+                // tasks sitting in some queue
+                std::atomic<uint64_t> queued_{0};
+        };
+
+        template <typename ParserT>
+        WorkStealingReadSource<ParserT>::job::job(WorkStealingReadSource& source) :
+            source_(source), worker_(source.workerId_()), task_{nullptr, 0, 0} {
+            auto waitStart = std::chrono::steady_clock::now();
+            auto& stats = source_.workers_[worker_].stats;
+            while (true) {
+                if (source_.popLocal_(worker_, task_)) { break; }
+                if (source_.steal_(worker_, task_)) {
+                    ++stats.numStolen;
+                    break;
+                }
+                if (source_.inputDone_.load()) {
+                    // nothing left to fetch; done once every queue is drained
+                    if (source_.queued_.load() == 0) { break; }
+                    std::this_thread::yield();
+                    continue;
+                }
+                source_.fetch_(worker_);
+            }
+            start_ = std::chrono::steady_clock::now();
+            stats.waitSeconds += std::chrono::duration<double>(start_ - waitStart).count();
+            if (task_.job) {
+                reads_.nb_filled = task_.end - task_.begin;
+                reads_.data.first = &(*task_.job)->data[task_.begin];
+            }
+        }
+
+        template <typename ParserT>
+        WorkStealingReadSource<ParserT>::job::~job() {
+            if (!task_.job) { return; }
+            auto& stats = source_.workers_[worker_].stats;
+            stats.numReads += reads_.nb_filled;
+            ++stats.numTasks;
+            // the last task of a parser job hands it back to the parser
+            task_.job.reset();
+            stats.busySeconds += std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start_).count();
+        }
+
+        template <typename ParserT>
+        uint32_t WorkStealingReadSource<ParserT>::workerId_() {
+            thread_local const WorkStealingReadSource* owner{nullptr};
+            thread_local uint32_t id{0};
+            if (owner != this) {
+                owner = this;
+                id = nextWorker_++;
+                if (id >= workers_.size()) {
+                    throw std::logic_error("More threads took work than the work-stealing "
+                                           "read source was built for");
+                }
+            }
+            return id;
+        }
+
+        template <typename ParserT>
+        bool WorkStealingReadSource<ParserT>::popLocal_(uint32_t w, Task& t) {
+            auto& worker = workers_[w];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.tasks.empty()) { return false; }
+            t = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+            --queued_;
+            return true;
+        }
+
+        template <typename ParserT>
+        bool WorkStealingReadSource<ParserT>::steal_(uint32_t w, Task& t) {
+            size_t n = workers_.size();
+            for (size_t i = 1; i < n; ++i) {
+                auto& victim = workers_[(w + i) % n];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (victim.tasks.empty()) { continue; }
+                t = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                --queued_;
+                return true;
+            }
+            return false;
+        }
+
+        template <typename ParserT>
+        void WorkStealingReadSource<ParserT>::fetch_(uint32_t w) {
+            std::lock_guard<std::mutex> fetchLock(fetchMutex_);
+            if (inputDone_.load()) { return; }
+            std::shared_ptr<parser_job> pj(new parser_job(parser_));
+            if (pj->is_empty()) {
+                inputDone_.store(true);
+                return;
+            }
+            size_t numReads = (*pj)->nb_filled;
+            auto& worker = workers_[w];
+            ++worker.stats.numFetched;
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            // pushed in reverse, so the owner maps the reads in file order
+            for (size_t end = numReads; end > 0; ) {
+                size_t begin = (end > taskSize_) ? end - taskSize_ : 0;
+                worker.tasks.push_back(Task{pj, begin, end});
+                ++queued_;
+                end = begin;
+            }
+        }
+    }
+}
+
+#endif // __WORK_STEALING_READ_SOURCE_HPP__
@@ -0,0 +1,57 @@
+#include "AllocationCounter.hpp"
+
+#ifdef RAPMAP_COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+namespace {
+    thread_local uint64_t numAllocations{0};
+
+    inline void* countedAlloc(std::size_t size) {
+        ++numAllocations;
+        // operator new(0) must still return a unique pointer
+        return std::malloc(size ? size : 1);
+    }
+}
+
+void* operator new(std::size_t size) {
+    void* p = countedAlloc(size);
+    if (p == nullptr) { throw std::bad_alloc(); }
+    return p;
+}
+
+void* operator new[](std::size_t size) {
+    void* p = countedAlloc(size);
+    if (p == nullptr) { throw std::bad_alloc(); }
+    return p;
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+namespace rapmap {
+    namespace utils {
+        uint64_t threadAllocationCount() { return numAllocations; }
+    }
+}
+
+#else // RAPMAP_COUNT_ALLOCATIONS
+
+namespace rapmap {
+    namespace utils {
+        uint64_t threadAllocationCount() { return 0; }
+    }
+}
+
+#endif // RAPMAP_COUNT_ALLOCATIONS
@@ -0,0 +1,211 @@
+#include "BGZFWriter.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace rapmap {
+    namespace bam {
+
+        namespace {
+            // Limits from the SAM/BAM specification (and htslib's bgzf.c)
+            constexpr size_t kMaxBlockSize = 0x10000;
+            constexpr size_t kMaxBlockInput = 0xff00;
+            constexpr size_t kHeaderSize = 18;
+            constexpr size_t kFooterSize = 8;
+
+            constexpr uint8_t kBlockHeader[kHeaderSize] = {
+                0x1f, 0x8b, 0x08, 0x04, // gzip magic, deflate, FEXTRA
+                0x00, 0x00, 0x00, 0x00, // MTIME
+                0x00, 0xff,             // XFL, OS (unknown)
+                0x06, 0x00,             // XLEN
+                'B',  'C',  0x02, 0x00, // BGZF subfield, SLEN
+                0x00, 0x00              // BSIZE (filled in per block)
+            };
+
+            // An empty block, which marks the end of a BGZF file
+            constexpr uint8_t kEOFBlock[28] = {
+                0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff,
+                0x06, 0x00, 0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00,
+                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+            };
+
+            inline void putLE16(char* p, uint16_t v) {
+                p[0] = static_cast<char>(v & 0xff);
+                p[1] = static_cast<char>(v >> 8);
+            }
+
+            inline void putLE32(char* p, uint32_t v) {
+                for (size_t i = 0; i < 4; ++i) { p[i] = static_cast<char>((v >> (8 * i)) & 0xff); }
+            }
+
+            void initDeflate(z_stream& strm, int level) {
+                std::memset(&strm, 0, sizeof(strm));
+                // negative window bits: raw deflate, BGZF adds its own framing
+                if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                    throw std::runtime_error("could not initialize zlib for BGZF output");
+                }
+            }
+        }
+
+        BGZFWriter::BGZFWriter(std::ostream& out, uint32_t numThreads, int level, size_t maxQueued) :
+            out_(out), level_(level), maxQueued_(std::max(maxQueued, size_t(1))) {
+            numThreads = std::max(numThreads, uint32_t(1));
+            for (uint32_t i = 0; i < numThreads; ++i) {
+                compressors_.emplace_back(&BGZFWriter::compressLoop_, this);
+            }
+            writer_ = std::thread(&BGZFWriter::writeLoop_, this);
+        }
+
+        BGZFWriter::~BGZFWriter() {
+            close();
+        }
+
+        void BGZFWriter::write(std::string& data) {
+            if (data.empty()) { return; }
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                spaceAvailable_.wait(lock, [this]() -> bool { return queue_.size() < maxQueued_; });
+                Chunk* c{nullptr};
+                if (free_.empty()) {
+                    chunks_.emplace_back(new Chunk);
+                    c = chunks_.back().get();
+                } else {
+                    c = free_.back();
+                    free_.pop_back();
+                }
+                // hand the caller back this chunk's old (empty) buffer
+                c->raw.swap(data);
+                c->done = false;
+                queue_.push_back(c);
+            }
+            workAvailable_.notify_one();
+        }
+
+        bool BGZFWriter::close() {
+            if (closed_) { return !failed_; }
+            closed_ = true;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                closing_ = true;
+            }
+            workAvailable_.notify_all();
+            for (auto& t : compressors_) { t.join(); }
+            chunkDone_.notify_all();
+            writer_.join();
+
+            if (!failed_) {
+                out_.write(reinterpret_cast<const char*>(kEOFBlock), sizeof(kEOFBlock));
+                out_.flush();
+                failed_ = out_.fail();
+            }
+            return !failed_;
+        }
+
+        void BGZFWriter::compressLoop_() {
+            z_stream strm;
+            z_stream storeStrm;
+            initDeflate(strm, level_);
+            initDeflate(storeStrm, Z_NO_COMPRESSION);
+            while (true) {
+                Chunk* c{nullptr};
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    workAvailable_.wait(lock, [this]() -> bool {
+                            return nextToCompress_ < queue_.size() or closing_;
+                            });
+                    if (nextToCompress_ >= queue_.size()) { break; }
+                    c = queue_[nextToCompress_++];
+                }
+                compressChunk_(*c, strm, storeStrm);
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    c->done = true;
+                }
+                chunkDone_.notify_one();
+            }
+            deflateEnd(&strm);
+            deflateEnd(&storeStrm);
+        }
+
+        void BGZFWriter::writeLoop_() {
+            while (true) {
+                Chunk* c{nullptr};
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    chunkDone_.wait(lock, [this]() -> bool {
+                            return (!queue_.empty() and queue_.front()->done) or
+                                   (closing_ and queue_.empty());
+                            });
+                    if (queue_.empty()) { break; }
+                    c = queue_.front();
+                }
+                // After a failure, keep taking chunks so the producers
+                // don't block, but stop writing them.
+                if (!failed_) {
+                    out_.write(c->compressed.data(), c->compressed.size());
+                    failed_ = out_.fail();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    queue_.pop_front();
+                    --nextToCompress_;
+                    c->raw.clear();
+                    c->compressed.clear();
+                    free_.push_back(c);
+                }
+                spaceAvailable_.notify_one();
+            }
+        }
+
+        void BGZFWriter::compressChunk_(Chunk& c, z_stream& strm, z_stream& storeStrm) {
+            c.compressed.clear();
+            const char* data = c.raw.data();
+            size_t remaining = c.raw.size();
+            while (remaining > 0) {
+                size_t len = std::min(remaining, kMaxBlockInput);
+                appendBlock_(data, len, c.compressed, strm, storeStrm);
+                data += len;
+                remaining -= len;
+            }
+        }
+
+        void BGZFWriter::appendBlock_(const char* data, size_t len, std::string& out,
+                                      z_stream& strm, z_stream& storeStrm) {
+            size_t blockStart = out.size();
+            out.resize(blockStart + kMaxBlockSize);
+            char* block = &out[blockStart];
+            std::memcpy(block, kBlockHeader, kHeaderSize);
+
+            size_t maxDeflated = kMaxBlockSize - kHeaderSize - kFooterSize;
+            z_stream* s = &strm;
+            deflateReset(s);
+            s->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            s->avail_in = static_cast<uInt>(len);
+            s->next_out = reinterpret_cast<Bytef*>(block + kHeaderSize);
+            s->avail_out = static_cast<uInt>(maxDeflated);
+            if (deflate(s, Z_FINISH) != Z_STREAM_END) {
+                // Incompressible data; stored blocks always fit, since the
+                // input is limited to kMaxBlockInput bytes.
+                s = &storeStrm;
+                deflateReset(s);
+                s->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+                s->avail_in = static_cast<uInt>(len);
+                s->next_out = reinterpret_cast<Bytef*>(block + kHeaderSize);
+                s->avail_out = static_cast<uInt>(maxDeflated);
+                if (deflate(s, Z_FINISH) != Z_STREAM_END) {
+                    throw std::runtime_error("BGZF block overflow");
+                }
+            }
+
+            size_t deflatedLen = maxDeflated - s->avail_out;
+            size_t blockSize = kHeaderSize + deflatedLen + kFooterSize;
+            putLE16(block + 16, static_cast<uint16_t>(blockSize - 1));
+            char* footer = block + kHeaderSize + deflatedLen;
+            uLong crc = crc32(0L, reinterpret_cast<const Bytef*>(data), static_cast<uInt>(len));
+            putLE32(footer, static_cast<uint32_t>(crc));
+            putLE32(footer + 4, static_cast<uint32_t>(len));
+            out.resize(blockStart + blockSize);
+        }
+    }
+}
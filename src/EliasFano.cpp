@@ -0,0 +1,58 @@
+#include "EliasFano.hpp"
+
+constexpr uint64_t EliasFano::zeroSampleShift_;
+
+EliasFano::EliasFano(const std::vector<uint64_t>& values, uint64_t universe) :
+    n_(values.size()), universe_(universe) {
+
+    l_ = 0;
+    if (n_ > 0 and universe_ > n_) {
+        uint64_t ratio = universe_ / n_;
+        while (ratio >>= 1) { ++l_; }
+    }
+    lowMask_ = (l_ == 0) ? 0 : ((~uint64_t(0)) >> (64 - l_));
+
+    // one extra word so that reads of a value straddling the last
+    // word boundary never run off the end
+    low_.assign(((n_ * l_ + 63) >> 6) + 1, 0);
+    uint64_t numHighBits = n_ + (universe_ >> l_) + 1;
+    high_.assign(((numHighBits + 63) >> 6) + 1, 0);
+
+    for (uint64_t i = 0; i < n_; ++i) {
+        uint64_t v = values[i];
+        uint64_t hp = (v >> l_) + i;
+        high_[hp >> 6] |= uint64_t(1) << (hp & 63);
+        if (l_ > 0) {
+            uint64_t low = v & lowMask_;
+            uint64_t bitPos = i * l_;
+            uint64_t w = bitPos >> 6;
+            uint64_t off = bitPos & 63;
+            low_[w] |= low << off;
+            if (off + l_ > 64) { low_[w + 1] |= low >> (64 - off); }
+        }
+    }
+
+    // Sample the positions of the 0s in the upper bits
+    uint64_t numZeros{0};
+    for (uint64_t p = 0; p < numHighBits; ++p) {
+        if (!getBit_(high_, p)) {
+            if ((numZeros & ((uint64_t(1) << zeroSampleShift_) - 1)) == 0) {
+                zeroSamples_.push_back(p);
+            }
+            ++numZeros;
+        }
+    }
+}
+
+uint64_t EliasFano::access(uint64_t i) const {
+    // The i-th 1 of the upper bits is at (value >> l) + i
+    uint64_t w{0};
+    uint64_t k = i;
+    uint64_t c = __builtin_popcountll(high_[0]);
+    while (k >= c) {
+        k -= c;
+        c = __builtin_popcountll(high_[++w]);
+    }
+    uint64_t onePos = (w << 6) + selectInWord_(high_[w], k);
+    return ((onePos - i) << l_) | lowAt_(i);
+}
@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include "EliasFano.hpp"
+
+using namespace std;
+
+// Reference predecessor: index of the last value <= x
+static uint64_t NaivePredecessor(const vector<uint64_t>& vals, uint64_t x){
+  return distance(vals.begin(), upper_bound(vals.begin(), vals.end(), x)) - 1;
+}
+
+static void CheckAll(const vector<uint64_t>& vals, uint64_t universe){
+  EliasFano ef(vals, universe);
+  ASSERT_EQ(vals.size(), ef.size());
+  for (uint64_t i = 0; i < vals.size(); ++i){
+    ASSERT_EQ(vals[i], ef.access(i));
+  }
+  for (uint64_t x = 0; x < universe; ++x){
+    uint64_t v;
+    uint64_t i = ef.predecessor(x, v);
+    ASSERT_EQ(NaivePredecessor(vals, x), i);
+    ASSERT_EQ(vals[i], v);
+  }
+}
+
+TEST(EliasFano, single){
+  CheckAll({0}, 1);
+  CheckAll({0}, 1000);
+}
+
+TEST(EliasFano, dense){
+  vector<uint64_t> vals;
+  for (uint64_t i = 0; i < 1000; ++i) vals.push_back(i);
+  CheckAll(vals, 1000);
+}
+
+TEST(EliasFano, random){
+  mt19937_64 gen(42);
+  for (uint64_t trial = 0; trial < 20; ++trial){
+    uint64_t universe = 1 + gen() % 200000;
+    vector<uint64_t> vals = {0};
+    uint64_t p = 0;
+    while (true){
+      // mix of short and long gaps, like transcript lengths
+      p += 1 + ((gen() % 8 == 0) ? gen() % 20000 : gen() % 300);
+      if (p >= universe) break;
+      vals.push_back(p);
+    }
+    CheckAll(vals, universe);
+  }
+}
@@ -0,0 +1,209 @@
+#include "FastqBlockParser.hpp"
+#include "GzipStream.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace rapmap {
+    namespace io {
+
+        namespace simd {
+            const char* findNthNewline(const char* b, const char* e, size_t n, size_t& count) {
+                count = 0;
+                if (n == 0) { return b; }
+#ifdef __SSE2__
+                const __m128i nl = _mm_set1_epi8('\n');
+                while (e - b >= 16) {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+                    uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+                    size_t c = __builtin_popcount(mask);
+                    if (count + c >= n) {
+                        // the one we want is in these 16 bytes
+                        while (true) {
+                            if (++count == n) { return b + __builtin_ctz(mask) + 1; }
+                            mask &= mask - 1;
+                        }
+                    }
+                    count += c;
+                    b += 16;
+                }
+#endif // __SSE2__
+                for (; b < e; ++b) {
+                    if (*b == '\n' and ++count == n) { return b + 1; }
+                }
+                return nullptr;
+            }
+
+            void findNewlines(const char* b, const char* e, std::vector<const char*>& out) {
+#ifdef __SSE2__
+                const __m128i nl = _mm_set1_epi8('\n');
+                while (e - b >= 16) {
+                    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+                    uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+                    while (mask != 0) {
+                        out.push_back(b + __builtin_ctz(mask));
+                        mask &= mask - 1;
+                    }
+                    b += 16;
+                }
+#endif // __SSE2__
+                for (; b < e; ++b) {
+                    if (*b == '\n') { out.push_back(b); }
+                }
+            }
+        }
+
+        std::shared_ptr<BlockPool::Block> BlockPool::acquire(const std::shared_ptr<BlockPool>& pool, size_t minSize) {
+            Block* b{nullptr};
+            {
+                std::unique_lock<std::mutex> lock(pool->mutex_);
+                pool->blockFree_.wait(lock, [&pool]() -> bool {
+                        return !pool->free_.empty() or pool->blocks_.size() < pool->maxBlocks_;
+                        });
+                if (pool->free_.empty()) {
+                    pool->blocks_.emplace_back(new Block);
+                    b = pool->blocks_.back().get();
+                } else {
+                    b = pool->free_.back();
+                    pool->free_.pop_back();
+                }
+            }
+            if (b->capacity < minSize) {
+                b->data.reset(new char[minSize]);
+                b->capacity = minSize;
+            }
+            // the deleter keeps the pool alive until every block is back
+            std::shared_ptr<BlockPool> owner(pool);
+            return std::shared_ptr<Block>(b, [owner](Block* blk) { owner->release_(blk); });
+        }
+
+        void BlockPool::release_(Block* b) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                free_.push_back(b);
+            }
+            blockFree_.notify_one();
+        }
+
+        FastqSource::FastqSource(const std::string& fname, uint32_t decompressThreads,
+                                 std::shared_ptr<BlockPool> pool, size_t blockSize) :
+            fname_(fname), pool_(std::move(pool)), blockSize_(blockSize) {
+            int fd = ::open(fname.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::runtime_error("Can't open file '" + fname + "': " + std::strerror(errno));
+            }
+            struct stat st;
+            unsigned char magic[2] = {0, 0};
+            bool regular = (::fstat(fd, &st) == 0 and S_ISREG(st.st_mode));
+            bool gzipped = (regular and ::pread(fd, magic, 2, 0) == 2 and
+                            magic[0] == 0x1f and magic[1] == 0x8b);
+            if (regular and !gzipped) {
+                size_t len = static_cast<size_t>(st.st_size);
+                if (len == 0) {
+                    eof_ = true;
+                    ::close(fd);
+                    return;
+                }
+                void* map = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map != MAP_FAILED) {
+                    ::madvise(map, len, MADV_SEQUENTIAL);
+                    ::close(fd);
+                    const char* p = static_cast<const char*>(map);
+                    holder_ = std::shared_ptr<const char>(p, [len](const char* q) {
+                            ::munmap(const_cast<char*>(q), len);
+                            });
+                    cur_ = p;
+                    end_ = p + len;
+                    eof_ = true;
+                    return;
+                }
+            }
+            // gzipped, not a regular file, or not mappable: read it in blocks,
+            // through the descriptor we have (a pipe can't be opened twice)
+            FILE* file = ::fdopen(fd, "rb");
+            if (file == nullptr) {
+                ::close(fd);
+                throw std::runtime_error("Can't open file '" + fname + "': " + std::strerror(errno));
+            }
+            stream_ = openReadStream(file, fname, decompressThreads);
+        }
+
+        FastqSource::~FastqSource() {}
+
+        bool FastqSource::refill_(size_t minSize) {
+            size_t tail = end_ - cur_;
+            auto block = BlockPool::acquire(pool_, std::max(minSize, tail + blockSize_ / 2));
+            char* data = block->data.get();
+            if (tail > 0) { std::memcpy(data, cur_, tail); }
+            stream_->read(data + tail, block->capacity - tail);
+            size_t got = static_cast<size_t>(stream_->gcount());
+            if (got < block->capacity - tail) { eof_ = true; }
+            holder_ = std::shared_ptr<const char>(block, data);
+            cur_ = data;
+            end_ = data + tail + got;
+            return got > 0;
+        }
+
+        size_t FastqSource::take(size_t n, const char*& b, const char*& e,
+                                 std::shared_ptr<const char>& holder) {
+            if (n == 0) { return 0; }
+            size_t minSize = blockSize_;
+            while (true) {
+                size_t count{0};
+                const char* p = simd::findNthNewline(cur_, end_, 4 * n, count);
+                if (p != nullptr) {
+                    b = cur_;
+                    e = p;
+                    cur_ = p;
+                    holder = holder_;
+                    return n;
+                }
+                if (!eof_) {
+                    // if a full block didn't hold n records, try a bigger one
+                    if (static_cast<size_t>(end_ - cur_) * 2 > minSize) { minSize *= 2; }
+                    refill_(minSize);
+                    continue;
+                }
+
+                // The end of the file: take the complete records that are left
+                size_t records = count / 4;
+                const char* recEnd = cur_;
+                if (records > 0) {
+                    size_t c;
+                    recEnd = simd::findNthNewline(cur_, end_, 4 * records, c);
+                }
+                size_t restNewlines = count - 4 * records;
+                bool restBlank = std::all_of(recEnd, end_, [](char c) -> bool {
+                        return c == '\n' or c == '\r';
+                        });
+                const char* last = end_;
+                if (!restBlank) {
+                    // a last record without a final newline
+                    if (restNewlines != 3 or end_[-1] == '\n') {
+                        throw std::runtime_error("Truncated FASTQ file '" + fname_ + "'");
+                    }
+                    ++records;
+                } else {
+                    last = recEnd;
+                }
+                b = cur_;
+                e = last;
+                cur_ = end_;
+                holder = holder_;
+                return records;
+            }
+        }
+    }
+}
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "FastqBlockParser.hpp"
+
+using namespace std;
+using rapmap::io::FastqBlockParser;
+
+static string TempName(){
+  char name[] = "/tmp/rapmap_fqXXXXXX";
+  int fd = mkstemp(name);
+  close(fd);
+  return name;
+}
+
+static string Reads(size_t n, const string& suffix){
+  string s;
+  for (size_t i = 0; i < n; ++i){
+    s += "@read" + to_string(i) + suffix + "\nACGTACGTTGCA\n+\nIIIIIIIIIIII\n";
+  }
+  return s;
+}
+
+static string Gzip(const string& s){
+  string fname = TempName();
+  gzFile f = gzopen(fname.c_str(), "wb");
+  gzwrite(f, s.data(), s.size());
+  gzclose(f);
+  ifstream in(fname, ios::binary);
+  stringstream ss;
+  ss << in.rdbuf();
+  remove(fname.c_str());
+  return ss.str();
+}
+
+// A FIFO fed by a thread, as a process substitution would be
+struct Pipe {
+  explicit Pipe(const string& contents) : name(TempName()){
+    remove(name.c_str());
+    EXPECT_EQ(0, mkfifo(name.c_str(), 0600));
+    writer = thread([this, contents](){
+      FILE* f = fopen(name.c_str(), "wb");
+      fwrite(contents.data(), 1, contents.size(), f);
+      fclose(f);
+    });
+  }
+  ~Pipe(){
+    writer.join();
+    remove(name.c_str());
+  }
+  string name;
+  thread writer;
+};
+
+// The headers of the records, in the order the parser handed them out
+template <typename ParserT>
+static vector<string> Headers(ParserT& parser, uint32_t numMates){
+  vector<string> headers;
+  while (true){
+    typename ParserT::job j(parser);
+    if (j.is_empty()) break;
+    for (size_t i = 0; i < j->nb_filled; ++i){
+      for (uint32_t m = 0; m < numMates; ++m){
+        headers.push_back(rapmap::io::mateRecord(j->data[i], m).header);
+      }
+    }
+  }
+  return headers;
+}
+
+static vector<string> Expected(size_t n, const vector<string>& suffixes){
+  vector<string> headers;
+  for (size_t i = 0; i < n; ++i){
+    for (auto& s : suffixes) headers.push_back("read" + to_string(i) + s);
+  }
+  return headers;
+}
+
+TEST(FastqBlockParser, single_end_pipe){
+  const size_t n = 20000;
+  for (auto& contents : {Reads(n, ""), Gzip(Reads(n, ""))}){
+    Pipe pipe(contents);
+    FastqBlockParser<jellyfish::sequence_list, 1> parser({pipe.name}, 1000, 1);
+    ASSERT_EQ(Expected(n, {""}), Headers(parser, 1));
+  }
+}
+
+TEST(FastqBlockParser, paired_end_pipe){
+  const size_t n = 20000;
+  Pipe left(Reads(n, "/1"));
+  Pipe right(Gzip(Reads(n, "/2")));
+  FastqBlockParser<sequence_list, 2> parser({left.name, right.name}, 1000, 1);
+  ASSERT_EQ(Expected(n, {"/1", "/2"}), Headers(parser, 2));
+}
+
+// The records are filled in when the job's reads are first looked at, not
+// when the job is taken
+TEST(FastqBlockParser, records_filled_on_first_use){
+  string fname = TempName();
+  ofstream(fname, ios::binary) << "@r0\nACGT\n+\nIIII\n@r1\nACGT\n+\nII\n";
+  FastqBlockParser<jellyfish::sequence_list, 1> parser({fname}, 1000, 1);
+  typename FastqBlockParser<jellyfish::sequence_list, 1>::job j(parser);
+  ASSERT_FALSE(j.is_empty());
+  ASSERT_THROW(j->nb_filled, runtime_error);
+  remove(fname.c_str());
+}
@@ -0,0 +1,426 @@
+#include "GzipStream.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <zlib.h>
+
+namespace rapmap {
+    namespace io {
+
+        namespace {
+            // Decompressed (serial) or compressed (BGZF) bytes per task
+            constexpr size_t kTaskSize = 1 << 20;
+            constexpr size_t kReadSize = 1 << 20;
+            constexpr size_t kGzipFixedHeader = 12;
+
+            inline uint16_t getLE16(const char* p) {
+                return static_cast<uint16_t>(static_cast<uint8_t>(p[0]) |
+                                             (static_cast<uint8_t>(p[1]) << 8));
+            }
+
+            inline uint32_t getLE32(const char* p) {
+                return static_cast<uint32_t>(getLE16(p)) |
+                       (static_cast<uint32_t>(getLE16(p + 2)) << 16);
+            }
+
+            inline bool isGzipMagic(const char* p) {
+                return static_cast<uint8_t>(p[0]) == 0x1f and static_cast<uint8_t>(p[1]) == 0x8b;
+            }
+
+            // Bytes read from the file but not yet consumed
+            struct InputBuffer {
+                std::string data;
+                size_t pos{0};
+
+                size_t available() const { return data.size() - pos; }
+                const char* begin() const { return data.data() + pos; }
+
+                // Make sure at least n bytes are available; false if the file ends first
+                bool ensure(FILE* f, size_t n) {
+                    if (available() >= n) { return true; }
+                    data.erase(0, pos);
+                    pos = 0;
+                    while (data.size() < n) {
+                        size_t oldSize = data.size();
+                        data.resize(oldSize + std::max(kReadSize, n - oldSize));
+                        size_t got = std::fread(&data[oldSize], 1, data.size() - oldSize, f);
+                        data.resize(oldSize + got);
+                        if (got == 0) { return false; }
+                    }
+                    return true;
+                }
+            };
+
+            /**
+             * If the member at the front of in is a BGZF block, return its
+             * total size; otherwise 0.  Requires the fixed header and the
+             * extra field (if any) to be in in.
+             */
+            size_t bgzfBlockSize(const char* p, size_t avail) {
+                uint8_t flags = static_cast<uint8_t>(p[3]);
+                if (!(flags & 0x04)) { return 0; } // no FEXTRA
+                uint16_t xlen = getLE16(p + 10);
+                if (avail < kGzipFixedHeader + xlen) { return 0; }
+                const char* x = p + kGzipFixedHeader;
+                const char* xend = x + xlen;
+                while (x + 4 <= xend) {
+                    uint16_t slen = getLE16(x + 2);
+                    if (x[0] == 'B' and x[1] == 'C' and slen == 2 and x + 6 <= xend) {
+                        return static_cast<size_t>(getLE16(x + 4)) + 1;
+                    }
+                    x += 4 + slen;
+                }
+                return 0;
+            }
+        }
+
+        GzipDecompressor::GzipDecompressor(FILE* file, std::string prefix,
+                                           const std::string& fname, uint32_t numThreads) :
+            fname_(fname), file_(file), prefix_(std::move(prefix)) {
+            numThreads = std::max(numThreads, uint32_t(1));
+            maxQueued_ = 2 * numThreads + 2;
+            for (uint32_t i = 0; i < numThreads; ++i) {
+                workers_.emplace_back(&GzipDecompressor::inflateLoop_, this);
+            }
+            reader_ = std::thread(&GzipDecompressor::readLoop_, this);
+        }
+
+        GzipDecompressor::~GzipDecompressor() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            workAvailable_.notify_all();
+            spaceAvailable_.notify_all();
+            if (reader_.joinable()) { reader_.join(); }
+            for (auto& t : workers_) { t.join(); }
+            if (file_ != nullptr) { std::fclose(file_); }
+        }
+
+        bool GzipDecompressor::next(std::string& chunk) {
+            Task* t{nullptr};
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                taskDone_.wait(lock, [this]() -> bool {
+                        return !error_.empty() or
+                               (!queue_.empty() and queue_.front()->done) or
+                               (queue_.empty() and readDone_);
+                        });
+                if (!error_.empty()) {
+                    std::cerr << "error reading " << fname_ << ": " << error_ << "\n";
+                    std::exit(1);
+                }
+                if (queue_.empty()) { return false; }
+                t = queue_.front();
+                queue_.pop_front();
+                --nextToInflate_;
+            }
+            spaceAvailable_.notify_one();
+            // the task takes the caller's old buffer, for reuse
+            chunk.swap(t->out);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                free_.push_back(t);
+            }
+            return true;
+        }
+
+        GzipDecompressor::Task* GzipDecompressor::newTask_() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Task* t{nullptr};
+            if (free_.empty()) {
+                tasks_.emplace_back(new Task);
+                t = tasks_.back().get();
+            } else {
+                t = free_.back();
+                free_.pop_back();
+            }
+            t->in.clear();
+            t->out.clear();
+            t->done = false;
+            return t;
+        }
+
+        void GzipDecompressor::submit_(Task* t) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                spaceAvailable_.wait(lock, [this]() -> bool {
+                        return queue_.size() < maxQueued_ or stopping_;
+                        });
+                queue_.push_back(t);
+            }
+            workAvailable_.notify_one();
+        }
+
+        void GzipDecompressor::fail_(const std::string& msg) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (error_.empty()) { error_ = msg; }
+                stopping_ = true;
+            }
+            taskDone_.notify_all();
+            workAvailable_.notify_all();
+            spaceAvailable_.notify_all();
+        }
+
+        void GzipDecompressor::readLoop_() {
+            std::string pending;
+            if (!readBGZF_(pending)) {
+                readSerial_(pending);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                readDone_ = true;
+            }
+            workAvailable_.notify_all();
+            taskDone_.notify_all();
+        }
+
+        /**
+         * Read whole BGZF blocks and queue them, in batches, for the
+         * workers.  Returns false, leaving the unconsumed input in pending,
+         * as soon as a member isn't a BGZF block.
+         */
+        bool GzipDecompressor::readBGZF_(std::string& pending) {
+            InputBuffer in;
+            in.data.swap(prefix_);
+            Task* t = newTask_();
+            bool isBGZF{true};
+            while (true) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (stopping_) { break; }
+                }
+                if (!in.ensure(file_, kGzipFixedHeader)) {
+                    if (in.available() > 0) { fail_("truncated gzip header"); }
+                    break;
+                }
+                const char* p = in.begin();
+                if (!isGzipMagic(p)) {
+                    fail_("not in gzip format");
+                    break;
+                }
+                size_t xlen = (static_cast<uint8_t>(p[3]) & 0x04) ? getLE16(p + 10) : 0;
+                if (!in.ensure(file_, kGzipFixedHeader + xlen)) {
+                    fail_("truncated gzip header");
+                    break;
+                }
+                size_t blockSize = bgzfBlockSize(in.begin(), in.available());
+                if (blockSize == 0) {
+                    isBGZF = false;
+                    break;
+                }
+                if (!in.ensure(file_, blockSize)) {
+                    fail_("truncated BGZF block");
+                    break;
+                }
+                t->in.append(in.begin(), blockSize);
+                in.pos += blockSize;
+                if (t->in.size() >= kTaskSize) {
+                    submit_(t);
+                    t = newTask_();
+                }
+            }
+            if (!t->in.empty()) {
+                submit_(t);
+            } else {
+                std::lock_guard<std::mutex> lock(mutex_);
+                free_.push_back(t);
+            }
+            pending.assign(in.begin(), in.available());
+            return isBGZF;
+        }
+
+        /**
+         * Inflate the rest of the file (starting with the bytes in
+         * pending) on this thread, member after member, and queue the
+         * output in kTaskSize chunks.
+         */
+        void GzipDecompressor::readSerial_(std::string& pending) {
+            InputBuffer in;
+            in.data.swap(pending);
+
+            z_stream strm;
+            std::memset(&strm, 0, sizeof(strm));
+            // 16 + MAX_WBITS: expect a gzip wrapper
+            if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK) {
+                fail_("could not initialize zlib");
+                return;
+            }
+
+            Task* t = newTask_();
+            t->out.resize(kTaskSize);
+            size_t outUsed{0};
+            bool inMember{true};
+            while (true) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (stopping_) { break; }
+                }
+                if (!in.ensure(file_, 1)) {
+                    if (inMember) { fail_("unexpected end of file"); }
+                    break;
+                }
+                strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.begin()));
+                strm.avail_in = static_cast<uInt>(in.available());
+                strm.next_out = reinterpret_cast<Bytef*>(&t->out[outUsed]);
+                strm.avail_out = static_cast<uInt>(t->out.size() - outUsed);
+
+                int ret = inflate(&strm, Z_NO_FLUSH);
+                in.pos += in.available() - strm.avail_in;
+                outUsed = t->out.size() - strm.avail_out;
+
+                if (ret == Z_STREAM_END) {
+                    // Another member may follow; anything else (e.g. zero
+                    // padding) ends the file, as it does for gzip -d.
+                    inMember = false;
+                    if (in.ensure(file_, 2) and isGzipMagic(in.begin())) {
+                        inflateReset(&strm);
+                        inMember = true;
+                    } else {
+                        break;
+                    }
+                } else if (ret != Z_OK and ret != Z_BUF_ERROR) {
+                    fail_((strm.msg != nullptr) ? strm.msg : "corrupt gzip data");
+                    break;
+                }
+
+                if (outUsed == t->out.size()) {
+                    submit_(t);
+                    t = newTask_();
+                    t->out.resize(kTaskSize);
+                    outUsed = 0;
+                }
+            }
+            inflateEnd(&strm);
+
+            t->out.resize(outUsed);
+            if (!t->out.empty()) {
+                submit_(t);
+            } else {
+                std::lock_guard<std::mutex> lock(mutex_);
+                free_.push_back(t);
+            }
+        }
+
+        void GzipDecompressor::inflateLoop_() {
+            while (true) {
+                Task* t{nullptr};
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    workAvailable_.wait(lock, [this]() -> bool {
+                            return nextToInflate_ < queue_.size() or readDone_ or stopping_;
+                            });
+                    if (stopping_ or nextToInflate_ >= queue_.size()) { break; }
+                    t = queue_[nextToInflate_++];
+                }
+                // serial-mode tasks come already inflated
+                if (!t->in.empty()) { inflateBlocks_(*t); }
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    t->done = true;
+                }
+                taskDone_.notify_all();
+            }
+        }
+
+        void GzipDecompressor::inflateBlocks_(Task& t) {
+            z_stream strm;
+            std::memset(&strm, 0, sizeof(strm));
+            // negative window bits: raw deflate, we handle the BGZF framing
+            if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+                fail_("could not initialize zlib");
+                return;
+            }
+
+            const char* p = t.in.data();
+            const char* end = p + t.in.size();
+            while (p < end) {
+                size_t blockSize = bgzfBlockSize(p, end - p);
+                size_t headerSize = kGzipFixedHeader + getLE16(p + 10);
+                uint32_t crc = getLE32(p + blockSize - 8);
+                uint32_t isize = getLE32(p + blockSize - 4);
+
+                size_t outStart = t.out.size();
+                t.out.resize(outStart + isize);
+                inflateReset(&strm);
+                strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(p + headerSize));
+                strm.avail_in = static_cast<uInt>(blockSize - headerSize - 8);
+                // zlib won't accept a null next_out, even for an empty block
+                Bytef dummy;
+                strm.next_out = (isize > 0) ? reinterpret_cast<Bytef*>(&t.out[outStart]) : &dummy;
+                strm.avail_out = static_cast<uInt>(isize);
+                int ret = inflate(&strm, Z_FINISH);
+                if (ret != Z_STREAM_END or strm.avail_out != 0) {
+                    fail_("corrupt BGZF block");
+                    break;
+                }
+                uLong blockCrc = crc32(0L, reinterpret_cast<const Bytef*>(t.out.data() + outStart), isize);
+                if (static_cast<uint32_t>(blockCrc) != crc) {
+                    fail_("BGZF block CRC mismatch");
+                    break;
+                }
+                p += blockSize;
+            }
+            inflateEnd(&strm);
+        }
+
+        GzipStreamBuf::int_type GzipStreamBuf::underflow() {
+            if (gptr() < egptr()) { return traits_type::to_int_type(*gptr()); }
+            do {
+                if (!decompressor_.next(chunk_)) { return traits_type::eof(); }
+            } while (chunk_.empty());
+            char* b = &chunk_[0];
+            setg(b, b, b + chunk_.size());
+            return traits_type::to_int_type(*gptr());
+        }
+
+        FileStreamBuf::int_type FileStreamBuf::underflow() {
+            if (gptr() < egptr()) { return traits_type::to_int_type(*gptr()); }
+            // the prefix is the first buffer's worth
+            if (started_ or buffer_.empty()) {
+                buffer_.resize(kReadSize);
+                size_t got = std::fread(&buffer_[0], 1, buffer_.size(), file_);
+                if (got == 0 and std::ferror(file_)) {
+                    throw std::runtime_error("error reading '" + fname_ + "': " +
+                                             std::strerror(errno));
+                }
+                buffer_.resize(got);
+            }
+            started_ = true;
+            if (buffer_.empty()) { return traits_type::eof(); }
+            char* b = &buffer_[0];
+            setg(b, b, b + buffer_.size());
+            return traits_type::to_int_type(*gptr());
+        }
+
+        std::unique_ptr<std::istream> openReadStream(const std::string& fname, uint32_t numThreads) {
+            FILE* file = std::fopen(fname.c_str(), "rb");
+            if (file == nullptr) {
+                throw std::runtime_error("Can't open file '" + fname + "': " + std::strerror(errno));
+            }
+            return openReadStream(file, fname, numThreads);
+        }
+
+        std::unique_ptr<std::istream> openReadStream(FILE* file, const std::string& fname,
+                                                     uint32_t numThreads) {
+            // Sniff the magic number through the same handle (a pipe can't
+            // be reopened or rewound) and hand what we read to the stream.
+            std::string prefix(2, '\0');
+            size_t got = std::fread(&prefix[0], 1, prefix.size(), file);
+            if (std::ferror(file)) {
+                int err = errno;
+                std::fclose(file);
+                throw std::runtime_error("error reading '" + fname + "': " + std::strerror(err));
+            }
+            prefix.resize(got);
+            if (got == 2 and isGzipMagic(prefix.data())) {
+                return std::unique_ptr<std::istream>(new GzipIStream(file, std::move(prefix), fname, numThreads));
+            }
+            return std::unique_ptr<std::istream>(new FileIStream(file, std::move(prefix), fname));
+        }
+    }
+}
@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "GzipStream.hpp"
+
+using namespace std;
+
+static string TempName(){
+  char name[] = "/tmp/rapmap_gzXXXXXX";
+  int fd = mkstemp(name);
+  close(fd);
+  return name;
+}
+
+static string Reads(size_t n){
+  string s;
+  for (size_t i = 0; i < n; ++i){
+    s += "@read" + to_string(i) + "\nACGTACGTTGCA\n+\nIIIIIIIIIIII\n";
+  }
+  return s;
+}
+
+static string Gzip(const string& s){
+  string fname = TempName();
+  gzFile f = gzopen(fname.c_str(), "wb");
+  gzwrite(f, s.data(), s.size());
+  gzclose(f);
+  ifstream in(fname, ios::binary);
+  stringstream ss;
+  ss << in.rdbuf();
+  remove(fname.c_str());
+  return ss.str();
+}
+
+static string ReadAll(istream& in){
+  stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+// Read contents through a FIFO, as from a process substitution
+static string ReadThroughPipe(const string& contents){
+  string fname = TempName();
+  remove(fname.c_str());
+  EXPECT_EQ(0, mkfifo(fname.c_str(), 0600));
+  thread writer([&](){
+    FILE* f = fopen(fname.c_str(), "wb");
+    fwrite(contents.data(), 1, contents.size(), f);
+    fclose(f);
+  });
+  auto in = rapmap::io::openReadStream(fname, 2);
+  string res = ReadAll(*in);
+  writer.join();
+  remove(fname.c_str());
+  return res;
+}
+
+TEST(GzipStream, regular_file){
+  string reads = Reads(1000);
+  for (auto& contents : {reads, Gzip(reads)}){
+    string fname = TempName();
+    ofstream(fname, ios::binary) << contents;
+    auto in = rapmap::io::openReadStream(fname, 2);
+    ASSERT_EQ(reads, ReadAll(*in));
+    remove(fname.c_str());
+  }
+}
+
+TEST(GzipStream, pipe){
+  string reads = Reads(100000);
+  ASSERT_EQ(reads, ReadThroughPipe(reads));
+  ASSERT_EQ(reads, ReadThroughPipe(Gzip(reads)));
+}
+
+TEST(GzipStream, short_and_empty){
+  ASSERT_EQ("", ReadThroughPipe(""));
+  ASSERT_EQ("@", ReadThroughPipe("@"));
+}
+
+TEST(GzipStream, missing_file){
+  ASSERT_THROW(rapmap::io::openReadStream("/nonexistent/reads.fq", 2), runtime_error);
+}
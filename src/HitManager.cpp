@@ -46,15 +46,11 @@ namespace rapmap {
 	            auto startOffset = hits.size();
                 for (auto& ph : processedHits) {
                         // If this is an *active* position list
-                        if (ph.second.active) {
-                                auto tid = ph.first;
-				auto minPosIt = std::min_element(ph.second.tqvec.begin(),
-						ph.second.tqvec.end(),
-						[](const SATxpQueryPos& a, const SATxpQueryPos& b) -> bool {
-						    return a.pos < b.pos;
-						});
-                                bool hitRC = minPosIt->queryRC;
-                                int32_t hitPos = minPosIt->pos - minPosIt->queryPos;
+                        if (ph.active) {
+                                auto tid = ph.tid;
+                                auto& minPos = processedHits.minPos(ph);
+                                bool hitRC = minPos.queryRC;
+                                int32_t hitPos = minPos.pos - minPos.queryPos;
                                 bool isFwd = !hitRC;
                                 hits.emplace_back(tid, hitPos, isFwd, readLen);
                                 hits.back().mateStatus = mateStatus;
@@ -345,34 +341,66 @@ namespace rapmap {
 
 
         template <typename RapMapIndexT>
-        void intersectSAIntervalWithOutput(SAIntervalHit<typename RapMapIndexT::IndexType>& h,
-                                           RapMapIndexT& rmi,
-                                           uint32_t intervalCounter,
-                                           SAHitMap& outHits) {
+        size_t intersectSAIntervalWithOutput(SAIntervalHit<typename RapMapIndexT::IndexType>& h,
+                                             RapMapIndexT& rmi,
+                                             SALocator<RapMapIndexT>& locator,
+                                             uint32_t intervalCounter,
+                                             SAHitMap& outHits,
+                                             const TxpBitmap* txpFilter) {
             using OffsetT = typename RapMapIndexT::IndexType;
             // Convenient bindings for variables we'll use
             auto& SA = rmi.SA;
             //auto& txpIDs = rmi.positionIDs;
             auto& rankDict = rmi.rankDict;
-            auto& txpStarts = rmi.txpOffsets;
+            size_t numAlive{0};
+
+            // A wide interval is located in bulk; since both the located
+            // hits and outHits are sorted by transcript, we can then
+            // intersect them with a single merge.
+            if (static_cast<size_t>(h.end - h.begin) >= SALocator<RapMapIndexT>::wideIntervalThreshold) {
+              auto& located = locator.locate(h.begin, h.end);
+              auto txpEntry = outHits.begin();
+              auto txpEntryEnd = outHits.end();
+              for (auto& lh : located) {
+                while (txpEntry != txpEntryEnd and txpEntry->tid < lh.tid) { ++txpEntry; }
+                if (txpEntry == txpEntryEnd) { break; }
+                if (txpEntry->tid == lh.tid) {
+                  if (txpEntry->numActive == intervalCounter - 1) {
+                    ++txpEntry->numActive;
+                    ++numAlive;
+                  }
+                  if (txpEntry->numActive == intervalCounter) {
+                    outHits.append(*txpEntry, lh.pos, h.queryPos, h.queryRC);
+                  }
+                }
+              }
+              return numAlive;
+            }
 
             // Walk through every hit in the new interval 'h'
             for (OffsetT i = h.begin; i != h.end; ++i) {
               //auto txpID = txpIDs[SA[i]];
               // auto txpID = rankDict.Rank(SA[i], 1);
-              auto txpID = rmi.transcriptAtPosition(SA[i]);
-              auto txpListIt = outHits.find(txpID);
+              OffsetT txpStart;
+              auto txpID = rmi.transcriptAtPosition(SA[i], txpStart);
+              // The bit test is cheaper than the search of outHits
+              if (txpFilter and !txpFilter->contains(txpID)) { continue; }
+              auto txpEntry = outHits.find(txpID);
               // If we found this transcript
               // Add this position to the list
-              if (txpListIt != outHits.end()) {
-                txpListIt->second.numActive += (txpListIt->second.numActive == intervalCounter - 1) ? 1 : 0;
-                if (txpListIt->second.numActive == intervalCounter) {
+              if (txpEntry != nullptr) {
+                if (txpEntry->numActive == intervalCounter - 1) {
+                  ++txpEntry->numActive;
+                  ++numAlive;
+                }
+                if (txpEntry->numActive == intervalCounter) {
                   auto globalPos = SA[i];
-                  auto localPos = globalPos - txpStarts[txpID];
-                  txpListIt->second.tqvec.emplace_back(localPos, h.queryPos, h.queryRC);
+                  auto localPos = globalPos - txpStart;
+                  outHits.append(*txpEntry, localPos, h.queryPos, h.queryRC);
                 }
               }
             }
+            return numAlive;
           }
 
 
@@ -575,10 +603,13 @@ namespace rapmap {
         }
 
         template <typename RapMapIndexT>
-        SAHitMap intersectSAHits(
+        void intersectSAHits(
                 std::vector<SAIntervalHit<typename RapMapIndexT::IndexType>>& inHits,
                 RapMapIndexT& rmi,
-                bool strictFilter 
+                SALocator<RapMapIndexT>& locator,
+                SAHitMap& outHits,
+                bool strictFilter,
+                const TxpBitmap* txpFilter
                 ) {
             using OffsetT = typename RapMapIndexT::IndexType;
             // Each inHit is a SAIntervalHit structure that contains
@@ -591,18 +622,13 @@ namespace rapmap {
 
             // Check this --- we should never call this function
             // with less than 2 hits.
-            SAHitMap outHits;
+            outHits.clear();
             if (inHits.size() < 2) {
                 std::cerr << "intersectHitsSA() called with < 2 hits "
                     " hits; this shouldn't happen\n";
-                return outHits;
+                return;
             }
 
-            auto& SA = rmi.SA;
-            auto& txpStarts = rmi.txpOffsets;
-            //auto& txpIDs = rmi.positionIDs;
-	    auto& rankDict = rmi.rankDict;
-
             // Start with the smallest interval
             // i.e. interval with the fewest hits.
             SAIntervalHit<OffsetT>* minHit = &inHits[0];
@@ -615,22 +641,23 @@ namespace rapmap {
             //outHits.reserve(minHit->span());
             // =========
             { // Add the info from minHit to outHits
-                for (OffsetT i = minHit->begin; i < minHit->end; ++i) {
-                    auto globalPos = SA[i];
-                    //auto tid = txpIDs[globalPos];
-                    auto tid = rmi.transcriptAtPosition(globalPos);
-                    auto txpPos = globalPos - txpStarts[tid];
-                    outHits[tid].tqvec.emplace_back(txpPos, minHit->queryPos, minHit->queryRC);
+                for (auto& lh : locator.locate(minHit->begin, minHit->end)) {
+                    if (txpFilter and !txpFilter->contains(lh.tid)) { continue; }
+                    outHits.addSeed(lh.tid, lh.pos, minHit->queryPos, minHit->queryRC);
                 }
+                outHits.seal();
             }
             // =========
 
             // Now intersect everything in inHits (apart from minHits)
-            // to get the final set of mapping info.
+            // to get the final set of mapping info.  Once no transcript
+            // is hit by every interval so far, none can be hit by all.
             size_t intervalCounter{2};
+            size_t numAlive = outHits.size();
             for (auto& h : inHits) {
+                if (numAlive == 0) { break; }
                 if (&h != minHit) { // don't intersect minHit with itself
-                    intersectSAIntervalWithOutput(h, rmi, intervalCounter, outHits);
+                    numAlive = intersectSAIntervalWithOutput(h, rmi, locator, intervalCounter, outHits, txpFilter);
                     ++intervalCounter;
                 }
             }
@@ -638,12 +665,11 @@ namespace rapmap {
             size_t requiredNumHits = inHits.size();
             // Mark as active any transcripts with the required number of hits.
             for (auto it = outHits.begin(); it != outHits.end(); ++it) {
-                bool enoughHits = (it->second.numActive >= requiredNumHits);
-                it->second.active = (strictFilter) ? 
-                    (enoughHits and it->second.checkConsistent(requiredNumHits)) :
+                bool enoughHits = (it->numActive >= requiredNumHits);
+                it->active = (strictFilter) ?
+                    (enoughHits and outHits.checkConsistent(*it, requiredNumHits)) :
                     (enoughHits);
             }
-            return outHits;
         }
 
 
@@ -658,43 +684,63 @@ namespace rapmap {
       using SAIndex64BitPerfect = RapMapSAIndex<int64_t, BooMap<uint64_t, rapmap::utils::SAInterval<int64_t>>>;
 
         template
-        void intersectSAIntervalWithOutput<SAIndex32BitDense>(SAIntervalHit<int32_t>& h,
+        size_t intersectSAIntervalWithOutput<SAIndex32BitDense>(SAIntervalHit<int32_t>& h,
                                                               SAIndex32BitDense& rmi, 
+                                                              SALocator<SAIndex32BitDense>& locator,
                                                               uint32_t intervalCounter, 
-                                                              SAHitMap& outHits);
+                                                              SAHitMap& outHits,
+                                                              const TxpBitmap* txpFilter);
 
         template
-        void intersectSAIntervalWithOutput<SAIndex64BitDense>(SAIntervalHit<int64_t>& h,
+        size_t intersectSAIntervalWithOutput<SAIndex64BitDense>(SAIntervalHit<int64_t>& h,
                                                               SAIndex64BitDense& rmi, 
+                                                              SALocator<SAIndex64BitDense>& locator,
                                                               uint32_t intervalCounter, 
-                                                              SAHitMap& outHits); 
+                                                              SAHitMap& outHits,
+                                                              const TxpBitmap* txpFilter); 
 
         template
-        SAHitMap intersectSAHits<SAIndex32BitDense>(std::vector<SAIntervalHit<int32_t>>& inHits,
-                                                    SAIndex32BitDense& rmi, bool strictFilter);
+        void intersectSAHits<SAIndex32BitDense>(std::vector<SAIntervalHit<int32_t>>& inHits,
+                                                    SAIndex32BitDense& rmi,
+                                                    SALocator<SAIndex32BitDense>& locator,
+                                                    SAHitMap& outHits, bool strictFilter,
+                                                    const TxpBitmap* txpFilter);
 
         template
-        SAHitMap intersectSAHits<SAIndex64BitDense>(std::vector<SAIntervalHit<int64_t>>& inHits,
-          SAIndex64BitDense& rmi, bool strictFilter);
+        void intersectSAHits<SAIndex64BitDense>(std::vector<SAIntervalHit<int64_t>>& inHits,
+          SAIndex64BitDense& rmi,
+          SALocator<SAIndex64BitDense>& locator,
+          SAHitMap& outHits, bool strictFilter,
+                                                    const TxpBitmap* txpFilter);
 
         template
-        void intersectSAIntervalWithOutput<SAIndex32BitPerfect>(SAIntervalHit<int32_t>& h,
+        size_t intersectSAIntervalWithOutput<SAIndex32BitPerfect>(SAIntervalHit<int32_t>& h,
                                                                 SAIndex32BitPerfect& rmi, 
+                                                                SALocator<SAIndex32BitPerfect>& locator,
                                                                 uint32_t intervalCounter, 
-                                                                SAHitMap& outHits);
+                                                                SAHitMap& outHits,
+                                                                const TxpBitmap* txpFilter);
 
         template
-        void intersectSAIntervalWithOutput<SAIndex64BitPerfect>(SAIntervalHit<int64_t>& h,
+        size_t intersectSAIntervalWithOutput<SAIndex64BitPerfect>(SAIntervalHit<int64_t>& h,
                                                                 SAIndex64BitPerfect& rmi, 
+                                                                SALocator<SAIndex64BitPerfect>& locator,
                                                                 uint32_t intervalCounter, 
-                                                                SAHitMap& outHits);
+                                                                SAHitMap& outHits,
+                                                                const TxpBitmap* txpFilter);
 
         template
-        SAHitMap intersectSAHits<SAIndex32BitPerfect>(std::vector<SAIntervalHit<int32_t>>& inHits,
-                                                      SAIndex32BitPerfect& rmi, bool strictFilter);
+        void intersectSAHits<SAIndex32BitPerfect>(std::vector<SAIntervalHit<int32_t>>& inHits,
+                                                      SAIndex32BitPerfect& rmi,
+                                                      SALocator<SAIndex32BitPerfect>& locator,
+                                                      SAHitMap& outHits, bool strictFilter,
+                                                    const TxpBitmap* txpFilter);
 
         template
-        SAHitMap intersectSAHits<SAIndex64BitPerfect>(std::vector<SAIntervalHit<int64_t>>& inHits,
-                                                      SAIndex64BitPerfect& rmi, bool strictFilter);
+        void intersectSAHits<SAIndex64BitPerfect>(std::vector<SAIntervalHit<int64_t>>& inHits,
+                                                      SAIndex64BitPerfect& rmi,
+                                                      SALocator<SAIndex64BitPerfect>& locator,
+                                                      SAHitMap& outHits, bool strictFilter,
+                                                    const TxpBitmap* txpFilter);
     }
 }
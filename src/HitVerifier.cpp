@@ -0,0 +1,98 @@
+#include "HitVerifier.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace rapmap {
+    namespace verify {
+
+        /*
+         * Lane l of a row holds D[i][l - kMaxBand]: the distance between
+         * query[0, i) and the reference up to the (i + l - kMaxBand)-th
+         * character after the expected start.  Row 0 is 0 across the band
+         * (the query can start on any of its diagonals), and
+         *
+         *   D[i][j] = min(D[i-1][j] + mismatch,  // (mis)match
+         *                 D[i-1][j+1] + 1,       // an extra query base
+         *                 D[i][j-1] + 1)         // an extra reference base
+         *
+         * The last term chains along the row, so it's applied as a prefix
+         * scan of shifts by 1, 2, 4 and 8 lanes.  Lanes outside the band
+         * are pinned at 255.
+         */
+        uint32_t bandedEditDistance(const char* query, uint32_t m, const char* ref,
+                                    uint32_t band, uint32_t maxEdits) {
+            if (band > kMaxBand) { band = kMaxBand; }
+            // the distances saturate at 255
+            uint32_t cap = std::min(maxEdits, 254u);
+            uint8_t outside[16];
+            for (uint32_t l = 0; l < 16; ++l) {
+                outside[l] = (l + band >= kMaxBand and l <= kMaxBand + band) ? 0 : 0xff;
+            }
+            uint32_t dist{0};
+#ifdef __SSE2__
+            const __m128i ones = _mm_set1_epi8(1);
+            const __m128i wildcard = _mm_set1_epi8(kWildcard);
+            const __m128i allSet = _mm_set1_epi8(-1);
+            const __m128i outMask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(outside));
+            // 255 in the lanes a shift brings in
+            const __m128i top1 = _mm_slli_si128(allSet, 15);
+            const __m128i low1 = _mm_srli_si128(allSet, 15);
+            const __m128i low2 = _mm_srli_si128(allSet, 14);
+            const __m128i low4 = _mm_srli_si128(allSet, 12);
+            const __m128i low8 = _mm_srli_si128(allSet, 8);
+            auto hmin = [](__m128i v) -> uint32_t {
+                v = _mm_min_epu8(v, _mm_srli_si128(v, 8));
+                v = _mm_min_epu8(v, _mm_srli_si128(v, 4));
+                v = _mm_min_epu8(v, _mm_srli_si128(v, 2));
+                v = _mm_min_epu8(v, _mm_srli_si128(v, 1));
+                return static_cast<uint32_t>(_mm_cvtsi128_si32(v)) & 0xff;
+            };
+
+            __m128i prev = outMask;
+            for (uint32_t i = 1; i <= m; ++i) {
+                __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ref + i - 1));
+                __m128i q = _mm_set1_epi8(query[i - 1]);
+                __m128i match = _mm_or_si128(_mm_cmpeq_epi8(r, q), _mm_cmpeq_epi8(r, wildcard));
+                __m128i diag = _mm_adds_epu8(prev, _mm_andnot_si128(match, ones));
+                __m128i up = _mm_adds_epu8(_mm_or_si128(_mm_srli_si128(prev, 1), top1), ones);
+                __m128i cur = _mm_or_si128(_mm_min_epu8(diag, up), outMask);
+                cur = _mm_min_epu8(cur, _mm_adds_epu8(_mm_or_si128(_mm_slli_si128(cur, 1), low1), ones));
+                cur = _mm_min_epu8(cur, _mm_adds_epu8(_mm_or_si128(_mm_slli_si128(cur, 2), low2), _mm_set1_epi8(2)));
+                cur = _mm_min_epu8(cur, _mm_adds_epu8(_mm_or_si128(_mm_slli_si128(cur, 4), low4), _mm_set1_epi8(4)));
+                cur = _mm_min_epu8(cur, _mm_adds_epu8(_mm_or_si128(_mm_slli_si128(cur, 8), low8), _mm_set1_epi8(8)));
+                prev = _mm_or_si128(cur, outMask);
+                // Every so often, see if the whole band is already too far
+                if ((i & 7) == 0 and hmin(prev) > cap) { return maxEdits + 1; }
+            }
+            dist = hmin(prev);
+#else
+            auto sat = [](uint32_t v) -> uint8_t { return static_cast<uint8_t>(std::min(v, 255u)); };
+            uint8_t prev[16], cur[16];
+            std::copy(outside, outside + 16, prev);
+            for (uint32_t i = 1; i <= m; ++i) {
+                char q = query[i - 1];
+                for (uint32_t l = 0; l < 16; ++l) {
+                    char r = ref[i - 1 + l];
+                    uint32_t mismatch = (r == q or r == kWildcard) ? 0 : 1;
+                    uint8_t diag = sat(prev[l] + mismatch);
+                    uint8_t up = (l == 15) ? 255 : sat(prev[l + 1] + 1);
+                    cur[l] = outside[l] ? 255 : std::min(diag, up);
+                }
+                for (uint32_t l = 1; l < 16; ++l) {
+                    cur[l] = std::min(cur[l], sat(cur[l - 1] + 1));
+                }
+                uint32_t rowMin{255};
+                for (uint32_t l = 0; l < 16; ++l) {
+                    prev[l] = outside[l] ? 255 : cur[l];
+                    rowMin = std::min(rowMin, static_cast<uint32_t>(prev[l]));
+                }
+                if (rowMin > cap) { return maxEdits + 1; }
+            }
+            dist = *std::min_element(prev, prev + 16);
+#endif // __SSE2__
+            return (dist > maxEdits) ? maxEdits + 1 : dist;
+        }
+    }
+}
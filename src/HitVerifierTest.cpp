@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include "HitVerifier.hpp"
+
+// Tests the SSE2 kernel of bandedEditDistance; build with -U__SSE2__ (for
+// both this file and HitVerifier.cpp) to test the scalar fallback.
+
+using namespace std;
+using rapmap::verify::bandedEditDistance;
+using rapmap::verify::kMaxBand;
+using rapmap::verify::kWildcard;
+
+// The plain DP over the cells (i, j) -- query[0, i) against ref[.., j) --
+// with kMaxBand - band <= j - i <= kMaxBand + band
+static uint32_t NaiveBanded(const string& query, const string& ref, uint32_t band){
+  const uint32_t inf = 1u << 30;
+  const int64_t lo = kMaxBand - band, hi = kMaxBand + band;
+  size_t m = query.size();
+  vector<vector<uint32_t>> D(m + 1, vector<uint32_t>(ref.size() + 1, inf));
+  for (int64_t j = lo; j <= hi; ++j) D[0][j] = 0;
+  for (size_t i = 1; i <= m; ++i){
+    for (int64_t j = i + lo; j <= static_cast<int64_t>(i) + hi; ++j){
+      char r = ref[j - 1];
+      uint32_t mismatch = (r == query[i - 1] or r == kWildcard) ? 0 : 1;
+      uint32_t d = D[i - 1][j - 1] + mismatch;
+      d = min(d, D[i - 1][j] + 1);
+      d = min(d, D[i][j - 1] + 1);
+      D[i][j] = d;
+    }
+  }
+  uint32_t best = inf;
+  for (int64_t j = m + lo; j <= static_cast<int64_t>(m) + hi; ++j) best = min(best, D[m][j]);
+  return best;
+}
+
+static uint32_t Expected(const string& query, const string& ref, uint32_t band, uint32_t maxEdits){
+  uint32_t d = NaiveBanded(query, ref, min(band, kMaxBand));
+  return (d > maxEdits) ? maxEdits + 1 : d;
+}
+
+// A read from the reference at offset kMaxBand + shift, with some edits;
+// the ends of the reference may be wildcards, as past a transcript's ends
+static void RandomCase(mt19937_64& gen, string& query, string& ref){
+  static const char bases[] = "ACGT";
+  size_t m = 1 + gen() % 150;
+  string txp;
+  for (size_t i = 0; i < m + 40; ++i) txp += bases[gen() % 4];
+  int64_t shift = static_cast<int64_t>(gen() % 11) - 5;
+  query = txp.substr(20 + shift, m);
+  size_t numEdits = gen() % 10;
+  for (size_t e = 0; e < numEdits and !query.empty(); ++e){
+    size_t p = gen() % query.size();
+    switch (gen() % 3){
+      case 0: query[p] = bases[gen() % 4]; break;
+      case 1: query.insert(query.begin() + p, bases[gen() % 4]); break;
+      default: if (query.size() > 1) query.erase(p, 1);
+    }
+  }
+  query.resize(min(query.size(), size_t(200)));
+  ref = txp.substr(20 - kMaxBand, query.size() + 16);
+  ref.resize(query.size() + 16, kWildcard);
+  if (gen() % 4 == 0){
+    size_t n = gen() % 12;
+    fill(ref.begin(), ref.begin() + min(n, ref.size()), kWildcard);
+  }
+  if (gen() % 4 == 0){
+    size_t n = min(gen() % 24, ref.size());
+    fill(ref.end() - n, ref.end(), kWildcard);
+  }
+}
+
+TEST(HitVerifier, exact_and_empty){
+  string ref = string(kMaxBand, 'A') + "ACGTACGTAC" + string(16, 'A');
+  ASSERT_EQ(0u, bandedEditDistance("ACGTACGTAC", 10, ref.data(), 3, 5));
+  ASSERT_EQ(0u, bandedEditDistance("", 0, ref.data(), 3, 5));
+  ASSERT_EQ(1u, bandedEditDistance("ACGTTCGTAC", 10, ref.data(), 3, 0));
+}
+
+TEST(HitVerifier, all_wildcards){
+  string ref(100 + 16, kWildcard);
+  string query(100, 'G');
+  ASSERT_EQ(0u, bandedEditDistance(query.data(), query.size(), ref.data(), 7, 0));
+}
+
+TEST(HitVerifier, random_vs_naive){
+  mt19937_64 gen(47);
+  const uint32_t maxEditsValues[] = {0, 1, 3, 5, 7, 8, 12, 300};
+  string query, ref;
+  for (size_t trial = 0; trial < 20000; ++trial){
+    RandomCase(gen, query, ref);
+    uint32_t band = gen() % (kMaxBand + 3);
+    uint32_t maxEdits = maxEditsValues[gen() % 8];
+    ASSERT_EQ(Expected(query, ref, band, maxEdits),
+              bandedEditDistance(query.data(), query.size(), ref.data(), band, maxEdits))
+        << "query " << query << " band " << band << " maxEdits " << maxEdits;
+  }
+}
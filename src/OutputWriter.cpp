@@ -0,0 +1,330 @@
+#include "OutputWriter.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace rapmap {
+    namespace io {
+
+        namespace {
+#ifdef IOV_MAX
+            constexpr int kMaxIov = (IOV_MAX < 256) ? IOV_MAX : 256;
+#else
+            constexpr int kMaxIov = 16;
+#endif
+            // How long the writer sleeps when no block is ready; a missed
+            // wake-up can never delay output by more than this.
+            constexpr std::chrono::milliseconds kWriterIdleWait{1};
+            // How long a stalled producer sleeps between looks at its free ring
+            constexpr std::chrono::microseconds kProducerStallWait{50};
+            constexpr size_t kStallSpins{64};
+        }
+
+        OutputChannel::OutputChannel(OutputWriter* writer, size_t blockSize, size_t numBlocks) :
+            writer_(writer), blocks_(numBlocks), full_(numBlocks), free_(numBlocks) {
+            for (auto& b : blocks_) {
+                b.data.reset(new char[blockSize]);
+                b.capacity = blockSize;
+                b.owner = this;
+                free_.push(&b);
+            }
+        }
+
+        void OutputChannel::write(const char* data, size_t len) {
+            if (len == 0) { return; }
+            if (current_ == nullptr) { acquire_(); }
+            if (current_->size + len > current_->capacity) {
+                if (current_->size > 0) {
+                    flush();
+                    acquire_();
+                }
+                // A single write that doesn't fit in an empty block gets a
+                // bigger block; it stays that size from then on.
+                if (len > current_->capacity) {
+                    current_->data.reset(new char[len]);
+                    current_->capacity = len;
+                }
+            }
+            std::memcpy(current_->data.get() + current_->size, data, len);
+            current_->size += len;
+        }
+
+        void OutputChannel::writeJob(uint64_t seq, const char* data, size_t len) {
+            // a job always gets a block of its own
+            flush();
+            acquire_();
+            if (len > current_->capacity) {
+                current_->data.reset(new char[len]);
+                current_->capacity = len;
+            }
+            if (len > 0) {
+                std::memcpy(current_->data.get(), data, len);
+            }
+            current_->size = len;
+            current_->seq = seq;
+            full_.push(current_);
+            current_ = nullptr;
+            writer_->notifyWriter_();
+        }
+
+        void OutputChannel::flush() {
+            if (current_ == nullptr or current_->size == 0) { return; }
+            // Can't fail; the ring has room for every block we own
+            full_.push(current_);
+            current_ = nullptr;
+            writer_->notifyWriter_();
+        }
+
+        void OutputChannel::acquire_() {
+            if (free_.pop(current_)) { return; }
+
+            ++numStalls_;
+            auto start = std::chrono::steady_clock::now();
+            size_t spins{0};
+            while (!free_.pop(current_)) {
+                if (spins < kStallSpins) {
+                    ++spins;
+                    std::this_thread::yield();
+                } else {
+                    std::this_thread::sleep_for(kProducerStallWait);
+                }
+            }
+            auto end = std::chrono::steady_clock::now();
+            stallNanos_ += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        }
+
+        OutputWriter::OutputWriter(const std::string& fname, uint32_t numChannels,
+                                   bool ordered, size_t blockSize, size_t blocksPerChannel) :
+            ordered_(ordered) {
+            if (fname.empty()) {
+                // anything already written through std::cout goes first
+                std::cout.flush();
+                fd_ = STDOUT_FILENO;
+                ownFd_ = false;
+            } else {
+                fd_ = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd_ < 0) {
+                    throw std::runtime_error("could not open " + fname + " for writing: " +
+                                             std::strerror(errno));
+                }
+                ownFd_ = true;
+            }
+
+            numChannels = (numChannels > 0) ? numChannels : 1;
+            blocksPerChannel = (blocksPerChannel > 1) ? blocksPerChannel : 2;
+            for (uint32_t i = 0; i < numChannels; ++i) {
+                channels_.emplace_back(new OutputChannel(this, blockSize, blocksPerChannel));
+            }
+            if (ordered_) {
+                window_.resize(numChannels * blocksPerChannel + numChannels, nullptr);
+                writer_ = std::thread(&OutputWriter::orderedWriteLoop_, this);
+            } else {
+                writer_ = std::thread(&OutputWriter::writeLoop_, this);
+            }
+        }
+
+        OutputWriter::~OutputWriter() {
+            close();
+        }
+
+        void OutputWriter::close() {
+            if (closed_) { return; }
+            closed_ = true;
+            for (auto& c : channels_) { c->flush(); }
+            closing_.store(true, std::memory_order_release);
+            notifyWriter_();
+            writer_.join();
+            if (ownFd_) {
+                ::close(fd_);
+            }
+        }
+
+        void OutputWriter::writeHeader(const char* data, size_t len) {
+            // Nothing is in the channels yet, so the writer thread has
+            // nothing to write and we can use the descriptor ourselves.
+            // Going through channel 0 instead would let the other channels'
+            // first blocks overtake the header in unordered mode.
+            headerBytes_ += len;
+            while (len > 0) {
+                ssize_t written = ::write(fd_, data, len);
+                if (written < 0) {
+                    if (errno == EINTR) { continue; }
+                    throw std::runtime_error(std::string("error writing output: ") +
+                                             std::strerror(errno));
+                }
+                data += written;
+                len -= static_cast<size_t>(written);
+            }
+        }
+
+        OutputStats OutputWriter::stats() const {
+            OutputStats s;
+            s.bytesWritten = headerBytes_ + bytesWritten_;
+            s.numWritev = numWritev_;
+            s.writerIdleWaits = writerIdleWaits_;
+            s.maxReorderDepth = maxReorderDepth_;
+            uint64_t stallNanos{0};
+            for (auto& c : channels_) {
+                s.producerStalls += c->numStalls();
+                stallNanos += c->stallNanos();
+            }
+            s.producerStallSeconds = stallNanos / 1e9;
+            return s;
+        }
+
+        void OutputWriter::notifyWriter_() {
+            // pairs with the store to writerSleeping_ in writeLoop_
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (writerSleeping_.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                workAvailable_.notify_one();
+            }
+        }
+
+        void OutputWriter::writeLoop_() {
+            struct iovec iov[kMaxIov];
+            OutputBlock* blocks[kMaxIov];
+
+            while (true) {
+                // Everything flushed before close() is visible once we've seen
+                // closing_, so an empty pass after that means we're done.
+                bool finishing = closing_.load(std::memory_order_acquire);
+
+                int n{0};
+                for (auto& c : channels_) {
+                    OutputBlock* b{nullptr};
+                    while (n < kMaxIov and c->full_.pop(b)) {
+                        iov[n].iov_base = b->data.get();
+                        iov[n].iov_len = b->size;
+                        blocks[n] = b;
+                        bytesWritten_ += b->size;
+                        ++n;
+                    }
+                }
+
+                if (n > 0) {
+                    writeAll_(iov, n);
+                    for (int i = 0; i < n; ++i) {
+                        blocks[i]->size = 0;
+                        blocks[i]->owner->free_.push(blocks[i]);
+                    }
+                    continue;
+                }
+                if (finishing) { break; }
+                idleWait_();
+            }
+        }
+
+        void OutputWriter::orderedWriteLoop_() {
+            struct iovec iov[kMaxIov];
+            OutputBlock* blocks[kMaxIov];
+            size_t windowSize = window_.size();
+            uint64_t numPending{0};
+
+            while (true) {
+                bool finishing = closing_.load(std::memory_order_acquire);
+
+                // Move every submitted job into the window
+                bool gotJob{false};
+                for (auto& c : channels_) {
+                    OutputBlock* b{nullptr};
+                    while (c->full_.pop(b)) {
+                        auto& slot = window_[b->seq % windowSize];
+                        if (slot != nullptr or b->seq < nextSeq_) {
+                            std::cerr << "ordered output: job " << b->seq
+                                      << " is outside the reorder window\n";
+                            std::exit(1);
+                        }
+                        slot = b;
+                        ++numPending;
+                        gotJob = true;
+                    }
+                }
+
+                // and write out the run of consecutive jobs at its front
+                int n{0};
+                int numIov{0};
+                while (n < kMaxIov) {
+                    auto& slot = window_[nextSeq_ % windowSize];
+                    if (slot == nullptr or slot->seq != nextSeq_) { break; }
+                    OutputBlock* b = slot;
+                    slot = nullptr;
+                    ++nextSeq_;
+                    --numPending;
+                    blocks[n++] = b;
+                    if (b->size > 0) {
+                        iov[numIov].iov_base = b->data.get();
+                        iov[numIov].iov_len = b->size;
+                        bytesWritten_ += b->size;
+                        ++numIov;
+                    }
+                }
+                if (numPending > maxReorderDepth_) { maxReorderDepth_ = numPending; }
+
+                if (n > 0) {
+                    if (numIov > 0) { writeAll_(iov, numIov); }
+                    for (int i = 0; i < n; ++i) {
+                        blocks[i]->size = 0;
+                        blocks[i]->owner->free_.push(blocks[i]);
+                    }
+                    continue;
+                }
+                if (finishing and !gotJob) {
+                    if (numPending > 0) {
+                        std::cerr << "ordered output: job " << nextSeq_ << " was never written\n";
+                        std::exit(1);
+                    }
+                    break;
+                }
+                // jobs we just took in may be waiting on an earlier one
+                idleWait_();
+            }
+        }
+
+        void OutputWriter::idleWait_() {
+            ++writerIdleWaits_;
+            std::unique_lock<std::mutex> lock(mutex_);
+            writerSleeping_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool haveWork = closing_.load(std::memory_order_acquire);
+            for (auto& c : channels_) {
+                haveWork = haveWork or !c->full_.empty();
+            }
+            if (!haveWork) {
+                workAvailable_.wait_for(lock, kWriterIdleWait);
+            }
+            writerSleeping_.store(false, std::memory_order_relaxed);
+        }
+
+        void OutputWriter::writeAll_(iovec* iov, int iovcnt) {
+            while (iovcnt > 0) {
+                ssize_t written = ::writev(fd_, iov, iovcnt);
+                if (written < 0) {
+                    if (errno == EINTR) { continue; }
+                    std::cerr << "error writing output: " << std::strerror(errno) << "\n";
+                    std::exit(1);
+                }
+                ++numWritev_;
+                // skip what was written, and resume a partially written buffer
+                size_t left = static_cast<size_t>(written);
+                while (iovcnt > 0 and left >= iov->iov_len) {
+                    left -= iov->iov_len;
+                    ++iov;
+                    --iovcnt;
+                }
+                if (iovcnt > 0) {
+                    iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+                    iov->iov_len -= left;
+                }
+            }
+        }
+    }
+}
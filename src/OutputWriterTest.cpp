@@ -0,0 +1,85 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "OutputWriter.hpp"
+
+using namespace std;
+
+static string TempName(){
+  char name[] = "/tmp/rapmap_outXXXXXX";
+  int fd = mkstemp(name);
+  close(fd);
+  return name;
+}
+
+static string ReadAll(const string& fname){
+  ifstream in(fname, ios::binary);
+  stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+// Each thread starts writing as soon as it's up, as the mapping threads do,
+// except that the thread of channel 0 (the one the header used to go
+// through) is slow to start; small blocks make the writer thread pass over
+// the channels many times.
+static void CheckHeaderFirst(uint32_t numChannels, bool ordered){
+  const string header = "@HD\tVN:0.1\tSO:unknown\n@SQ\tSN:t\tLN:100\n";
+  const size_t recordsPerThread = 1000;
+  for (size_t trial = 0; trial < 20; ++trial){
+    string fname = TempName();
+    {
+      rapmap::io::OutputWriter out(fname, numChannels, ordered, 64, 2);
+      out.writeHeader(header);
+      rapmap::io::JobSequencer sequencer;
+      vector<thread> threads;
+      for (uint32_t i = 0; i < numChannels; ++i){
+        threads.emplace_back([&, i](){
+          string rec = "read" + to_string(i) + "\n";
+          if (i == 0 and numChannels > 1){
+            this_thread::sleep_for(chrono::milliseconds(5));
+          }
+          for (size_t j = 0; j < recordsPerThread; ++j){
+            if (ordered){
+              uint64_t seq;
+              {
+                lock_guard<mutex> lock(sequencer.mutex);
+                seq = sequencer.next++;
+              }
+              out.channel(i).writeJob(seq, rec.data(), rec.size());
+            } else {
+              out.channel(i).write(rec.data(), rec.size());
+            }
+          }
+        });
+      }
+      for (auto& t : threads) t.join();
+      out.close();
+    }
+    string contents = ReadAll(fname);
+    remove(fname.c_str());
+    ASSERT_EQ(header, contents.substr(0, header.size()));
+    size_t numRecords = 0;
+    for (char c : contents.substr(header.size())) numRecords += (c == '\n');
+    ASSERT_EQ(numChannels * recordsPerThread, numRecords);
+  }
+}
+
+TEST(OutputWriter, header_is_first_with_one_channel){
+  CheckHeaderFirst(1, false);
+}
+
+TEST(OutputWriter, header_is_first_with_N_channels){
+  CheckHeaderFirst(8, false);
+  CheckHeaderFirst(32, false);
+}
+
+TEST(OutputWriter, header_is_first_with_N_channels_ordered){
+  CheckHeaderFirst(8, true);
+}
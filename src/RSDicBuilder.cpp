@@ -0,0 +1,99 @@
+/* 
+ *  Copyright (c) 2012 Daisuke Okanohara
+ * 
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ * 
+ *   1. Redistributions of source code must retain the above Copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above Copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the name of the authors nor the names of its contributors
+ *      may be used to endorse or promote products derived from this
+ *      software without specific prior written permission.
+ */
+
+#include "Util.hpp"
+#include "EnumCoder.hpp"
+#include "RSDicBuilder.hpp"
+
+namespace rsdic{
+
+RSDicBuilder::RSDicBuilder() : buf_(0), offset_(0), one_num_(0), num_(0){
+}
+
+RSDicBuilder::~RSDicBuilder(){
+}
+
+void RSDicBuilder::Clear(){
+  std::vector<uint64_t>().swap(bits_);
+  std::vector<uint64_t>().swap(pointer_blocks_);
+  std::vector<uint64_t>().swap(rank_blocks_);
+  std::vector<uint64_t>().swap(select_one_inds_);
+  std::vector<uint64_t>().swap(select_zero_inds_);
+  std::vector<uint8_t>().swap(rank_small_blocks_);
+  buf_ = 0;
+  offset_ = 0;
+  one_num_ = 0;
+  num_ = 0;
+}
+
+void RSDicBuilder::PushBack(bool bit){
+  if (num_ % kLargeBlockSize == 0){
+    rank_blocks_.push_back(one_num_);
+    pointer_blocks_.push_back(offset_);
+  }
+  if (bit){
+    if (one_num_ % kSelectBlockSize == 0){
+      select_one_inds_.push_back(num_ / kLargeBlockSize);
+    }
+    buf_ |= 1LLU << (num_ % kSmallBlockSize);
+    ++one_num_;
+  } else {
+    uint64_t zero_num = num_ - one_num_;
+    if (zero_num % kSelectBlockSize == 0){
+      select_zero_inds_.push_back(num_ / kLargeBlockSize);
+    }
+  }
+  ++num_;
+  if (num_ % kSmallBlockSize == 0){
+    WriteBlock();
+  }
+}
+
+void RSDicBuilder::WriteBlock(){
+  uint64_t rank_sb = __builtin_popcountll(buf_);
+  rank_small_blocks_.push_back(rank_sb);
+  uint64_t len = EnumCoder::Len(rank_sb);
+  uint64_t code = (len == kSmallBlockSize) ? buf_ : EnumCoder::Encode(buf_, rank_sb);
+  // keep one spare word so that GetSlice may always read block+1
+  uint64_t new_size = Util::Floor(offset_ + len, kSmallBlockSize) + 1;
+  if (new_size > bits_.size()){
+    bits_.resize(new_size, 0);
+  }
+  Util::SetSlice(bits_, offset_, len, code);
+  offset_ += len;
+  buf_ = 0;
+}
+
+void RSDicBuilder::Build(RSDic& bv){
+  if (num_ % kSmallBlockSize != 0){
+    WriteBlock();
+  }
+  bv.Clear();
+  bits_.swap(bv.bits_);
+  pointer_blocks_.swap(bv.pointer_blocks_);
+  rank_blocks_.swap(bv.rank_blocks_);
+  select_one_inds_.swap(bv.select_one_inds_);
+  select_zero_inds_.swap(bv.select_zero_inds_);
+  rank_small_blocks_.swap(bv.rank_small_blocks_);
+  bv.num_ = num_;
+  bv.one_num_ = one_num_;
+  Clear();
+}
+
+}
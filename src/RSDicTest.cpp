@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include "RSDic.hpp"
+#include "RSDicBuilder.hpp"
+
+using namespace std;
+using namespace rsdic;
+
+void CheckDic(const vector<bool>& orig, const RSDic& bv){
+  uint64_t one_num = 0;
+  vector<uint64_t> one_pos;
+  vector<uint64_t> zero_pos;
+  for (uint64_t i = 0; i < orig.size(); ++i){
+    ASSERT_EQ(one_num, bv.Rank(i, true));
+    ASSERT_EQ(i - one_num, bv.Rank(i, false));
+    ASSERT_EQ(orig[i], bv.GetBit(i));
+    pair<uint64_t, uint64_t> br = bv.GetBitAndRank(i);
+    ASSERT_EQ(orig[i], br.first);
+    ASSERT_EQ(orig[i] ? one_num : i - one_num, br.second);
+    if (orig[i]){
+      one_pos.push_back(i);
+      ++one_num;
+    } else {
+      zero_pos.push_back(i);
+    }
+  }
+  ASSERT_EQ(orig.size(), bv.num());
+  ASSERT_EQ(one_num, bv.one_num());
+  ASSERT_EQ(one_num, bv.Rank(orig.size(), true));
+  for (uint64_t i = 0; i < one_pos.size(); ++i){
+    ASSERT_EQ(one_pos[i], bv.Select(i, true));
+  }
+  for (uint64_t i = 0; i < zero_pos.size(); ++i){
+    ASSERT_EQ(zero_pos[i], bv.Select(i, false));
+  }
+}
+
+void BuildDic(const vector<bool>& orig, RSDic& bv){
+  RSDicBuilder bvb;
+  for (uint64_t i = 0; i < orig.size(); ++i){
+    bvb.PushBack(orig[i]);
+  }
+  bvb.Build(bv);
+}
+
+TEST(RSDic, small){
+  vector<bool> orig;
+  orig.push_back(true);
+  orig.push_back(false);
+  orig.push_back(true);
+  RSDic bv;
+  BuildDic(orig, bv);
+  CheckDic(orig, bv);
+}
+
+TEST(RSDic, random){
+  // from very sparse (raw blocks never used) to dense
+  uint64_t densities[] = {1000, 61, 7, 2};
+  for (uint64_t d : densities){
+    vector<bool> orig;
+    for (uint64_t i = 0; i < 100000; ++i){
+      orig.push_back(rand() % d == 0);
+    }
+    RSDic bv;
+    BuildDic(orig, bv);
+    CheckDic(orig, bv);
+  }
+}
+
+TEST(RSDic, allSame){
+  for (int b = 0; b < 2; ++b){
+    vector<bool> orig(5000, b == 1);
+    RSDic bv;
+    BuildDic(orig, bv);
+    CheckDic(orig, bv);
+  }
+}
+
+TEST(RSDic, saveLoad){
+  vector<bool> orig;
+  for (uint64_t i = 0; i < 20000; ++i){
+    orig.push_back(rand() % 13 == 0);
+  }
+  RSDic bv;
+  BuildDic(orig, bv);
+  ostringstream os;
+  bv.Save(os);
+  istringstream is(os.str());
+  RSDic bvLoaded;
+  bvLoaded.Load(is);
+  ASSERT_EQ(bv, bvLoaded);
+  CheckDic(orig, bvLoaded);
+}
@@ -0,0 +1,141 @@
+/**
+ * Micro-benchmark for the rank dictionaries that can back the transcript
+ * boundary bit vector of the quasi index.
+ *
+ * usage: rank_bench [rsd.bin] [numQueries]
+ *
+ * With no bit vector on the command line, a synthetic one is used, with
+ * a set bit at the end of each of ~200k "transcripts" of 200--5000 bases.
+ * For each backend we report the bytes per bit of the whole structure
+ * and the latency of a rank query.  Latency is measured with dependent
+ * queries (each position is derived from the previous answer), so that
+ * the CPU can't overlap the cache misses of successive queries.
+ */
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bit_array.h"
+#include "EliasFano.hpp"
+#include "RankDictionary.hpp"
+#include "RSDicBuilder.hpp"
+
+namespace {
+
+// Treat the transcript starts as a "rank dictionary" too, since that's
+// what the Elias-Fano boundaries replace.
+class EliasFanoDictionary : public RankDictionary {
+    public:
+        EliasFanoDictionary(const std::vector<uint64_t>& starts, uint64_t numBits, uint64_t numOnes) :
+            ef_(starts, numBits), numBits_(numBits), numOnes_(numOnes) {}
+
+        uint64_t rank(uint64_t pos) override {
+            uint64_t start;
+            return ef_.predecessor(pos, start);
+        }
+        uint64_t numBits() const override { return numBits_; }
+        uint64_t numOnes() const override { return numOnes_; }
+        uint64_t sizeInBytes() const override { return ef_.sizeInBytes(); }
+        const char* name() const override { return "eliasfano"; }
+
+    private:
+        EliasFano ef_;
+        uint64_t numBits_;
+        uint64_t numOnes_;
+};
+
+inline uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+void bench(RankDictionary& dict, uint64_t numQueries, uint64_t expectedSum) {
+    uint64_t n = dict.numBits();
+    uint64_t sum{0};
+    uint64_t r{0};
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint64_t i = 0; i < numQueries; ++i) {
+        r = dict.rank(mix(r + i) % n);
+        sum += r;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+
+    std::printf("%-10s %10.3f bytes/bit (%12llu bytes) %8.1f ns/rank%s\n",
+                dict.name(), static_cast<double>(dict.sizeInBytes()) / n,
+                static_cast<unsigned long long>(dict.sizeInBytes()),
+                ns / numQueries,
+                (expectedSum != 0 and sum != expectedSum) ? "  [MISMATCH]" : "");
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t numQueries = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 10000000;
+
+    BIT_ARRAY* bits{nullptr};
+    if (argc > 1) {
+        FILE* f = fopen(argv[1], "r");
+        if (f == nullptr) {
+            std::cerr << "couldn't open " << argv[1] << "\n";
+            std::exit(1);
+        }
+        bits = bit_array_create(0);
+        if (!bit_array_load(bits, f)) {
+            std::cerr << "couldn't load a bit array from " << argv[1] << "\n";
+            std::exit(1);
+        }
+        fclose(f);
+    } else {
+        std::mt19937_64 eng(42);
+        std::uniform_int_distribution<uint64_t> lenDist(200, 5000);
+        std::vector<uint64_t> lens(200000);
+        uint64_t total{0};
+        for (auto& l : lens) { l = lenDist(eng); total += l; }
+        bits = bit_array_create(total);
+        uint64_t p{0};
+        for (auto l : lens) { p += l; bit_array_set_bit(bits, p - 1); }
+    }
+
+    uint64_t numBits = bits->num_of_bits;
+    // transcript t starts right after the (t-1)-th set bit
+    std::vector<uint64_t> starts{0};
+    rsdic::RSDicBuilder rsdb;
+    for (uint64_t p = 0; p < numBits; ++p) {
+        bool bit = bit_array_get_bit(bits, p);
+        rsdb.PushBack(bit);
+        if (bit and p + 1 < numBits) { starts.push_back(p + 1); }
+    }
+    uint64_t numOnes = bit_array_num_bits_set(bits);
+    std::cerr << "bit vector: " << numBits << " bits, " << numOnes << " set\n";
+
+    std::vector<std::unique_ptr<RankDictionary>> dicts;
+    dicts.emplace_back(new Rank9bDictionary(bits));
+    std::unique_ptr<RSDicDictionary> rsd(new RSDicDictionary);
+    rsdb.Build(rsd->dict());
+    dicts.emplace_back(std::move(rsd));
+    dicts.emplace_back(new EliasFanoDictionary(starts, numBits, numOnes));
+
+    // The reference answer comes from rank9b; run it once to warm up
+    // and to record the checksum the other backends should reproduce.
+    uint64_t expected{0};
+    {
+        uint64_t r{0};
+        for (uint64_t i = 0; i < numQueries; ++i) {
+            r = dicts.front()->rank(mix(r + i) % numBits);
+            expected += r;
+        }
+    }
+    for (auto& d : dicts) {
+        bench(*d, numQueries, expected);
+    }
+    return 0;
+}
@@ -11,6 +11,8 @@ int rapMapIndex(int argc, char* argv[]);
 int rapMapSAIndex(int argc, char* argv[]);
 int rapMapMap(int argc, char* argv[]);
 int rapMapSAMap(int argc, char* argv[]);
+int rapMapSASearch(int argc, char* argv[]);
+int rapMapBin2Sam(int argc, char* argv[]);
 
 void printUsage() {
     std::string versionString = rapmap::version;
@@ -19,11 +21,13 @@ void printUsage() {
     std::cerr << "=====================================\n";
     auto usage =
         R"(
-There are currently 4 RapMap subcommands
+There are currently 6 RapMap subcommands
     pseudoindex   --- builds a k-mer-based index
     pseudomap     --- map reads using a k-mer-based index
     quasiindex --- builds a suffix array-based (SA) index
     quasimap   --- map reads using the SA-based index
+    quasisearch --- find exact occurrences of patterns using the SA-based index
+    bin2sam    --- convert the binary alignments of quasimap --binary to SAM
 
 Run a corresponding command "rapmap <cmd> -h" for
 more information on each of the possible RapMap
@@ -65,6 +69,10 @@ int main(int argc, char* argv[]) {
         return rapMapMap(argc - 1, args.data());
     } else if (std::string(argv[1]) == "quasimap") {
         return rapMapSAMap(argc - 1, args.data());
+    } else if (std::string(argv[1]) == "quasisearch") {
+        return rapMapSASearch(argc - 1, args.data());
+    } else if (std::string(argv[1]) == "bin2sam") {
+        return rapMapBin2Sam(argc - 1, args.data());
     } else {
         std::cerr << "the command " << argv[1]
                   << " is not yet implemented\n";
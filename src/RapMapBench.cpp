@@ -0,0 +1,405 @@
+/**
+ * Micro-benchmark for the search primitives of the quasi index.
+ *
+ * usage: rapmap_bench [results.json] [numTranscripts] [numQueries]
+ *
+ * A synthetic transcriptome is generated (random transcripts of
+ * 200--3000 bases, a quarter of which carry a slightly mutated copy of
+ * one of a few repeat families, chosen with a skewed distribution so
+ * that the k-mer SA intervals range from 1 to thousands of suffixes)
+ * and indexed in memory exactly as the quasi indexer would index it.
+ * We then time, on inputs drawn from the transcriptome:
+ *
+ *   - k-mer probes of the dense_hash_map and the BooMap (hits and misses)
+ *   - rank9b rank queries (dependent, as in rank_bench)
+ *   - SASearcher::extendSearchNaive from a k-mer interval, and
+ *     SASearcher::lce on the interval it returns
+ *   - libdivsufsort's sa_search with and without the boundary BIT_ARRAY
+ *   - hit_manager::intersectSAHits, bucketed by the width of the
+ *     seeding interval
+ *
+ * Every result (ns per operation, plus a checksum of the answers, so a
+ * change in the answers shows up too) is printed and written as JSON to
+ * results.json (default rapmap_bench.json), for tracking regressions
+ * from version to version.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "google/dense_hash_map"
+
+#include "divsufsort.h"
+#include "bit_array.h"
+#include "BooMap.hpp"
+#include "HitManager.hpp"
+#include "RankDictionary.hpp"
+#include "RapMapConfig.hpp"
+#include "RapMapSAIndex.hpp"
+#include "RapMapUtils.hpp"
+#include "SALocator.hpp"
+#include "SASearcher.hpp"
+
+namespace {
+
+using IndexT = int32_t;
+using DenseHash = google::dense_hash_map<uint64_t, rapmap::utils::SAInterval<IndexT>,
+                                         rapmap::utils::KmerKeyHasher>;
+using PerfectHash = BooMap<uint64_t, rapmap::utils::SAInterval<IndexT>>;
+using SAIndexT = RapMapSAIndex<IndexT, DenseHash>;
+
+constexpr uint32_t k = 31;
+constexpr size_t readLen = 100;
+
+struct BenchResult {
+    std::string name;
+    uint64_t ops;
+    double nsPerOp;
+    uint64_t checksum;
+};
+
+inline uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Time f(i) for i in [0, ops); f returns something to fold into the checksum
+template <typename F>
+BenchResult timeOps(const std::string& name, uint64_t ops, F f) {
+    uint64_t sum{0};
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint64_t i = 0; i < ops; ++i) {
+        sum += f(i);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    BenchResult r{name, ops, (ops > 0) ? ns / ops : 0.0, sum};
+    std::printf("%-32s %12llu ops %10.1f ns/op  checksum %llu\n",
+                r.name.c_str(), static_cast<unsigned long long>(r.ops), r.nsPerOp,
+                static_cast<unsigned long long>(r.checksum));
+    return r;
+}
+
+std::string randomSeq(std::mt19937_64& eng, size_t len) {
+    static const char bases[] = {'A', 'C', 'G', 'T'};
+    std::string s(len, 'A');
+    for (auto& c : s) { c = bases[eng() & 3]; }
+    return s;
+}
+
+/**
+ * Fill the text, transcript tables and boundary bits of the index with
+ * a synthetic transcriptome, and build its suffix array.
+ */
+void buildTranscriptome(SAIndexT& rmi, BIT_ARRAY*& bits, size_t numTranscripts) {
+    std::mt19937_64 eng(42);
+    std::uniform_int_distribution<size_t> lenDist(200, 3000);
+    std::uniform_real_distribution<double> unif(0.0, 1.0);
+
+    // Family f is picked with probability ~ 1/(f+1)
+    const size_t numFamilies = 64;
+    const size_t familyLen = 300;
+    std::vector<std::string> families;
+    std::vector<double> familyWeights;
+    for (size_t f = 0; f < numFamilies; ++f) {
+        families.push_back(randomSeq(eng, familyLen));
+        familyWeights.push_back(1.0 / (f + 1));
+    }
+    std::discrete_distribution<size_t> familyDist(familyWeights.begin(), familyWeights.end());
+
+    std::string& text = rmi.seq;
+    for (size_t t = 0; t < numTranscripts; ++t) {
+        std::string txp = randomSeq(eng, lenDist(eng));
+        if (unif(eng) < 0.25) {
+            std::string copy = families[familyDist(eng)];
+            // 1% substitutions, so the copies don't all share every k-mer
+            for (auto& c : copy) {
+                if (unif(eng) < 0.01) { c = "ACGT"[eng() & 3]; }
+            }
+            size_t at = eng() % (txp.size() + 1);
+            txp.insert(at, copy);
+        }
+        rmi.txpNames.push_back("txp" + std::to_string(t));
+        rmi.txpOffsets.push_back(text.size());
+        rmi.txpLens.push_back(txp.size());
+        text += txp;
+        text += '$';
+    }
+
+    bits = bit_array_create(text.size());
+    for (size_t t = 0; t < numTranscripts; ++t) {
+        bit_array_set_bit(bits, rmi.txpOffsets[t] + rmi.txpLens[t]);
+    }
+
+    rmi.SA.resize(text.size());
+    auto ret = divsufsort(reinterpret_cast<const unsigned char*>(text.data()),
+                          rmi.SA.data(), text.size());
+    if (ret != 0) {
+        std::cerr << "divsufsort failed with return code " << ret << "\n";
+        std::exit(1);
+    }
+}
+
+/**
+ * Record the SA interval of every k-mer that doesn't cross a transcript
+ * boundary (as buildHash does in the indexer) in kintervals, and build
+ * both hashes from them.
+ */
+void buildHashes(SAIndexT& rmi, PerfectHash& booMap) {
+    auto& SA = rmi.SA;
+    auto& text = rmi.seq;
+    IndexT n = static_cast<IndexT>(SA.size());
+    auto valid = [&](IndexT p) -> bool {
+        auto t = rmi.rankDict->rank(p);
+        return static_cast<size_t>(p) + k <= static_cast<size_t>(rmi.txpOffsets[t] + rmi.txpLens[t]);
+    };
+
+    rmi.khash.set_empty_key(std::numeric_limits<uint64_t>::max());
+    IndexT i = 0;
+    while (i < n) {
+        if (!valid(SA[i])) { ++i; continue; }
+        IndexT j = i + 1;
+        while (j < n and valid(SA[j]) and
+               text.compare(SA[j], k, text, SA[i], k) == 0) {
+            ++j;
+        }
+        rapmap::utils::my_mer mer(text.c_str() + SA[i]);
+        uint64_t key = mer.get_bits(0, 2 * k);
+        rmi.kintervals.push_back({key, i, j});
+        rmi.khash[key] = {i, j};
+        booMap.add(std::move(key), rapmap::utils::SAInterval<IndexT>{i, j});
+        i = j;
+    }
+    booMap.build(1);
+}
+
+// Text positions at which a whole read fits in one transcript
+std::vector<IndexT> samplePositions(SAIndexT& rmi, size_t num, uint64_t seed) {
+    std::mt19937_64 eng(seed);
+    std::vector<IndexT> pos;
+    size_t numTxps = rmi.txpOffsets.size();
+    while (pos.size() < num) {
+        size_t t = eng() % numTxps;
+        size_t len = rmi.txpLens[t];
+        pos.push_back(rmi.txpOffsets[t] + eng() % (len - readLen + 1));
+    }
+    return pos;
+}
+
+uint64_t widthBucket(uint64_t w) {
+    uint64_t b{1};
+    while (b * 4 <= w) { b *= 4; }
+    return b;
+}
+
+void writeResults(const std::string& fname, size_t numTranscripts, size_t textLen,
+                  size_t numKmers, uint64_t numQueries,
+                  const std::vector<BenchResult>& results) {
+    std::ofstream out(fname);
+    if (!out.good()) {
+        std::cerr << "couldn't write results to " << fname << "\n";
+        std::exit(1);
+    }
+    out << "{\n";
+    out << "  \"version\": \"" << rapmap::version << "\",\n";
+    out << "  \"config\": {\"num_transcripts\": " << numTranscripts
+        << ", \"text_length\": " << textLen
+        << ", \"num_kmers\": " << numKmers
+        << ", \"k\": " << k
+        << ", \"read_length\": " << readLen
+        << ", \"num_queries\": " << numQueries << "},\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"ops\": " << r.ops
+            << ", \"ns_per_op\": " << r.nsPerOp
+            << ", \"checksum\": " << r.checksum << "}"
+            << ((i + 1 < results.size()) ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::string outName = (argc > 1) ? argv[1] : "rapmap_bench.json";
+    size_t numTranscripts = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 10000;
+    uint64_t numQueries = (argc > 3) ? std::strtoull(argv[3], nullptr, 10) : 1000000;
+    if (numTranscripts == 0 or numQueries == 0) {
+        std::cerr << "usage: rapmap_bench [results.json] [numTranscripts] [numQueries]\n";
+        std::exit(1);
+    }
+
+    rapmap::utils::my_mer::k(k);
+    SAIndexT rmi;
+    PerfectHash booMap;
+    BIT_ARRAY* bits{nullptr};
+    buildTranscriptome(rmi, bits, numTranscripts);
+    // rankDict owns the bits; sa_search borrows them
+    rmi.rankDict.reset(new Rank9bDictionary(bits));
+    buildHashes(rmi, booMap);
+    std::cerr << "text: " << rmi.seq.size() << " bases, "
+              << rmi.kintervals.size() << " distinct k-mers\n";
+
+    std::vector<BenchResult> results;
+    auto& text = rmi.seq;
+    auto textPtr = reinterpret_cast<const unsigned char*>(text.data());
+    IndexT textLen = static_cast<IndexT>(text.size());
+    auto positions = samplePositions(rmi, std::min<uint64_t>(numQueries, 1 << 16), 7);
+    size_t numPos = positions.size();
+
+    // ---- hash probes ----
+    std::vector<uint64_t> hitKeys, missKeys;
+    {
+        std::mt19937_64 eng(11);
+        for (size_t i = 0; i < numPos; ++i) {
+            hitKeys.push_back(rmi.kintervals[eng() % rmi.kintervals.size()].kmer);
+            missKeys.push_back(eng() & ((1ULL << (2 * k)) - 1));
+        }
+    }
+    auto& khash = rmi.khash;
+    results.push_back(timeOps("dense_hash_map.find.hit", numQueries, [&](uint64_t i) -> uint64_t {
+                auto it = khash.find(hitKeys[i % numPos]);
+                return (it != khash.end()) ? it->second.begin : 0;
+                }));
+    results.push_back(timeOps("dense_hash_map.find.miss", numQueries, [&](uint64_t i) -> uint64_t {
+                auto it = khash.find(missKeys[i % numPos]);
+                return (it != khash.end()) ? it->second.begin : 0;
+                }));
+    results.push_back(timeOps("boomap.find.hit", numQueries, [&](uint64_t i) -> uint64_t {
+                auto it = booMap.find(hitKeys[i % numPos]);
+                return (it != booMap.end()) ? it->second.begin : 0;
+                }));
+    results.push_back(timeOps("boomap.find.miss", numQueries, [&](uint64_t i) -> uint64_t {
+                auto it = booMap.find(missKeys[i % numPos]);
+                return (it != booMap.end()) ? it->second.begin : 0;
+                }));
+
+    // ---- rank ----
+    {
+        uint64_t r{0};
+        uint64_t numBits = rmi.rankDict->numBits();
+        results.push_back(timeOps("rank9b.rank", numQueries, [&](uint64_t i) -> uint64_t {
+                    r = rmi.rankDict->rank(mix(r + i) % numBits);
+                    return r;
+                    }));
+    }
+
+    // ---- extendSearchNaive and lce, seeded as in SACollector ----
+    SASearcher<SAIndexT> saSearcher(&rmi);
+    struct Extension {
+        IndexT lb, ub, matchedLen;
+        size_t pos;
+    };
+    std::vector<Extension> extensions;
+    {
+        std::vector<std::string> reads;
+        for (auto p : positions) { reads.push_back(text.substr(p, readLen)); }
+        std::mt19937_64 eng(13);
+        // put a mismatch in half of the reads, past the first k-mer
+        for (size_t i = 0; i < reads.size(); i += 2) {
+            auto& c = reads[i][k + eng() % (readLen - k)];
+            c = (c == 'A') ? 'C' : 'A';
+        }
+        size_t numExt{0};
+        results.push_back(timeOps("sasearcher.extendSearchNaive", numQueries, [&](uint64_t i) -> uint64_t {
+                    auto& read = reads[i % numPos];
+                    rapmap::utils::my_mer mer(read.c_str());
+                    auto it = khash.find(mer.get_bits(0, 2 * k));
+                    IndexT lbRestart = std::max(static_cast<IndexT>(0), it->second.begin - 1);
+                    IndexT lb, ub, matchedLen;
+                    std::tie(lb, ub, matchedLen) = saSearcher.extendSearchNaive(
+                        lbRestart, it->second.end, k, read.begin(), read.end());
+                    if (numExt < numPos) {
+                        extensions.push_back({lb, ub, matchedLen, i % numPos});
+                        ++numExt;
+                    }
+                    return static_cast<uint64_t>(lb) + ub + matchedLen;
+                    }));
+    }
+    results.push_back(timeOps("sasearcher.lce", numQueries, [&](uint64_t i) -> uint64_t {
+                auto& e = extensions[i % extensions.size()];
+                if (e.ub <= e.lb) { return 0; }
+                return saSearcher.lce(e.lb, e.ub - 1, e.matchedLen, readLen - e.matchedLen);
+                }));
+
+    // ---- sa_search, with and without the boundary bits ----
+    for (size_t patLen : {static_cast<size_t>(k), readLen}) {
+        for (bool withBits : {true, false}) {
+            const BIT_ARRAY* ba = withBits ? bits : nullptr;
+            std::string name = "sa_search." + std::to_string(patLen) +
+                (withBits ? ".bit_array" : ".no_bit_array");
+            results.push_back(timeOps(name, numQueries, [&](uint64_t i) -> uint64_t {
+                        saidx_t left;
+                        auto count = sa_search(textPtr, textLen, textPtr + positions[i % numPos],
+                                               static_cast<saidx_t>(patLen),
+                                               rmi.SA.data(), textLen, ba, &left);
+                        return static_cast<uint64_t>(count) + left;
+                        }));
+        }
+    }
+
+    // ---- intersectSAHits on interval pairs, by width of the seed ----
+    {
+        // Pair each k-mer interval with the interval of the k-mer a read
+        // length further along the first suffix, as two seeds of one read
+        // would be.
+        std::map<uint64_t, std::vector<std::pair<rapmap::utils::SAInterval<IndexT>,
+                                                 rapmap::utils::SAInterval<IndexT>>>> pairs;
+        const size_t maxPairs = 4096;
+        for (auto& ki : rmi.kintervals) {
+            auto& bucket = pairs[widthBucket(ki.end - ki.begin)];
+            if (bucket.size() >= maxPairs) { continue; }
+            IndexT p = rmi.SA[ki.begin];
+            IndexT q = p + readLen - k;
+            auto t = rmi.rankDict->rank(p);
+            if (static_cast<size_t>(q) + k > static_cast<size_t>(rmi.txpOffsets[t] + rmi.txpLens[t])) {
+                continue;
+            }
+            auto it = khash.find(rapmap::utils::my_mer(text.c_str() + q).get_bits(0, 2 * k));
+            bucket.push_back({{ki.begin, ki.end}, it->second});
+        }
+
+        SALocator<SAIndexT> locator(&rmi);
+        rapmap::hit_manager::SAHitMap outHits;
+        std::vector<rapmap::utils::SAIntervalHit<IndexT>> inHits;
+        for (auto& kv : pairs) {
+            auto& bucket = kv.second;
+            if (bucket.empty()) { continue; }
+            std::string name = "intersectSAHits.width_" + std::to_string(kv.first) +
+                "_" + std::to_string(4 * kv.first - 1);
+            // scale the work down for the wide intervals
+            uint64_t ops = std::max<uint64_t>(numQueries / (kv.first * 8), 1000);
+            results.push_back(timeOps(name, ops, [&](uint64_t i) -> uint64_t {
+                        auto& pr = bucket[i % bucket.size()];
+                        inHits.clear();
+                        inHits.emplace_back(pr.first.begin, pr.first.end, k, 0, false);
+                        inHits.emplace_back(pr.second.begin, pr.second.end, k, readLen - k, false);
+                        rapmap::hit_manager::intersectSAHits(inHits, rmi, locator, outHits, false);
+                        uint64_t active{0};
+                        for (auto& h : outHits) { active += h.active ? 1 : 0; }
+                        return active;
+                        }));
+        }
+    }
+
+    writeResults(outName, numTranscripts, text.size(), rmi.kintervals.size(),
+                 numQueries, results);
+    std::cerr << "wrote results to " << outName << "\n";
+    return 0;
+}
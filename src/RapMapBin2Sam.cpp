@@ -0,0 +1,218 @@
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tclap/CmdLine.h"
+
+#include "spdlog/spdlog.h"
+#include "spdlog/details/format.h"
+
+#include "AlignmentFormat.hpp"
+#include "RapMapConfig.hpp"
+#include "RapMapUtils.hpp"
+#include "ScopedTimer.hpp"
+
+/**
+ * Convert the binary alignments of rapmap quasimap --binary to SAM
+ * (rapmap bin2sam).  The records are those quasimap would have written
+ * as SAM, except that the binary format doesn't keep the reads, so SEQ
+ * and QUAL are '*'.
+ */
+
+namespace {
+
+using MateStatus = rapmap::utils::MateStatus;
+
+// Reused for every read
+struct SAMFormatter {
+    SAMFormatter() : cigarStr1(buff1, 1000), cigarStr2(buff2, 1000) {}
+
+    char buff1[1000];
+    char buff2[1000];
+    rapmap::utils::FixedWriter cigarStr1;
+    rapmap::utils::FixedWriter cigarStr2;
+};
+
+void writeSingle(const rapmap::aln::Header& h, rapmap::aln::Read& r,
+                 SAMFormatter& formatter, fmt::MemoryWriter& sstream) {
+    uint16_t flags;
+    uint32_t alnCtr{0};
+    for (auto& qa : r.hits) {
+        rapmap::utils::getSamFlags(qa, flags);
+        if (alnCtr != 0) {
+            flags |= 0x900;
+        }
+        rapmap::utils::adjustOverhang(qa.pos, qa.readLen, h.txpLens[qa.tid], formatter.cigarStr1);
+        sstream << r.name << '\t' // QNAME
+                << flags << '\t' // FLAGS
+                << h.txpNames[qa.tid] << '\t' // RNAME
+                << qa.pos + 1 << '\t' // POS (1-based)
+                << 255 << '\t' // MAPQ
+                << formatter.cigarStr1.c_str() << '\t' // CIGAR
+                << '*' << '\t' // MATE NAME
+                << 0 << '\t' // MATE POS
+                << qa.fragLen << '\t' // TLEN
+                << '*' << '\t' // SEQ
+                << '*' << '\t' // QSTR
+                << "NH:i:" << r.hits.size() << '\n';
+        ++alnCtr;
+    }
+}
+
+void writePair(const rapmap::aln::Header& h, rapmap::aln::Read& r,
+               SAMFormatter& formatter, fmt::MemoryWriter& sstream) {
+    auto& cigarStr1 = formatter.cigarStr1;
+    auto& cigarStr2 = formatter.cigarStr2;
+    uint16_t flags1, flags2;
+    uint32_t alnCtr{0};
+    for (auto& qa : r.hits) {
+        auto& transcriptName = h.txpNames[qa.tid];
+        uint32_t txpLen = h.txpLens[qa.tid];
+        rapmap::utils::getSamFlags(qa, true, flags1, flags2);
+        if (alnCtr != 0) {
+            flags1 |= 0x100; flags2 |= 0x100;
+        }
+
+        if (qa.isPaired) {
+            rapmap::utils::adjustOverhang(qa, txpLen, cigarStr1, cigarStr2);
+            // If the fragment overhangs the right end of the transcript
+            // adjust fragLen (overhanging the left end is already handled).
+            const bool read1First{qa.pos < qa.matePos};
+            const int32_t minPos = read1First ? qa.pos : qa.matePos;
+            if (minPos + qa.fragLen > txpLen) { qa.fragLen = txpLen - minPos; }
+            const int32_t fragLen = static_cast<int32_t>(qa.fragLen);
+
+            sstream << r.name << '\t' << flags1 << '\t' << transcriptName << '\t'
+                    << qa.pos + 1 << '\t' << 1 << '\t' << cigarStr1.c_str() << '\t'
+                    << '=' << '\t' << qa.matePos + 1 << '\t'
+                    << ((read1First) ? fragLen : -fragLen) << '\t'
+                    << '*' << '\t' << '*' << '\t' << "NH:i:" << r.hits.size() << '\n';
+            sstream << r.name << '\t' << flags2 << '\t' << transcriptName << '\t'
+                    << qa.matePos + 1 << '\t' << 1 << '\t' << cigarStr2.c_str() << '\t'
+                    << '=' << '\t' << qa.pos + 1 << '\t'
+                    << ((read1First) ? -fragLen : fragLen) << '\t'
+                    << '*' << '\t' << '*' << '\t' << "NH:i:" << r.hits.size() << '\n';
+        } else {
+            // An orphan: the aligned mate, then the unaligned one
+            bool leftAligned = (qa.mateStatus == MateStatus::PAIRED_END_LEFT);
+            uint16_t flags = leftAligned ? flags1 : flags2;
+            uint16_t unalignedFlags = leftAligned ? flags2 : flags1;
+            rapmap::utils::adjustOverhang(qa.pos, qa.readLen, txpLen, cigarStr1);
+
+            sstream << r.name << '\t' << flags << '\t' << transcriptName << '\t'
+                    << qa.pos + 1 << '\t' << 1 << '\t' << cigarStr1.c_str() << '\t'
+                    << '=' << '\t' << qa.pos + 1 << '\t' << 0 << '\t'
+                    << '*' << '\t' << '*' << '\t' << "NH:i:" << r.hits.size() << '\n';
+            sstream << r.name << '\t' << unalignedFlags << '\t' << transcriptName << '\t'
+                    << qa.pos + 1 << '\t' << 0 << '\t' << qa.mateLen << 'S' << '\t'
+                    << '=' << '\t' << qa.pos + 1 << '\t' << 0 << '\t'
+                    << '*' << '\t' << '*' << '\t' << "NH:i:" << r.hits.size() << '\n';
+        }
+        ++alnCtr;
+    }
+}
+
+bool convert(std::istream& in, std::ostream& out,
+             std::shared_ptr<spdlog::logger> consoleLog) {
+    rapmap::aln::Header h;
+    if (!rapmap::aln::readHeader(in, h)) {
+        consoleLog->error("The input isn't in RapMap's binary alignment format "
+                          "(or was written by another version)");
+        return false;
+    }
+
+    fmt::MemoryWriter sstream;
+    sstream << "@HD\tVN:0.1\tSO:unknown\n";
+    for (size_t i = 0; i < h.txpNames.size(); ++i) {
+        sstream << "@SQ\tSN:" << h.txpNames[i] << "\tLN:" << h.txpLens[i] << '\n';
+    }
+    out.write(sstream.data(), sstream.size());
+    sstream.clear();
+
+    SAMFormatter formatter;
+    rapmap::aln::Chunk chunk;
+    rapmap::aln::Read r;
+    uint64_t numChunks{0}, numReads{0};
+    while (in.peek() != std::char_traits<char>::eof()) {
+        if (!rapmap::aln::readChunk(in, chunk)) {
+            consoleLog->error("The input ends in the middle of chunk {}", numChunks);
+            return false;
+        }
+        rapmap::aln::ChunkDecoder decoder(chunk, h.paired);
+        uint32_t n{0};
+        while (n < chunk.numReads and decoder.next(r)) {
+            if (h.paired) {
+                writePair(h, r, formatter, sstream);
+            } else {
+                writeSingle(h, r, formatter, sstream);
+            }
+            ++n;
+        }
+        if (n != chunk.numReads) {
+            consoleLog->error("Chunk {} is corrupt", numChunks);
+            return false;
+        }
+        out.write(sstream.data(), sstream.size());
+        sstream.clear();
+        ++numChunks;
+        numReads += n;
+    }
+    consoleLog->info("Converted {} reads in {} chunks", numReads, numChunks);
+    return out.good();
+}
+
+}
+
+int rapMapBin2Sam(int argc, char* argv[]) {
+  std::cerr << "RapMap binary alignments to SAM\n";
+
+  std::string versionString = rapmap::version;
+  TCLAP::CmdLine cmd(
+		     "RapMap bin2sam",
+		     ' ',
+		     versionString);
+  cmd.getProgramName() = "rapmap";
+
+  TCLAP::ValueArg<std::string> input("i", "input", "The binary alignments written by rapmap quasimap --binary", true, "", "path");
+  TCLAP::ValueArg<std::string> outname("o", "output", "The output file (default: stdout)", false, "", "path");
+  cmd.add(input);
+  cmd.add(outname);
+
+  auto consoleSink = std::make_shared<spdlog::sinks::stderr_sink_mt>();
+  auto consoleLog = spdlog::create("stderrLog", {consoleSink});
+
+  try {
+
+    cmd.parse(argc, argv);
+
+    std::ifstream in(input.getValue(), std::ios::binary);
+    if (!in.good()) {
+      consoleLog->error("Couldn't open {}", input.getValue());
+      std::exit(1);
+    }
+
+    std::ofstream outFile;
+    std::ostream* out = &std::cout;
+    if (outname.getValue() != "") {
+      outFile.open(outname.getValue());
+      if (!outFile.good()) {
+        consoleLog->error("Couldn't open {} for writing", outname.getValue());
+        std::exit(1);
+      }
+      out = &outFile;
+    }
+
+    bool success{false};
+    {
+      ScopedTimer timer;
+      success = convert(in, *out, consoleLog);
+    }
+    return success ? 0 : 1;
+  } catch (TCLAP::ArgException& e) {
+    consoleLog->error("Exception [{}] when parsing argument {}", e.error(), e.argId());
+    return 1;
+  }
+}
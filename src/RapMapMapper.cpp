@@ -6,6 +6,7 @@
 #include <fstream>
 #include <algorithm>
 #include <iterator>
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
@@ -30,6 +31,7 @@
 // Jellyfish 2 include
 #include "jellyfish/mer_dna.hpp"
 #include "jellyfish/stream_manager.hpp"
+#include "GzipStream.hpp"
 #include "jellyfish/whole_sequence_parser.hpp"
 #include "jellyfish/hash_counter.hpp"
 
@@ -50,6 +52,9 @@
 #include "RapMapConfig.hpp"
 #include "ScopedTimer.hpp"
 #include "SpinLock.hpp"
+#include "BAMUtils.hpp"
+#include "BGZFWriter.hpp"
+#include "OutputWriter.hpp"
 
 // #define __DEBUG__
 // #define __TRACK_CORRECT__
@@ -59,7 +64,8 @@
 // KSEQ_INIT(int, read)
 
 using paired_parser = pair_sequence_parser<char**>;
-using stream_manager = jellyfish::stream_manager<std::vector<std::string>::const_iterator>;
+// Like jellyfish::stream_manager, but reads gzipped files too
+using stream_manager = rapmap::io::ReadStreamManager<std::vector<std::string>::const_iterator>;
 using single_parser = jellyfish::whole_sequence_parser<stream_manager>;
 using TranscriptID = uint32_t;
 using TranscriptIDVector = std::vector<TranscriptID>;
@@ -707,7 +713,9 @@ void processReadsSingle(single_parser* parser,
         RapMapIndex& rmi,
 	CollectorT& hitCollector,
         MutexT* iomutex,
-	std::shared_ptr<spdlog::logger> outQueue,
+	rapmap::io::OutputChannel* outChannel,
+	rapmap::io::JobSequencer* sequencer,
+        rapmap::bam::BGZFWriter* bamWriter,
         HitCounters& hctr,
         uint32_t maxNumHits,
         bool noOutput) {
@@ -720,6 +728,8 @@ void processReadsSingle(single_parser* parser,
     constexpr char bases[] = {'A', 'C', 'G', 'T'};
 
     fmt::MemoryWriter sstream;
+    // BAM records of the current job, if we're writing BAM
+    std::string bamBuffer;
     size_t batchSize{1000};
     std::vector<QuasiAlignment> hits;
 
@@ -728,8 +738,15 @@ void processReadsSingle(single_parser* parser,
     size_t readLen{0};
 
     while(true) {
+        uint64_t jobSeq{0};
+        std::unique_lock<std::mutex> seqLock;
+        if (sequencer) { seqLock = std::unique_lock<std::mutex>(sequencer->mutex); }
         typename single_parser::job j(*parser); // Get a job from the parser: a bunch of read (at most max_read_group)
         if(j.is_empty()) break;           // If got nothing, quit
+        if (sequencer) {
+            jobSeq = sequencer->next++;
+            seqLock.unlock();
+        }
         for(size_t i = 0; i < j->nb_filled; ++i) { // For each sequence
             readLen = j->data[i].seq.length();
             ++hctr.numReads;
@@ -744,39 +761,23 @@ void processReadsSingle(single_parser* parser,
             hctr.totHits += numHits;
 
              if (hits.size() > 0 and !noOutput and hits.size() <= maxNumHits) {
-                rapmap::utils::writeAlignmentsToStream(j->data[i], formatter,
-                        hctr, hits, sstream);
-            }
-
-            if (hctr.numReads > hctr.lastPrint + 1000000) {
-		hctr.lastPrint.store(hctr.numReads.load());
-                if (iomutex->try_lock()){
-                    if (hctr.numReads > 0) {
-#if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
-                        std::cerr << "\033[F\033[F\033[F";
-#else
-                        std::cerr << "\033[F\033[F";
-#endif // __DEBUG__
-                    }
-                    std::cerr << "saw " << hctr.numReads << " reads\n";
-                    std::cerr << "# hits per read = "
-                        << hctr.totHits / static_cast<float>(hctr.numReads) << "\n";
-#if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
-                    std::cerr << "The true hit was in the returned set of hits "
-                        << 100.0 * (hctr.trueHits / static_cast<float>(hctr.numReads))
-                        <<  "% of the time\n";
-#endif // __DEBUG__
-                    iomutex->unlock();
+                if (bamWriter) {
+                    rapmap::utils::writeAlignmentsToBAM(j->data[i], formatter,
+                            hctr, hits, bamBuffer);
+                } else {
+                    rapmap::utils::writeAlignmentsToStream(j->data[i], formatter,
+                            hctr, hits, sstream);
                 }
             }
         } // for all reads in this job
 
-	if (!noOutput) {
-        std::string outStr(sstream.str());
-        // Get rid of last newline
-        if (!outStr.empty()) {
-            outStr.pop_back();
-            outQueue->info() << std::move(outStr);
+	if (bamWriter) {
+	    bamWriter->write(bamBuffer);
+	} else if (outChannel) {
+        if (sequencer) {
+            outChannel->writeJob(jobSeq, sstream.data(), sstream.size());
+        } else {
+            outChannel->write(sstream.data(), sstream.size());
         }
 	    sstream.clear();
 	}
@@ -799,7 +800,9 @@ void processReadsPair(paired_parser* parser,
         RapMapIndex& rmi,
 	CollectorT& hitCollector,
         MutexT* iomutex,
-	std::shared_ptr<spdlog::logger> outQueue,
+	rapmap::io::OutputChannel* outChannel,
+	rapmap::io::JobSequencer* sequencer,
+        rapmap::bam::BGZFWriter* bamWriter,
         HitCounters& hctr,
         uint32_t maxNumHits,
         bool noOutput) {
@@ -813,6 +816,8 @@ void processReadsPair(paired_parser* parser,
     auto logger = spdlog::get("stderrLog");
 
     fmt::MemoryWriter sstream;
+    // BAM records of the current job, if we're writing BAM
+    std::string bamBuffer;
     size_t batchSize{1000};
     std::vector<QuasiAlignment> leftHits;
     std::vector<QuasiAlignment> rightHits;
@@ -831,8 +836,15 @@ void processReadsPair(paired_parser* parser,
     // (currently not treated as orphan).
     uint32_t orphanStatus{0};
     while(true) {
+        uint64_t jobSeq{0};
+        std::unique_lock<std::mutex> seqLock;
+        if (sequencer) { seqLock = std::unique_lock<std::mutex>(sequencer->mutex); }
         typename paired_parser::job j(*parser); // Get a job from the parser: a bunch of read (at most max_read_group)
         if(j.is_empty()) break;           // If got nothing, quit
+        if (sequencer) {
+            jobSeq = sequencer->next++;
+            seqLock.unlock();
+        }
         for(size_t i = 0; i < j->nb_filled; ++i) { // For each sequence
 	    tooManyHits = false;
             readLen = j->data[i].first.seq.length();
@@ -851,45 +863,23 @@ void processReadsPair(paired_parser* parser,
 
 
             if (jointHits.size() > 0 and !noOutput and jointHits.size() <= maxNumHits) {
-                rapmap::utils::writeAlignmentsToStream(j->data[i], formatter,
-                                                       hctr, jointHits, sstream);
-            }
-
-            if (hctr.numReads > hctr.lastPrint + 1000000) {
-		hctr.lastPrint.store(hctr.numReads.load());
-                if (iomutex->try_lock()) {
-                    if (hctr.numReads > 0) {
-#if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
-                        std::cerr << "\033[F\033[F\033[F\033[F";
-#else
-                        std::cerr << "\033[F\033[F\033[F";
-#endif // __DEBUG__
-                    }
-                    std::cerr << "saw " << hctr.numReads << " reads\n";
-                    std::cerr << "# pe hits per read = "
-                        << hctr.peHits / static_cast<float>(hctr.numReads) << "\n";
-                    std::cerr << "# se hits per read = "
-                        << hctr.seHits / static_cast<float>(hctr.numReads) << "\n";
-#if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
-                    std::cerr << "The true hit was in the returned set of hits "
-                        << 100.0 * (hctr.trueHits / static_cast<float>(hctr.numReads))
-                        <<  "% of the time\n";
-		    /*
-                    std::cerr << "Average jump size = "
-                              << js.jumpSizes / static_cast<double>(js.numJumps) << "\n";
-			      */
-#endif // __DEBUG__
-                    iomutex->unlock();
+                if (bamWriter) {
+                    rapmap::utils::writeAlignmentsToBAM(j->data[i], formatter,
+                                                        hctr, jointHits, bamBuffer);
+                } else {
+                    rapmap::utils::writeAlignmentsToStream(j->data[i], formatter,
+                                                           hctr, jointHits, sstream);
                 }
             }
         } // for all reads in this job
 
-	if (!noOutput) {
-        std::string outStr(sstream.str());
-        // Get rid of last newline
-        if (!outStr.empty()){
-            outStr.pop_back();
-            outQueue->info() << std::move(outStr);
+	if (bamWriter) {
+	    bamWriter->write(bamBuffer);
+	} else if (outChannel) {
+        if (sequencer) {
+            outChannel->writeJob(jobSeq, sstream.data(), sstream.size());
+        } else {
+            outChannel->write(sstream.data(), sstream.size());
         }
 	    sstream.clear();
 	}
@@ -929,6 +919,10 @@ int rapMapMap(int argc, char* argv[]) {
     TCLAP::ValueArg<std::string> outname("o", "output", "The output file (default: stdout)", false, "", "path");
     TCLAP::SwitchArg endCollectorSwitch("e", "endCollector", "Use the simpler (and faster) \"end\" collector as opposed to the more sophisticated \"skipping\" collector", false);
     TCLAP::SwitchArg noout("n", "noOutput", "Don't write out any alignments (for speed testing purposes)", false);
+    TCLAP::SwitchArg bam("b", "bam", "Write the alignments as BAM rather than SAM", false);
+    TCLAP::ValueArg<uint32_t> bamThreads("", "bamThreads", "Number of threads used to compress BAM output", false, 2, "positive integer");
+    TCLAP::ValueArg<uint32_t> gzThreads("", "gzThreads", "Number of threads used to decompress each gzipped read file", false, 2, "positive integer");
+    TCLAP::SwitchArg ordered("", "ordered", "Write the alignments in the same order as the input reads (SAM output only)", false);
     cmd.add(index);
     cmd.add(noout);
 
@@ -939,6 +933,10 @@ int rapMapMap(int argc, char* argv[]) {
     cmd.add(numThreads);
     cmd.add(maxNumHits);
     cmd.add(endCollectorSwitch);
+    cmd.add(bam);
+    cmd.add(bamThreads);
+    cmd.add(ordered);
+    cmd.add(gzThreads);
 
     auto consoleSink = std::make_shared<spdlog::sinks::stderr_sink_mt>();
     auto consoleLog = spdlog::create("stderrLog", {consoleSink});
@@ -997,42 +995,96 @@ int rapMapMap(int argc, char* argv[]) {
 
 	std::cerr << "\n\n\n\n";
 
-	// from: http://stackoverflow.com/questions/366955/obtain-a-stdostream-either-from-stdcout-or-stdofstreamfile
-	// set either a file or cout as the output stream
-	std::streambuf* outBuf;
-	std::ofstream outFile;
-	bool haveOutputFile{false};
-	if (outname.getValue() == "") {
-	    outBuf = std::cout.rdbuf();
-	} else {
-	    outFile.open(outname.getValue());
-	    outBuf = outFile.rdbuf();
-	    haveOutputFile = true;
-	}
-	// Now set the output stream to the buffer, which is
-	// either std::cout, or a file.
-	std::ostream outStream(outBuf);
+	bool writeBAM = bam.getValue() and !noout.getValue();
+	uint32_t nthread = numThreads.getValue();
 
-	// Must be a power of 2
-	size_t queueSize{268435456};
-	spdlog::set_async_mode(queueSize);
-	auto outputSink = std::make_shared<spdlog::sinks::ostream_sink_mt>(outStream);
-	auto outLog = std::make_shared<spdlog::logger>("outLog", outputSink);
-	outLog->set_pattern("%v");
+	// If we're writing BAM, the mapping threads hand their records
+	// straight to a BGZF writer (and its compression threads).
+	std::ofstream bamFile;
+	std::unique_ptr<std::ostream> bamStream{nullptr};
+	std::unique_ptr<rapmap::bam::BGZFWriter> bamWriter{nullptr};
+	// Otherwise, each mapping thread writes SAM to its own channel of
+	// the output writer.  In ordered mode, the jobs are numbered as the
+	// parser hands them out, and the writer puts them back in that order.
+	std::unique_ptr<rapmap::io::OutputWriter> outWriter{nullptr};
+	std::unique_ptr<rapmap::io::JobSequencer> sequencer{nullptr};
+	if (ordered.getValue() and bam.getValue()) {
+	    consoleLog->error("--ordered can't be used with --bam");
+	    std::exit(1);
+	}
+	if (writeBAM) {
+	    // from: http://stackoverflow.com/questions/366955/obtain-a-stdostream-either-from-stdcout-or-stdofstreamfile
+	    // set either a file or cout as the output stream
+	    std::streambuf* outBuf = std::cout.rdbuf();
+	    if (outname.getValue() != "") {
+	        bamFile.open(outname.getValue(), std::ios::binary);
+	        if (!bamFile.is_open()) {
+	            consoleLog->error("could not open {} for writing: {}", outname.getValue(),
+	                              std::strerror(errno));
+	            std::exit(1);
+	        }
+	        outBuf = bamFile.rdbuf();
+	    }
+	    bamStream.reset(new std::ostream(outBuf));
+	    bamWriter.reset(new rapmap::bam::BGZFWriter(*bamStream, bamThreads.getValue()));
+	} else if (!noout.getValue()) {
+	    try {
+	        outWriter.reset(new rapmap::io::OutputWriter(outname.getValue(), nthread,
+	                                                     ordered.getValue()));
+	        if (ordered.getValue()) {
+	            sequencer.reset(new rapmap::io::JobSequencer);
+	        }
+	    } catch (std::runtime_error& e) {
+	        consoleLog->error("{}", e.what());
+	        std::exit(1);
+	    }
+	}
 
-	uint32_t nthread = numThreads.getValue();
 	std::unique_ptr<paired_parser> pairParserPtr{nullptr};
 	std::unique_ptr<single_parser> singleParserPtr{nullptr};
 
-	if (!noout.getValue()) {
-	    rapmap::utils::writeSAMHeader(rmi, outLog);
+	if (writeBAM) {
+	    std::string bamHeader;
+	    rapmap::bam::appendHeader(rmi, bamHeader);
+	    bamWriter->write(bamHeader);
+	} else if (outWriter) {
+	    rapmap::utils::writeSAMHeader(rmi, *outWriter);
 	}
 
 	SpinLockT iomutex;
 	{
 	    ScopedTimer timer;
-	    HitCounters hctrs;
+	    rapmap::utils::HitCounterSet hctrs(nthread);
 	    consoleLog->info("mapping reads . . . \n\n\n");
+	    auto printProgress = [pairedEnd](const rapmap::utils::HitTotals& t) -> void {
+	        if (pairedEnd) {
+#if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
+	            std::cerr << "\033[F\033[F\033[F\033[F";
+#else
+	            std::cerr << "\033[F\033[F\033[F";
+#endif // __DEBUG__
+	            std::cerr << "saw " << t.numReads << " reads\n";
+	            std::cerr << "# pe hits per read = "
+	                << t.peHits / static_cast<float>(t.numReads) << "\n";
+	            std::cerr << "# se hits per read = "
+	                << t.seHits / static_cast<float>(t.numReads) << "\n";
+	        } else {
+#if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
+	            std::cerr << "\033[F\033[F\033[F";
+#else
+	            std::cerr << "\033[F\033[F";
+#endif // __DEBUG__
+	            std::cerr << "saw " << t.numReads << " reads\n";
+	            std::cerr << "# hits per read = "
+	                << t.totHits / static_cast<float>(t.numReads) << "\n";
+	        }
+#if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
+	        std::cerr << "The true hit was in the returned set of hits "
+	            << 100.0 * (t.trueHits / static_cast<float>(t.numReads))
+	            <<  "% of the time\n";
+#endif // __DEBUG__
+	    };
+	    rapmap::utils::ProgressReporter progress(hctrs, printProgress);
 	    if (pairedEnd) {
 		std::vector<std::thread> threads;
 		std::vector<std::string> read1Vec = rapmap::utils::tokenize(read1.getValue(), ',');
@@ -1054,7 +1106,8 @@ int rapMapMap(int argc, char* argv[]) {
 		size_t concurrentFile{2}; // Number of files to read simultaneously
 		pairParserPtr.reset(new paired_parser(4 * nthread, maxReadGroup,
 			    concurrentFile,
-			    pairFileList, pairFileList+numFiles));
+			    pairFileList, pairFileList+numFiles,
+			    gzThreads.getValue()));
 
 		/** Create the threads depending on the collector type **/
 		if (endCollectorSwitch.getValue()) {
@@ -1065,8 +1118,10 @@ int rapMapMap(int argc, char* argv[]) {
 				std::ref(rmi),
 				std::ref(endCollector),
 				&iomutex,
-				outLog,
-				std::ref(hctrs),
+				(outWriter ? &outWriter->channel(i) : nullptr),
+				sequencer.get(),
+				bamWriter.get(),
+				std::ref(hctrs.local(i)),
 				maxNumHits.getValue(),
 				noout.getValue());
 		    }
@@ -1078,8 +1133,10 @@ int rapMapMap(int argc, char* argv[]) {
 				std::ref(rmi),
 				std::ref(skippingCollector),
 				&iomutex,
-				outLog,
-				std::ref(hctrs),
+				(outWriter ? &outWriter->channel(i) : nullptr),
+				sequencer.get(),
+				bamWriter.get(),
+				std::ref(hctrs.local(i)),
 				maxNumHits.getValue(),
 				noout.getValue());
 		    }
@@ -1093,7 +1150,7 @@ int rapMapMap(int argc, char* argv[]) {
 		size_t maxReadGroup{1000}; // Number of reads in each "job"
 		size_t concurrentFile{1};
 		stream_manager streams( unmatedReadVec.begin(), unmatedReadVec.end(),
-			concurrentFile);
+			concurrentFile, gzThreads.getValue());
 		singleParserPtr.reset(new single_parser(4 * nthread,
 			    maxReadGroup,
 			    concurrentFile,
@@ -1108,8 +1165,10 @@ int rapMapMap(int argc, char* argv[]) {
 				std::ref(rmi),
 				std::ref(endCollector),
 				&iomutex,
-				outLog,
-				std::ref(hctrs),
+				(outWriter ? &outWriter->channel(i) : nullptr),
+				sequencer.get(),
+				bamWriter.get(),
+				std::ref(hctrs.local(i)),
 				maxNumHits.getValue(),
 				noout.getValue());
 		    }
@@ -1121,26 +1180,43 @@ int rapMapMap(int argc, char* argv[]) {
 				std::ref(rmi),
 				std::ref(skippingCollector),
 				&iomutex,
-				outLog,
-				std::ref(hctrs),
+				(outWriter ? &outWriter->channel(i) : nullptr),
+				sequencer.get(),
+				bamWriter.get(),
+				std::ref(hctrs.local(i)),
 				maxNumHits.getValue(),
 				noout.getValue());
 		    }
 		}
 		for (auto& t : threads) { t.join(); }
 	    }
+	    progress.stop();
+	    auto totals = hctrs.total();
 	    consoleLog->info("Done mapping reads.");
-        consoleLog->info("In total saw {} reads.", hctrs.numReads);
-        consoleLog->info("Final # hits per read = {}", hctrs.totHits / static_cast<float>(hctrs.numReads));
+        consoleLog->info("In total saw {} reads.", totals.numReads);
+        consoleLog->info("Final # hits per read = {}", totals.totHits / static_cast<float>(totals.numReads));
 	    consoleLog->info("Discarded {} reads because they had > {} alignments",
-		    hctrs.tooManyHits, maxNumHits.getValue());
+		    totals.tooManyHits, maxNumHits.getValue());
 
 	    consoleLog->info("flushing output");
-	    outLog->flush();
+	    if (outWriter) {
+	        outWriter->close();
+	        auto ostats = outWriter->stats();
+	        consoleLog->info("Wrote {} bytes of output in {} writev calls", ostats.bytesWritten, ostats.numWritev);
+	        consoleLog->info("Mapping threads waited on output {} times ({} s); the writer waited on mapping {} times",
+	                         ostats.producerStalls, ostats.producerStallSeconds, ostats.writerIdleWaits);
+	        if (outWriter->ordered()) {
+	            consoleLog->info("At most {} jobs waited in the reorder window", ostats.maxReorderDepth);
+	        }
+	    }
+	    if (bamWriter and !bamWriter->close()) {
+	        consoleLog->error("Writing the BAM output failed");
+	        return 1;
+	    }
 	}
 
-	if (haveOutputFile) {
-	    outFile.close();
+	if (bamFile.is_open()) {
+	    bamFile.close();
 	}
 	return 0;
     } catch (TCLAP::ArgException& e) {
@@ -1,6 +1,7 @@
 #include "BooMap.hpp"
 #include "RapMapSAIndex.hpp"
 #include "IndexHeader.hpp"
+#include "RapMapFileSystem.hpp"
 #include <cereal/types/unordered_map.hpp>
 #include <cereal/types/vector.hpp>
 #include <cereal/types/string.hpp>
@@ -37,13 +38,6 @@ bool loadHashFromIndex(const std::string& indexDir,
 template <typename IndexT, typename HashT>
 RapMapSAIndex<IndexT, HashT>::RapMapSAIndex() {}
 
-// Given a position, p, in the concatenated text,
-// return the corresponding transcript
-template <typename IndexT, typename HashT>
-IndexT RapMapSAIndex<IndexT, HashT>::transcriptAtPosition(IndexT p) {
-    return rankDict->rank(p);
-}
-
 template <typename IndexT, typename HashT>
 bool RapMapSAIndex<IndexT, HashT>::load(const std::string& indDir) {
 
@@ -126,32 +120,71 @@ bool RapMapSAIndex<IndexT, HashT>::load(const std::string& indDir) {
        }
        rsStream.close();
        */
-    std::string rsFileName = indDir + "rsd.bin";
-    FILE* rsFile = fopen(rsFileName.c_str(), "r");
-    {
+    std::string posIDFileName = indDir + "posIDs.bin";
+    if (rapmap::fs::FileExists(posIDFileName.c_str())) {
+        std::ifstream posIDStream(posIDFileName, std::ios::binary);
+        {
+            logger->info("Loading Position IDs");
+            cereal::BinaryInputArchive posIDArchive(posIDStream);
+            posIDArchive(positionIDs);
+        }
+        posIDStream.close();
+        logger->info("Using {}-bit position IDs for fast locate ({} bytes)",
+                     positionIDs.width(), positionIDs.sizeInBytes());
+    }
+
+    // The compressed rank dictionary is only written on request, so if
+    // it is present, prefer it to the other boundary structures.
+    std::string rsdicFileName = indDir + "rsdic.bin";
+    std::string boundaryFileName = indDir + "txpBoundaries.bin";
+    if (rapmap::fs::FileExists(rsdicFileName.c_str())) {
+        logger->info("Loading Compressed Rank-Select Dictionary");
+        rankDict = RSDicDictionary::load(rsdicFileName);
+        if (!rankDict) {
+            logger->error("Couldn't load rank-select dictionary from {}!", rsdicFileName);
+            std::exit(1);
+        }
+    } else if (rapmap::fs::FileExists(boundaryFileName.c_str())) {
+        std::ifstream boundaryStream(boundaryFileName, std::ios::binary);
+        {
+            logger->info("Loading Transcript Boundaries");
+            cereal::BinaryInputArchive boundaryArchive(boundaryStream);
+            boundaryArchive(txpBoundaries);
+        }
+        boundaryStream.close();
+        logger->info("There were {} transcript boundaries ({} bytes)",
+                     txpBoundaries.size(), txpBoundaries.sizeInBytes());
+    } else {
+        std::string rsFileName = indDir + "rsd.bin";
         logger->info("Loading Rank-Select Bit Array");
-        bitArray.reset(bit_array_create(0));
-        if (!bit_array_load(bitArray.get(), rsFile)) {
+        rankDict = Rank9bDictionary::load(rsFileName);
+        if (!rankDict) {
             logger->error("Couldn't load bit array from {}!", rsFileName);
             std::exit(1);
         }
-        logger->info("There were {} set bits in the bit array", bit_array_num_bits_set(bitArray.get()));
-        rankDict.reset(new rank9b(bitArray->words, bitArray->num_of_bits));
     }
-    fclose(rsFile);
+    if (rankDict) {
+        logger->info("There were {} set bits in the bit array ({} rank dictionary, {} bytes)",
+                     rankDict->numOnes(), rankDict->name(), rankDict->sizeInBytes());
+    }
 
     {
         logger->info("Computing transcript lengths");
+        // Don't count the '$' terminating each transcript, if there is one
+        IndexT sepLen = h.generalizedSA() ? 1 : 0;
+        if (h.generalizedSA()) {
+            logger->info("Transcripts are '$'-terminated (generalized suffix array)");
+        }
         txpLens.resize(txpOffsets.size());
         if (txpOffsets.size() > 1) {
             for(size_t i = 0; i < txpOffsets.size() - 1; ++i) {
                 auto nextOffset = txpOffsets[i+1];
                 auto currentOffset = txpOffsets[i];
-                txpLens[i] = (nextOffset - 1) - currentOffset;
+                txpLens[i] = (nextOffset - sepLen) - currentOffset;
             }
         }
         // The last length is just the length of the suffix array - the last offset
-        txpLens[txpOffsets.size()-1] = (SA.size() - 1) - txpOffsets[txpOffsets.size() - 1];
+        txpLens[txpOffsets.size()-1] = (SA.size() - sepLen) - txpOffsets[txpOffsets.size() - 1];
     }
 
     logger->info("Waiting to finish loading hash");
@@ -46,10 +46,13 @@
 #include "jellyfish/mer_overlap_sequence_parser.hpp"
 #include "jellyfish/thread_exec.hpp"
 #include "rank9b.h"
+#include "RSDicBuilder.hpp"
 
 #include "sparsehash/dense_hash_map"
 
 #include "IndexHeader.hpp"
+#include "EliasFano.hpp"
+#include "PackedIntVector.hpp"
 
 #include <chrono>
 
@@ -165,7 +168,7 @@ bool buildPerfectHash(const std::string& outputDir, std::string& concatText,
   }
   if (start < tlen) {
     if (currentKmer.length() == k and
-        currentKmer.find_first_of('$') != std::string::npos) {
+        currentKmer.find_first_of('$') == std::string::npos) {
       mer = rapmap::utils::my_mer(currentKmer);
       auto bits = mer.get_bits(0, 2 * k);
       // intervals.push_back(std::make_pair<uint64_t,
@@ -363,7 +366,7 @@ bool buildHash(const std::string& outputDir, std::string& concatText,
   }
   if (start < tlen) {
     if (currentKmer.length() == k and
-        currentKmer.find_first_of('$') != std::string::npos) {
+        currentKmer.find_first_of('$') == std::string::npos) {
       mer = rapmap::utils::my_mer(currentKmer);
       khash[mer.get_bits(0, 2 * k)] = {start, stop};
     }
@@ -392,7 +395,8 @@ bool buildHash(const std::string& outputDir, std::string& concatText,
 template <typename ParserT> //, typename CoverageCalculator>
 void indexTranscriptsSA(ParserT* parser, std::string& outputDir,
                         bool noClipPolyA, bool usePerfectHash,
-                        uint32_t numHashThreads, std::mutex& iomutex,
+                        uint32_t numHashThreads, bool fastLocate,
+                        bool useRSDic, bool generalizedSA, std::mutex& iomutex,
                         std::shared_ptr<spdlog::logger> log) {
   // Seed with a real random value, if available
   std::random_device rd;
@@ -406,7 +410,6 @@ void indexTranscriptsSA(ParserT* parser, std::string& outputDir,
   uint32_t k = rapmap::utils::my_mer::k();
   std::vector<std::string> transcriptNames;
   std::vector<int64_t> transcriptStarts;
-  // std::vector<uint32_t> positionIDs;
   constexpr char bases[] = {'A', 'C', 'G', 'T'};
   uint32_t polyAClipLength{10};
   uint32_t numPolyAsClipped{0};
@@ -429,7 +432,6 @@ void indexTranscriptsSA(ParserT* parser, std::string& outputDir,
   size_t currIndex{0};
   std::cerr << "\n[Step 1 of 4] : counting k-mers\n";
 
-  // rsdic::RSDicBuilder rsdb;
   std::vector<uint64_t>
       onePos; // Positions in the bit array where we should write a '1'
   fmt::MemoryWriter txpSeqStream;
@@ -504,6 +506,15 @@ void indexTranscriptsSA(ParserT* parser, std::string& outputDir,
 
           txpSeqStream << readStr;
           currIndex += readLen;
+          // Terminate the transcript; '$' sorts before every base, so
+          // divsufsort orders each suffix only up to the end of its
+          // transcript, and no search can match across the junction.
+          // The boundary bit then marks the terminator rather than the
+          // last base.
+          if (generalizedSA) {
+            txpSeqStream << '$';
+            ++currIndex;
+          }
           onePos.push_back(currIndex - 1);
         } else {
             log->warn("Discarding entry with header [{}], since it was shorter than "
@@ -539,6 +550,26 @@ void indexTranscriptsSA(ParserT* parser, std::string& outputDir,
     bit_array_set_bit(bitArray, p);
   }
 
+  if (useRSDic) {
+    std::ofstream rsdicStream(outputDir + "rsdic.bin", std::ios::binary);
+    {
+      ScopedTimer timer;
+      std::cerr << "Building compressed rank-select dictionary and saving to disk ";
+      rsdic::RSDicBuilder rsdb;
+      size_t nextOne{0};
+      for (size_t p = 0; p < tlen; ++p) {
+        bool bit = (nextOne < onePos.size() and onePos[nextOne] == p);
+        nextOne += bit ? 1 : 0;
+        rsdb.PushBack(bit);
+      }
+      rsdic::RSDic rsd;
+      rsdb.Build(rsd);
+      rsd.Save(rsdicStream);
+      std::cerr << "done (" << rsd.GetUsageBytes() << " bytes)\n";
+    }
+    rsdicStream.close();
+  }
+
   onePos.clear();
   onePos.shrink_to_fit();
 
@@ -553,6 +584,39 @@ void indexTranscriptsSA(ParserT* parser, std::string& outputDir,
   fclose(rsFile);
   bit_array_free(bitArray);
 
+  std::ofstream boundaryStream(outputDir + "txpBoundaries.bin", std::ios::binary);
+  {
+    ScopedTimer timer;
+    std::cerr << "Building Elias-Fano transcript boundaries and saving to disk ";
+    std::vector<uint64_t> starts(transcriptStarts.begin(), transcriptStarts.end());
+    EliasFano txpBoundaries(starts, concatText.length());
+    cereal::BinaryOutputArchive boundaryArchive(boundaryStream);
+    boundaryArchive(txpBoundaries);
+    std::cerr << "done\n";
+  }
+  boundaryStream.close();
+
+  if (fastLocate) {
+    std::ofstream posIDStream(outputDir + "posIDs.bin", std::ios::binary);
+    {
+      ScopedTimer timer;
+      std::cerr << "Building packed position IDs and saving to disk ";
+      size_t numTxps = transcriptStarts.size();
+      PackedIntVector positionIDs(
+          tlen, PackedIntVector::bitsFor(numTxps > 0 ? numTxps - 1 : 0));
+      for (size_t t = 0; t < numTxps; ++t) {
+        size_t txpEnd = (t + 1 < numTxps) ? transcriptStarts[t + 1] : tlen;
+        for (size_t p = transcriptStarts[t]; p < txpEnd; ++p) {
+          positionIDs.set(p, t);
+        }
+      }
+      cereal::BinaryOutputArchive posIDArchive(posIDStream);
+      posIDArchive(positionIDs);
+      std::cerr << "done\n";
+    }
+    posIDStream.close();
+  }
+
   std::ofstream seqStream(outputDir + "txpInfo.bin", std::ios::binary);
   {
     ScopedTimer timer;
@@ -571,15 +635,12 @@ void indexTranscriptsSA(ParserT* parser, std::string& outputDir,
       transcriptStarts.shrink_to_fit();
       { seqArchive(txpStarts); }
     }
-    // seqArchive(positionIDs);
     seqArchive(concatText);
     std::cerr << "done\n";
   }
   seqStream.close();
 
   // clear stuff we no longer need
-  // positionIDs.clear();
-  // positionIDs.shrink_to_fit();
   transcriptStarts.clear();
   transcriptStarts.shrink_to_fit();
   transcriptNames.clear();
@@ -635,7 +696,7 @@ void indexTranscriptsSA(ParserT* parser, std::string& outputDir,
 
   std::string indexVersion = "q3";
   IndexHeader header(IndexType::QUASI, indexVersion, true, k, largeIndex,
-                     usePerfectHash);
+                     usePerfectHash, generalizedSA);
   // Finally (since everything presumably succeeded) write the header
   std::ofstream headerStream(outputDir + "header.json");
   {
@@ -668,12 +729,31 @@ int rapMapSAIndex(int argc, char* argv[]) {
       "x", "numThreads",
       "Use this many threads to build the perfect hash function", false, 4,
       "positive integer <= # cores");
+  TCLAP::SwitchArg fastLocateArg(
+      "f", "fastLocate", "Also store the transcript of every text position "
+                         "(ceil(log2(# transcripts)) bits each) --- uses more "
+                         "memory, but locates hits without a rank query",
+      false);
+  TCLAP::SwitchArg rsdicArg(
+      "r", "rsdic", "Also write a compressed (RSDic) rank-select dictionary "
+                    "of the transcript boundaries, and use it in place of "
+                    "the default boundary structure when mapping",
+      false);
+  TCLAP::SwitchArg generalizedSAArg(
+      "g", "generalizedSA", "End every transcript with a '$' terminator, so "
+                            "that suffixes are sorted (and matched) only up "
+                            "to the end of their transcript, and no k-mer "
+                            "interval holds a suffix spanning two transcripts",
+      false);
   cmd.add(transcripts);
   cmd.add(index);
   cmd.add(kval);
   cmd.add(noClip);
   cmd.add(perfectHash);
   cmd.add(numHashThreads);
+  cmd.add(fastLocateArg);
+  cmd.add(rsdicArg);
+  cmd.add(generalizedSAArg);
   cmd.parse(argc, argv);
 
   // stupid parsing for now
@@ -723,8 +803,12 @@ int rapMapSAIndex(int argc, char* argv[]) {
   bool noClipPolyA = noClip.getValue();
   bool usePerfectHash = perfectHash.getValue();
   uint32_t numPerfectHashThreads = numHashThreads.getValue();
+  bool fastLocate = fastLocateArg.getValue();
+  bool useRSDic = rsdicArg.getValue();
+  bool generalizedSA = generalizedSAArg.getValue();
   std::mutex iomutex;
   indexTranscriptsSA(transcriptParserPtr.get(), indexDir, noClipPolyA,
-                     usePerfectHash, numPerfectHashThreads, iomutex, jointLog);
+                     usePerfectHash, numPerfectHashThreads, fastLocate,
+                     useRSDic, generalizedSA, iomutex, jointLog);
   return 0;
 }
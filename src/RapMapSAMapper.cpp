@@ -6,6 +6,7 @@
 #include <fstream>
 #include <algorithm>
 #include <iterator>
+#include <cerrno>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
@@ -31,12 +32,12 @@
 #include "xxhash.h"
 
 #include "spdlog/spdlog.h"
-#include "spdlog/sinks/ostream_sink.h"
 #include "spdlog/details/format.h"
 
 // Jellyfish 2 include
 #include "jellyfish/mer_dna.hpp"
 #include "jellyfish/stream_manager.hpp"
+#include "GzipStream.hpp"
 #include "jellyfish/whole_sequence_parser.hpp"
 #include "jellyfish/hash_counter.hpp"
 
@@ -60,12 +61,27 @@
 #include "IndexHeader.hpp"
 #include "SASearcher.hpp"
 #include "SACollector.hpp"
+#include "AllocationCounter.hpp"
+#include "BAMUtils.hpp"
+#include "BGZFWriter.hpp"
+#include "OutputWriter.hpp"
+#include "FastqBlockParser.hpp"
+#include "HitVerifier.hpp"
+#include "MEMFormat.hpp"
+#include "AlignmentFormat.hpp"
+#include "ReadEqClasses.hpp"
+#include "WorkStealingReadSource.hpp"
+#include "StageTimer.hpp"
 
 //#define __TRACK_CORRECT__
 
 using paired_parser = pair_sequence_parser<char**>;
-using stream_manager = jellyfish::stream_manager<std::vector<std::string>::const_iterator>;
+// Like jellyfish::stream_manager, but reads gzipped files too
+using stream_manager = rapmap::io::ReadStreamManager<std::vector<std::string>::const_iterator>;
 using single_parser = jellyfish::whole_sequence_parser<stream_manager>;
+// The FASTQ-only block parsers (--blockParser)
+using paired_block_parser = rapmap::io::FastqBlockParser<sequence_list, 2>;
+using single_block_parser = rapmap::io::FastqBlockParser<jellyfish::sequence_list, 1>;
 using TranscriptID = uint32_t;
 using TranscriptIDVector = std::vector<TranscriptID>;
 using KmerIDMap = std::vector<TranscriptIDVector>;
@@ -93,17 +109,22 @@ using FixedWriter = rapmap::utils::FixedWriter;
 
 
 
-template <typename RapMapIndexT, typename CollectorT, typename MutexT>
-void processReadsSingleSA(single_parser * parser,
+template <typename ParserT, typename RapMapIndexT, typename CollectorT, typename MutexT>
+void processReadsSingleSA(ParserT* parser,
                           RapMapIndexT& rmi,
                           CollectorT& hitCollector,
                           MutexT* iomutex,
-                          std::shared_ptr<spdlog::logger> outQueue,
+                          rapmap::io::OutputChannel* outChannel,
+                          rapmap::io::JobSequencer* sequencer,
+                          rapmap::bam::BGZFWriter* bamWriter,
                           HitCounters& hctr,
                           uint32_t maxNumHits,
                           bool noOutput,
                           bool strictCheck,
-                          bool consistentHits) {
+                          bool consistentHits,
+                          int32_t maxEdits,
+                          rapmap::utils::ReadEqClassTable* eqTable,
+                          bool binaryOutput) {
 
     using OffsetT = typename RapMapIndexT::IndexType;
     auto& txpNames = rmi.txpNames;
@@ -113,6 +134,11 @@ void processReadsSingleSA(single_parser * parser,
     auto logger = spdlog::get("stderrLog");
 
     fmt::MemoryWriter sstream;
+    // BAM records of the current job, if we're writing BAM
+    std::string bamBuffer;
+    // Binary records of the current job, if we're writing them
+    rapmap::aln::ChunkWriter chunk;
+    std::string chunkBuffer;
     size_t batchSize{2500};
     std::vector<QuasiAlignment> hits;
 
@@ -123,60 +149,94 @@ void processReadsSingleSA(single_parser * parser,
     SingleAlignmentFormatter<RapMapIndexT*> formatter(&rmi);
 
     SASearcher<RapMapIndexT> saSearcher(&rmi);
+    // Buffers the collector reuses for every read this thread maps
+    typename CollectorT::Scratch collectorScratch(&rmi);
+    // Checks the hits against the text, if maxEdits >= 0
+    rapmap::verify::HitVerifier<RapMapIndexT> verifier(&rmi, std::max(maxEdits, 0));
+    // The transcripts of a read, if we're counting equivalence classes
+    std::vector<uint32_t> eqTids;
+#ifdef RAPMAP_COUNT_ALLOCATIONS
+    uint64_t mappingAllocs{0};
+#endif // RAPMAP_COUNT_ALLOCATIONS
 
     uint32_t orphanStatus{0};
     while(true) {
-        typename single_parser::job j(*parser); // Get a job from the parser: a bunch of reads (at most max_read_group)
+        uint64_t jobSeq{0};
+        std::unique_lock<std::mutex> seqLock;
+        if (sequencer) { seqLock = std::unique_lock<std::mutex>(sequencer->mutex); }
+        RAPMAP_STAGE_BEGIN(parserWaitStart);
+        typename ParserT::job j(*parser); // Get a job from the parser: a bunch of reads (at most max_read_group)
+        RAPMAP_STAGE_END(ParserWait, parserWaitStart);
         if(j.is_empty()) break;                 // If we got nothing, then quit.
+        if (sequencer) {
+            jobSeq = sequencer->next++;
+            seqLock.unlock();
+        }
         for(size_t i = 0; i < j->nb_filled; ++i) { // For each sequence
             readLen = j->data[i].seq.length();
             ++hctr.numReads;
+            RAPMAP_READ_BEGIN();
+#ifdef RAPMAP_COUNT_ALLOCATIONS
+            auto allocsBefore = rapmap::utils::threadAllocationCount();
+#endif // RAPMAP_COUNT_ALLOCATIONS
             hits.clear();
-            hitCollector(j->data[i].seq, hits, saSearcher, MateStatus::SINGLE_END, strictCheck, consistentHits);
+            hitCollector(j->data[i].seq, hits, saSearcher, collectorScratch, MateStatus::SINGLE_END, strictCheck, consistentHits);
+            if (maxEdits >= 0) {
+                RAPMAP_STAGE_BEGIN(verifyStart);
+                hctr.unverifiedHits += verifier.filter(j->data[i].seq, hits);
+                RAPMAP_STAGE_END(VerifyHits, verifyStart);
+            }
             auto numHits = hits.size();
             hctr.totHits += numHits;
 
-	    if (hits.size() > 0 and !noOutput and hits.size() <= maxNumHits) {
+            if (eqTable) {
+                if (hits.size() > 0 and hits.size() <= maxNumHits) {
+                    eqTids.clear();
+                    for (auto& h : hits) { eqTids.push_back(h.tid); }
+                    eqTable->add(eqTids);
+                }
+            } else if (hits.size() > 0 and !noOutput and hits.size() <= maxNumHits) {
                 /*
                 std::sort(hits.begin(), hits.end(),
                             [](const QuasiAlignment& a, const QuasiAlignment& b) -> bool {
                                 return a.tid < b.tid;
                             });
                 */
-                rapmap::utils::writeAlignmentsToStream(j->data[i], formatter,
-                                                       hctr, hits, sstream);
-            }
-
-            if (hctr.numReads > hctr.lastPrint + 1000000) {
-        		hctr.lastPrint.store(hctr.numReads.load());
-                if (iomutex->try_lock()){
-                    if (hctr.numReads > 0) {
-#if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
-                        std::cerr << "\033[F\033[F\033[F";
-#else
-                        std::cerr << "\033[F\033[F";
-#endif // __DEBUG__
-                    }
-                    std::cerr << "saw " << hctr.numReads << " reads\n";
-                    std::cerr << "# hits per read = "
-                        << hctr.totHits / static_cast<float>(hctr.numReads) << "\n";
-#if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
-                    std::cerr << "The true hit was in the returned set of hits "
-                        << 100.0 * (hctr.trueHits / static_cast<float>(hctr.numReads))
-                        <<  "% of the time\n";
-#endif // __DEBUG__
-                    iomutex->unlock();
+                RAPMAP_STAGE_BEGIN(formatStart);
+                if (bamWriter) {
+                    rapmap::utils::writeAlignmentsToBAM(j->data[i], formatter,
+                                                        hctr, hits, bamBuffer);
+                } else if (binaryOutput) {
+                    chunk.add(j->data[i].header, readLen, hits);
+                } else {
+                    rapmap::utils::writeAlignmentsToStream(j->data[i], formatter,
+                                                           hctr, hits, sstream);
                 }
+                RAPMAP_STAGE_END(Format, formatStart);
             }
+            RAPMAP_READ_END();
+#ifdef RAPMAP_COUNT_ALLOCATIONS
+            mappingAllocs += rapmap::utils::threadAllocationCount() - allocsBefore;
+#endif // RAPMAP_COUNT_ALLOCATIONS
         } // for all reads in this job
 
         // DUMP OUTPUT
-        if (!noOutput) {
-            std::string outStr(sstream.str());
-            // Get rid of last newline
-            if (!outStr.empty()) {
-                outStr.pop_back();
-                outQueue->info() << std::move(outStr);
+        RAPMAP_STAGE_BEGIN(outputStart);
+        if (bamWriter) {
+            bamWriter->write(bamBuffer);
+        } else if (outChannel and binaryOutput) {
+            chunk.flush(chunkBuffer);
+            if (sequencer) {
+                outChannel->writeJob(jobSeq, chunkBuffer.data(), chunkBuffer.size());
+            } else {
+                outChannel->write(chunkBuffer.data(), chunkBuffer.size());
+            }
+            chunkBuffer.clear();
+        } else if (outChannel) {
+            if (sequencer) {
+                outChannel->writeJob(jobSeq, sstream.data(), sstream.size());
+            } else {
+                outChannel->write(sstream.data(), sstream.size());
             }
             sstream.clear();
             /*
@@ -186,27 +246,36 @@ void processReadsSingleSA(single_parser * parser,
              sstream.clear();
              */
         }
+        RAPMAP_STAGE_END(Output, outputStart);
 
     } // processed all reads
 
-
+#ifdef RAPMAP_COUNT_ALLOCATIONS
+    hctr.mappingAllocs += mappingAllocs;
+#endif // RAPMAP_COUNT_ALLOCATIONS
 }
 
 /**
  *  Map reads from a collection of paired-end files.
  */
-template <typename RapMapIndexT, typename CollectorT, typename MutexT>
-void processReadsPairSA(paired_parser* parser,
+template <typename ParserT, typename RapMapIndexT, typename CollectorT, typename MutexT>
+void processReadsPairSA(ParserT* parser,
                         RapMapIndexT& rmi,
                         CollectorT& hitCollector,
                         MutexT* iomutex,
-                        std::shared_ptr<spdlog::logger> outQueue,
+                        rapmap::io::OutputChannel* outChannel,
+                        rapmap::io::JobSequencer* sequencer,
+                        rapmap::bam::BGZFWriter* bamWriter,
                         HitCounters& hctr,
                         uint32_t maxNumHits,
                         bool noOutput,
                         bool strictCheck,
                         bool nonStrictMerge,
-                        bool consistentHits) {
+                        bool mateConstrained,
+                        bool consistentHits,
+                        int32_t maxEdits,
+                        rapmap::utils::ReadEqClassTable* eqTable,
+                        bool binaryOutput) {
 
     using OffsetT = typename RapMapIndexT::IndexType;
 
@@ -217,6 +286,11 @@ void processReadsPairSA(paired_parser* parser,
     auto logger = spdlog::get("stderrLog");
 
     fmt::MemoryWriter sstream;
+    // BAM records of the current job, if we're writing BAM
+    std::string bamBuffer;
+    // Binary records of the current job, if we're writing them
+    rapmap::aln::ChunkWriter chunk;
+    std::string chunkBuffer;
     size_t batchSize{1000};
     std::vector<QuasiAlignment> leftHits;
     std::vector<QuasiAlignment> rightHits;
@@ -230,30 +304,113 @@ void processReadsPairSA(paired_parser* parser,
     PairAlignmentFormatter<RapMapIndexT*> formatter(&rmi);
 
     SASearcher<RapMapIndexT> saSearcher(&rmi);
+    // Buffers the collector reuses for every read this thread maps
+    typename CollectorT::Scratch collectorScratch(&rmi);
+    // Checks the hits against the text, if maxEdits >= 0
+    rapmap::verify::HitVerifier<RapMapIndexT> verifier(&rmi, std::max(maxEdits, 0));
+    // The transcripts of a read, if we're counting equivalence classes
+    std::vector<uint32_t> eqTids;
+    // The transcripts hit by the first mate, in mate-constrained mode
+    rapmap::hit_manager::TxpBitmap mateTxps;
+    if (mateConstrained) { mateTxps.resize(rmi.txpNames.size()); }
+#ifdef RAPMAP_COUNT_ALLOCATIONS
+    uint64_t mappingAllocs{0};
+#endif // RAPMAP_COUNT_ALLOCATIONS
 
     uint32_t orphanStatus{0};
     while(true) {
-        typename paired_parser::job j(*parser); // Get a job from the parser: a bunch of reads (at most max_read_group)
+        uint64_t jobSeq{0};
+        std::unique_lock<std::mutex> seqLock;
+        if (sequencer) { seqLock = std::unique_lock<std::mutex>(sequencer->mutex); }
+        RAPMAP_STAGE_BEGIN(parserWaitStart);
+        typename ParserT::job j(*parser); // Get a job from the parser: a bunch of reads (at most max_read_group)
+        RAPMAP_STAGE_END(ParserWait, parserWaitStart);
         if(j.is_empty()) break;                 // If we got nothing, quit
+        if (sequencer) {
+            jobSeq = sequencer->next++;
+            seqLock.unlock();
+        }
         for(size_t i = 0; i < j->nb_filled; ++i) { // For each sequence
 		    tooManyHits = false;
             readLen = j->data[i].first.seq.length();
             ++hctr.numReads;
+            RAPMAP_READ_BEGIN();
+#ifdef RAPMAP_COUNT_ALLOCATIONS
+            auto allocsBefore = rapmap::utils::threadAllocationCount();
+#endif // RAPMAP_COUNT_ALLOCATIONS
             jointHits.clear();
             leftHits.clear();
             rightHits.clear();
 
-            bool lh = hitCollector(j->data[i].first.seq,
-                                   leftHits, saSearcher,
-                                   MateStatus::PAIRED_END_LEFT,
-                                   strictCheck,
-                                   consistentHits);
+            bool lh{false}, rh{false};
+            if (mateConstrained) {
+                // Map the mate with the more specific seeds first, then
+                // look for the other only on the transcripts it hit
+                auto& leftRead = j->data[i].first.seq;
+                auto& rightRead = j->data[i].second.seq;
+                bool leftFirst = hitCollector.firstSeedWidth(leftRead) <=
+                                 hitCollector.firstSeedWidth(rightRead);
+                auto& firstRead = leftFirst ? leftRead : rightRead;
+                auto& secondRead = leftFirst ? rightRead : leftRead;
+                auto& firstHits = leftFirst ? leftHits : rightHits;
+                auto& secondHits = leftFirst ? rightHits : leftHits;
+                auto firstStatus = leftFirst ? MateStatus::PAIRED_END_LEFT : MateStatus::PAIRED_END_RIGHT;
+                auto secondStatus = leftFirst ? MateStatus::PAIRED_END_RIGHT : MateStatus::PAIRED_END_LEFT;
+
+                hitCollector(firstRead, firstHits, saSearcher, collectorScratch,
+                             firstStatus, strictCheck, consistentHits);
+                if (maxEdits >= 0) {
+                    RAPMAP_STAGE_BEGIN(verifyStart);
+                    hctr.unverifiedHits += verifier.filter(firstRead, firstHits);
+                    RAPMAP_STAGE_END(VerifyHits, verifyStart);
+                }
+                for (auto& h : firstHits) { mateTxps.insert(h.tid); }
+                if (!mateTxps.empty()) {
+                    hitCollector(secondRead, secondHits, saSearcher, collectorScratch,
+                                 secondStatus, strictCheck, consistentHits, &mateTxps);
+                    if (maxEdits >= 0) {
+                        RAPMAP_STAGE_BEGIN(verifyStart);
+                        hctr.unverifiedHits += verifier.filter(secondRead, secondHits);
+                        RAPMAP_STAGE_END(VerifyHits, verifyStart);
+                    }
+                    mateTxps.clear();
+                }
+                // Without a concordant pair, all the hits of the second
+                // mate are reported as orphans, so search it again in full
+                if (secondHits.empty()) {
+                    ++hctr.mateRescans;
+                    hitCollector(secondRead, secondHits, saSearcher, collectorScratch,
+                                 secondStatus, strictCheck, consistentHits);
+                    if (maxEdits >= 0) {
+                        RAPMAP_STAGE_BEGIN(verifyStart);
+                        hctr.unverifiedHits += verifier.filter(secondRead, secondHits);
+                        RAPMAP_STAGE_END(VerifyHits, verifyStart);
+                    }
+                }
+                lh = !leftHits.empty();
+                rh = !rightHits.empty();
+            } else {
+                lh = hitCollector(j->data[i].first.seq,
+                                  leftHits, saSearcher, collectorScratch,
+                                  MateStatus::PAIRED_END_LEFT,
+                                  strictCheck,
+                                  consistentHits);
+
+                rh = hitCollector(j->data[i].second.seq,
+                                  rightHits, saSearcher, collectorScratch,
+                                  MateStatus::PAIRED_END_RIGHT,
+                                  strictCheck,
+                                  consistentHits);
+            }
 
-            bool rh = hitCollector(j->data[i].second.seq,
-                                   rightHits, saSearcher,
-                                   MateStatus::PAIRED_END_RIGHT,
-                                   strictCheck,
-                                   consistentHits);
+            if (maxEdits >= 0 and !mateConstrained) {
+                RAPMAP_STAGE_BEGIN(verifyStart);
+                hctr.unverifiedHits += verifier.filter(j->data[i].first.seq, leftHits);
+                hctr.unverifiedHits += verifier.filter(j->data[i].second.seq, rightHits);
+                RAPMAP_STAGE_END(VerifyHits, verifyStart);
+                lh = !leftHits.empty();
+                rh = !rightHits.empty();
+            }
 
             if (nonStrictMerge) {
                 rapmap::utils::mergeLeftRightHitsFuzzy(
@@ -267,37 +424,50 @@ void processReadsPairSA(paired_parser* parser,
                         readLen, maxNumHits, tooManyHits, hctr);
             }
 
-            // If we have reads to output, and we're writing output.
-            if (jointHits.size() > 0 and !noOutput and jointHits.size() <= maxNumHits) {
-                rapmap::utils::writeAlignmentsToStream(j->data[i], formatter,
-                                                       hctr, jointHits, sstream);
-            }
-
-            if (hctr.numReads > hctr.lastPrint + 1000000) {
-        		hctr.lastPrint.store(hctr.numReads.load());
-                if (iomutex->try_lock()) {
-                    if (hctr.numReads > 0) {
-                        std::cerr << "\r\r";
-                    }
-                    std::cerr << "saw " << hctr.numReads << " reads : "
-                              << "pe / read = " << hctr.peHits / static_cast<float>(hctr.numReads)
-                              << " : se / read = " << hctr.seHits / static_cast<float>(hctr.numReads) << ' ';
-#if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
-                    std::cerr << ": true hit \% = "
-                        << (100.0 * (hctr.trueHits / static_cast<float>(hctr.numReads)));
-#endif // __DEBUG__
-                    iomutex->unlock();
+            if (eqTable) {
+                if (jointHits.size() > 0 and jointHits.size() <= maxNumHits) {
+                    eqTids.clear();
+                    for (auto& h : jointHits) { eqTids.push_back(h.tid); }
+                    eqTable->add(eqTids);
                 }
+            } else if (jointHits.size() > 0 and !noOutput and jointHits.size() <= maxNumHits) {
+                // If we have reads to output, and we're writing output.
+                RAPMAP_STAGE_BEGIN(formatStart);
+                if (bamWriter) {
+                    rapmap::utils::writeAlignmentsToBAM(j->data[i], formatter,
+                                                        hctr, jointHits, bamBuffer);
+                } else if (binaryOutput) {
+                    chunk.add(j->data[i].first.header, j->data[i].first.seq.length(),
+                              j->data[i].second.seq.length(), jointHits);
+                } else {
+                    rapmap::utils::writeAlignmentsToStream(j->data[i], formatter,
+                                                           hctr, jointHits, sstream);
+                }
+                RAPMAP_STAGE_END(Format, formatStart);
             }
+            RAPMAP_READ_END();
+#ifdef RAPMAP_COUNT_ALLOCATIONS
+            mappingAllocs += rapmap::utils::threadAllocationCount() - allocsBefore;
+#endif // RAPMAP_COUNT_ALLOCATIONS
         } // for all reads in this job
 
         // DUMP OUTPUT
-        if (!noOutput) {
-            std::string outStr(sstream.str());
-            // Get rid of last newline
-            if (!outStr.empty()) {
-                outStr.pop_back();
-                outQueue->info() << std::move(outStr);
+        RAPMAP_STAGE_BEGIN(outputStart);
+        if (bamWriter) {
+            bamWriter->write(bamBuffer);
+        } else if (outChannel and binaryOutput) {
+            chunk.flush(chunkBuffer);
+            if (sequencer) {
+                outChannel->writeJob(jobSeq, chunkBuffer.data(), chunkBuffer.size());
+            } else {
+                outChannel->write(chunkBuffer.data(), chunkBuffer.size());
+            }
+            chunkBuffer.clear();
+        } else if (outChannel) {
+            if (sequencer) {
+                outChannel->writeJob(jobSeq, sstream.data(), sstream.size());
+            } else {
+                outChannel->write(sstream.data(), sstream.size());
             }
             sstream.clear();
 	        /*
@@ -307,78 +477,245 @@ void processReadsPairSA(paired_parser* parser,
             sstream.clear();
 	        */
         }
+        RAPMAP_STAGE_END(Output, outputStart);
 
     } // processed all reads
 
+#ifdef RAPMAP_COUNT_ALLOCATIONS
+    hctr.mappingAllocs += mappingAllocs;
+#endif // RAPMAP_COUNT_ALLOCATIONS
 }
 
-template <typename RapMapIndexT, typename MutexT>
+/**
+ * Instead of mapping, write the SMEMs (of at least minLen bases) of
+ * each read, and of its reverse complement, in the format of
+ * MEMFormat.hpp.  numMates is 2 for paired-end parsers, 1 otherwise.
+ */
+template <typename ParserT, typename RapMapIndexT>
+void processReadsMEMs(ParserT* parser,
+                      RapMapIndexT& rmi,
+                      rapmap::io::OutputChannel* outChannel,
+                      rapmap::io::JobSequencer* sequencer,
+                      HitCounters& hctr,
+                      uint32_t minLen,
+                      uint32_t numMates) {
+    using SMEM = typename SASearcher<RapMapIndexT>::SMEM;
+
+    SASearcher<RapMapIndexT> saSearcher(&rmi);
+    std::string buffer;
+    std::string read, rcRead;
+    std::vector<SMEM> fwdMems, rcMems;
+
+    while(true) {
+        uint64_t jobSeq{0};
+        std::unique_lock<std::mutex> seqLock;
+        if (sequencer) { seqLock = std::unique_lock<std::mutex>(sequencer->mutex); }
+        RAPMAP_STAGE_BEGIN(parserWaitStart);
+        typename ParserT::job j(*parser);
+        RAPMAP_STAGE_END(ParserWait, parserWaitStart);
+        if(j.is_empty()) break;
+        if (sequencer) {
+            jobSeq = sequencer->next++;
+            seqLock.unlock();
+        }
+        for(size_t i = 0; i < j->nb_filled; ++i) {
+            ++hctr.numReads;
+            for (uint32_t m = 0; m < numMates; ++m) {
+                auto& rec = rapmap::io::mateRecord(j->data[i], m);
+                read = rec.seq;
+                std::transform(read.begin(), read.end(), read.begin(), ::toupper);
+                rcRead.resize(read.length());
+                for (size_t p = 0; p < read.length(); ++p) {
+                    char c = read[read.length() - 1 - p];
+                    switch (c) {
+                        case 'A': c = 'T'; break;
+                        case 'C': c = 'G'; break;
+                        case 'G': c = 'C'; break;
+                        case 'T': c = 'A'; break;
+                        default: c = 'N';
+                    }
+                    rcRead[p] = c;
+                }
+                fwdMems.clear();
+                rcMems.clear();
+                saSearcher.smems(read, minLen, fwdMems);
+                saSearcher.smems(rcRead, minLen, rcMems);
+                hctr.totHits += fwdMems.size() + rcMems.size();
+                if (outChannel) {
+                    rapmap::mems::appendRecord(buffer, rec.header, static_cast<uint8_t>(m),
+                                               fwdMems, rcMems);
+                }
+            }
+        }
+
+        RAPMAP_STAGE_BEGIN(outputStart);
+        if (outChannel) {
+            if (sequencer) {
+                outChannel->writeJob(jobSeq, buffer.data(), buffer.size());
+            } else {
+                outChannel->write(buffer.data(), buffer.size());
+            }
+            buffer.clear();
+        }
+        RAPMAP_STAGE_END(Output, outputStart);
+    }
+}
+
+template <typename ParserT, typename RapMapIndexT>
+bool spawnMEMThreads(uint32_t nthread,
+                     ParserT* parser,
+                     RapMapIndexT& rmi,
+                     rapmap::io::OutputWriter* outWriter,
+                     rapmap::io::JobSequencer* sequencer,
+                     rapmap::utils::HitCounterSet& hctrs,
+                     uint32_t minLen,
+                     uint32_t numMates) {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < nthread; ++i) {
+        threads.emplace_back(processReadsMEMs<ParserT, RapMapIndexT>,
+                             parser,
+                             std::ref(rmi),
+                             (outWriter ? &outWriter->channel(i) : nullptr),
+                             sequencer,
+                             std::ref(hctrs.local(i)),
+                             minLen,
+                             numMates);
+    }
+    for (auto& t : threads) { t.join(); }
+    return true;
+}
+
+template <typename ParserT, typename RapMapIndexT, typename MutexT>
 bool spawnProcessReadsThreads(
                               uint32_t nthread,
-                              paired_parser* parser,
+                              ParserT* parser,
                               RapMapIndexT& rmi,
                               MutexT& iomutex,
-                              std::shared_ptr<spdlog::logger> outQueue,
-                              HitCounters& hctr,
+                              rapmap::io::OutputWriter* outWriter,
+                              rapmap::io::JobSequencer* sequencer,
+                              rapmap::bam::BGZFWriter* bamWriter,
+                              rapmap::utils::HitCounterSet& hctrs,
                               uint32_t maxNumHits,
                               bool noOutput,
                               bool strictCheck,
                               bool fuzzy,
-                              bool consistentHits) {
-
+                              bool mateConstrained,
+                              bool consistentHits,
+                              uint32_t rescueMismatches,
+                              int32_t maxEdits,
+                              std::vector<rapmap::utils::ReadEqClassTable>* eqTables,
+                              bool binaryOutput,
+                              uint32_t memMinLen) {
+
+            if (memMinLen > 0) {
+                return spawnMEMThreads(nthread, parser, rmi, outWriter, sequencer, hctrs, memMinLen, 2);
+            }
             std::vector<std::thread> threads;
-            SACollector<RapMapIndexT> saCollector(&rmi);
+            SACollector<RapMapIndexT> saCollector(&rmi, rescueMismatches);
             for (size_t i = 0; i < nthread; ++i) {
-                threads.emplace_back(processReadsPairSA<RapMapIndexT, SACollector<RapMapIndexT>, MutexT>,
+                threads.emplace_back(processReadsPairSA<ParserT, RapMapIndexT, SACollector<RapMapIndexT>, MutexT>,
                                      parser,
                                      std::ref(rmi),
                                      std::ref(saCollector),
                                      &iomutex,
-                                     outQueue,
-                                     std::ref(hctr),
+                                     (outWriter ? &outWriter->channel(i) : nullptr),
+                                     sequencer,
+                                     bamWriter,
+                                     std::ref(hctrs.local(i)),
                                      maxNumHits,
                                      noOutput,
                                      strictCheck,
                                      fuzzy,
-                                     consistentHits);
+                                     mateConstrained,
+                                     consistentHits,
+                                     maxEdits,
+                                     (eqTables ? &(*eqTables)[i] : nullptr),
+                                     binaryOutput);
             }
 
             for (auto& t : threads) { t.join(); }
             return true;
         }
 
-template <typename RapMapIndexT, typename MutexT>
+template <typename ParserT, typename RapMapIndexT, typename MutexT>
 bool spawnProcessReadsThreads(
                               uint32_t nthread,
-                              single_parser* parser,
+                              ParserT* parser,
                               RapMapIndexT& rmi,
                               MutexT& iomutex,
-                              std::shared_ptr<spdlog::logger> outQueue,
-                              HitCounters& hctr,
+                              rapmap::io::OutputWriter* outWriter,
+                              rapmap::io::JobSequencer* sequencer,
+                              rapmap::bam::BGZFWriter* bamWriter,
+                              rapmap::utils::HitCounterSet& hctrs,
                               uint32_t maxNumHits,
                               bool noOutput,
                               bool strictCheck,
-                              bool consistentHits) {
-
+                              bool consistentHits,
+                              uint32_t rescueMismatches,
+                              int32_t maxEdits,
+                              std::vector<rapmap::utils::ReadEqClassTable>* eqTables,
+                              bool binaryOutput,
+                              uint32_t memMinLen) {
+
+            if (memMinLen > 0) {
+                return spawnMEMThreads(nthread, parser, rmi, outWriter, sequencer, hctrs, memMinLen, 1);
+            }
             std::vector<std::thread> threads;
-            SACollector<RapMapIndexT> saCollector(&rmi);
+            SACollector<RapMapIndexT> saCollector(&rmi, rescueMismatches);
             for (size_t i = 0; i < nthread; ++i) {
-                threads.emplace_back(processReadsSingleSA<RapMapIndexT, SACollector<RapMapIndexT>, MutexT>,
+                threads.emplace_back(processReadsSingleSA<ParserT, RapMapIndexT, SACollector<RapMapIndexT>, MutexT>,
                                      parser,
                                      std::ref(rmi),
                                      std::ref(saCollector),
                                      &iomutex,
-                                     outQueue,
-                                     std::ref(hctr),
+                                     (outWriter ? &outWriter->channel(i) : nullptr),
+                                     sequencer,
+                                     bamWriter,
+                                     std::ref(hctrs.local(i)),
                                      maxNumHits,
                                      noOutput,
                                      strictCheck, 
-                                     consistentHits);
+                                     consistentHits,
+                                     maxEdits,
+                                     (eqTables ? &(*eqTables)[i] : nullptr),
+                                     binaryOutput);
             }
             for (auto& t : threads) { t.join(); }
             return true;
         }
 
+/**
+ * Run the mapping threads on the reads from parser, either taking jobs
+ * straight from the parser or, if taskSize > 0, through a work-stealing
+ * read source that splits the jobs into tasks of taskSize reads.  args
+ * are the rest of spawnProcessReadsThreads' arguments.
+ */
+template <typename ParserT, typename RapMapIndexT, typename MutexT, typename... Args>
+bool spawnMappingThreads(uint32_t nthread,
+                         ParserT* parser,
+                         uint32_t taskSize,
+                         RapMapIndexT& rmi,
+                         MutexT& iomutex,
+                         Args&&... args) {
+    if (taskSize == 0) {
+        return spawnProcessReadsThreads(nthread, parser, rmi, iomutex, std::forward<Args>(args)...);
+    }
+
+    rapmap::io::WorkStealingReadSource<ParserT> source(*parser, nthread, taskSize);
+    bool success = spawnProcessReadsThreads(nthread, &source, rmi, iomutex, std::forward<Args>(args)...);
+
+    auto logger = spdlog::get("stderrLog");
+    auto utilization = source.utilization();
+    for (size_t i = 0; i < utilization.size(); ++i) {
+        auto& u = utilization[i];
+        logger->info("thread {}: {} reads in {} tasks ({} stolen, {} parser jobs); "
+                     "mapping {:.2f} s, waiting {:.2f} s ({:.1f}% utilization)",
+                     i, u.numReads, u.numTasks, u.numStolen, u.numFetched,
+                     u.busySeconds, u.waitSeconds, 100.0 * u.utilization());
+    }
+    return success;
+}
+
 template <typename RapMapIndexT>
 bool mapReads(RapMapIndexT& rmi,
 	      std::shared_ptr<spdlog::logger> consoleLog,
@@ -392,50 +729,178 @@ bool mapReads(RapMapIndexT& rmi,
 	      TCLAP::SwitchArg& noout,
 	      TCLAP::SwitchArg& strict,
           TCLAP::SwitchArg& fuzzy, 
-          TCLAP::SwitchArg& consistent) {
+          TCLAP::SwitchArg& consistent,
+          TCLAP::SwitchArg& bam,
+          TCLAP::ValueArg<uint32_t>& bamThreads,
+          TCLAP::SwitchArg& ordered,
+          TCLAP::ValueArg<uint32_t>& gzThreads,
+          TCLAP::SwitchArg& blockParser,
+          TCLAP::SwitchArg& workStealing,
+          TCLAP::ValueArg<uint32_t>& taskSize,
+          TCLAP::ValueArg<std::string>& stageTimes,
+          TCLAP::ValueArg<uint32_t>& rescue,
+          TCLAP::ValueArg<uint32_t>& verifyEdits,
+          TCLAP::ValueArg<std::string>& eqClasses,
+          TCLAP::ValueArg<uint32_t>& mems,
+          TCLAP::SwitchArg& binary,
+          TCLAP::SwitchArg& mateFirst) {
 
 	std::cerr << "\n\n\n\n";
 
 	bool pairedEnd = (read1.isSet() or read2.isSet());
-	// from: http://stackoverflow.com/questions/366955/obtain-a-stdostream-either-from-stdcout-or-stdofstreamfile
-	// set either a file or cout as the output stream
-	std::streambuf* outBuf;
-	std::ofstream outFile;
-	bool haveOutputFile{false};
-	if (outname.getValue() == "") {
-	    outBuf = std::cout.rdbuf();
-	} else {
-	    outFile.open(outname.getValue());
-	    outBuf = outFile.rdbuf();
-	    haveOutputFile = true;
-	}
-	// Now set the output stream to the buffer, which is
-	// either std::cout, or a file.
-	std::ostream outStream(outBuf);
+	// With --eqClasses, each mapping thread counts the reads per set of
+	// transcripts they map to, and no alignments are written at all
+	bool countEqClasses = eqClasses.isSet();
+	bool writeBAM = bam.getValue() and !noout.getValue() and !countEqClasses;
+	uint32_t nthread = numThreads.getValue();
 
-	// Must be a power of 2
-	size_t queueSize{268435456};
-	spdlog::set_async_mode(queueSize);
-	auto outputSink = std::make_shared<spdlog::sinks::ostream_sink_mt>(outStream);
-	std::shared_ptr<spdlog::logger> outLog = std::make_shared<spdlog::logger>("outLog", outputSink);
-	outLog->set_pattern("%v");
+	// If we're writing BAM, the mapping threads hand their records
+	// straight to a BGZF writer (and its compression threads).
+	std::ofstream bamFile;
+	std::unique_ptr<std::ostream> bamStream{nullptr};
+	std::unique_ptr<rapmap::bam::BGZFWriter> bamWriter{nullptr};
+	bool outputOk{true};
+	// Otherwise, each mapping thread writes SAM to its own channel of
+	// the output writer.  In ordered mode, the jobs are numbered as the
+	// parser hands them out, and the writer puts them back in that order.
+	std::unique_ptr<rapmap::io::OutputWriter> outWriter{nullptr};
+	std::unique_ptr<rapmap::io::JobSequencer> sequencer{nullptr};
+	if (ordered.getValue() and bam.getValue()) {
+	    consoleLog->error("--ordered can't be used with --bam");
+	    std::exit(1);
+	}
+	// With --mems, the SMEMs of the reads are written in place of SAM
+	uint32_t memMinLen = mems.isSet() ? std::max(mems.getValue(), 1u) : 0;
+	if (memMinLen > 0 and bam.getValue()) {
+	    consoleLog->error("--mems can't be used with --bam");
+	    std::exit(1);
+	}
+	if (countEqClasses and (memMinLen > 0 or bam.getValue())) {
+	    consoleLog->error("--eqClasses can't be used with --mems or --bam");
+	    std::exit(1);
+	}
+	// With --binary, the alignments are written in the format of
+	// AlignmentFormat.hpp, through the same channels as SAM
+	bool writeBinary = binary.getValue();
+	if (writeBinary and (countEqClasses or memMinLen > 0 or bam.getValue())) {
+	    consoleLog->error("--binary can't be used with --eqClasses, --mems or --bam");
+	    std::exit(1);
+	}
+	std::vector<rapmap::utils::ReadEqClassTable> eqTables(countEqClasses ? nthread : 0);
+	// Tasks finish far out of order, more than the writer can reorder
+	if (ordered.getValue() and workStealing.getValue()) {
+	    consoleLog->error("--ordered can't be used with --workStealing");
+	    std::exit(1);
+	}
+	uint32_t stealTaskSize{0};
+	if (workStealing.getValue()) {
+	    stealTaskSize = (taskSize.getValue() > 0) ? taskSize.getValue() : 1;
+	}
+	if (writeBAM) {
+	    // from: http://stackoverflow.com/questions/366955/obtain-a-stdostream-either-from-stdcout-or-stdofstreamfile
+	    // set either a file or cout as the output stream
+	    std::streambuf* outBuf = std::cout.rdbuf();
+	    if (outname.getValue() != "") {
+	        bamFile.open(outname.getValue(), std::ios::binary);
+	        if (!bamFile.is_open()) {
+	            consoleLog->error("could not open {} for writing: {}", outname.getValue(),
+	                              std::strerror(errno));
+	            std::exit(1);
+	        }
+	        outBuf = bamFile.rdbuf();
+	    }
+	    bamStream.reset(new std::ostream(outBuf));
+	    bamWriter.reset(new rapmap::bam::BGZFWriter(*bamStream, bamThreads.getValue()));
+	} else if (!noout.getValue() and !countEqClasses) {
+	    try {
+	        outWriter.reset(new rapmap::io::OutputWriter(outname.getValue(), nthread,
+	                                                     ordered.getValue()));
+	        if (ordered.getValue()) {
+	            sequencer.reset(new rapmap::io::JobSequencer);
+	        }
+	    } catch (std::runtime_error& e) {
+	        consoleLog->error("{}", e.what());
+	        std::exit(1);
+	    }
+	}
 
-	uint32_t nthread = numThreads.getValue();
 	std::unique_ptr<paired_parser> pairParserPtr{nullptr};
 	std::unique_ptr<single_parser> singleParserPtr{nullptr};
-
-	if (!noout.getValue()) {
-	  rapmap::utils::writeSAMHeader(rmi, outLog);
+	std::unique_ptr<paired_block_parser> pairBlockParserPtr{nullptr};
+	std::unique_ptr<single_block_parser> singleBlockParserPtr{nullptr};
+
+	if (writeBAM) {
+	  std::string bamHeader;
+	  rapmap::bam::appendHeader(rmi, bamHeader);
+	  bamWriter->write(bamHeader);
+	} else if (outWriter and memMinLen > 0) {
+	  std::string memHeader;
+	  rapmap::mems::appendHeader(memHeader, memMinLen);
+	  outWriter->writeHeader(memHeader);
+	} else if (outWriter and writeBinary) {
+	  std::string alnHeader;
+	  rapmap::aln::appendHeader(alnHeader, rmi.txpNames, rmi.txpLens, pairedEnd);
+	  outWriter->writeHeader(alnHeader);
+	} else if (outWriter) {
+	  rapmap::utils::writeSAMHeader(rmi, *outWriter);
 	}
 
     bool strictCheck = strict.getValue();
     bool fuzzyIntersection = fuzzy.getValue();
     bool consistentHits = consistent.getValue();
+    // Search each mate of a pair only on the transcripts its mate hit
+    bool mateConstrained = mateFirst.getValue();
+    if (mateConstrained and fuzzyIntersection) {
+        consoleLog->error("--mateConstrained can't be used with --fuzzyIntersection");
+        std::exit(1);
+    }
+    if (mateConstrained and !pairedEnd) {
+        consoleLog->error("--mateConstrained needs paired-end reads (-1 and -2)");
+        std::exit(1);
+    }
+    uint32_t rescueMismatches = rescue.getValue();
+    // -1 leaves the hits unverified
+    int32_t maxEdits = verifyEdits.isSet() ? static_cast<int32_t>(verifyEdits.getValue()) : -1;
 	SpinLockT iomutex;
 	{
 	    ScopedTimer timer;
-	    HitCounters hctrs;
+	    rapmap::utils::HitCounterSet hctrs(nthread);
 	    consoleLog->info("mapping reads . . . \n\n\n");
+	    auto printProgress = [pairedEnd](const rapmap::utils::HitTotals& t) -> void {
+	        if (pairedEnd) {
+	            std::cerr << "\r\r";
+	            std::cerr << "saw " << t.numReads << " reads : "
+	                      << "pe / read = " << t.peHits / static_cast<float>(t.numReads)
+	                      << " : se / read = " << t.seHits / static_cast<float>(t.numReads) << ' ';
+#if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
+	            std::cerr << ": true hit \% = "
+	                      << (100.0 * (t.trueHits / static_cast<float>(t.numReads)));
+#endif // __DEBUG__
+	        } else {
+#if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
+	            std::cerr << "\033[F\033[F\033[F";
+#else
+	            std::cerr << "\033[F\033[F";
+#endif // __DEBUG__
+	            std::cerr << "saw " << t.numReads << " reads\n";
+	            std::cerr << "# hits per read = "
+	                      << t.totHits / static_cast<float>(t.numReads) << "\n";
+#if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
+	            std::cerr << "The true hit was in the returned set of hits "
+	                      << 100.0 * (t.trueHits / static_cast<float>(t.numReads))
+	                      <<  "% of the time\n";
+#endif // __DEBUG__
+	        }
+	    };
+	    rapmap::utils::ProgressReporter progress(hctrs, printProgress);
+	    if (stageTimes.isSet()) {
+#ifdef RAPMAP_STAGE_TIMING
+	        rapmap::timing::startStageTiming();
+#else
+	        consoleLog->warn("RapMap was built without STAGE_TIMING; {} will be empty",
+	                         stageTimes.getValue());
+#endif // RAPMAP_STAGE_TIMING
+	    }
         if (pairedEnd) {
             std::vector<std::string> read1Vec = rapmap::utils::tokenize(read1.getValue(), ',');
             std::vector<std::string> read2Vec = rapmap::utils::tokenize(read2.getValue(), ',');
@@ -446,57 +911,129 @@ bool mapReads(RapMapIndexT& rmi,
                 std::exit(1);
             }
 
-            size_t numFiles = read1Vec.size() + read2Vec.size();
-            char** pairFileList = new char*[numFiles];
-            for (size_t i = 0; i < read1Vec.size(); ++i) {
-                pairFileList[2*i] = const_cast<char*>(read1Vec[i].c_str());
-                pairFileList[2*i+1] = const_cast<char*>(read2Vec[i].c_str());
+            if (blockParser.getValue()) {
+                std::vector<std::string> pairFiles;
+                for (size_t i = 0; i < read1Vec.size(); ++i) {
+                    pairFiles.push_back(read1Vec[i]);
+                    pairFiles.push_back(read2Vec[i]);
+                }
+                uint32_t maxReadGroup{1000}; // Number of reads in each "job"
+                pairBlockParserPtr.reset(new paired_block_parser(pairFiles, maxReadGroup,
+                                                                 nthread, gzThreads.getValue()));
+                spawnMappingThreads(nthread, pairBlockParserPtr.get(), stealTaskSize, rmi, iomutex,
+                                         outWriter.get(), sequencer.get(), bamWriter.get(), hctrs, maxNumHits.getValue(), noout.getValue(), strictCheck,
+                                         fuzzyIntersection, mateConstrained, consistentHits, rescueMismatches, maxEdits,
+                                         eqTables.empty() ? nullptr : &eqTables, writeBinary, memMinLen);
+            } else {
+                size_t numFiles = read1Vec.size() + read2Vec.size();
+                char** pairFileList = new char*[numFiles];
+                for (size_t i = 0; i < read1Vec.size(); ++i) {
+                    pairFileList[2*i] = const_cast<char*>(read1Vec[i].c_str());
+                    pairFileList[2*i+1] = const_cast<char*>(read2Vec[i].c_str());
+                }
+                size_t maxReadGroup{1000}; // Number of reads in each "job"
+                size_t concurrentFile{2}; // Number of files to read simultaneously
+                pairParserPtr.reset(new paired_parser(4 * nthread, maxReadGroup,
+                            concurrentFile,
+                            pairFileList, pairFileList+numFiles,
+                            gzThreads.getValue()));
+
+                spawnMappingThreads(nthread, pairParserPtr.get(), stealTaskSize, rmi, iomutex,
+                                         outWriter.get(), sequencer.get(), bamWriter.get(), hctrs, maxNumHits.getValue(), noout.getValue(), strictCheck, 
+                                         fuzzyIntersection, mateConstrained, consistentHits, rescueMismatches, maxEdits,
+                                         eqTables.empty() ? nullptr : &eqTables, writeBinary, memMinLen);
+                delete [] pairFileList;
             }
-            size_t maxReadGroup{1000}; // Number of reads in each "job"
-            size_t concurrentFile{2}; // Number of files to read simultaneously
-            pairParserPtr.reset(new paired_parser(4 * nthread, maxReadGroup,
-                        concurrentFile,
-                        pairFileList, pairFileList+numFiles));
-
-            spawnProcessReadsThreads(nthread, pairParserPtr.get(), rmi, iomutex,
-                                     outLog, hctrs, maxNumHits.getValue(), noout.getValue(), strictCheck, 
-                                     fuzzyIntersection, consistentHits);
-            delete [] pairFileList;
         } else {
             std::vector<std::string> unmatedReadVec = rapmap::utils::tokenize(unmatedReads.getValue(), ',');
-            size_t maxReadGroup{1000}; // Number of reads in each "job"
-            size_t concurrentFile{1};
-            stream_manager streams( unmatedReadVec.begin(), unmatedReadVec.end(),
-                    concurrentFile);
-            singleParserPtr.reset(new single_parser(4 * nthread,
-                        maxReadGroup,
-                        concurrentFile,
-                        streams));
-
-            /** Create the threads depending on the collector type **/
-            spawnProcessReadsThreads(nthread, singleParserPtr.get(), rmi, iomutex,
-                                      outLog, hctrs, maxNumHits.getValue(), noout.getValue(), 
-                                     strictCheck, consistentHits);
+            if (blockParser.getValue()) {
+                uint32_t maxReadGroup{1000}; // Number of reads in each "job"
+                singleBlockParserPtr.reset(new single_block_parser(unmatedReadVec, maxReadGroup,
+                                                                   nthread, gzThreads.getValue()));
+                spawnMappingThreads(nthread, singleBlockParserPtr.get(), stealTaskSize, rmi, iomutex,
+                                         outWriter.get(), sequencer.get(), bamWriter.get(), hctrs, maxNumHits.getValue(), noout.getValue(),
+                                         strictCheck, consistentHits, rescueMismatches, maxEdits,
+                                         eqTables.empty() ? nullptr : &eqTables, writeBinary, memMinLen);
+            } else {
+                size_t maxReadGroup{1000}; // Number of reads in each "job"
+                size_t concurrentFile{1};
+                stream_manager streams( unmatedReadVec.begin(), unmatedReadVec.end(),
+                        concurrentFile, gzThreads.getValue());
+                singleParserPtr.reset(new single_parser(4 * nthread,
+                            maxReadGroup,
+                            concurrentFile,
+                            streams));
+
+                /** Create the threads depending on the collector type **/
+                spawnMappingThreads(nthread, singleParserPtr.get(), stealTaskSize, rmi, iomutex,
+                                          outWriter.get(), sequencer.get(), bamWriter.get(), hctrs, maxNumHits.getValue(), noout.getValue(), 
+                                         strictCheck, consistentHits, rescueMismatches, maxEdits,
+                                         eqTables.empty() ? nullptr : &eqTables, writeBinary, memMinLen);
+            }
         }
+	progress.stop();
 	std::cerr << "\n\n";
+	// the mapping threads have exited, so their timings are in the totals
+	if (stageTimes.isSet() and !rapmap::timing::writeStageReport(stageTimes.getValue())) {
+	    consoleLog->error("Couldn't write the stage timings to {}", stageTimes.getValue());
+	}
 
-
+    auto totals = hctrs.total();
     consoleLog->info("Done mapping reads.");
-    consoleLog->info("In total saw {} reads.", hctrs.numReads);
-    consoleLog->info("Final # hits per read = {}", hctrs.totHits / static_cast<float>(hctrs.numReads));
+    consoleLog->info("In total saw {} reads.", totals.numReads);
+    if (verifyEdits.isSet()) {
+        consoleLog->info("Dropped {} hits with more than {} edits", totals.unverifiedHits, maxEdits);
+    }
+    if (mateConstrained) {
+        consoleLog->info("Searched the second mate again, unconstrained, for {} pairs", totals.mateRescans);
+    }
+    if (memMinLen > 0) {
+        consoleLog->info("Final # SMEMs per read = {}", totals.totHits / static_cast<float>(totals.numReads));
+    } else {
+        consoleLog->info("Final # hits per read = {}", totals.totHits / static_cast<float>(totals.numReads));
+    }
+#ifdef RAPMAP_COUNT_ALLOCATIONS
+    consoleLog->info("Heap allocations while mapping = {} ({} per read)", totals.mappingAllocs,
+                     totals.mappingAllocs / static_cast<float>(totals.numReads));
+#endif // RAPMAP_COUNT_ALLOCATIONS
+	if (countEqClasses) {
+	    rapmap::utils::ReadEqClassTable eqTotals;
+	    for (auto& t : eqTables) {
+	        eqTotals.merge(t);
+	        t = rapmap::utils::ReadEqClassTable();
+	    }
+	    consoleLog->info("{} mapped reads fell into {} equivalence classes",
+	                     eqTotals.numReads(), eqTotals.numClasses());
+	    if (!eqTotals.write(eqClasses.getValue(), rmi.txpNames)) {
+	        consoleLog->error("Couldn't write the equivalence classes to {}", eqClasses.getValue());
+	    }
+	}
 	consoleLog->info("flushing output queue.");
-	outLog->flush();
+	if (outWriter) {
+	    outWriter->close();
+	    auto ostats = outWriter->stats();
+	    consoleLog->info("Wrote {} bytes of output in {} writev calls", ostats.bytesWritten, ostats.numWritev);
+	    consoleLog->info("Mapping threads waited on output {} times ({} s); the writer waited on mapping {} times",
+	                     ostats.producerStalls, ostats.producerStallSeconds, ostats.writerIdleWaits);
+	    if (outWriter->ordered()) {
+	        consoleLog->info("At most {} jobs waited in the reorder window", ostats.maxReorderDepth);
+	    }
+	}
+	if (bamWriter and !bamWriter->close()) {
+	    consoleLog->error("Writing the BAM output failed");
+	    outputOk = false;
+	}
 	/*
 	    consoleLog->info("Discarded {} reads because they had > {} alignments",
-		    hctrs.tooManyHits, maxNumHits.getValue());
+		    totals.tooManyHits, maxNumHits.getValue());
 		    */
 
 	}
 
-	if (haveOutputFile) {
-	    outFile.close();
+	if (bamFile.is_open()) {
+	    bamFile.close();
 	}
-	return true;
+	return outputOk;
 }
 
 
@@ -521,6 +1058,20 @@ int rapMapSAMap(int argc, char* argv[]) {
   TCLAP::SwitchArg strict("s", "strictCheck", "Perform extra checks to try and assure that only equally \"best\" mappings for a read are reported", false);
   TCLAP::SwitchArg fuzzy("f", "fuzzyIntersection", "Find paired-end mapping locations using fuzzy intersection", false);
   TCLAP::SwitchArg consistent("c", "consistentHits", "Ensure that the hits collected are consistent (co-linear)", false);
+  TCLAP::SwitchArg bam("b", "bam", "Write the alignments as BAM rather than SAM", false);
+  TCLAP::ValueArg<uint32_t> bamThreads("", "bamThreads", "Number of threads used to compress BAM output", false, 2, "positive integer");
+  TCLAP::ValueArg<uint32_t> gzThreads("", "gzThreads", "Number of threads used to decompress each gzipped read file", false, 2, "positive integer");
+  TCLAP::SwitchArg blockParser("", "blockParser", "Parse the reads (FASTQ only) with the block parser, which finds records with SIMD newline scans", false);
+  TCLAP::SwitchArg workStealing("", "workStealing", "Split the parser's jobs into small tasks that idle mapping threads can steal from busy ones", false);
+  TCLAP::ValueArg<uint32_t> taskSize("", "taskSize", "Number of reads in each task, with --workStealing", false, 32, "positive integer");
+  TCLAP::ValueArg<std::string> stageTimes("", "stageTimes", "Write per-stage timings of the mapping path to this JSON file (needs a build with -DSTAGE_TIMING=TRUE)", false, "", "path");
+  TCLAP::SwitchArg ordered("", "ordered", "Write the output (SAM, --binary or --mems) in the same order as the input reads; not supported with --bam", false);
+  TCLAP::ValueArg<uint32_t> rescue("", "rescueMismatches", "Search for reads with no exact k-mer match as a whole, with up to this many substitutions (0 disables this rescue)", false, 0, "non-negative integer");
+  TCLAP::ValueArg<uint32_t> verifyEdits("", "maxEdits", "Align each hit against its transcript (within a band of up to 7 indels) and drop those needing more than this many edits", false, 5, "non-negative integer");
+  TCLAP::ValueArg<std::string> eqClasses("", "eqClasses", "Rather than writing alignments, count the reads mapping to each set of transcripts and write these equivalence classes to this file", false, "", "path");
+  TCLAP::ValueArg<uint32_t> mems("", "mems", "Rather than mapping the reads, write their super-maximal exact matches (SMEMs) at least this long, in binary (see include/MEMFormat.hpp); needs an index built with -g", false, 31, "positive integer");
+  TCLAP::SwitchArg binary("", "binary", "Write the alignments in a compact binary format (see include/AlignmentFormat.hpp); rapmap bin2sam converts them to SAM", false);
+  TCLAP::SwitchArg mateFirst("", "mateConstrained", "Paired-end reads only: map the mate with the more specific seeds first, and search for the other only on the transcripts it hit", false);
   cmd.add(index);
   cmd.add(noout);
 
@@ -533,6 +1084,20 @@ int rapMapSAMap(int argc, char* argv[]) {
   cmd.add(strict);
   cmd.add(fuzzy);
   cmd.add(consistent);
+  cmd.add(bam);
+  cmd.add(bamThreads);
+  cmd.add(ordered);
+  cmd.add(gzThreads);
+  cmd.add(blockParser);
+  cmd.add(workStealing);
+  cmd.add(taskSize);
+  cmd.add(stageTimes);
+  cmd.add(rescue);
+  cmd.add(verifyEdits);
+  cmd.add(eqClasses);
+  cmd.add(mems);
+  cmd.add(binary);
+  cmd.add(mateFirst);
 
   auto consoleSink = std::make_shared<spdlog::sinks::stderr_sink_mt>();
   auto consoleLog = spdlog::create("stderrLog", {consoleSink});
@@ -585,6 +1150,15 @@ int rapMapSAMap(int argc, char* argv[]) {
       std::exit(1);
     }
 
+    // Without '$' terminators, a match can run on from one transcript
+    // into the next, and the SMEMs would include (and be hidden by) such
+    // matches
+    if (mems.isSet() and !h.generalizedSA()) {
+      consoleLog->error("--mems needs an index built with -g (--generalizedSA), "
+                        "so that matches stop at the end of a transcript");
+      std::exit(1);
+    }
+
     //std::unique_ptr<RapMapSAIndex<int32_t>> SAIdxPtr{nullptr};
     //std::unique_ptr<RapMapSAIndex<int64_t>> BigSAIdxPtr{nullptr};
 
@@ -598,7 +1172,9 @@ int rapMapSAMap(int argc, char* argv[]) {
           rmi.load(indexPrefix);
           success = mapReads(rmi, consoleLog, index, read1, read2,
                              unmatedReads, numThreads, maxNumHits,
-                             outname, noout, strict, fuzzy, consistent);
+                             outname, noout, strict, fuzzy, consistent,
+                             bam, bamThreads, ordered, gzThreads, blockParser,
+                             workStealing, taskSize, stageTimes, rescue, verifyEdits, eqClasses, mems, binary, mateFirst);
       } else {
           RapMapSAIndex<int64_t,
                         google::dense_hash_map<uint64_t, rapmap::utils::SAInterval<int64_t>,
@@ -606,7 +1182,9 @@ int rapMapSAMap(int argc, char* argv[]) {
           rmi.load(indexPrefix);
           success = mapReads(rmi, consoleLog, index, read1, read2,
                              unmatedReads, numThreads, maxNumHits,
-                             outname, noout, strict, fuzzy, consistent);
+                             outname, noout, strict, fuzzy, consistent,
+                             bam, bamThreads, ordered, gzThreads, blockParser,
+                             workStealing, taskSize, stageTimes, rescue, verifyEdits, eqClasses, mems, binary, mateFirst);
       }
     } else {
         //std::cerr << "Loading 32-bit suffix array index: \n";
@@ -617,7 +1195,9 @@ int rapMapSAMap(int argc, char* argv[]) {
             rmi.load(indexPrefix);
             success = mapReads(rmi, consoleLog, index, read1, read2,
                                unmatedReads, numThreads, maxNumHits,
-                               outname, noout, strict, fuzzy, consistent);
+                               outname, noout, strict, fuzzy, consistent,
+                             bam, bamThreads, ordered, gzThreads, blockParser,
+                             workStealing, taskSize, stageTimes, rescue, verifyEdits, eqClasses, mems, binary, mateFirst);
         } else {
             RapMapSAIndex<int32_t,
                           google::dense_hash_map<uint64_t, rapmap::utils::SAInterval<int32_t>,
@@ -625,7 +1205,9 @@ int rapMapSAMap(int argc, char* argv[]) {
             rmi.load(indexPrefix);
             success = mapReads(rmi, consoleLog, index, read1, read2,
                                unmatedReads, numThreads, maxNumHits,
-                               outname, noout, strict, fuzzy, consistent);
+                               outname, noout, strict, fuzzy, consistent,
+                             bam, bamThreads, ordered, gzThreads, blockParser,
+                             workStealing, taskSize, stageTimes, rescue, verifyEdits, eqClasses, mems, binary, mateFirst);
         }
     }
 
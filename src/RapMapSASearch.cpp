@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <cereal/archives/json.hpp>
+
+#include "tclap/CmdLine.h"
+
+#include "spdlog/spdlog.h"
+#include "spdlog/details/format.h"
+
+#include "google/dense_hash_map"
+
+#include "BooMap.hpp"
+#include "GzipStream.hpp"
+#include "IndexHeader.hpp"
+#include "OutputWriter.hpp"
+#include "RapMapConfig.hpp"
+#include "RapMapFileSystem.hpp"
+#include "RapMapSAIndex.hpp"
+#include "RapMapUtils.hpp"
+#include "SALocator.hpp"
+#include "SASearcher.hpp"
+#include "ScopedTimer.hpp"
+
+/**
+ * Exact pattern search over the quasi index (rapmap quasisearch).
+ *
+ * Patterns are read one per line, in batches, by a pool of search
+ * threads.  A pattern at least k long is looked up by its first k-mer
+ * in the index's k-mer hash, and only the suffixes of that interval are
+ * searched for the rest of it; a shorter one is binary searched over the
+ * whole suffix array.  The output holds a line per pattern, in input
+ * order: the pattern and its number of occurrences, followed (unless
+ * only counting) by each occurrence as transcript:offset.
+ */
+
+namespace {
+
+// Hands out numbered batches of patterns to the search threads
+class PatternSource {
+    public:
+        PatternSource(std::unique_ptr<std::istream> in, size_t batchSize) :
+            in_(std::move(in)), batchSize_(batchSize) {}
+
+        // Returns false once the patterns are exhausted
+        bool next(std::vector<std::string>& batch, uint64_t& seq) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            size_t n{0};
+            while (n < batchSize_) {
+                if (n == batch.size()) { batch.emplace_back(); }
+                if (!std::getline(*in_, batch[n])) { break; }
+                auto& p = batch[n];
+                if (!p.empty() and p.back() == '\r') { p.pop_back(); }
+                if (p.empty()) { continue; }
+                ++n;
+            }
+            batch.resize(n);
+            seq = nextSeq_++;
+            return n > 0;
+        }
+
+    private:
+        std::mutex mutex_;
+        std::unique_ptr<std::istream> in_;
+        size_t batchSize_;
+        uint64_t nextSeq_{0};
+};
+
+struct SearchCounts {
+    uint64_t numPatterns{0};
+    // patterns that occur at least once
+    uint64_t numFound{0};
+    uint64_t numOccurrences{0};
+    // patterns seeded from the k-mer hash
+    uint64_t numSeeded{0};
+    // patterns with more than maxNumHits occurrences, which weren't listed
+    uint64_t numTooMany{0};
+};
+
+template <typename RapMapIndexT>
+void searchPatterns(RapMapIndexT& rmi,
+                    PatternSource& source,
+                    rapmap::io::OutputChannel& out,
+                    bool countOnly,
+                    uint32_t maxNumHits,
+                    bool generalizedSA,
+                    SearchCounts& counts) {
+    using OffsetT = typename RapMapIndexT::IndexType;
+    using LocatedHit = typename SALocator<RapMapIndexT>::LocatedHit;
+    auto& khash = rmi.khash;
+    auto& txpNames = rmi.txpNames;
+    auto& txpLens = rmi.txpLens;
+    uint32_t k = rapmap::utils::my_mer::k();
+    OffsetT saLen = static_cast<OffsetT>(rmi.SA.size());
+
+    SASearcher<RapMapIndexT> saSearcher(&rmi);
+    SALocator<RapMapIndexT> locator(&rmi);
+    std::vector<std::string> batch;
+    std::string query;
+    std::vector<LocatedHit> hits;
+    fmt::MemoryWriter sstream;
+    uint64_t seq{0};
+
+    while (source.next(batch, seq)) {
+        sstream.clear();
+        for (auto& pattern : batch) {
+            ++counts.numPatterns;
+            query = pattern;
+            std::transform(query.begin(), query.end(), query.begin(), ::toupper);
+
+            OffsetT lb{0}, ub{0};
+            // The text is all ACGT (and the transcript separators), so
+            // nothing else can match
+            if (query.find_first_not_of("ACGT") == std::string::npos) {
+                OffsetT startAt{0};
+                OffsetT seedLb{0}, seedUb{saLen};
+                bool seeded{true};
+                if (query.length() >= k) {
+                    rapmap::utils::my_mer mer(query.c_str());
+                    auto it = khash.find(mer.get_bits(0, 2*k));
+                    if (it == khash.end()) {
+                        seeded = false;
+                    } else {
+                        seedLb = it->second.begin;
+                        seedUb = it->second.end;
+                        startAt = k;
+                        ++counts.numSeeded;
+                    }
+                }
+                if (seeded) {
+                    std::tie(lb, ub) = saSearcher.exactInterval(seedLb, seedUb, startAt,
+                                                                query.begin(), query.end());
+                }
+            }
+
+            // Without '$' terminators the transcripts run into one another,
+            // so an occurrence may cross into the next transcript.  Those
+            // aren't occurrences, and finding them means locating every one.
+            uint64_t numOcc = ub - lb;
+            bool listHits = (!countOnly and numOcc > 0 and numOcc <= maxNumHits);
+            hits.clear();
+            if (numOcc > 0 and (listHits or !generalizedSA)) {
+                OffsetT patLen = static_cast<OffsetT>(query.length());
+                for (auto& h : locator.locate(lb, ub)) {
+                    if (generalizedSA or h.pos + patLen <= txpLens[h.tid]) {
+                        hits.push_back(h);
+                    }
+                }
+                numOcc = hits.size();
+                listHits = (!countOnly and numOcc > 0 and numOcc <= maxNumHits);
+            }
+            counts.numFound += (numOcc > 0) ? 1 : 0;
+            counts.numOccurrences += numOcc;
+            sstream << pattern << '\t' << numOcc;
+            if (listHits) {
+                for (auto& h : hits) {
+                    sstream << '\t' << txpNames[h.tid] << ':' << h.pos;
+                }
+            } else if (!countOnly and numOcc > 0) {
+                ++counts.numTooMany;
+            }
+            sstream << '\n';
+        }
+        out.writeJob(seq, sstream.data(), sstream.size());
+    }
+    // the batch past the end still has a number, and must be written
+    out.writeJob(seq, "", 0);
+}
+
+template <typename RapMapIndexT>
+bool searchIndex(RapMapIndexT& rmi,
+                 std::shared_ptr<spdlog::logger> consoleLog,
+                 TCLAP::ValueArg<std::string>& patterns,
+                 TCLAP::ValueArg<uint32_t>& numThreads,
+                 TCLAP::ValueArg<uint32_t>& maxNumHits,
+                 TCLAP::ValueArg<std::string>& outname,
+                 TCLAP::SwitchArg& countOnly,
+                 TCLAP::ValueArg<uint32_t>& gzThreads,
+                 bool generalizedSA) {
+    uint32_t nthread = std::max(numThreads.getValue(), 1u);
+
+    std::unique_ptr<std::istream> in;
+    try {
+        in = rapmap::io::openReadStream(patterns.getValue(), gzThreads.getValue());
+    } catch (std::runtime_error& e) {
+        consoleLog->error("Couldn't open the pattern file: {}", e.what());
+        std::exit(1);
+    }
+    size_t batchSize{10000}; // Number of patterns in each batch
+    PatternSource source(std::move(in), batchSize);
+
+    std::unique_ptr<rapmap::io::OutputWriter> outWriter{nullptr};
+    try {
+        outWriter.reset(new rapmap::io::OutputWriter(outname.getValue(), nthread, true));
+    } catch (std::runtime_error& e) {
+        consoleLog->error("{}", e.what());
+        std::exit(1);
+    }
+
+    std::vector<SearchCounts> counts(nthread);
+    {
+        ScopedTimer timer;
+        consoleLog->info("searching for patterns . . .");
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < nthread; ++i) {
+            threads.emplace_back(searchPatterns<RapMapIndexT>, std::ref(rmi), std::ref(source),
+                                 std::ref(outWriter->channel(i)), countOnly.getValue(),
+                                 maxNumHits.getValue(), generalizedSA, std::ref(counts[i]));
+        }
+        for (auto& t : threads) { t.join(); }
+        outWriter->close();
+    }
+
+    SearchCounts total;
+    for (auto& c : counts) {
+        total.numPatterns += c.numPatterns;
+        total.numFound += c.numFound;
+        total.numOccurrences += c.numOccurrences;
+        total.numSeeded += c.numSeeded;
+        total.numTooMany += c.numTooMany;
+    }
+    consoleLog->info("Searched for {} patterns ({} seeded from the k-mer hash)",
+                     total.numPatterns, total.numSeeded);
+    consoleLog->info("{} patterns occur, {} times in total", total.numFound, total.numOccurrences);
+    if (!countOnly.getValue() and total.numTooMany > 0) {
+        consoleLog->info("Only counted the {} patterns with > {} occurrences",
+                         total.numTooMany, maxNumHits.getValue());
+    }
+    return true;
+}
+
+}
+
+int rapMapSASearch(int argc, char* argv[]) {
+  std::cerr << "RapMap Pattern Search (SA-based)\n";
+
+  std::string versionString = rapmap::version;
+  TCLAP::CmdLine cmd(
+		     "RapMap Pattern Search",
+		     ' ',
+		     versionString);
+  cmd.getProgramName() = "rapmap";
+
+  TCLAP::ValueArg<std::string> index("i", "index", "The location of the quasiindex", true, "", "path");
+  TCLAP::ValueArg<std::string> patterns("p", "patterns", "The file of patterns to search for, one per line", true, "", "path");
+  TCLAP::ValueArg<uint32_t> numThreads("t", "numThreads", "Number of threads to use", false, 1, "positive integer");
+  TCLAP::ValueArg<uint32_t> maxNumHits("m", "maxNumHits", "Patterns occurring more than this many times are only counted", false, 200, "positive integer");
+  TCLAP::ValueArg<std::string> outname("o", "output", "The output file (default: stdout)", false, "", "path");
+  TCLAP::SwitchArg countOnly("c", "count", "Only report the number of occurrences of each pattern", false);
+  TCLAP::ValueArg<uint32_t> gzThreads("", "gzThreads", "Number of threads used to decompress a gzipped pattern file", false, 2, "positive integer");
+  cmd.add(index);
+  cmd.add(patterns);
+  cmd.add(numThreads);
+  cmd.add(maxNumHits);
+  cmd.add(outname);
+  cmd.add(countOnly);
+  cmd.add(gzThreads);
+
+  auto consoleSink = std::make_shared<spdlog::sinks::stderr_sink_mt>();
+  auto consoleLog = spdlog::create("stderrLog", {consoleSink});
+
+  try {
+
+    cmd.parse(argc, argv);
+
+    std::string indexPrefix(index.getValue());
+    if (indexPrefix.back() != '/') {
+      indexPrefix += "/";
+    }
+
+    if (!rapmap::fs::DirExists(indexPrefix.c_str())) {
+      consoleLog->error("It looks like the index you provided [{}] "
+			"doesn't exist", indexPrefix);
+      std::exit(1);
+    }
+
+    IndexHeader h;
+    std::ifstream indexStream(indexPrefix + "header.json");
+    {
+      cereal::JSONInputArchive ar(indexStream);
+      ar(h);
+    }
+    indexStream.close();
+
+    if (h.indexType() != IndexType::QUASI) {
+      consoleLog->error("The index {} does not appear to be of the "
+			"appropriate type (quasi)", indexPrefix);
+      std::exit(1);
+    }
+
+    bool success{false};
+    if (h.bigSA()) {
+      if (h.perfectHash()) {
+          RapMapSAIndex<int64_t, BooMap<uint64_t, rapmap::utils::SAInterval<int64_t>>> rmi;
+          rmi.load(indexPrefix);
+          success = searchIndex(rmi, consoleLog, patterns, numThreads, maxNumHits,
+                                outname, countOnly, gzThreads, h.generalizedSA());
+      } else {
+          RapMapSAIndex<int64_t,
+                        google::dense_hash_map<uint64_t, rapmap::utils::SAInterval<int64_t>,
+                                               rapmap::utils::KmerKeyHasher>> rmi;
+          rmi.load(indexPrefix);
+          success = searchIndex(rmi, consoleLog, patterns, numThreads, maxNumHits,
+                                outname, countOnly, gzThreads, h.generalizedSA());
+      }
+    } else {
+        if (h.perfectHash()) {
+            RapMapSAIndex<int32_t, BooMap<uint64_t, rapmap::utils::SAInterval<int32_t>>> rmi;
+            rmi.load(indexPrefix);
+            success = searchIndex(rmi, consoleLog, patterns, numThreads, maxNumHits,
+                                  outname, countOnly, gzThreads, h.generalizedSA());
+        } else {
+            RapMapSAIndex<int32_t,
+                          google::dense_hash_map<uint64_t, rapmap::utils::SAInterval<int32_t>,
+                                                 rapmap::utils::KmerKeyHasher>> rmi;
+            rmi.load(indexPrefix);
+            success = searchIndex(rmi, consoleLog, patterns, numThreads, maxNumHits,
+                                  outname, countOnly, gzThreads, h.generalizedSA());
+        }
+    }
+
+    return success ? 0 : 1;
+  } catch (TCLAP::ArgException& e) {
+    consoleLog->error("Exception [{}] when parsing argument {}", e.error(), e.argId());
+    return 1;
+  }
+}
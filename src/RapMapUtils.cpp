@@ -1,3 +1,5 @@
+#include <chrono>
+
 #include <cereal/types/vector.hpp>
 #include <cereal/types/unordered_map.hpp>
 #include <cereal/archives/binary.hpp>
@@ -7,11 +9,62 @@
 #include "RapMapIndex.hpp"
 #include "PairAlignmentFormatter.hpp"
 #include "SingleAlignmentFormatter.hpp"
+#include "BAMUtils.hpp"
 #include "jellyfish/whole_sequence_parser.hpp"
 #include "BooMap.hpp"
 
 namespace rapmap {
     namespace utils {
+        HitTotals HitCounterSet::total() const {
+            HitTotals t;
+            for (auto& c : counters_) {
+                t.peHits += c.peHits;
+                t.seHits += c.seHits;
+                t.trueHits += c.trueHits;
+                t.totHits += c.totHits;
+                t.numReads += c.numReads;
+                t.tooManyHits += c.tooManyHits;
+                t.mappingAllocs += c.mappingAllocs;
+                t.unverifiedHits += c.unverifiedHits;
+                t.mateRescans += c.mateRescans;
+            }
+            return t;
+        }
+
+        ProgressReporter::ProgressReporter(const HitCounterSet& counters,
+                                           std::function<void(const HitTotals&)> report,
+                                           uint64_t interval) :
+            counters_(counters), report_(std::move(report)), interval_(interval) {
+            thread_ = std::thread(&ProgressReporter::run_, this);
+        }
+
+        ProgressReporter::~ProgressReporter() {
+            stop();
+        }
+
+        void ProgressReporter::stop() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (stopping_) { return; }
+                stopping_ = true;
+            }
+            stopRequested_.notify_one();
+            thread_.join();
+        }
+
+        void ProgressReporter::run_() {
+            uint64_t lastPrint{0};
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!stopRequested_.wait_for(lock, std::chrono::milliseconds(200),
+                                            [this]() -> bool { return stopping_; })) {
+                auto totals = counters_.total();
+                if (totals.numReads > lastPrint + interval_) {
+                    lastPrint = totals.numReads;
+                    report_(totals);
+                }
+            }
+        }
+
         std::vector<std::string> tokenize(const std::string &s, char delim) {
             std::stringstream ss(s);
             std::string item;
@@ -77,6 +130,23 @@ namespace rapmap {
             //std::swap(qual, qualWork);
         }
 
+        // If the read name contains multiple space-separated parts, keep only
+        // the first; for paired-end reads, also trim a trailing /1 or /2.
+        // The name is cut short in place (with a '\0'); returns its new length.
+        static size_t trimReadName(std::string& readName, bool trimMateSuffix) {
+            size_t splitPos = readName.find(' ');
+            if (splitPos < readName.length()) {
+                readName[splitPos] = '\0';
+            } else {
+                splitPos = readName.length();
+            }
+            if (trimMateSuffix and splitPos > 2 and readName[splitPos - 2] == '/') {
+                readName[splitPos - 2] = '\0';
+                splitPos -= 2;
+            }
+            return splitPos;
+        }
+
         template <typename ReadT, typename IndexT>
         uint32_t writeAlignmentsToStream(
                 ReadT& r,
@@ -104,13 +174,12 @@ namespace rapmap {
 #endif //__DEBUG__
                 // If the read name contains multiple space-separated parts, print
                 // only the first
-                size_t splitPos = readName.find(' ');
-                if (splitPos < readName.length()) {
-                    readName[splitPos] = '\0';
-                }
+                trimReadName(readName, false);
 
 
-                std::string numHitFlag = fmt::format("NH:i:{}", hits.size());
+                auto& numHitFlag = formatter.numHitFlag;
+                numHitFlag.clear();
+                numHitFlag << "NH:i:" << hits.size();
                 uint32_t alnCtr{0};
                 bool haveRev{false};
                 for (auto& qa : hits) {
@@ -147,7 +216,7 @@ namespace rapmap {
                         << qa.fragLen << '\t' // TLEN
                         << *readSeq << '\t' // SEQ
                         << *qstr << '\t' // QSTR
-                        << numHitFlag << '\n';
+                        << numHitFlag.c_str() << '\n';
                     ++alnCtr;
                     // === SAM
 #if defined(__DEBUG__) || defined(__TRACK_CORRECT__)
@@ -180,34 +249,11 @@ namespace rapmap {
                 uint16_t flags1, flags2;
 
                 auto& readName = r.first.header;
-                // If the read name contains multiple space-separated parts,
-                // print only the first
-                size_t splitPos = readName.find(' ');
-                if (splitPos < readName.length()) {
-                    readName[splitPos] = '\0';
-                } else {
-                    splitPos = readName.length();
-                }
-
-                // trim /1 from the pe read
-                if (splitPos > 2 and readName[splitPos - 2] == '/') {
-                    readName[splitPos - 2] = '\0';
-                }
-
                 auto& mateName = r.second.header;
-                // If the read name contains multiple space-separated parts,
-                // print only the first
-                splitPos = mateName.find(' ');
-                if (splitPos < mateName.length()) {
-                    mateName[splitPos] = '\0';
-                } else {
-                    splitPos = mateName.length();
-                }
-
-                // trim /2 from the pe read
-                if (splitPos > 2 and mateName[splitPos - 2] == '/') {
-                    mateName[splitPos - 2] = '\0';
-                }
+                // If the read names contain multiple space-separated parts,
+                // print only the first, and trim /1 and /2 from them
+                trimReadName(readName, true);
+                trimReadName(mateName, true);
 
                 /*
                 // trim /1 and /2 from pe read names
@@ -221,7 +267,9 @@ namespace rapmap {
                 }
                 */
 
-                std::string numHitFlag = fmt::format("NH:i:{}", jointHits.size());
+                auto& numHitFlag = formatter.numHitFlag;
+                numHitFlag.clear();
+                numHitFlag << "NH:i:" << jointHits.size();
                 uint32_t alnCtr{0};
 				uint32_t trueHitCtr{0};
 				QuasiAlignment* firstTrueHit{nullptr};
@@ -292,7 +340,7 @@ namespace rapmap {
                                 << ((read1First) ? fragLen : -fragLen) << '\t' // TLEN
                                 << *readSeq1 << '\t' // SEQ
                                 << *qstr1 << '\t' // QUAL
-                                << numHitFlag << '\n';
+                                << numHitFlag.c_str() << '\n';
 
                         sstream << mateName.c_str() << '\t' // QNAME
                                 << flags2 << '\t' // FLAGS
@@ -305,7 +353,7 @@ namespace rapmap {
                                 << ((read1First) ? -fragLen : fragLen) << '\t' // TLEN
                                 << *readSeq2 << '\t' // SEQ
                                 << *qstr2 << '\t' // QUAL
-                                << numHitFlag << '\n';
+                                << numHitFlag.c_str() << '\n';
                     } else {
                         rapmap::utils::getSamFlags(qa, true, flags1, flags2);
                         if (alnCtr != 0) {
@@ -404,7 +452,7 @@ namespace rapmap {
                                 << 0 << '\t' // TLEN (spec says 0, not read len)
                                 << *readSeq << '\t' // SEQ
                                 << *qstr << '\t' // QUAL
-                                << numHitFlag << '\n';
+                                << numHitFlag.c_str() << '\n';
 
 
                         // Output the info for the unaligned mate.
@@ -419,7 +467,7 @@ namespace rapmap {
                             << 0 << '\t' // TLEN (spec says 0, not read len)
                             << *unalignedSeq << '\t' // SEQ
                             << *unalignedQstr << '\t' // QUAL
-                            << numHitFlag << '\n';
+                            << numHitFlag.c_str() << '\n';
                     }
                     ++alnCtr;
                     // == SAM
@@ -451,6 +499,198 @@ namespace rapmap {
 
 
 
+        template <typename ReadT, typename IndexT>
+        uint32_t writeAlignmentsToBAM(
+                ReadT& r,
+                SingleAlignmentFormatter<IndexT>& formatter,
+                HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& hits,
+                std::string& bamBuffer
+                ) {
+                // Convenient variable name bindings
+                auto& txpLens = formatter.index->txpLens;
+
+                auto& readTemp = formatter.readTemp;
+                auto& qualTemp = formatter.qualTemp;
+                rapmap::bam::Cigar cigar;
+
+                uint16_t flags;
+
+                auto& readName = r.header;
+                size_t nameLen = trimReadName(readName, false);
+
+                uint32_t numHits = hits.size();
+                uint32_t alnCtr{0};
+                bool haveRev{false};
+                for (auto& qa : hits) {
+                    rapmap::utils::getSamFlags(qa, flags);
+                    if (alnCtr != 0) {
+                        flags |= 0x900;
+                    }
+
+                    std::string* readSeq = &(r.seq);
+                    std::string* qstr = &(r.qual);
+
+                    if (!qa.fwd) {
+                        if (!haveRev) {
+                            rapmap::utils::reverseRead(*readSeq, *qstr,
+                                                       readTemp, qualTemp);
+                            haveRev = true;
+                        }
+                        readSeq = &(readTemp);
+                        qstr = &(qualTemp);
+                    }
+
+                    rapmap::bam::adjustOverhang(qa.pos, qa.readLen, txpLens[qa.tid], cigar);
+                    rapmap::bam::appendRecord(bamBuffer, readName.c_str(), nameLen,
+                                              flags, qa.tid, qa.pos, 255, cigar,
+                                              -1, -1, qa.fragLen,
+                                              *readSeq, *qstr, numHits);
+                    ++alnCtr;
+                }
+                return alnCtr;
+            }
+
+        // For reads paired *in sequencing*
+        template <typename ReadPairT, typename IndexT>
+        uint32_t writeAlignmentsToBAM(
+                ReadPairT& r,
+                PairAlignmentFormatter<IndexT>& formatter,
+                HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                std::string& bamBuffer
+                ) {
+                // Convenient variable name bindings
+                auto& txpLens = formatter.index->txpLens;
+
+                auto& read1Temp = formatter.read1Temp;
+                auto& read2Temp = formatter.read2Temp;
+                auto& qual1Temp = formatter.qual1Temp;
+                auto& qual2Temp = formatter.qual2Temp;
+                rapmap::bam::Cigar cigar1;
+                rapmap::bam::Cigar cigar2;
+
+                uint16_t flags1, flags2;
+
+                auto& readName = r.first.header;
+                auto& mateName = r.second.header;
+                size_t readNameLen = trimReadName(readName, true);
+                size_t mateNameLen = trimReadName(mateName, true);
+
+                uint32_t numHits = jointHits.size();
+                uint32_t alnCtr{0};
+                bool haveRev1{false};
+                bool haveRev2{false};
+                for (auto& qa : jointHits) {
+                    int32_t tid = qa.tid;
+                    rapmap::utils::getSamFlags(qa, true, flags1, flags2);
+                    if (alnCtr != 0) {
+                        flags1 |= 0x100; flags2 |= 0x100;
+                    }
+
+                    if (qa.isPaired) {
+                        auto txpLen = txpLens[qa.tid];
+                        rapmap::bam::adjustOverhang(qa.pos, qa.readLen, txpLen, cigar1);
+                        rapmap::bam::adjustOverhang(qa.matePos, qa.mateLen, txpLen, cigar2);
+
+                        // Reverse complement the read and reverse
+                        // the quality string if we need to
+                        std::string* readSeq1 = &(r.first.seq);
+                        std::string* qstr1 = &(r.first.qual);
+                        if (!qa.fwd) {
+                            if (!haveRev1) {
+                                rapmap::utils::reverseRead(*readSeq1, *qstr1,
+                                        read1Temp, qual1Temp);
+                                haveRev1 = true;
+                            }
+                            readSeq1 = &(read1Temp);
+                            qstr1 = &(qual1Temp);
+                        }
+
+                        std::string* readSeq2 = &(r.second.seq);
+                        std::string* qstr2 = &(r.second.qual);
+                        if (!qa.mateIsFwd) {
+                            if (!haveRev2) {
+                                rapmap::utils::reverseRead(*readSeq2, *qstr2,
+                                        read2Temp, qual2Temp);
+                                haveRev2 = true;
+                            }
+                            readSeq2 = &(read2Temp);
+                            qstr2 = &(qual2Temp);
+                        }
+
+                        // If the fragment overhangs the right end of the transcript
+                        // adjust fragLen (overhanging the left end is already handled).
+                        int32_t read1Pos = qa.pos;
+                        int32_t read2Pos = qa.matePos;
+                        const bool read1First{read1Pos < read2Pos};
+                        const int32_t minPos = read1First ? read1Pos : read2Pos;
+                        if (minPos + qa.fragLen > txpLen) { qa.fragLen = txpLen - minPos; }
+
+                        // get the fragment length as a signed int
+                        const int32_t fragLen = static_cast<int32_t>(qa.fragLen);
+
+                        rapmap::bam::appendRecord(bamBuffer, readName.c_str(), readNameLen,
+                                                  flags1, tid, qa.pos, 1, cigar1,
+                                                  tid, qa.matePos,
+                                                  (read1First) ? fragLen : -fragLen,
+                                                  *readSeq1, *qstr1, numHits);
+                        rapmap::bam::appendRecord(bamBuffer, mateName.c_str(), mateNameLen,
+                                                  flags2, tid, qa.matePos, 1, cigar2,
+                                                  tid, qa.pos,
+                                                  (read1First) ? -fragLen : fragLen,
+                                                  *readSeq2, *qstr2, numHits);
+                    } else {
+                        bool leftAligned = (qa.mateStatus == MateStatus::PAIRED_END_LEFT);
+
+                        const std::string& alignedName = leftAligned ? readName : mateName;
+                        size_t alignedNameLen = leftAligned ? readNameLen : mateNameLen;
+                        const std::string& unalignedName = leftAligned ? mateName : readName;
+                        size_t unalignedNameLen = leftAligned ? mateNameLen : readNameLen;
+
+                        std::string* readSeq = leftAligned ? &(r.first.seq) : &(r.second.seq);
+                        std::string* qstr = leftAligned ? &(r.first.qual) : &(r.second.qual);
+                        const std::string& unalignedSeq = leftAligned ? r.second.seq : r.first.seq;
+                        const std::string& unalignedQstr = leftAligned ? r.second.qual : r.first.qual;
+
+                        uint16_t flags = leftAligned ? flags1 : flags2;
+                        uint16_t unalignedFlags = leftAligned ? flags2 : flags1;
+
+                        bool* haveRev = leftAligned ? &haveRev1 : &haveRev2;
+                        std::string* readTemp = leftAligned ? &read1Temp : &read2Temp;
+                        std::string* qualTemp = leftAligned ? &qual1Temp : &qual2Temp;
+
+                        // Reverse complement the read and reverse
+                        // the quality string if we need to
+                        if (!qa.fwd) {
+                            if (!(*haveRev)) {
+                                rapmap::utils::reverseRead(*readSeq, *qstr,
+                                        *readTemp, *qualTemp);
+                                *haveRev = true;
+                            }
+                            readSeq = readTemp;
+                            qstr = qualTemp;
+                        }
+
+                        rapmap::bam::adjustOverhang(qa.pos, qa.readLen, txpLens[qa.tid], cigar1);
+                        rapmap::bam::appendRecord(bamBuffer, alignedName.c_str(), alignedNameLen,
+                                                  flags, tid, qa.pos, 1, cigar1,
+                                                  tid, qa.pos, 0,
+                                                  *readSeq, *qstr, numHits);
+
+                        // Output the info for the unaligned mate.
+                        cigar2.clear();
+                        cigar2.push(unalignedSeq.length(), rapmap::bam::CIGAR_SOFT_CLIP);
+                        rapmap::bam::appendRecord(bamBuffer, unalignedName.c_str(), unalignedNameLen,
+                                                  unalignedFlags, tid, qa.pos, 0, cigar2,
+                                                  tid, qa.pos, 0,
+                                                  unalignedSeq, unalignedQstr, numHits);
+                    }
+                    ++alnCtr;
+                }
+                return alnCtr;
+        }
+
         // Is there a smarter way to do save / load here?
         /*
         template <typename Archive, typename MerT>
@@ -560,3 +800,84 @@ template uint32_t rapmap::utils::writeAlignmentsToStream<jellyfish::header_seque
                 std::vector<rapmap::utils::QuasiAlignment>& jointHits,
                 fmt::MemoryWriter& sstream
                 );
+
+// BAM output
+// pair parser, 32-bit, dense hash
+template uint32_t rapmap::utils::writeAlignmentsToBAM<std::pair<header_sequence_qual, header_sequence_qual>, SAIndex32BitDense*>(
+                std::pair<header_sequence_qual, header_sequence_qual>& r,
+                PairAlignmentFormatter<SAIndex32BitDense*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                std::string& bamBuffer);
+
+// pair parser, 64-bit, dense hash
+template uint32_t rapmap::utils::writeAlignmentsToBAM<std::pair<header_sequence_qual, header_sequence_qual>, SAIndex64BitDense*>(
+                std::pair<header_sequence_qual, header_sequence_qual>& r,
+                PairAlignmentFormatter<SAIndex64BitDense*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                std::string& bamBuffer);
+
+// pair parser, 32-bit, perfect hash
+template uint32_t rapmap::utils::writeAlignmentsToBAM<std::pair<header_sequence_qual, header_sequence_qual>, SAIndex32BitPerfect*>(
+                std::pair<header_sequence_qual, header_sequence_qual>& r,
+                PairAlignmentFormatter<SAIndex32BitPerfect*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                std::string& bamBuffer);
+
+// pair parser, 64-bit, perfect hash
+template uint32_t rapmap::utils::writeAlignmentsToBAM<std::pair<header_sequence_qual, header_sequence_qual>, SAIndex64BitPerfect*>(
+                std::pair<header_sequence_qual, header_sequence_qual>& r,
+                PairAlignmentFormatter<SAIndex64BitPerfect*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                std::string& bamBuffer);
+
+// single parser, 32-bit, dense hash
+template uint32_t rapmap::utils::writeAlignmentsToBAM<jellyfish::header_sequence_qual, SAIndex32BitDense*>(
+		jellyfish::header_sequence_qual& r,
+                SingleAlignmentFormatter<SAIndex32BitDense*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                std::string& bamBuffer);
+
+// single parser, 64-bit, dense hash
+template uint32_t rapmap::utils::writeAlignmentsToBAM<jellyfish::header_sequence_qual, SAIndex64BitDense*>(
+		jellyfish::header_sequence_qual& r,
+                SingleAlignmentFormatter<SAIndex64BitDense*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                std::string& bamBuffer);
+
+// single parser, 32-bit, perfect hash
+template uint32_t rapmap::utils::writeAlignmentsToBAM<jellyfish::header_sequence_qual, SAIndex32BitPerfect*>(
+ 		jellyfish::header_sequence_qual& r,
+                SingleAlignmentFormatter<SAIndex32BitPerfect*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                std::string& bamBuffer);
+
+// single parser, 64-bit, perfect hash
+template uint32_t rapmap::utils::writeAlignmentsToBAM<jellyfish::header_sequence_qual, SAIndex64BitPerfect*>(
+		jellyfish::header_sequence_qual& r,
+                SingleAlignmentFormatter<SAIndex64BitPerfect*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                std::string& bamBuffer);
+
+template uint32_t rapmap::utils::writeAlignmentsToBAM<std::pair<header_sequence_qual, header_sequence_qual>, RapMapIndex*>(
+                std::pair<header_sequence_qual, header_sequence_qual>& r,
+                PairAlignmentFormatter<RapMapIndex*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                std::string& bamBuffer
+                );
+
+template uint32_t rapmap::utils::writeAlignmentsToBAM<jellyfish::header_sequence_qual, RapMapIndex*>(
+                jellyfish::header_sequence_qual& r,
+                SingleAlignmentFormatter<RapMapIndex*>& formatter,
+                rapmap::utils::HitCounters& hctr,
+                std::vector<rapmap::utils::QuasiAlignment>& jointHits,
+                std::string& bamBuffer
+                );
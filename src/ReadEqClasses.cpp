@@ -0,0 +1,59 @@
+#include "ReadEqClasses.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#include "spdlog/details/format.h"
+
+namespace rapmap {
+    namespace utils {
+
+        void ReadEqClassTable::add(std::vector<uint32_t>& tids) {
+            std::sort(tids.begin(), tids.end());
+            tids.erase(std::unique(tids.begin(), tids.end()), tids.end());
+            ++numReads_;
+            auto it = counts_.find(tids);
+            if (it != counts_.end()) {
+                ++it->second;
+            } else {
+                counts_.emplace(tids, 1);
+            }
+        }
+
+        void ReadEqClassTable::merge(const ReadEqClassTable& other) {
+            for (auto& kv : other.counts_) {
+                counts_[kv.first] += kv.second;
+            }
+            numReads_ += other.numReads_;
+        }
+
+        bool ReadEqClassTable::write(const std::string& fname,
+                                     const std::vector<std::string>& txpNames) const {
+            std::ofstream out(fname);
+            if (!out.good()) { return false; }
+
+            using ClassIt = decltype(counts_)::const_iterator;
+            std::vector<ClassIt> classes;
+            classes.reserve(counts_.size());
+            for (auto it = counts_.begin(); it != counts_.end(); ++it) { classes.push_back(it); }
+            std::sort(classes.begin(), classes.end(),
+                      [](const ClassIt& a, const ClassIt& b) -> bool { return a->first < b->first; });
+
+            fmt::MemoryWriter w;
+            w << txpNames.size() << '\n' << classes.size() << '\n';
+            for (auto& n : txpNames) { w << n << '\n'; }
+            for (auto& c : classes) {
+                w << c->first.size();
+                for (auto tid : c->first) { w << '\t' << tid; }
+                w << '\t' << c->second << '\n';
+                // don't let the buffer grow with the number of classes
+                if (w.size() > (1 << 20)) {
+                    out.write(w.data(), w.size());
+                    w.clear();
+                }
+            }
+            out.write(w.data(), w.size());
+            return out.good();
+        }
+    }
+}
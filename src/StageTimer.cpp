@@ -0,0 +1,155 @@
+#include "StageTimer.hpp"
+
+#include <fstream>
+#include <mutex>
+
+namespace rapmap {
+    namespace timing {
+
+        namespace {
+            struct RunTotals {
+                std::mutex mutex;
+                StageTimes times;
+                uint64_t startTicks{0};
+                std::chrono::steady_clock::time_point startTime{std::chrono::steady_clock::now()};
+            };
+
+            RunTotals& runTotals() {
+                static RunTotals totals;
+                return totals;
+            }
+
+            // The smallest tick count t such that at least q of the
+            // samples are <= t (as the top of a bucket)
+            uint64_t quantile(const uint64_t* buckets, uint64_t n, double q) {
+                if (n == 0) { return 0; }
+                uint64_t target = static_cast<uint64_t>(q * n);
+                uint64_t seen{0};
+                for (size_t b = 0; b < kNumBuckets; ++b) {
+                    seen += buckets[b];
+                    if (seen > target or seen == n) {
+                        return (b == 0) ? 0 : ((b >= 64) ? ~0ULL : (1ULL << b) - 1);
+                    }
+                }
+                return ~0ULL;
+            }
+
+            void writeDistribution(std::ostream& out, const uint64_t* buckets, uint64_t n) {
+                out << "{\"count\": " << n
+                    << ", \"p50\": " << quantile(buckets, n, 0.5)
+                    << ", \"p90\": " << quantile(buckets, n, 0.9)
+                    << ", \"p99\": " << quantile(buckets, n, 0.99)
+                    << ", \"log2_buckets\": [";
+                size_t last{0};
+                for (size_t b = 0; b < kNumBuckets; ++b) {
+                    if (buckets[b] > 0) { last = b; }
+                }
+                for (size_t b = 0; b <= last; ++b) {
+                    out << ((b > 0) ? ", " : "") << buckets[b];
+                }
+                out << "]}";
+            }
+        }
+
+        const char* stageName(Stage s) {
+            switch (s) {
+                case Stage::ParserWait: return "parser_wait";
+                case Stage::HashProbe: return "hash_probe";
+                case Stage::ExtendSearch: return "extend_search";
+                case Stage::LCE: return "lce";
+                case Stage::IntersectHits: return "intersect_hits";
+                case Stage::MismatchRescue: return "mismatch_rescue";
+                case Stage::VerifyHits: return "verify_hits";
+                case Stage::Format: return "format";
+                case Stage::Output: return "output";
+                default: return "unknown";
+            }
+        }
+
+        void StageTimes::add(const StageTimes& o) {
+            for (size_t i = 0; i < kNumStages; ++i) {
+                ticks[i] += o.ticks[i];
+                calls[i] += o.calls[i];
+            }
+            for (size_t i = 0; i <= kNumStages; ++i) {
+                for (size_t b = 0; b < kNumBuckets; ++b) {
+                    buckets[i][b] += o.buckets[i][b];
+                }
+            }
+            numReads += o.numReads;
+            readTicks += o.readTicks;
+        }
+
+        ThreadStageTimes::~ThreadStageTimes() {
+            auto& totals = runTotals();
+            std::lock_guard<std::mutex> lock(totals.mutex);
+            totals.times.add(times_);
+        }
+
+        void ThreadStageTimes::endRead() {
+            uint64_t elapsed = ticks() - readStart_;
+            for (size_t i = 0; i < kNumStages; ++i) {
+                if (stageIsPerRead(static_cast<Stage>(i))) {
+                    ++times_.buckets[i][bucket(current_[i])];
+                }
+            }
+            ++times_.buckets[kNumStages][bucket(elapsed)];
+            ++times_.numReads;
+            times_.readTicks += elapsed;
+        }
+
+        ThreadStageTimes& threadStageTimes() {
+            thread_local ThreadStageTimes times;
+            return times;
+        }
+
+        void startStageTiming() {
+            auto& totals = runTotals();
+            std::lock_guard<std::mutex> lock(totals.mutex);
+            totals.times = StageTimes();
+            totals.startTicks = ticks();
+            totals.startTime = std::chrono::steady_clock::now();
+        }
+
+        bool writeStageReport(const std::string& fname) {
+            auto& totals = runTotals();
+            std::lock_guard<std::mutex> lock(totals.mutex);
+            std::ofstream out(fname);
+            if (!out.good()) { return false; }
+
+            double seconds = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - totals.startTime).count();
+            uint64_t elapsedTicks = ticks() - totals.startTicks;
+            double ticksPerSecond = (seconds > 0.0) ? elapsedTicks / seconds : 0.0;
+            auto toSeconds = [ticksPerSecond](uint64_t t) -> double {
+                return (ticksPerSecond > 0.0) ? t / ticksPerSecond : 0.0;
+            };
+            const auto& times = totals.times;
+
+            out << "{\n";
+            out << "  \"wall_seconds\": " << seconds << ",\n";
+            out << "  \"ticks_per_second\": " << ticksPerSecond << ",\n";
+            out << "  \"num_reads\": " << times.numReads << ",\n";
+            out << "  \"read\": {\"ticks\": " << times.readTicks
+                << ", \"seconds\": " << toSeconds(times.readTicks)
+                << ", \"per_read\": ";
+            writeDistribution(out, times.buckets[kNumStages], times.numReads);
+            out << "},\n";
+            out << "  \"stages\": {\n";
+            for (size_t i = 0; i < kNumStages; ++i) {
+                Stage s = static_cast<Stage>(i);
+                bool perRead = stageIsPerRead(s);
+                out << "    \"" << stageName(s) << "\": {"
+                    << "\"ticks\": " << times.ticks[i]
+                    << ", \"seconds\": " << toSeconds(times.ticks[i])
+                    << ", \"calls\": " << times.calls[i]
+                    << ", " << (perRead ? "\"per_read\": " : "\"per_call\": ");
+                writeDistribution(out, times.buckets[i], perRead ? times.numReads : times.calls[i]);
+                out << "}" << ((i + 1 < kNumStages) ? "," : "") << "\n";
+            }
+            out << "  }\n";
+            out << "}\n";
+            return out.good();
+        }
+    }
+}